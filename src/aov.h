@@ -0,0 +1,141 @@
+#pragma once
+
+#include "lajolla.h"
+#include "intersection.h"
+#include "material.h"
+#include "scene.h"
+#include "spectrum.h"
+#include <chrono>
+#include <optional>
+#include <string>
+
+/// Arbitrary output variables (AOVs): the data of the first surface a camera path hits,
+/// which the compositing and denoising pipelines want next to the rendering.
+/// Unlike aux_render, which traces its own camera rays and outputs one buffer at a time,
+/// the path tracer fills the AOVs from the first vertex and the material closure it
+/// computes anyway, so they come for free with the beauty render.
+/// Like the radiance, we average the AOVs over the samples of a pixel (so the edges are
+/// anti-aliased), except for the IDs, where averaging makes no sense: they come from
+/// the first sample of the pixel.
+/// The paths that hit nothing have zero AOVs, and -1 IDs.
+///
+/// The cost AOVs are different: they don't come from the paths, but from the renderer,
+/// which measures how long it spent on each pixel (wall-clock time in seconds, with steady_clock)
+/// and how many rays it traced for the pixel (with intersect() and occluded()), summed over
+/// all the samples of the pixel. They show where the rendering time goes (e.g., glass or
+/// dense media), for deciding where to sample adaptively, what to simplify in a scene,
+/// or how to schedule the tiles.
+
+/// What path_tracing() records about the first vertex of a path.
+struct AOVRecord {
+    std::optional<PathVertex> vertex;
+    // The distance from the camera to the vertex.
+    Real depth = 0;
+    // Zero if the path doesn't shade the first vertex (e.g., maxDepth = 1).
+    Spectrum albedo = make_zero_spectrum();
+    // The emission the camera ray sees directly: the emission of the first vertex
+    // if it is on a light, or of the envmap if the ray hits nothing.
+    // The denoiser (see render.cpp) leaves it alone.
+    Spectrum emission = make_zero_spectrum();
+};
+
+/// The "color" of a surface for the albedo AOV (e.g., a feature of a denoiser):
+/// the reflectance of the diffuse layers and the base color of the Disney BSDFs.
+/// The dielectrics get their transmittance, and the clearcoat gets 1, since their color comes
+/// from what they reflect or refract.
+inline Spectrum albedo(const MaterialClosure &closure) {
+    if (auto *c = std::get_if<LambertianClosure>(&closure)) {
+        return c->reflectance;
+    } else if (auto *c = std::get_if<RoughPlasticClosure>(&closure)) {
+        return c->diffuse_reflectance;
+    } else if (auto *c = std::get_if<RoughDielectricClosure>(&closure)) {
+        return c->specular_transmittance;
+    } else if (auto *c = std::get_if<DisneyDiffuseClosure>(&closure)) {
+        return c->base_color;
+    } else if (auto *c = std::get_if<DisneyMetalClosure>(&closure)) {
+        return c->base_color;
+    } else if (auto *c = std::get_if<DisneyGlassClosure>(&closure)) {
+        return c->base_color;
+    } else if (auto *c = std::get_if<DisneySheenClosure>(&closure)) {
+        return c->base_color;
+    } else if (auto *c = std::get_if<DisneyBSDFClosure>(&closure)) {
+        return c->base_color;
+    }
+    return make_const_spectrum(1);
+}
+
+/// The name of the layer of an AOV in the output image.
+inline std::string aov_name(AOVType type) {
+    switch (type) {
+        case AOVType::Albedo: return "albedo";
+        case AOVType::ShadingNormal: return "normal";
+        case AOVType::Depth: return "depth";
+        case AOVType::Position: return "position";
+        case AOVType::ObjectID: return "objectId";
+        case AOVType::MaterialID: return "materialId";
+        case AOVType::Time: return "time";
+        case AOVType::RayCount: return "rays";
+    }
+    return "";
+}
+
+/// The depths, positions, IDs, and costs need more precision than half floats.
+inline EXRPixelType aov_pixel_type(AOVType type) {
+    return type == AOVType::Albedo || type == AOVType::ShadingNormal ?
+        EXRPixelType::Half : EXRPixelType::Float;
+}
+
+/// The IDs are not averaged over the samples of a pixel.
+inline bool is_id_aov(AOVType type) {
+    return type == AOVType::ObjectID || type == AOVType::MaterialID;
+}
+
+/// The time and ray count AOVs are measured by the renderer, not recorded from the paths.
+inline bool is_cost_aov(AOVType type) {
+    return type == AOVType::Time || type == AOVType::RayCount;
+}
+
+/// The value of an AOV as a color. The scalar AOVs go to all 3 channels.
+/// (Zero for the cost AOVs, see PixelCost.)
+inline Spectrum aov_value(AOVType type, const AOVRecord &record) {
+    if (is_id_aov(type)) {
+        int id = -1;
+        if (record.vertex) {
+            id = type == AOVType::ObjectID ? record.vertex->shape_id : record.vertex->material_id;
+        }
+        return make_const_spectrum(Real(id));
+    }
+    if (!record.vertex) {
+        return make_zero_spectrum();
+    }
+    switch (type) {
+        case AOVType::Albedo: return record.albedo;
+        case AOVType::ShadingNormal: return record.vertex->shading_frame.n;
+        case AOVType::Depth: return make_const_spectrum(record.depth);
+        case AOVType::Position: return record.vertex->position;
+        default: return make_zero_spectrum();
+    }
+}
+
+/// Measures the cost of a pixel for the cost AOVs: start it before the samples of the pixel,
+/// and it gives the time and the rays of the thread since then.
+struct PixelCost {
+    PixelCost() : start_time(std::chrono::steady_clock::now()),
+                  start_rays(num_traced_rays_of_thread()) {}
+
+    Real elapsed() const {
+        std::chrono::duration<double> d = std::chrono::steady_clock::now() - start_time;
+        return Real(d.count());
+    }
+    uint64_t num_rays() const {
+        return num_traced_rays_of_thread() - start_rays;
+    }
+
+    std::chrono::steady_clock::time_point start_time;
+    uint64_t start_rays;
+};
+
+/// Whether we need to measure the cost of the pixels.
+inline bool has_cost_aovs(const std::vector<AOVType> &aovs) {
+    return std::any_of(aovs.begin(), aovs.end(), is_cost_aov);
+}
@@ -0,0 +1,514 @@
+#pragma once
+
+#include "scene.h"
+#include "image.h"
+#include "intersection.h"
+#include "material.h"
+#include "sampler.h"
+#include "transform.h"
+#include <array>
+
+/// Bidirectional path tracing (BDPT), from Veach's thesis (Chapter 10) and
+/// "Bi-directional Path Tracing" from Lafortune and Willems.
+/// For each camera sample, we trace a subpath from the camera z_0, z_1, ...
+/// and another subpath from a light source y_0, y_1, ..., then connect every prefix
+/// y_0...y_{s-1} of the light subpath with every prefix z_0...z_{t-1} of the camera subpath.
+/// Each (s, t) is a different strategy to sample a path with s + t vertices:
+/// s = 0 is the camera subpath hitting a light (the BSDF sampling of a path tracer),
+/// s = 1 is next event estimation, and t = 1 connects the light subpath to the camera
+/// directly (light tracing). The light tracing strategies are much better at
+/// caustics and at lights that are only reachable through a small opening, while
+/// the path tracer strategies are better when we see the lights directly.
+/// We combine all of them with multiple importance sampling (MIS), following pbrt-v3
+/// (Chapter 16.3 of the book), using the power heuristic like our path tracer.
+///
+/// The light tracing strategies can contribute to any pixel, so they are "splatted"
+/// to an image shared by all threads.
+///
+/// Limitations:
+/// - We use a one-pixel box filter and ignore the filter of the film: with the other
+///   filters, a splat would need to spread over several pixels.
+/// - Light subpaths only start from the lights with finite positions.
+///   Envmaps and directional lights are only reached by the s = 0 and s = 1 strategies.
+/// - No participating media.
+/// - We don't correct the light subpaths for the shading normals (Chapter 5.3 of Veach's thesis),
+///   so meshes with interpolated normals can look slightly different from the path tracer.
+
+/// The subpaths have fixed-size storage. With max_depth == -1 we rely on Russian roulette
+/// to terminate them, and truncate the few that are longer.
+constexpr int c_bdpt_max_vertices = 32;
+
+enum class BDPTVertexType {
+    Camera,
+    Light,
+    Surface
+};
+
+struct BDPTVertex {
+    BDPTVertexType type;
+    Vector3 position;
+    // The geometric normal. Zero for the pinhole and the point & spot lights,
+    // which have no surface.
+    Vector3 normal;
+    // For surfaces: the intersection, its BSDF, and the direction
+    // towards the previous vertex of the subpath.
+    PathVertex vertex;
+    MaterialClosure closure;
+    Vector3 dir_prev;
+    // For light vertices and surfaces on area lights.
+    int light_id = -1;
+    // The path contribution of the subpath up to this vertex divided by its probability density
+    // (the BSDF/emission at this vertex is not included).
+    Spectrum beta;
+    // The probability densities (area measure) of sampling this vertex from the previous vertex
+    // of its subpath (pdf_fwd), and from the next vertex, i.e., if the path was
+    // sampled from the other end (pdf_rev). MIS compares the strategies with them.
+    Real pdf_fwd = 0;
+    Real pdf_rev = 0;
+};
+
+/// A subpath from the camera or from a light.
+struct BDPTSubpath {
+    std::array<BDPTVertex, c_bdpt_max_vertices> vertices;
+    int num_vertices = 0;
+    // Camera subpaths that leave the scene can still hit the envmap:
+    // the last direction, its BSDF pdf (solid angle), and the throughput of the subpath.
+    bool escaped = false;
+    Vector3 escaped_dir;
+    Real escaped_pdf;
+    Spectrum escaped_beta;
+};
+
+inline bool is_delta_light_vertex(const Scene &scene, const BDPTVertex &v) {
+    return v.type == BDPTVertexType::Light && is_delta_light(scene.lights[v.light_id]);
+}
+
+/// Converts a solid angle density of sampling the direction from "from" to "to"
+/// to the area measure at "to".
+inline Real solid_angle_to_area(Real pdf_dir, const BDPTVertex &from, const BDPTVertex &to) {
+    Vector3 d = to.position - from.position;
+    Real dist_sq = length_squared(d);
+    if (dist_sq <= 0) {
+        return 0;
+    }
+    // No cosine for the vertices without a surface.
+    if (length_squared(to.normal) > 0) {
+        pdf_dir *= fabs(dot(to.normal, d)) / sqrt(dist_sq);
+    }
+    return pdf_dir / dist_sq;
+}
+
+/// The density (area measure) of a light vertex v emitting towards "next".
+inline Real pdf_light_dir(const Scene &scene, const BDPTVertex &v, const BDPTVertex &next) {
+    const Light &light = scene.lights[v.light_id];
+    Vector3 dir = normalize(next.position - v.position);
+    Real pdf_dir = pdf_emission(light, PointAndNormal{v.position, v.normal}, dir, scene).dir;
+    return solid_angle_to_area(pdf_dir, v, next);
+}
+
+/// The density (area measure) of a light subpath starting at v.
+inline Real pdf_light_origin(const Scene &scene, const BDPTVertex &v) {
+    const Light &light = scene.lights[v.light_id];
+    // The direction doesn't matter for the position density.
+    Vector3 dummy_dir{0, 0, 1};
+    return light_pmf(scene, v.light_id) *
+        pdf_emission(light, PointAndNormal{v.position, v.normal}, dummy_dir, scene).pos;
+}
+
+/// The density (area measure) of sampling "next" from v, given the vertex before v ("prev").
+/// prev is only needed for surfaces.
+inline Real pdf_next(const Scene &scene,
+                     const BDPTVertex &v,
+                     const BDPTVertex *prev,
+                     const BDPTVertex &next) {
+    Vector3 dir = normalize(next.position - v.position);
+    Real pdf_dir = 0;
+    if (v.type == BDPTVertexType::Camera) {
+        pdf_dir = camera_importance(scene.camera, dir);
+    } else if (v.type == BDPTVertexType::Light) {
+        return pdf_light_dir(scene, v, next);
+    } else {
+        assert(prev != nullptr);
+        // The pdfs of the BSDFs don't depend on the transport direction.
+        pdf_dir = pdf_sample_bsdf(v.closure, normalize(prev->position - v.position), dir, v.vertex);
+    }
+    return solid_angle_to_area(pdf_dir, v, next);
+}
+
+/// Extends a subpath with BSDF sampling. The last vertex of the subpath has already sampled
+/// the ray with density pdf_dir (solid angle), and beta is the throughput of the ray.
+/// We store the pdfs of both directions of each vertex along the way.
+inline void random_walk(const Scene &scene,
+                        Ray ray,
+                        RayDifferential ray_diff,
+                        Spectrum beta,
+                        Real pdf_dir,
+                        Sampler &sampler,
+                        TransportDirection transport_dir,
+                        int max_vertices,
+                        BDPTSubpath &path) {
+    // For Russian roulette, see path_tracing.h.
+    // We use the throughput relative to the first vertex,
+    // since the light subpaths start with the emission divided by the pdf.
+    Spectrum throughput = make_const_spectrum(1);
+    Real eta_scale = 1;
+    while (path.num_vertices < max_vertices) {
+        std::optional<PathVertex> vertex_ = intersect(scene, ray, ray_diff);
+        if (!vertex_) {
+            path.escaped = true;
+            path.escaped_dir = ray.dir;
+            path.escaped_pdf = pdf_dir;
+            path.escaped_beta = beta;
+            break;
+        }
+        BDPTVertex &prev = path.vertices[path.num_vertices - 1];
+        BDPTVertex &v = path.vertices[path.num_vertices++];
+        const PathVertex &vertex = *vertex_;
+        v.type = BDPTVertexType::Surface;
+        v.position = vertex.position;
+        v.normal = vertex.geometric_normal;
+        v.vertex = vertex;
+        v.closure = make_closure(scene.materials[vertex.material_id], vertex, scene.texture_pool);
+        v.dir_prev = -ray.dir;
+        v.light_id = get_area_light_id(scene.shapes[vertex.shape_id]);
+        v.beta = beta;
+        v.pdf_fwd = solid_angle_to_area(pdf_dir, prev, v);
+        v.pdf_rev = 0;
+        if (path.num_vertices >= max_vertices) {
+            break;
+        }
+
+        Vector2 bsdf_rnd_param_uv = next_2d(sampler);
+        Real bsdf_rnd_param_w = next_1d(sampler);
+        std::optional<BSDFSampleRecord> bsdf_sample = sample_bsdf(
+            v.closure, v.dir_prev, v.vertex, bsdf_rnd_param_uv, bsdf_rnd_param_w, transport_dir);
+        if (!bsdf_sample || bsdf_sample->pdf_fwd <= 0) {
+            break;
+        }
+        // The BSDF record already includes the cosine.
+        beta *= bsdf_sample->f / bsdf_sample->pdf_fwd;
+        throughput *= bsdf_sample->f / bsdf_sample->pdf_fwd;
+        pdf_dir = bsdf_sample->pdf_fwd;
+        prev.pdf_rev = solid_angle_to_area(bsdf_sample->pdf_rev, v, prev);
+        if (bsdf_sample->eta == 0) {
+            ray_diff.spread = reflect(ray_diff, vertex.mean_curvature, bsdf_sample->roughness);
+        } else {
+            ray_diff.spread = refract(ray_diff, vertex.mean_curvature, bsdf_sample->eta, bsdf_sample->roughness);
+            eta_scale /= (bsdf_sample->eta * bsdf_sample->eta);
+        }
+
+        if (path.num_vertices - 1 >= scene.options.rr_depth) {
+            Real rr_prob = min(max((1 / eta_scale) * throughput), Real(0.95));
+            if (next_1d(sampler) > rr_prob) {
+                break;
+            }
+            beta /= rr_prob;
+            throughput /= rr_prob;
+        }
+        ray = Ray{v.position, bsdf_sample->dir_out, get_intersection_epsilon(scene), infinity<Real>()};
+    }
+}
+
+/// The MIS weight of connecting the light subpath prefix of length s with the camera subpath
+/// prefix of length t. For s = 1 and t = 1, the light/camera vertex is newly sampled
+/// for the connection (sampled), instead of the first vertex of the subpath.
+/// See Chapter 16.3.4 of pbrt-v3: we compute the ratios between the densities of the
+/// other strategies and ours by moving the connection along the path,
+/// which only needs the pdf_fwd & pdf_rev of each vertex.
+inline Real bdpt_mis_weight(const Scene &scene,
+                            const BDPTSubpath &light_path,
+                            const BDPTSubpath &camera_path,
+                            const BDPTVertex &sampled,
+                            int s, int t) {
+    if (s + t == 2) {
+        // The only other strategy for these paths (s = 1, t = 1) is not used.
+        return 1;
+    }
+    auto light_vertex = [&](int i) -> const BDPTVertex & {
+        return s == 1 && i == 0 ? sampled : light_path.vertices[i];
+    };
+    auto camera_vertex = [&](int i) -> const BDPTVertex & {
+        return t == 1 && i == 0 ? sampled : camera_path.vertices[i];
+    };
+    // The reverse pdfs of the vertices around the connection change with the strategy:
+    // they are now sampled from the other subpath.
+    const BDPTVertex &pt = camera_vertex(t - 1);
+    const BDPTVertex *qs = s > 0 ? &light_vertex(s - 1) : nullptr;
+    const BDPTVertex *pt_minus = t > 1 ? &camera_vertex(t - 2) : nullptr;
+    const BDPTVertex *qs_minus = s > 1 ? &light_vertex(s - 2) : nullptr;
+    Real pt_rev = qs != nullptr ? pdf_next(scene, *qs, qs_minus, pt) : pdf_light_origin(scene, pt);
+    Real pt_minus_rev = 0;
+    if (pt_minus != nullptr) {
+        pt_minus_rev = qs != nullptr ?
+            pdf_next(scene, pt, qs, *pt_minus) : pdf_light_dir(scene, pt, *pt_minus);
+    }
+    Real qs_rev = qs != nullptr ? pdf_next(scene, pt, pt_minus, *qs) : 0;
+    Real qs_minus_rev = qs_minus != nullptr ? pdf_next(scene, *qs, &pt, *qs_minus) : 0;
+    auto camera_pdf_rev = [&](int i) {
+        return i == t - 1 ? pt_rev : i == t - 2 ? pt_minus_rev : camera_path.vertices[i].pdf_rev;
+    };
+    auto light_pdf_rev = [&](int i) {
+        return i == s - 1 ? qs_rev : i == s - 2 ? qs_minus_rev : light_path.vertices[i].pdf_rev;
+    };
+    // A zero density in the ratios means the vertex is a Dirac delta
+    // (e.g., a point light can't be hit), so we treat them as 1.
+    auto remap0 = [](Real pdf) { return pdf != 0 ? pdf : Real(1); };
+
+    // With the power heuristic, w = p_st^2 / sum_i p_i^2 = 1 / sum_i (p_i / p_st)^2.
+    Real sum_ri = 0;
+    // Strategies with fewer camera vertices. t = 0 (hitting the pinhole) is impossible.
+    Real ri = 1;
+    for (int i = t - 1; i > 0; i--) {
+        ri *= remap0(camera_pdf_rev(i)) / remap0(camera_vertex(i).pdf_fwd);
+        sum_ri += ri * ri;
+    }
+    // Strategies with fewer light vertices. We can't hit a delta light (s = 0).
+    ri = 1;
+    for (int i = s - 1; i >= 0; i--) {
+        ri *= remap0(light_pdf_rev(i)) / remap0(light_vertex(i).pdf_fwd);
+        if (i > 0 || !is_delta_light_vertex(scene, light_vertex(0))) {
+            sum_ri += ri * ri;
+        }
+    }
+    return 1 / (1 + sum_ri);
+}
+
+/// Connects the light subpath prefix of length s with the camera subpath prefix of length t,
+/// and returns the MIS-weighted contribution. For t = 1, the contribution is splatted
+/// to the pixel the light subpath projects to instead.
+inline Spectrum bdpt_connect(const Scene &scene,
+                             const BDPTSubpath &light_path,
+                             const BDPTSubpath &camera_path,
+                             int s, int t,
+                             Sampler &sampler,
+                             SplatImage &splats) {
+    BDPTVertex sampled;
+    Spectrum L = make_zero_spectrum();
+    if (s == 0) {
+        // The camera subpath hits a light.
+        const BDPTVertex &pt = camera_path.vertices[t - 1];
+        if (pt.light_id < 0) {
+            return make_zero_spectrum();
+        }
+        L = pt.beta * emission(pt.vertex, pt.dir_prev, scene);
+    } else if (t == 1) {
+        // Light tracing: connect the light subpath to the camera.
+        const BDPTVertex &qs = light_path.vertices[s - 1];
+        std::optional<Vector2> screen_pos = world_to_screen(scene.camera, qs.position);
+        if (!screen_pos) {
+            return make_zero_spectrum();
+        }
+        sampled.type = BDPTVertexType::Camera;
+        sampled.position = xform_point(scene.camera.cam_to_world, Vector3{0, 0, 0});
+        sampled.normal = Vector3{0, 0, 0};
+        sampled.pdf_fwd = 1;
+        Vector3 dir_camera = sampled.position - qs.position;
+        Real dist_sq = length_squared(dir_camera);
+        dir_camera = dir_camera / sqrt(dist_sq);
+        Real W = camera_importance(scene.camera, -dir_camera);
+        if (qs.type == BDPTVertexType::Light) {
+            Real cos_light = length_squared(qs.normal) > 0 ? fabs(dot(qs.normal, dir_camera)) : Real(1);
+            L = qs.beta * emission(scene.lights[qs.light_id], dir_camera, Real(0),
+                                   PointAndNormal{qs.position, qs.normal}, scene) * cos_light;
+        } else {
+            L = qs.beta * eval(qs.closure, qs.dir_prev, dir_camera, qs.vertex, TransportDirection::TO_VIEW);
+        }
+        L *= W / dist_sq;
+        if (max(L) <= 0) {
+            return make_zero_spectrum();
+        }
+        Ray shadow_ray{qs.position, dir_camera,
+                       get_shadow_epsilon(scene),
+                       (1 - get_shadow_epsilon(scene)) * sqrt(dist_sq)};
+        if (occluded(scene, shadow_ray)) {
+            return make_zero_spectrum();
+        }
+        L *= bdpt_mis_weight(scene, light_path, camera_path, sampled, s, t);
+        int x = min(int(screen_pos->x * scene.camera.width), scene.camera.width - 1);
+        int y = min(int(screen_pos->y * scene.camera.height), scene.camera.height - 1);
+        splats.add(x, y, L);
+        return make_zero_spectrum();
+    } else if (s == 1) {
+        // Next event estimation: sample a new point on a light.
+        const BDPTVertex &pt = camera_path.vertices[t - 1];
+        Vector2 light_uv = next_2d(sampler);
+        Real light_w = next_1d(sampler);
+        Real shape_w = next_1d(sampler);
+        int light_id = sample_light(scene, light_w);
+        const Light &light = scene.lights[light_id];
+        PointAndNormal point_on_light =
+            sample_point_on_light(light, pt.position, pt.vertex.shading_frame.n, light_uv, shape_w, scene);
+        Real p = light_pmf(scene, light_id) *
+            pdf_point_on_light(light, point_on_light, pt.position, pt.vertex.shading_frame.n, scene);
+        if (p <= 0) {
+            return make_zero_spectrum();
+        }
+        if (is_infinite_light(light)) {
+            // See the envmap in bdpt() for the MIS weight: the light subpaths never start
+            // from infinite lights, so we only compare with the BSDF sampling.
+            Vector3 dir_light = -point_on_light.normal;
+            BSDFEvalRecord bsdf_eval = eval_with_pdf(pt.closure, pt.dir_prev, dir_light, pt.vertex);
+            Spectrum Le = emission(light, -dir_light, Real(0), point_on_light, scene);
+            L = pt.beta * bsdf_eval.f * Le / p;
+            if (max(L) <= 0) {
+                return make_zero_spectrum();
+            }
+            Ray shadow_ray{pt.position, dir_light, get_shadow_epsilon(scene), infinity<Real>()};
+            if (occluded(scene, shadow_ray)) {
+                return make_zero_spectrum();
+            }
+            Real w = is_delta_light(light) ? Real(1) :
+                (p * p) / (p * p + bsdf_eval.pdf_fwd * bsdf_eval.pdf_fwd);
+            return L * w;
+        }
+        sampled.type = BDPTVertexType::Light;
+        sampled.position = point_on_light.position;
+        sampled.normal = is_delta_light(light) ? Vector3{0, 0, 0} : point_on_light.normal;
+        sampled.light_id = light_id;
+        // For MIS, the density of the light subpaths starting at this point
+        // (instead of the density of our light sampling, like pbrt-v3).
+        sampled.pdf_fwd = pdf_light_origin(scene, sampled);
+        Vector3 dir_light = point_on_light.position - pt.position;
+        Real dist_sq = length_squared(dir_light);
+        dir_light = dir_light / sqrt(dist_sq);
+        Real G = length_squared(sampled.normal) > 0 ?
+            fabs(dot(dir_light, sampled.normal)) / dist_sq : 1 / dist_sq;
+        L = pt.beta * eval(pt.closure, pt.dir_prev, dir_light, pt.vertex) *
+            emission(light, -dir_light, Real(0), point_on_light, scene) * G / p;
+        if (max(L) <= 0) {
+            return make_zero_spectrum();
+        }
+        Ray shadow_ray{pt.position, dir_light,
+                       get_shadow_epsilon(scene),
+                       (1 - get_shadow_epsilon(scene)) * sqrt(dist_sq)};
+        if (occluded(scene, shadow_ray)) {
+            return make_zero_spectrum();
+        }
+    } else {
+        // Connect two surface vertices.
+        const BDPTVertex &qs = light_path.vertices[s - 1];
+        const BDPTVertex &pt = camera_path.vertices[t - 1];
+        Vector3 d = qs.position - pt.position;
+        Real dist_sq = length_squared(d);
+        d = d / sqrt(dist_sq);
+        // Both BSDF values include their cosine, so only the distance is left of the geometry term.
+        L = pt.beta * eval(pt.closure, pt.dir_prev, d, pt.vertex) *
+            eval(qs.closure, qs.dir_prev, -d, qs.vertex, TransportDirection::TO_VIEW) *
+            qs.beta / dist_sq;
+        if (max(L) <= 0) {
+            return make_zero_spectrum();
+        }
+        Ray shadow_ray{pt.position, d,
+                       get_shadow_epsilon(scene),
+                       (1 - get_shadow_epsilon(scene)) * sqrt(dist_sq)};
+        if (occluded(scene, shadow_ray)) {
+            return make_zero_spectrum();
+        }
+    }
+    if (max(L) <= 0) {
+        return make_zero_spectrum();
+    }
+    return L * bdpt_mis_weight(scene, light_path, camera_path, sampled, s, t);
+}
+
+/// Bidirectional path tracing for a sample of pixel (x, y).
+/// Returns the contribution to the pixel, and splats the light tracing contributions to splats.
+/// The final image is (the average of the returned values) + splats / (samples per pixel).
+Spectrum bdpt(const Scene &scene,
+              int x, int y, /* pixel coordinates */
+              Sampler &sampler,
+              SplatImage &splats) {
+    int w = scene.camera.width, h = scene.camera.height;
+    // max_depth is the maximum number of segments of a path, so a camera subpath has
+    // max_depth + 1 vertices at most, and a light subpath max_depth (t >= 1).
+    int max_depth = scene.options.max_depth;
+    int max_camera_vertices = max_depth == -1 ?
+        c_bdpt_max_vertices : min(max_depth + 1, c_bdpt_max_vertices);
+    int max_light_vertices = max_depth == -1 ?
+        c_bdpt_max_vertices : min(max_depth, c_bdpt_max_vertices);
+
+    // The camera subpath. We sample the pixel uniformly (a box filter), so the importance
+    // cancels out with the density of the camera ray, and z_1 has throughput 1.
+    BDPTSubpath camera_path;
+    Vector2 pixel_uv = next_2d(sampler);
+    Vector2 screen_pos((x + pixel_uv.x) / w,
+                       (y + pixel_uv.y) / h);
+    Ray ray = screen_to_ray(scene.camera, screen_pos);
+    BDPTVertex &z0 = camera_path.vertices[0];
+    z0.type = BDPTVertexType::Camera;
+    z0.position = ray.org;
+    z0.normal = Vector3{0, 0, 0};
+    z0.beta = make_const_spectrum(1);
+    z0.pdf_fwd = 1;
+    camera_path.num_vertices = 1;
+    random_walk(scene, ray, init_ray_differential(w, h), make_const_spectrum(1),
+                camera_importance(scene.camera, ray.dir), sampler,
+                TransportDirection::TO_LIGHT, max_camera_vertices, camera_path);
+
+    // The light subpath: pick a light, a point on it, and an emission direction.
+    BDPTSubpath light_path;
+    Real light_w = next_1d(sampler);
+    Vector2 light_pos_uv = next_2d(sampler);
+    Real light_pos_w = next_1d(sampler);
+    Vector2 light_dir_uv = next_2d(sampler);
+    int light_id = sample_light(scene, light_w);
+    const Light &light = scene.lights[light_id];
+    if (max_light_vertices > 0 && !is_infinite_light(light)) {
+        if (std::optional<LightEmissionRecord> rec =
+                sample_emission(light, light_pos_uv, light_pos_w, light_dir_uv, scene)) {
+            Real pdf_pos = light_pmf(scene, light_id) * rec->pdf.pos;
+            if (pdf_pos > 0 && rec->pdf.dir > 0) {
+                BDPTVertex &y0 = light_path.vertices[0];
+                y0.type = BDPTVertexType::Light;
+                y0.position = rec->point_on_light.position;
+                y0.normal = is_delta_light(light) ? Vector3{0, 0, 0} : rec->point_on_light.normal;
+                y0.light_id = light_id;
+                y0.beta = make_const_spectrum(1 / pdf_pos);
+                y0.pdf_fwd = pdf_pos;
+                light_path.num_vertices = 1;
+                Real cos_light = is_delta_light(light) ? Real(1) : fabs(dot(y0.normal, rec->dir));
+                Spectrum Le = emission(light, rec->dir, Real(0), rec->point_on_light, scene);
+                Spectrum beta = y0.beta * Le * cos_light / rec->pdf.dir;
+                Ray light_ray{y0.position, rec->dir, get_intersection_epsilon(scene), infinity<Real>()};
+                random_walk(scene, light_ray, RayDifferential{}, beta, rec->pdf.dir, sampler,
+                            TransportDirection::TO_VIEW, max_light_vertices, light_path);
+            }
+        }
+    }
+
+    Spectrum radiance = make_zero_spectrum();
+    // Envmap hits: like the unidirectional path tracer, the only other strategy for these paths
+    // is light sampling (s = 1), since the light subpaths never start from an envmap.
+    if (camera_path.escaped && has_envmap(scene)) {
+        const Light &envmap = get_envmap(scene);
+        const Vector3 &dir = camera_path.escaped_dir;
+        Spectrum Le = emission(envmap, -dir, Real(0), PointAndNormal{}, scene);
+        Real w = 1;
+        if (camera_path.num_vertices > 1) {
+            const BDPTVertex &last = camera_path.vertices[camera_path.num_vertices - 1];
+            Real p_bsdf = camera_path.escaped_pdf;
+            Real p_light = light_pmf(scene, scene.envmap_light_id) *
+                pdf_point_on_light(envmap, PointAndNormal{Vector3{0, 0, 0}, -dir},
+                                   last.position, last.vertex.shading_frame.n, scene);
+            w = (p_bsdf * p_bsdf) / (p_bsdf * p_bsdf + p_light * p_light);
+        }
+        radiance += camera_path.escaped_beta * Le * w;
+    }
+
+    for (int t = 1; t <= camera_path.num_vertices; t++) {
+        // s = 1 samples a new light vertex, so it doesn't need the light subpath.
+        for (int s = 0; s <= max(light_path.num_vertices, 1); s++) {
+            int num_segments = s + t - 1;
+            if (t == 1 && s <= 1) {
+                // We can't hit the pinhole, and we don't connect a light directly
+                // to the camera (we see the lights with s = 0, t = 2).
+                continue;
+            }
+            if (num_segments < 1 || (max_depth != -1 && num_segments > max_depth)) {
+                continue;
+            }
+            radiance += bdpt_connect(scene, light_path, camera_path, s, t, sampler, splats);
+        }
+    }
+    return radiance;
+}
@@ -0,0 +1,338 @@
+#include "bsdf_batch.h"
+#include "frame.h"
+#include "intersection.h"
+
+void BSDFBatch::resize(int n) {
+    for (std::vector<Real> *v : {&in_x, &in_y, &in_z, &out_x, &out_y, &out_z,
+                                 &valid, &reflect,
+                                 &kd_r, &kd_g, &kd_b, &ks_r, &ks_g, &ks_b,
+                                 &roughness, &eta,
+                                 &f_r, &f_g, &f_b, &pdf_fwd, &pdf_rev}) {
+        v->resize(n);
+    }
+}
+
+/// Everything below is written without branches (the ternaries become blends),
+/// so that the loops over the batches can be vectorized.
+
+/// Same as fresnel_dielectric(n_dot_i, eta) in microfacet.h.
+inline Real fresnel_dielectric_batch(Real n_dot_i, Real eta) {
+    Real sin_i_sq = 1 - n_dot_i * n_dot_i;
+    sin_i_sq = sin_i_sq > 0 ? sin_i_sq : Real(0);
+    Real n_dot_t_sq = 1 - sin_i_sq / (eta * eta);
+    Real n_dot_t = sqrt(n_dot_t_sq > 0 ? n_dot_t_sq : Real(0));
+    n_dot_i = fabs(n_dot_i);
+    n_dot_i = n_dot_i < 1 ? n_dot_i : Real(1);
+    Real rs = (n_dot_i - eta * n_dot_t) / (n_dot_i + eta * n_dot_t);
+    Real rp = (eta * n_dot_i - n_dot_t) / (eta * n_dot_i + n_dot_t);
+    // total internal reflection (or grazing in and out)
+    bool reflect_all = n_dot_t_sq < 0 || (n_dot_i == 0 && n_dot_t == 0);
+    return reflect_all ? Real(1) : (rs * rs + rp * rp) / 2;
+}
+
+/// Same as GTR2() in microfacet.h, with alpha^2 precomputed.
+inline Real GTR2_batch(Real n_dot_h, Real a2) {
+    Real n_dot_h2 = n_dot_h * n_dot_h;
+    Real t = (1 - n_dot_h2) + a2 * n_dot_h2;
+    return a2 / (c_PI * t * t);
+}
+
+/// Same as smith_masking_gtr2() in microfacet.h, with alpha^2 precomputed.
+inline Real smith_masking_gtr2_batch(Real x, Real y, Real z, Real a2) {
+    Real Lambda = (-1 + sqrt(1 + (x * x * a2 + y * y * a2) / (z * z))) / 2;
+    return 1 / (1 + Lambda);
+}
+
+void eval_lambertian_batch(BSDFBatch &b) {
+    int n = b.size();
+    const Real *in_z = b.in_z.data();
+    const Real *out_z = b.out_z.data();
+    const Real *valid = b.valid.data();
+    const Real *kd_r = b.kd_r.data();
+    const Real *kd_g = b.kd_g.data();
+    const Real *kd_b = b.kd_b.data();
+    Real *f_r = b.f_r.data();
+    Real *f_g = b.f_g.data();
+    Real *f_b = b.f_b.data();
+    Real *pdf_fwd = b.pdf_fwd.data();
+    Real *pdf_rev = b.pdf_rev.data();
+#pragma omp simd
+    for (int i = 0; i < n; i++) {
+        Real n_dot_out = (out_z[i] > 0 ? out_z[i] : Real(0)) * valid[i];
+        f_r[i] = n_dot_out * kd_r[i] / c_PI;
+        f_g[i] = n_dot_out * kd_g[i] / c_PI;
+        f_b[i] = n_dot_out * kd_b[i] / c_PI;
+        pdf_fwd[i] = n_dot_out / c_PI;
+        pdf_rev[i] = (in_z[i] > 0 ? in_z[i] : Real(0)) * valid[i] / c_PI;
+    }
+}
+
+void eval_rough_plastic_batch(BSDFBatch &b) {
+    int n = b.size();
+    const Real *in_x = b.in_x.data();
+    const Real *in_y = b.in_y.data();
+    const Real *in_z = b.in_z.data();
+    const Real *out_x = b.out_x.data();
+    const Real *out_y = b.out_y.data();
+    const Real *out_z = b.out_z.data();
+    const Real *valid = b.valid.data();
+    const Real *kd_r = b.kd_r.data();
+    const Real *kd_g = b.kd_g.data();
+    const Real *kd_b = b.kd_b.data();
+    const Real *ks_r = b.ks_r.data();
+    const Real *ks_g = b.ks_g.data();
+    const Real *ks_b = b.ks_b.data();
+    const Real *roughness = b.roughness.data();
+    const Real *eta = b.eta.data();
+    Real *f_r = b.f_r.data();
+    Real *f_g = b.f_g.data();
+    Real *f_b = b.f_b.data();
+    Real *pdf_fwd = b.pdf_fwd.data();
+    Real *pdf_rev = b.pdf_rev.data();
+#pragma omp simd
+    for (int i = 0; i < n; i++) {
+        Real ix = in_x[i], iy = in_y[i], iz = in_z[i];
+        Real ox = out_x[i], oy = out_y[i], oz = out_z[i];
+        Real hx = ix + ox, hy = iy + oy, hz = iz + oz;
+        Real inv_len = 1 / sqrt(hx * hx + hy * hy + hz * hz);
+        hx *= inv_len; hy *= inv_len; hz *= inv_len;
+        bool ok = (valid[i] > 0) & (oz > 0) & (hz > 0);
+
+        // Clamp roughness to avoid numerical issues.
+        Real r = roughness[i] < Real(0.01) ? Real(0.01) :
+                 (roughness[i] > Real(1) ? Real(1) : roughness[i]);
+        Real alpha = r * r;
+        Real a2 = alpha * alpha;
+        Real F_o = fresnel_dielectric_batch(hx * ox + hy * oy + hz * oz, eta[i]);
+        Real F_i = fresnel_dielectric_batch(hx * ix + hy * iy + hz * iz, eta[i]);
+        Real D = GTR2_batch(hz, a2);
+        Real G_in = smith_masking_gtr2_batch(ix, iy, iz, a2);
+        Real G_out = smith_masking_gtr2_batch(ox, oy, oz, a2);
+
+        Real spec = (G_in * G_out * F_o * D) / (4 * iz * oz);
+        Real diffuse = (1 - F_o) * (1 - F_i) / c_PI;
+        f_r[i] = ok ? (ks_r[i] * spec + kd_r[i] * diffuse) * oz : Real(0);
+        f_g[i] = ok ? (ks_g[i] * spec + kd_g[i] * diffuse) * oz : Real(0);
+        f_b[i] = ok ? (ks_b[i] * spec + kd_b[i] * diffuse) * oz : Real(0);
+
+        Real lS = ks_r[i] * Real(0.212671) + ks_g[i] * Real(0.715160) + ks_b[i] * Real(0.072169);
+        Real lR = kd_r[i] * Real(0.212671) + kd_g[i] * Real(0.715160) + kd_b[i] * Real(0.072169);
+        bool pdf_ok = ok & (lS + lR > 0);
+        Real spec_prob = lS / (lS + lR);
+        Real diff_prob = 1 - spec_prob;
+        pdf_fwd[i] = pdf_ok ?
+            spec_prob * (G_in * D) / (4 * iz) + diff_prob * oz / c_PI : Real(0);
+        pdf_rev[i] = pdf_ok ?
+            spec_prob * (G_out * D) / (4 * oz) + diff_prob * iz / c_PI : Real(0);
+    }
+}
+
+void eval_rough_dielectric_batch(BSDFBatch &b, TransportDirection dir) {
+    int n = b.size();
+    const Real *in_x = b.in_x.data();
+    const Real *in_y = b.in_y.data();
+    const Real *in_z = b.in_z.data();
+    const Real *out_x = b.out_x.data();
+    const Real *out_y = b.out_y.data();
+    const Real *out_z = b.out_z.data();
+    const Real *reflect = b.reflect.data();
+    const Real *kd_r = b.kd_r.data();
+    const Real *kd_g = b.kd_g.data();
+    const Real *kd_b = b.kd_b.data();
+    const Real *ks_r = b.ks_r.data();
+    const Real *ks_g = b.ks_g.data();
+    const Real *ks_b = b.ks_b.data();
+    const Real *roughness = b.roughness.data();
+    const Real *etas = b.eta.data();
+    Real *f_r = b.f_r.data();
+    Real *f_g = b.f_g.data();
+    Real *f_b = b.f_b.data();
+    Real *pdf_fwd = b.pdf_fwd.data();
+    Real *pdf_rev = b.pdf_rev.data();
+    // 1 if we need the 1/eta^2 factor (see roughdielectric.inl), 0 otherwise.
+    Real to_light = dir == TransportDirection::TO_LIGHT ? Real(1) : Real(0);
+#pragma omp simd
+    for (int i = 0; i < n; i++) {
+        Real ix = in_x[i], iy = in_y[i], iz = in_z[i];
+        Real ox = out_x[i], oy = out_y[i], oz = out_z[i];
+        Real eta = etas[i];
+        bool is_reflect = reflect[i] > 0;
+        // The generalized half-vector for refraction
+        Real s = is_reflect ? Real(1) : eta;
+        Real hx = ix + ox * s, hy = iy + oy * s, hz = iz + oz * s;
+        Real inv_len = 1 / sqrt(hx * hx + hy * hy + hz * hz);
+        // Flip half-vector if it's below surface
+        inv_len = hz < 0 ? -inv_len : inv_len;
+        hx *= inv_len; hy *= inv_len; hz *= inv_len;
+
+        // Clamp roughness to avoid numerical issues.
+        Real r = roughness[i] < Real(0.01) ? Real(0.01) :
+                 (roughness[i] > Real(1) ? Real(1) : roughness[i]);
+        Real alpha = r * r;
+        Real a2 = alpha * alpha;
+        Real h_dot_in = hx * ix + hy * iy + hz * iz;
+        Real h_dot_out = hx * ox + hy * oy + hz * oz;
+        Real F = fresnel_dielectric_batch(h_dot_in, eta);
+        Real D = GTR2_batch(hz, a2);
+        Real G_in = smith_masking_gtr2_batch(ix, iy, iz, a2);
+        Real G_out = smith_masking_gtr2_batch(ox, oy, oz, a2);
+        Real n_dot_in = fabs(iz), n_dot_out = fabs(oz);
+
+        // Reflection
+        Real r_pdf_fwd = (F * D * G_in) / (4 * n_dot_in);
+        Real r_pdf_rev = (F * D * G_out) / (4 * n_dot_out);
+        Real r_f = r_pdf_fwd * G_out;
+        // Refraction
+        Real eta_factor = to_light / (eta * eta) + (1 - to_light);
+        Real sqrt_denom = h_dot_in + eta * h_dot_out;
+        Real h_term = fabs(h_dot_out * h_dot_in) / (sqrt_denom * sqrt_denom);
+        Real t_pdf_fwd = (1 - F) * D * G_in * eta * eta * h_term / n_dot_in;
+        Real t_pdf_rev = (1 - F) * D * G_out * h_term / n_dot_out;
+        Real t_f = eta_factor * t_pdf_fwd * G_out;
+
+        // Select between reflection & refraction. We load both reflectances
+        // and compute everything into local variables before the stores,
+        // otherwise GCC fails to if-convert the loop.
+        Real fr_r = ks_r[i] * r_f, fr_g = ks_g[i] * r_f, fr_b = ks_b[i] * r_f;
+        Real ft_r = kd_r[i] * t_f, ft_g = kd_g[i] * t_f, ft_b = kd_b[i] * t_f;
+        Real fr = is_reflect ? fr_r : ft_r;
+        Real fg = is_reflect ? fr_g : ft_g;
+        Real fb = is_reflect ? fr_b : ft_b;
+        Real pf = is_reflect ? r_pdf_fwd : t_pdf_fwd;
+        Real pr = is_reflect ? r_pdf_rev : t_pdf_rev;
+        f_r[i] = fr;
+        f_g[i] = fg;
+        f_b[i] = fb;
+        pdf_fwd[i] = pf;
+        pdf_rev[i] = pr;
+    }
+}
+
+/// Write the local directions of a query into the batch.
+/// The shading frame is flipped following the convention of the material.
+inline void gather_directions(BSDFBatch &b, int i, const BSDFQuery &q, bool flip) {
+    Frame frame = flip ? -q.vertex->shading_frame : q.vertex->shading_frame;
+    Vector3 in = to_local(frame, q.dir_in);
+    Vector3 out = to_local(frame, q.dir_out);
+    b.in_x[i] = in.x; b.in_y[i] = in.y; b.in_z[i] = in.z;
+    b.out_x[i] = out.x; b.out_y[i] = out.y; b.out_z[i] = out.z;
+}
+
+/// For the reflective materials: both directions need to be above the surface,
+/// and the shading frame is flipped to the side of dir_in.
+inline void gather_reflective(BSDFBatch &b, int i, const BSDFQuery &q) {
+    const Vector3 &ng = q.vertex->geometric_normal;
+    b.valid[i] = dot(ng, q.dir_in) >= 0 && dot(ng, q.dir_out) >= 0 ? Real(1) : Real(0);
+    gather_directions(b, i, q, dot(q.vertex->shading_frame.n, q.dir_in) < 0);
+}
+
+inline void gather(BSDFBatch &b, int i, const BSDFQuery &q, const LambertianClosure &c) {
+    gather_reflective(b, i, q);
+    b.kd_r[i] = c.reflectance.x; b.kd_g[i] = c.reflectance.y; b.kd_b[i] = c.reflectance.z;
+}
+
+inline void gather(BSDFBatch &b, int i, const BSDFQuery &q, const RoughPlasticClosure &c) {
+    gather_reflective(b, i, q);
+    b.kd_r[i] = c.diffuse_reflectance.x;
+    b.kd_g[i] = c.diffuse_reflectance.y;
+    b.kd_b[i] = c.diffuse_reflectance.z;
+    b.ks_r[i] = c.specular_reflectance.x;
+    b.ks_g[i] = c.specular_reflectance.y;
+    b.ks_b[i] = c.specular_reflectance.z;
+    b.roughness[i] = c.roughness;
+    b.eta[i] = c.eta;
+}
+
+inline void gather(BSDFBatch &b, int i, const BSDFQuery &q, const RoughDielectricClosure &c) {
+    const Vector3 &ng = q.vertex->geometric_normal;
+    Real ng_dot_in = dot(ng, q.dir_in);
+    b.valid[i] = 1;
+    b.reflect[i] = ng_dot_in * dot(ng, q.dir_out) > 0 ? Real(1) : Real(0);
+    gather_directions(b, i, q, dot(q.vertex->shading_frame.n, q.dir_in) * ng_dot_in < 0);
+    b.ks_r[i] = c.specular_reflectance.x;
+    b.ks_g[i] = c.specular_reflectance.y;
+    b.ks_b[i] = c.specular_reflectance.z;
+    b.kd_r[i] = c.specular_transmittance.x;
+    b.kd_g[i] = c.specular_transmittance.y;
+    b.kd_b[i] = c.specular_transmittance.z;
+    b.roughness[i] = c.roughness;
+    // If we are going into the surface, then we use normal eta
+    // (internal/external), otherwise we use external/internal.
+    b.eta[i] = ng_dot_in > 0 ? c.eta : 1 / c.eta;
+}
+
+/// The index of a closure type in the MaterialClosure variant.
+template <typename T, std::size_t I = 0>
+constexpr int closure_index() {
+    if constexpr (std::is_same_v<std::variant_alternative_t<I, MaterialClosure>, T>) {
+        return (int)I;
+    } else {
+        return closure_index<T, I + 1>();
+    }
+}
+
+template <typename ClosureType, typename Kernel>
+void eval_run(const std::vector<BSDFQuery> &queries,
+              const int *ids, int count,
+              BSDFBatch &batch,
+              std::vector<BSDFEvalRecord> &results,
+              Kernel kernel) {
+    batch.resize(count);
+    for (int i = 0; i < count; i++) {
+        const BSDFQuery &q = queries[ids[i]];
+        gather(batch, i, q, std::get<ClosureType>(*q.closure));
+    }
+    kernel(batch);
+    for (int i = 0; i < count; i++) {
+        results[ids[i]] = BSDFEvalRecord{
+            Spectrum{batch.f_r[i], batch.f_g[i], batch.f_b[i]},
+            batch.pdf_fwd[i], batch.pdf_rev[i]};
+    }
+}
+
+void eval_with_pdf_batch(const std::vector<BSDFQuery> &queries,
+                         std::vector<BSDFEvalRecord> &results,
+                         BSDFBatch &batch,
+                         TransportDirection dir) {
+    int n = (int)queries.size();
+    results.resize(n);
+    // Counting sort of the queries by material type.
+    constexpr int num_types = (int)std::variant_size_v<MaterialClosure>;
+    std::vector<int> offsets(num_types + 1, 0);
+    for (const BSDFQuery &q : queries) {
+        offsets[q.closure->index() + 1]++;
+    }
+    for (int t = 0; t < num_types; t++) {
+        offsets[t + 1] += offsets[t];
+    }
+    std::vector<int> &sorted = batch.sorted_ids;
+    sorted.resize(n);
+    std::vector<int> next(offsets.begin(), offsets.end() - 1);
+    for (int i = 0; i < n; i++) {
+        sorted[next[queries[i].closure->index()]++] = i;
+    }
+
+    for (int t = 0; t < num_types; t++) {
+        const int *ids = sorted.data() + offsets[t];
+        int count = offsets[t + 1] - offsets[t];
+        if (count == 0) {
+            continue;
+        }
+        if (t == closure_index<LambertianClosure>()) {
+            eval_run<LambertianClosure>(queries, ids, count, batch, results,
+                [](BSDFBatch &b) { eval_lambertian_batch(b); });
+        } else if (t == closure_index<RoughPlasticClosure>()) {
+            eval_run<RoughPlasticClosure>(queries, ids, count, batch, results,
+                [](BSDFBatch &b) { eval_rough_plastic_batch(b); });
+        } else if (t == closure_index<RoughDielectricClosure>()) {
+            eval_run<RoughDielectricClosure>(queries, ids, count, batch, results,
+                [&](BSDFBatch &b) { eval_rough_dielectric_batch(b, dir); });
+        } else {
+            // No batched kernel -- fall back to the scalar code.
+            for (int i = 0; i < count; i++) {
+                const BSDFQuery &q = queries[ids[i]];
+                results[ids[i]] = eval_with_pdf(*q.closure, q.dir_in, q.dir_out, *q.vertex, dir);
+            }
+        }
+    }
+}
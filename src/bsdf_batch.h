@@ -0,0 +1,69 @@
+#pragma once
+
+#include "lajolla.h"
+#include "material.h"
+#include "vector.h"
+#include <vector>
+
+struct PathVertex;
+
+/// Batched BSDF evaluation. Instead of std::visit-ing the material of
+/// each query one at a time, we sort the queries by material type,
+/// gather each run into a structure-of-arrays (SoA) batch, and run
+/// a tight loop over the batch. The loops are branch-free and only touch
+/// contiguous arrays of Reals, so that the compiler can vectorize them
+/// (compile with e.g. -march=native to get AVX2/AVX-512 instead of SSE2).
+/// Lambertian, RoughPlastic, and RoughDielectric have batched kernels,
+/// the other materials fall back to the scalar eval_with_pdf().
+///
+/// This is meant to be fed by wavefront-style integrators that
+/// collect the shading queries of many paths (e.g., a tile) before evaluating them.
+
+/// A single BSDF query. The pointers must stay valid during the evaluation.
+struct BSDFQuery {
+    const MaterialClosure *closure;
+    const PathVertex *vertex;
+    Vector3 dir_in;
+    Vector3 dir_out;
+};
+
+/// The SoA storage of a batch. Directions are stored in the local shading
+/// frame (flipped to the side of dir_in), so the shading normal is (0, 0, 1).
+struct BSDFBatch {
+    void resize(int n);
+    int size() const { return (int)in_x.size(); }
+
+    std::vector<Real> in_x, in_y, in_z;
+    std::vector<Real> out_x, out_y, out_z;
+    // 1 if the directions pass the geometric normal tests of the material, 0 otherwise.
+    std::vector<Real> valid;
+    // 1 if dir_in and dir_out are on the same side of the geometric normal (dielectric only).
+    std::vector<Real> reflect;
+    // The material parameters. Unused ones are left uninitialized.
+    std::vector<Real> kd_r, kd_g, kd_b; // diffuse reflectance/specular transmittance
+    std::vector<Real> ks_r, ks_g, ks_b; // specular reflectance
+    std::vector<Real> roughness;
+    std::vector<Real> eta; // for dielectric: relative IOR seen from dir_in
+    // Output
+    std::vector<Real> f_r, f_g, f_b;
+    std::vector<Real> pdf_fwd, pdf_rev;
+
+    // Scratch space of eval_with_pdf_batch for sorting the queries by material type.
+    std::vector<int> sorted_ids;
+};
+
+/// Kernels that evaluate all queries in a batch. The batch must
+/// have been gathered for the corresponding material type.
+void eval_lambertian_batch(BSDFBatch &batch);
+void eval_rough_plastic_batch(BSDFBatch &batch);
+void eval_rough_dielectric_batch(BSDFBatch &batch, TransportDirection dir);
+
+/// Evaluate the BSDF values and pdfs (same as eval_with_pdf()) of all the queries.
+/// Queries are sorted by material type, and each run is processed by the batched kernels.
+/// The results are written in the order of the queries.
+/// workspace holds the SoA storage -- reuse it between calls
+/// so that we don't reallocate the arrays every time.
+void eval_with_pdf_batch(const std::vector<BSDFQuery> &queries,
+                         std::vector<BSDFEvalRecord> &results,
+                         BSDFBatch &workspace,
+                         TransportDirection dir = TransportDirection::TO_LIGHT);
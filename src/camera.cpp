@@ -1,5 +1,7 @@
 #include "camera.h"
 #include "lajolla.h"
+#include "profiler.h"
+#include "stats.h"
 #include "transform.h"
 
 #include <cmath>
@@ -18,6 +20,11 @@ Camera::Camera(const Matrix4x4 &cam_to_world,
                     translate(Vector3(-Real(1.0), -Real(1.0) / aspect, Real(0.0))) *
                     perspective(fov);
     sample_to_cam = inverse(cam_to_sample);
+
+    // Project the corners of the screen to the plane at distance 1.
+    Vector3 c0 = xform_point(sample_to_cam, Vector3{0, 0, 0});
+    Vector3 c1 = xform_point(sample_to_cam, Vector3{1, 1, 0});
+    screen_area = fabs((c1.x / c1.z - c0.x / c0.z) * (c1.y / c1.z - c0.y / c0.z));
 }
 
 Ray sample_primary(const Camera &camera,
@@ -37,11 +44,48 @@ Ray sample_primary(const Camera &camera,
       (floor(pixel_pos.x) + Real(0.5) + offset.x) / camera.width,
       (floor(pixel_pos.y) + Real(0.5) + offset.y) / camera.height};
 
+    return screen_to_ray(camera, remapped_pos);
+}
+
+Ray screen_to_ray(const Camera &camera,
+                  const Vector2 &screen_pos) {
+    ProfileScope profile(ProfilePhase::CameraRay);
+    count_stat(Stat::CameraRays);
     Vector3 pt = xform_point(camera.sample_to_cam,
-        Vector3(remapped_pos[0], remapped_pos[1], Real(0)));
+        Vector3(screen_pos[0], screen_pos[1], Real(0)));
     Vector3 dir = normalize(pt);
     return Ray{xform_point(camera.cam_to_world, Vector3{0, 0, 0}),
                // the last normalize might not be necessary
                normalize(xform_vector(camera.cam_to_world, dir)),
                Real(0), infinity<Real>()};
 }
+
+std::optional<Vector2> world_to_screen(const Camera &camera,
+                                       const Vector3 &p) {
+    Vector3 pt = xform_point(camera.world_to_cam, p);
+    if (pt.z <= 0) {
+        // Behind the camera
+        return {};
+    }
+    Vector3 screen_pos = xform_point(camera.cam_to_sample, pt);
+    if (screen_pos.x < 0 || screen_pos.x >= 1 ||
+            screen_pos.y < 0 || screen_pos.y >= 1) {
+        return {};
+    }
+    return Vector2{screen_pos.x, screen_pos.y};
+}
+
+Real camera_importance(const Camera &camera,
+                       const Vector3 &dir) {
+    Vector3 local_dir = normalize(xform_vector(camera.world_to_cam, dir));
+    Real cos_theta = local_dir.z;
+    if (cos_theta <= 0) {
+        return 0;
+    }
+    Vector3 screen_pos = xform_point(camera.cam_to_sample, local_dir);
+    if (screen_pos.x < 0 || screen_pos.x >= 1 ||
+            screen_pos.y < 0 || screen_pos.y >= 1) {
+        return 0;
+    }
+    return 1 / (camera.screen_area * cos_theta * cos_theta * cos_theta);
+}
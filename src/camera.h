@@ -5,6 +5,7 @@
 #include "matrix.h"
 #include "vector.h"
 #include "ray.h"
+#include <optional>
 
 /// Currently we only support a pinhole perspective camera
 struct Camera {
@@ -19,6 +20,9 @@ struct Camera {
     Matrix4x4 cam_to_world, world_to_cam;
     int width, height;
     Filter filter;
+    // The area of the screen at distance 1 from the pinhole (in camera space),
+    // for the importance of the camera (see camera_importance()).
+    Real screen_area;
 
     int medium_id; // for participating media rendering in homework 2
 };
@@ -27,3 +31,24 @@ struct Camera {
 /// generate a camera ray.
 Ray sample_primary(const Camera &camera,
                    const Vector2 &screen_pos);
+
+/// Same as sample_primary(), but without the pixel filter:
+/// the ray passes through screen_pos exactly.
+Ray screen_to_ray(const Camera &camera,
+                  const Vector2 &screen_pos);
+
+/// The inverse of screen_to_ray(): project a point in the world onto the screen.
+/// Returns an invalid value if the point is behind the camera or outside of the screen.
+std::optional<Vector2> world_to_screen(const Camera &camera,
+                                       const Vector3 &p);
+
+/// For methods that connect paths to the camera (e.g., bidirectional path tracing):
+/// the importance W of the camera for a direction dir leaving the pinhole.
+/// For a pinhole camera, W = 1 / (A cos^3(theta)), where A is the area of the screen
+/// at distance 1, and theta is the angle between dir and the viewing direction.
+/// One cosine converts the screen area to the solid angle, and the other two come from the
+/// distance to the screen. The importance integrates to one over the whole screen,
+/// and it is also the solid angle density of screen_to_ray() with a uniform screen position.
+/// Returns 0 if dir is outside of the screen.
+Real camera_importance(const Camera &camera,
+                       const Vector3 &dir);
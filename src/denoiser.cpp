@@ -0,0 +1,145 @@
+#include "denoiser.h"
+#include "parallel.h"
+#include "spectrum.h"
+#include <vector>
+
+/// The 1D B3-spline kernel of Dammertz et al. The 5x5 kernel is its outer product.
+constexpr Real c_atrous_kernel[5] = {Real(1) / 16, Real(1) / 4, Real(3) / 8, Real(1) / 4, Real(1) / 16};
+
+/// We don't demodulate the channels with (almost) zero albedo,
+/// e.g., black surfaces or the pixels that see the envmap.
+constexpr Real c_min_albedo = Real(1e-3);
+
+inline Spectrum demodulation_factor(const Spectrum &albedo) {
+    Spectrum f;
+    for (int c = 0; c < 3; c++) {
+        f[c] = albedo[c] > c_min_albedo ? albedo[c] : Real(1);
+    }
+    return f;
+}
+
+/// The pixels that see nothing have zero depth. We don't filter them,
+/// and we don't let them leak into the pixels that see something.
+inline bool is_miss(const Image3 &depth, int x, int y) {
+    return depth(x, y)[0] <= 0;
+}
+
+void denoise(Image3 &img,
+             const Image1 &variance,
+             const Image3 &albedo,
+             const Image3 &normal,
+             const Image3 &depth,
+             int num_iterations) {
+    int w = img.width, h = img.height;
+    // Demodulate the albedo.
+    std::vector<Spectrum> color(w * h), next_color(w * h);
+    std::vector<Real> var(w * h), next_var(w * h);
+    for (int i = 0; i < w * h; i++) {
+        Spectrum f = demodulation_factor(albedo(i));
+        color[i] = img(i) / f;
+        var[i] = variance(i) / (luminance(f) * luminance(f));
+    }
+
+    // The normals are averaged over the samples of the pixels, so they are shorter
+    // at the edges (and zero if the samples cancel each other out).
+    std::vector<Vector3> n(w * h);
+    for (int i = 0; i < w * h; i++) {
+        Real l = length(normal(i));
+        n[i] = l > 0 ? normal(i) / l : Vector3{0, 0, 0};
+    }
+
+    // The depth gradient of each pixel in screen space. We take the smaller one-sided difference
+    // on each axis, so that the pixels at the silhouettes don't get huge gradients.
+    std::vector<Vector2> depth_gradient(w * h);
+    parallel_for([&](int64_t y) {
+        for (int x = 0; x < w; x++) {
+            Real z = depth(x, int(y))[0];
+            auto one_sided = [&](int xx, int yy) {
+                if (xx < 0 || xx >= w || yy < 0 || yy >= h || is_miss(depth, xx, yy)) {
+                    return infinity<Real>();
+                }
+                return fabs(depth(xx, yy)[0] - z);
+            };
+            Real gx = min(one_sided(x - 1, int(y)), one_sided(x + 1, int(y)));
+            Real gy = min(one_sided(x, int(y) - 1), one_sided(x, int(y) + 1));
+            depth_gradient[y * w + x] = Vector2{gx < infinity<Real>() ? gx : 0,
+                                                gy < infinity<Real>() ? gy : 0};
+        }
+    }, h);
+
+    for (int iteration = 0; iteration < num_iterations; iteration++) {
+        int step = 1 << iteration;
+        parallel_for([&](int64_t y_) {
+            int y = int(y_);
+            for (int x = 0; x < w; x++) {
+                int p = y * w + x;
+                if (is_miss(depth, x, y)) {
+                    next_color[p] = color[p];
+                    next_var[p] = var[p];
+                    continue;
+                }
+                // SVGF blurs the variance of the center pixel with a 3x3 Gaussian,
+                // since the variance estimate itself is noisy.
+                Real blurred_var = 0;
+                Real blurred_weight = 0;
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int qx = x + dx, qy = y + dy;
+                        if (qx >= 0 && qx < w && qy >= 0 && qy < h) {
+                            Real k = Real(1) / ((1 + abs(dx)) * (1 + abs(dy)));
+                            blurred_var += k * var[qy * w + qx];
+                            blurred_weight += k;
+                        }
+                    }
+                }
+                Real sigma_l = c_denoiser_sigma_luminance * sqrt(max(blurred_var / blurred_weight, Real(0)));
+
+                Real l_p = luminance(color[p]);
+                Real z_p = depth(x, y)[0];
+                const Vector3 &n_p = n[p];
+                const Vector2 &grad_p = depth_gradient[p];
+                Spectrum sum_color = make_zero_spectrum();
+                Real sum_var = 0;
+                Real sum_weight = 0;
+                for (int j = -2; j <= 2; j++) {
+                    for (int i = -2; i <= 2; i++) {
+                        int qx = x + i * step, qy = y + j * step;
+                        if (qx < 0 || qx >= w || qy < 0 || qy >= h || is_miss(depth, qx, qy)) {
+                            continue;
+                        }
+                        int q = qy * w + qx;
+                        // max(dot(n_p, n_q), 0)^sigma_normal by repeated squaring.
+                        Real w_n = max(dot(n_p, n[q]), Real(0));
+                        for (int k = 1; k < c_denoiser_sigma_normal; k *= 2) {
+                            w_n *= w_n;
+                        }
+                        // We expect the depth to change linearly along the gradient.
+                        Real expected_dz = fabs(grad_p.x * i * step) + fabs(grad_p.y * j * step);
+                        Real d_z = fabs(z_p - depth(qx, qy)[0]) /
+                            (c_denoiser_sigma_depth * expected_dz + Real(1e-3) * z_p);
+                        Real d_l = fabs(l_p - luminance(color[q])) / (sigma_l + Real(1e-10));
+                        // exp(-d_z) * exp(-d_l) with one exp.
+                        Real weight = c_atrous_kernel[i + 2] * c_atrous_kernel[j + 2] * w_n * exp(-(d_z + d_l));
+                        sum_color += weight * color[q];
+                        sum_var += weight * weight * var[q];
+                        sum_weight += weight;
+                    }
+                }
+                // Only the pixels with zero normals have zero weights, even for the center tap.
+                if (sum_weight > 0) {
+                    next_color[p] = sum_color / sum_weight;
+                    next_var[p] = sum_var / (sum_weight * sum_weight);
+                } else {
+                    next_color[p] = color[p];
+                    next_var[p] = var[p];
+                }
+            }
+        }, h);
+        std::swap(color, next_color);
+        std::swap(var, next_var);
+    }
+
+    for (int i = 0; i < w * h; i++) {
+        img(i) = color[i] * demodulation_factor(albedo(i));
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "lajolla.h"
+#include "image.h"
+
+/// A denoiser for the path tracer: the edge-avoiding à-trous wavelet filter from
+/// "Edge-Avoiding À-Trous Wavelet Transform for fast Global Illumination Filtering"
+/// from Dammertz et al., with the variance-guided luminance weights of
+/// "Spatiotemporal Variance-Guided Filtering" (SVGF) from Schied et al.
+///
+/// The à-trous ("with holes") transform approximates a large blur with a few iterations
+/// of a 5x5 kernel, where the i-th iteration spreads its taps 2^i pixels apart.
+/// Each tap is weighted by how similar the neighbor is to the center pixel:
+/// its normal and depth (so that we don't blur across geometric edges) and its luminance,
+/// relative to the standard deviation of the center pixel (so that we blur the noise,
+/// but not the actual features of the lighting like the shadow boundaries).
+/// We track the variance of the filtered pixels through the iterations: each iteration
+/// reduces the noise, so the later iterations, with wider taps, become more conservative.
+///
+/// Before filtering, we divide the radiance by the albedo (and multiply it back after),
+/// so that we only blur the lighting and keep the texture details sharp.
+
+/// Dammertz et al. use 5 iterations, i.e., a 61x61 filter footprint.
+constexpr int c_denoiser_iterations = 5;
+/// The parameters of the edge-stopping functions from the SVGF paper.
+/// sigma_normal is the exponent of the normal weight, a power of 2 so that we can square our way there.
+constexpr int c_denoiser_sigma_normal = 128;
+constexpr Real c_denoiser_sigma_depth = Real(1);
+constexpr Real c_denoiser_sigma_luminance = Real(4);
+
+/// Denoises the image in place. variance is the variance of the luminance of each pixel
+/// (of the pixel mean, not of the samples). albedo, normal, and depth are the AOVs of
+/// the rendering (see aov.h), with the depth in all 3 channels.
+/// Runs on the thread pool (see parallel.h).
+void denoise(Image3 &img,
+             const Image1 &variance,
+             const Image3 &albedo,
+             const Image3 &normal,
+             const Image3 &depth,
+             int num_iterations = c_denoiser_iterations);
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "lajolla.h"
+#include "image.h"
+#include "mipmap.h"
+#include "parallel.h"
+#include "vector.h"
+
+/// Equal-area octahedral mapping between the unit sphere and the unit square [0, 1]^2.
+/// See "Fast Equal-Area Mapping of the (Hemi)Sphere using SIMD" from Clarberg
+/// and the implementation in pbrt-v4. Compared to the latitude-longitude mapping,
+/// all texels cover the same solid angle (4pi / #texels), so we don't waste
+/// resolution at the poles, and the sampling Jacobian is simply a constant 4pi.
+/// The mapping only needs a sqrt and a polynomial approximation of atan,
+/// which is much cheaper than the atan2 & acos of the lat-long mapping.
+inline Vector2 equal_area_sphere_to_square(const Vector3 &d) {
+    Real x = fabs(d.x), y = fabs(d.y), z = fabs(d.z);
+    // Compute the radius r
+    Real r = sqrt(max(1 - z, Real(0)));
+    // Compute the argument to atan (detect a=0 to avoid div-by-zero)
+    Real a = max(x, y), b = min(x, y);
+    b = a == 0 ? Real(0) : b / a;
+    // Polynomial approximation of atan(b) * 2/pi, b in [0, 1]
+    const Real t1 = Real(0.406758566246788489601959989e-5);
+    const Real t2 = Real(0.636226545274016134946890922156);
+    const Real t3 = Real(0.61572017898280213493197203466e-2);
+    const Real t4 = Real(-0.247333733281268944196501420480);
+    const Real t5 = Real(0.881770664775316294736387951347e-1);
+    const Real t6 = Real(0.419038818029165735901852432784e-1);
+    const Real t7 = Real(-0.251390972343483509333252996350e-1);
+    Real phi = t1 + b * (t2 + b * (t3 + b * (t4 + b * (t5 + b * (t6 + b * t7)))));
+    if (x < y) {
+        phi = 1 - phi;
+    }
+    // Find (u, v) based on (r, phi)
+    Real v = phi * r;
+    Real u = r - v;
+    if (d.z < 0) {
+        // southern hemisphere -> mirror u, v
+        std::swap(u, v);
+        u = 1 - u;
+        v = 1 - v;
+    }
+    // Move (u, v) to the correct quadrant based on the signs of (x, y)
+    u = std::copysign(u, d.x);
+    v = std::copysign(v, d.y);
+    // Transform (u, v) from [-1, 1] to [0, 1]
+    return Vector2{Real(0.5) * (u + 1), Real(0.5) * (v + 1)};
+}
+
+/// The inverse of the function above.
+inline Vector3 equal_area_square_to_sphere(const Vector2 &p) {
+    // Transform p to [-1, 1]^2 and compute absolute values
+    Real u = 2 * p.x - 1, v = 2 * p.y - 1;
+    Real up = fabs(u), vp = fabs(v);
+    // Compute the radius r as the signed distance from the diagonal
+    Real signed_distance = 1 - (up + vp);
+    Real d = fabs(signed_distance);
+    Real r = 1 - d;
+    // Compute the angle phi for the square to sphere mapping
+    Real phi = (r == 0 ? Real(1) : (vp - up) / r + 1) * c_PI / 4;
+    // Find z for the unit vector
+    Real z = std::copysign(1 - r * r, signed_distance);
+    // Compute cos(phi) and sin(phi) for the original quadrant
+    Real cos_phi = std::copysign(cos(phi), u);
+    Real sin_phi = std::copysign(sin(phi), v);
+    Real s = r * sqrt(max(2 - r * r, Real(0)));
+    return Vector3{cos_phi * s, sin_phi * s, z};
+}
+
+/// Bilinear lookup of an equal-area octahedral image at one mipmap level.
+/// Unlike the usual texture lookup, we can't simply wrap around at the boundary:
+/// the neighbors of the edge texels are mirrored along the same edge.
+template <typename T>
+inline T lookup_equal_area(const Mipmap<T> &mipmap, Real u, Real v, int level) {
+    const Image<T> &img = mipmap.images[level];
+    int w = img.width, h = img.height;
+    auto texel = [&](int x, int y) {
+        if (x < 0) {
+            x = -x - 1;
+            y = h - 1 - y;
+        } else if (x >= w) {
+            x = 2 * w - 1 - x;
+            y = h - 1 - y;
+        }
+        if (y < 0) {
+            x = w - 1 - x;
+            y = -y - 1;
+        } else if (y >= h) {
+            x = w - 1 - x;
+            y = 2 * h - 1 - y;
+        }
+        return img(std::clamp(x, 0, w - 1), std::clamp(y, 0, h - 1));
+    };
+    // (-0.5 to match the coordinates of the usual mipmap lookup)
+    u = u * w - Real(0.5);
+    v = v * h - Real(0.5);
+    int ufi = (int)floor(u), vfi = (int)floor(v);
+    Real u_off = u - ufi, v_off = v - vfi;
+    return texel(ufi    , vfi    ) * (1 - u_off) * (1 - v_off) +
+           texel(ufi    , vfi + 1) * (1 - u_off) *      v_off +
+           texel(ufi + 1, vfi    ) *      u_off  * (1 - v_off) +
+           texel(ufi + 1, vfi + 1) *      u_off  *      v_off;
+}
+
+/// Resample a latitude-longitude environment map (with the y-up convention of
+/// the Envmap light) into a square equal-area octahedral image
+/// that is indexed by the same local directions.
+/// The octahedral map has the same width as the lat-long map (so twice as many texels).
+/// Fewer texels would match the solid angle of the lat-long texels at the equator,
+/// but the octahedral texels are sheared near the diagonals, and the bilinear resampling
+/// blurs the image, so we keep the extra resolution to preserve the details.
+inline Image3 latlong_to_equal_area(const Image3 &latlong) {
+    Mipmap3 src;
+    src.images.push_back(latlong);
+    // Round up to a multiple of 64 so that the mipmap levels stay even.
+    int n = max(64 * ((latlong.width + 63) / 64), 64);
+    Image3 img(n, n);
+    parallel_for([&](int64_t y) {
+        for (int x = 0; x < n; x++) {
+            Vector3 dir = equal_area_square_to_sphere(
+                Vector2{(x + Real(0.5)) / n, (y + Real(0.5)) / n});
+            // Same conversion as the lat-long Envmap lookup.
+            Real u = atan2(dir.x, -dir.z) * c_INVTWOPI;
+            if (u < 0) {
+                u += 1;
+            }
+            Real v = acos(std::clamp(dir.y, Real(-1), Real(1))) * c_INVPI;
+            img(x, (int)y) = lookup(src, u, v, 0);
+        }
+    }, n, 16);
+    return img;
+}
@@ -0,0 +1,57 @@
+#include "film.h"
+#include "flexception.h"
+
+Film::Film(int width, int height, bool track_variance) : width(width), height(height) {
+    num_tiles_x = (width + c_film_tile_size - 1) / c_film_tile_size;
+    int num_tiles_y = (height + c_film_tile_size - 1) / c_film_tile_size;
+    size_t num_pixels = size_t(num_tiles_x) * num_tiles_y * c_film_tile_size * c_film_tile_size;
+    sums.resize(num_pixels, Vector3f{0, 0, 0});
+    counts.resize(num_pixels, 0);
+    if (track_variance) {
+        m2.resize(num_pixels, 0);
+    }
+}
+
+void Film::merge(const Film &film) {
+    if (film.width != width || film.height != height) {
+        Error("Merging films of different sizes.");
+    }
+    if (track_variance() && !film.track_variance()) {
+        Error("Merging a film without variance into a film with variance.");
+    }
+    for (int i = 0; i < (int)sums.size(); i++) {
+        uint32_t n_a = counts[i], n_b = film.counts[i];
+        if (n_b == 0) {
+            continue;
+        }
+        if (track_variance()) {
+            // The parallel version of Welford's algorithm from Chan et al.
+            Real mean_a = n_a > 0 ? luminance(Spectrum(sums[i])) / n_a : Real(0);
+            Real mean_b = luminance(Spectrum(film.sums[i])) / n_b;
+            Real delta = mean_b - mean_a;
+            m2[i] += film.m2[i] + float(delta * delta * (Real(n_a) * n_b / (n_a + n_b)));
+        }
+        sums[i] += film.sums[i];
+        counts[i] += n_b;
+    }
+}
+
+Image3 Film::resolve() const {
+    Image3 img(width, height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            img(x, y) = mean(x, y);
+        }
+    }
+    return img;
+}
+
+Image1 Film::resolve_variance() const {
+    Image1 img(width, height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            img(x, y) = variance(x, y);
+        }
+    }
+    return img;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "lajolla.h"
+#include "image.h"
+#include "profiler.h"
+#include "spectrum.h"
+#include "vector.h"
+
+#include <cstdint>
+#include <vector>
+
+/// The pixels of a Film are stored tile by tile, and the tiles have the same size as
+/// the tiles the renderers work on, so that the pixels of a tile are contiguous in memory.
+constexpr int c_film_tile_size = 16;
+
+/// A render target that accumulates the samples of the pixels: for each pixel,
+/// we store the sum of the samples in float RGB and the number of samples, so that we can
+/// keep adding samples to a pixel across passes (e.g., ReSTIR, or the training pass of the
+/// radiance cache), or merge the films of several renderings of the same image.
+/// That's 16 bytes per pixel, instead of the 24 bytes of an Image3 of doubles.
+///
+/// If track_variance is on, we also store the sum of the squared differences from the mean (M2)
+/// of the luminance of the samples, which we update with Welford's algorithm
+/// (see https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance),
+/// for 4 more bytes per pixel. Unlike summing the squared luminance and subtracting the squared
+/// mean at the end, this doesn't lose all the precision of float when the variance is small
+/// compared to the mean.
+///
+/// Different threads can add samples to different pixels at the same time, but not to the same pixel.
+/// (For that, see SplatImage in image.h.)
+struct Film {
+    Film() {}
+    Film(int width, int height, bool track_variance = false);
+
+    void add_sample(int x, int y, const Spectrum &L) {
+        ProfileScope profile(ProfilePhase::FilmWrite);
+        int i = pixel_index(x, y);
+        uint32_t n = ++counts[i];
+        if (!m2.empty()) {
+            Real l = luminance(L);
+            Real old_mean = n > 1 ? luminance(Spectrum(sums[i])) / (n - 1) : Real(0);
+            Real delta = l - old_mean;
+            Real new_mean = old_mean + delta / n;
+            m2[i] += float(delta * (l - new_mean));
+        }
+        sums[i] += Vector3f(L);
+    }
+
+    int num_samples(int x, int y) const {
+        return counts[pixel_index(x, y)];
+    }
+
+    /// The average of the samples of pixel (x, y), or zero if it has no samples.
+    Spectrum mean(int x, int y) const {
+        int i = pixel_index(x, y);
+        return counts[i] > 0 ? Spectrum(sums[i]) / Real(counts[i]) : make_zero_spectrum();
+    }
+
+    /// The variance of the mean luminance of pixel (x, y), i.e., the sample variance
+    /// divided by the number of samples. Needs track_variance.
+    /// We can't estimate it with less than 2 samples, so it is zero then.
+    Real variance(int x, int y) const {
+        int i = pixel_index(x, y);
+        uint32_t n = counts[i];
+        return n > 1 ? Real(m2[i]) / (Real(n - 1) * n) : Real(0);
+    }
+
+    /// Adds the samples of another film of the same size,
+    /// as if we added them to this film one by one.
+    void merge(const Film &film);
+
+    /// The means of the pixels.
+    Image3 resolve() const;
+    /// The variances of the pixels (see variance()).
+    Image1 resolve_variance() const;
+
+    bool track_variance() const {
+        return !m2.empty();
+    }
+
+    int pixel_index(int x, int y) const {
+        int tile_id = (y / c_film_tile_size) * num_tiles_x + x / c_film_tile_size;
+        return tile_id * c_film_tile_size * c_film_tile_size +
+               (y % c_film_tile_size) * c_film_tile_size + x % c_film_tile_size;
+    }
+
+    int width = 0, height = 0;
+    // The tiles at the right & bottom boundaries are padded to the full tile size.
+    int num_tiles_x = 0;
+    std::vector<Vector3f> sums;
+    std::vector<uint32_t> counts;
+    // Empty if we don't track the variance.
+    std::vector<float> m2;
+};
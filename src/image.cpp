@@ -4,7 +4,10 @@
 #define TINYEXR_USE_MINIZ 1
 #define TINYEXR_IMPLEMENTATION
 #include "3rdparty/tinyexr.h"
+#include "film.h"
 #include "flexception.h"
+#include "parallel.h"
+#include "profiler.h"
 #include <algorithm>
 #include <fstream>
 
@@ -25,6 +28,98 @@ inline bool ends_with(const string &str, const string &suffix) {
     return true;
 }
 
+/// Reads the R, G, B channels of a layer of an EXR file (the channels "<layer>.R" etc.,
+/// or "R", "G", "B" if layer is empty). If the file only has one channel, we read it as gray.
+/// tinyexr's LoadEXR() strips the layer names and takes the first channels it finds,
+/// so it mixes up the channels of the files with multiple layers (see ImageLayer).
+Image3 read_exr(const fs::path &filename, const std::string &layer) {
+    EXRVersion exr_version;
+    if (ParseEXRVersionFromFile(&exr_version, filename.string().c_str()) != TINYEXR_SUCCESS ||
+            exr_version.multipart || exr_version.non_image) {
+        Error(std::string("Failure when loading image: ") + filename.string());
+    }
+    EXRHeader header;
+    InitEXRHeader(&header);
+    const char* err = nullptr;
+    int ret = ParseEXRHeaderFromFile(&header, &exr_version, filename.string().c_str(), &err);
+    EXRImage exr_image;
+    InitEXRImage(&exr_image);
+    if (ret == TINYEXR_SUCCESS) {
+        // Read the half channels as float.
+        for (int i = 0; i < header.num_channels; i++) {
+            if (header.pixel_types[i] == TINYEXR_PIXELTYPE_HALF) {
+                header.requested_pixel_types[i] = TINYEXR_PIXELTYPE_FLOAT;
+            }
+        }
+        ret = LoadEXRImageFromFile(&exr_image, &header, filename.string().c_str(), &err);
+    }
+    if (ret != TINYEXR_SUCCESS) {
+        std::cerr << "OpenEXR error: " << err << std::endl;
+        FreeEXRErrorMessage(err);
+        FreeEXRHeader(&header);
+        Error(std::string("Failure when loading image: ") + filename.string());
+    }
+
+    std::string prefix = layer.empty() ? "" : layer + ".";
+    int channel_ids[3] = {-1, -1, -1};
+    const char *rgb[] = {"R", "G", "B"};
+    for (int c = 0; c < 3; c++) {
+        for (int i = 0; i < header.num_channels; i++) {
+            if (header.channels[i].name == prefix + rgb[c]) {
+                channel_ids[c] = i;
+            }
+        }
+    }
+    if (header.num_channels == 1) {
+        channel_ids[0] = channel_ids[1] = channel_ids[2] = 0;
+    } else if (layer.empty() && channel_ids[0] == -1) {
+        // No default layer. Same as LoadEXR(): use the first R, G, B channels of any layer.
+        for (int c = 0; c < 3; c++) {
+            for (int i = header.num_channels - 1; i >= 0; i--) {
+                std::string name = header.channels[i].name;
+                if (ends_with(name, std::string(".") + rgb[c])) {
+                    channel_ids[c] = i;
+                }
+            }
+        }
+    }
+    if (channel_ids[0] == -1 || channel_ids[1] == -1 || channel_ids[2] == -1) {
+        FreeEXRHeader(&header);
+        FreeEXRImage(&exr_image);
+        Error(std::string("Layer \"") + layer + "\" not found in image: " + filename.string());
+    }
+
+    Image3 img(exr_image.width, exr_image.height);
+    auto copy_channels = [&](unsigned char **images, int src_id, int x, int y) {
+        for (int c = 0; c < 3; c++) {
+            img(x, y)[c] = reinterpret_cast<float **>(images)[channel_ids[c]][src_id];
+        }
+    };
+    if (header.tiled) {
+        for (int t = 0; t < exr_image.num_tiles; t++) {
+            const EXRTile &tile = exr_image.tiles[t];
+            for (int j = 0; j < header.tile_size_y; j++) {
+                for (int i = 0; i < header.tile_size_x; i++) {
+                    int x = tile.offset_x * header.tile_size_x + i;
+                    int y = tile.offset_y * header.tile_size_y + j;
+                    if (x < img.width && y < img.height) {
+                        copy_channels(tile.images, j * header.tile_size_x + i, x, y);
+                    }
+                }
+            }
+        }
+    } else {
+        for (int y = 0; y < img.height; y++) {
+            for (int x = 0; x < img.width; x++) {
+                copy_channels(exr_image.images, y * img.width + x, x, y);
+            }
+        }
+    }
+    FreeEXRHeader(&header);
+    FreeEXRImage(&exr_image);
+    return img;
+}
+
 Image1 imread1(const fs::path &filename) {
     Image1 img;
     std::string extension = to_lowercase(filename.extension().string());
@@ -52,32 +147,14 @@ Image1 imread1(const fs::path &filename) {
         }
         stbi_image_free(data);
     } else if (extension == ".exr") {
-        float* data = nullptr;
-        int width;
-        int height;
-        const char* err = nullptr;
-#ifdef _WINDOWS
-        int ret = LoadEXR(&data, &width, &height, filename.string().c_str(), &err);
-#else
-        int ret = LoadEXR(&data, &width, &height, filename.c_str(), &err);
-#endif
-        if (ret != TINYEXR_SUCCESS) {
-            std::cerr << "OpenEXR error: " << err << std::endl;
-            FreeEXRErrorMessage(err);
-            Error(std::string("Failure when loading image: ") + filename.string());
-        }
-        img = Image1(width, height);
-        for (int i = 0; i < width * height; i++) {
-            img(i) = (data[4 * i] + data[4 * i + 1] + data[4 * i + 2]) / 3;
-        }
-        free(data);
+        img = to_image1(read_exr(filename, ""));
     } else {
         Error(std::string("Unsupported image format: ") + filename.string());
     }
     return img;
 }
 
-Image3 imread3(const fs::path &filename) {
+Image3 imread3(const fs::path &filename, const std::string &layer) {
     Image3 img;
     std::string extension = to_lowercase(filename.extension().string());
     // JPG, PNG, TGA, BMP, PSD, GIF, HDR, PIC
@@ -89,6 +166,9 @@ Image3 imread3(const fs::path &filename) {
           extension == ".gif" ||
           extension == ".hdr" ||
           extension == ".pic") {
+        if (!layer.empty()) {
+            Error(std::string("Only EXR images have layers: ") + filename.string());
+        }
         int w, h, n;
 #ifdef _WINDOWS
         float* data = stbi_loadf(filename.string().c_str(), &w, &h, &n, 3);
@@ -107,32 +187,239 @@ Image3 imread3(const fs::path &filename) {
         }
         stbi_image_free(data);
     } else if (extension == ".exr") {
-        float* data = nullptr;
-        int width;
-        int height;
-        const char* err = nullptr;
-#ifdef _WINDOWS
-        int ret = LoadEXR(&data, &width, &height, filename.string().c_str(), &err);
-#else
-        int ret = LoadEXR(&data, &width, &height, filename.c_str(), &err);
-#endif
-        if (ret != TINYEXR_SUCCESS) {
-            std::cerr << "OpenEXR error: " << err << std::endl;
-            FreeEXRErrorMessage(err);
-            Error(std::string("Failure when loading image: ") + filename.string());
-        }
-        img = Image3(width, height);
-        for (int i = 0; i < width * height; i++) {
-            img(i) = Vector3{data[4 * i], data[4 * i + 1], data[4 * i + 2]};
-        }
-        free(data);
+        img = read_exr(filename, layer);
     } else {
         Error(std::string("Unsupported image format: ") + filename.string());
     }
     return img;
 }
 
-void imwrite(const fs::path &filename, const Image3 &image) {
+TiledEXRWriter::TiledEXRWriter(const fs::path &filename,
+                               const Image3 &image,
+                               const std::vector<ImageLayer> &layers,
+                               const EXROptions &options) :
+        filename(filename), width(image.width), height(image.height), options(options) {
+    const char *rgb[] = {"R", "G", "B"};
+    for (int c = 0; c < 3; c++) {
+        channels.push_back(Channel{rgb[c], &image, nullptr, c, options.pixel_type});
+    }
+    open(layers);
+}
+
+TiledEXRWriter::TiledEXRWriter(const fs::path &filename,
+                               const Film &film,
+                               const std::vector<ImageLayer> &layers,
+                               const EXROptions &options) :
+        filename(filename), width(film.width), height(film.height), options(options) {
+    const char *rgb[] = {"R", "G", "B"};
+    for (int c = 0; c < 3; c++) {
+        channels.push_back(Channel{rgb[c], nullptr, &film, c, options.pixel_type});
+    }
+    open(layers);
+}
+
+/// The channels of the image and the layers in an EXR file. OpenEXR wants the channels
+/// sorted by their names, so the RGB of the image become B, G, R,
+/// and the RGB of a layer "foo" become foo.B, foo.G, foo.R.
+void TiledEXRWriter::open(const std::vector<ImageLayer> &layers) {
+    const char *rgb[] = {"R", "G", "B"};
+    for (int i = 0; i < (int)layers.size(); i++) {
+        const ImageLayer &layer = layers[i];
+        if (layer.image.width != width || layer.image.height != height) {
+            Error(std::string("The size of layer ") + layer.name + " doesn't match the image.");
+        }
+        for (int j = 0; j < i; j++) {
+            if (layer.name == layers[j].name) {
+                Error(std::string("Duplicated layer name: ") + layer.name);
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            channels.push_back(Channel{layer.name + "." + rgb[c], &layer.image, nullptr, c, layer.pixel_type});
+        }
+    }
+    std::sort(channels.begin(), channels.end(),
+        [](const Channel &a, const Channel &b) { return a.name < b.name; });
+
+    int tile_size = options.tile_size;
+    num_tiles_x = (width + tile_size - 1) / tile_size;
+    num_tiles_y = (height + tile_size - 1) / tile_size;
+    pixels_left = std::vector<std::atomic<int>>(num_tiles_x * num_tiles_y);
+    for (int ty = 0; ty < num_tiles_y; ty++) {
+        for (int tx = 0; tx < num_tiles_x; tx++) {
+            int tile_w = min(tile_size, width - tx * tile_size);
+            int tile_h = min(tile_size, height - ty * tile_size);
+            pixels_left[ty * num_tiles_x + tx].store(tile_w * tile_h, std::memory_order_relaxed);
+        }
+    }
+    tile_offsets.resize(num_tiles_x * num_tiles_y, 0);
+
+    // The header, following SaveEXRNPartImageToMemory() of tinyexr.
+    vector<unsigned char> header = {0x76, 0x2f, 0x31, 0x01};
+    bool long_names = false;
+    vector<tinyexr::ChannelInfo> channel_infos;
+    for (const Channel &channel : channels) {
+        tinyexr::ChannelInfo info;
+        info.name = channel.name;
+        info.pixel_type = info.requested_pixel_type = channel.pixel_type == EXRPixelType::Half ?
+            TINYEXR_PIXELTYPE_HALF : TINYEXR_PIXELTYPE_FLOAT;
+        info.x_sampling = info.y_sampling = 1;
+        info.p_linear = 0;
+        channel_infos.push_back(info);
+        long_names = long_names || channel.name.size() > 31;
+    }
+    // Version 2, tiled (0x200), and maybe long names (0x400).
+    vector<unsigned char> version = {2, (unsigned char)(long_names ? 0x6 : 0x2), 0, 0};
+    header.insert(header.end(), version.begin(), version.end());
+    vector<unsigned char> channel_data;
+    tinyexr::WriteChannelInfo(channel_data, channel_infos);
+    tinyexr::WriteAttributeToMemory(&header, "channels", "chlist",
+        channel_data.data(), (int)channel_data.size());
+    unsigned char compression = options.compression == EXRCompression::ZIP ? TINYEXR_COMPRESSIONTYPE_ZIP :
+        options.compression == EXRCompression::PIZ ? TINYEXR_COMPRESSIONTYPE_PIZ : TINYEXR_COMPRESSIONTYPE_NONE;
+    tinyexr::WriteAttributeToMemory(&header, "compression", "compression", &compression, 1);
+    int window[4] = {0, 0, width - 1, height - 1};
+    tinyexr::WriteAttributeToMemory(&header, "dataWindow", "box2i",
+        reinterpret_cast<const unsigned char *>(window), sizeof(window));
+    tinyexr::WriteAttributeToMemory(&header, "displayWindow", "box2i",
+        reinterpret_cast<const unsigned char *>(window), sizeof(window));
+    // Our tiles come in whatever order the threads finish them, which is RANDOM_Y in OpenEXR's terms.
+    // But tinyexr reads any line order other than INCREASING_Y bottom-up, and the readers
+    // find the tiles through the offset table anyway, so we claim INCREASING_Y.
+    unsigned char line_order = 0;
+    tinyexr::WriteAttributeToMemory(&header, "lineOrder", "lineOrder", &line_order, 1);
+    float aspect_ratio = 1;
+    tinyexr::WriteAttributeToMemory(&header, "pixelAspectRatio", "float",
+        reinterpret_cast<const unsigned char *>(&aspect_ratio), sizeof(float));
+    float center[2] = {0, 0};
+    tinyexr::WriteAttributeToMemory(&header, "screenWindowCenter", "v2f",
+        reinterpret_cast<const unsigned char *>(center), sizeof(center));
+    float window_width = 1;
+    tinyexr::WriteAttributeToMemory(&header, "screenWindowWidth", "float",
+        reinterpret_cast<const unsigned char *>(&window_width), sizeof(float));
+    // Tile width & height, then one level, rounding down.
+    unsigned char tiles[9] = {0};
+    memcpy(tiles, &tile_size, sizeof(int));
+    memcpy(tiles + 4, &tile_size, sizeof(int));
+    tinyexr::WriteAttributeToMemory(&header, "tiles", "tiledesc", tiles, sizeof(tiles));
+    header.push_back(0);
+
+    file.open(filename, std::ios::binary);
+    if (!file) {
+        Error(std::string("Failure when writing image: ") + filename.string());
+    }
+    file.write(reinterpret_cast<const char *>(header.data()), header.size());
+    // We fill in the offsets in finish().
+    offset_table_position = header.size();
+    file.write(reinterpret_cast<const char *>(tile_offsets.data()), tile_offsets.size() * sizeof(uint64_t));
+    file_size = offset_table_position + tile_offsets.size() * sizeof(uint64_t);
+}
+
+void TiledEXRWriter::add_pixels(int x0, int y0, int x1, int y1) {
+    int tile_size = options.tile_size;
+    // The region can cover several tiles, or a part of one.
+    for (int ty = y0 / tile_size; ty * tile_size < y1; ty++) {
+        for (int tx = x0 / tile_size; tx * tile_size < x1; tx++) {
+            int n = (min(x1, (tx + 1) * tile_size) - max(x0, tx * tile_size)) *
+                    (min(y1, (ty + 1) * tile_size) - max(y0, ty * tile_size));
+            int tile_id = ty * num_tiles_x + tx;
+            if (n > 0 && pixels_left[tile_id].fetch_sub(n, std::memory_order_acq_rel) == n) {
+                write_tile(tile_id);
+            }
+        }
+    }
+}
+
+/// A tile is a sequence of scanlines, and each scanline stores the channels one after another.
+void TiledEXRWriter::write_tile(int tile_id) {
+    ProfileScope profile(ProfilePhase::FilmWrite);
+    int tile_size = options.tile_size;
+    int tx = tile_id % num_tiles_x, ty = tile_id / num_tiles_x;
+    int x0 = tx * tile_size, y0 = ty * tile_size;
+    int tile_w = min(tile_size, width - x0);
+    int tile_h = min(tile_size, height - y0);
+
+    vector<unsigned char> raw;
+    for (int y = y0; y < y0 + tile_h; y++) {
+        for (const Channel &channel : channels) {
+            for (int x = x0; x < x0 + tile_w; x++) {
+                tinyexr::FP32 f;
+                f.f = float(channel.image != nullptr ?
+                    (*channel.image)(x, y)[channel.c] : channel.film->mean(x, y)[channel.c]);
+                if (channel.pixel_type == EXRPixelType::Half) {
+                    unsigned short h = tinyexr::float_to_half_full(f).u;
+                    raw.insert(raw.end(), reinterpret_cast<unsigned char *>(&h),
+                                          reinterpret_cast<unsigned char *>(&h) + sizeof(h));
+                } else {
+                    raw.insert(raw.end(), reinterpret_cast<unsigned char *>(&f.f),
+                                          reinterpret_cast<unsigned char *>(&f.f) + sizeof(float));
+                }
+            }
+        }
+    }
+
+    // The chunk: the tile coordinates, the level (always 0), the data size, and the data.
+    // Both compressors store the raw data if it doesn't get smaller.
+    vector<unsigned char> chunk(5 * sizeof(int));
+    int data_size = (int)raw.size();
+    if (options.compression == EXRCompression::ZIP) {
+        chunk.resize(chunk.size() + mz_compressBound(raw.size()));
+        tinyexr::tinyexr_uint64 compressed_size = 0;
+        tinyexr::CompressZip(chunk.data() + 5 * sizeof(int), compressed_size, raw.data(), raw.size());
+        data_size = (int)compressed_size;
+    } else if (options.compression == EXRCompression::PIZ) {
+        // Same bound as tinyexr.
+        chunk.resize(chunk.size() + 8192 + 2 * raw.size());
+        vector<tinyexr::ChannelInfo> channel_infos(channels.size());
+        for (int i = 0; i < (int)channels.size(); i++) {
+            channel_infos[i].requested_pixel_type = channels[i].pixel_type == EXRPixelType::Half ?
+                TINYEXR_PIXELTYPE_HALF : TINYEXR_PIXELTYPE_FLOAT;
+        }
+        unsigned int compressed_size = (unsigned int)(chunk.size() - 5 * sizeof(int));
+        tinyexr::CompressPiz(chunk.data() + 5 * sizeof(int), &compressed_size, raw.data(), raw.size(),
+                             channel_infos, tile_w, tile_h);
+        data_size = (int)compressed_size;
+    } else {
+        chunk.insert(chunk.end(), raw.begin(), raw.end());
+    }
+    chunk.resize(5 * sizeof(int) + data_size);
+    int chunk_header[5] = {tx, ty, 0, 0, data_size};
+    memcpy(chunk.data(), chunk_header, sizeof(chunk_header));
+
+    std::lock_guard<std::mutex> lock(file_mutex);
+    tile_offsets[tile_id] = file_size;
+    file.write(reinterpret_cast<const char *>(chunk.data()), chunk.size());
+    file_size += chunk.size();
+}
+
+void TiledEXRWriter::finish() {
+    vector<int> tiles_left;
+    for (int i = 0; i < (int)tile_offsets.size(); i++) {
+        if (tile_offsets[i] == 0) {
+            tiles_left.push_back(i);
+        }
+    }
+    parallel_for([&](int64_t i) {
+        write_tile(tiles_left[i]);
+    }, tiles_left.size(), 1);
+    file.seekp(offset_table_position);
+    file.write(reinterpret_cast<const char *>(tile_offsets.data()), tile_offsets.size() * sizeof(uint64_t));
+    file.close();
+    if (file.fail()) {
+        Error(std::string("Failure when writing image: ") + filename.string());
+    }
+}
+
+void imwrite(const fs::path &filename,
+             const Image3 &image,
+             const std::vector<ImageLayer> &layers,
+             const EXROptions &exr_options) {
+    for (int i = 0; i < (int)layers.size(); i++) {
+        for (int j = 0; j < i; j++) {
+            if (layers[i].name == layers[j].name) {
+                Error(std::string("Duplicated layer name: ") + layers[i].name);
+            }
+        }
+    }
 #ifdef _WINDOWS
     if (ends_with(filename.string(), ".pfm")) {
 #else
@@ -147,27 +434,23 @@ void imwrite(const fs::path &filename, const Image3 &image) {
         std::transform(image.data.cbegin(), image.data.cend(), data.begin(),
             [] (const Vector3 &v) {return Vector3f(v.x, v.y, v.z);});
         ofs.write((const char *)data.data(), data.size() * sizeof(Vector3f));
+        for (const ImageLayer &layer : layers) {
+            fs::path layer_filename = filename;
+            layer_filename.replace_filename(
+                filename.stem().string() + "_" + layer.name + filename.extension().string());
+            imwrite(layer_filename, layer.image);
+        }
 #ifdef _WINDOWS
     } else if (ends_with(filename.string(), ".exr")) {
 #else
     } else if (ends_with(filename, ".exr")) {
 #endif
-        // Convert image to float
-        vector<Vector3f> data(image.data.size());
-        std::transform(image.data.cbegin(), image.data.cend(), data.begin(),
-            [] (const Vector3 &v) {return Vector3f(v.x, v.y, v.z);});
-        const char* err = nullptr;
-#ifdef _WINDOWS
-        int ret = SaveEXR((float*)data.data(),
-            image.width, image.height, 3, 1 /* write as fp16 */, filename.string().c_str(), &err);
-#else
-        int ret = SaveEXR((float*)data.data(),
-            image.width, image.height, 3, 1 /* write as fp16 */, filename.c_str(), &err);
-#endif
-        if (ret != TINYEXR_SUCCESS) {
-            std::cerr << "OpenEXR error: " << err << std::endl;
-            FreeEXRErrorMessage(err);
-            Error(std::string("Failure when writing image: ") + filename.string());
+        EXROptions options = exr_options;
+        // Same as SaveEXR() of tinyexr: no compression for tiny images.
+        if (image.width < 16 && image.height < 16) {
+            options.compression = EXRCompression::None;
         }
+        TiledEXRWriter writer(filename, image, layers, options);
+        writer.finish();
     }
 }
@@ -2,8 +2,11 @@
 
 #include "vector.h"
 
+#include <atomic>
+#include <fstream>
+#include <mutex>
 #include <string>
-#include <cstring>
+#include <type_traits>
 #include <vector>
 
 /// A N-channel image stored in a contiguous vector
@@ -13,8 +16,12 @@ template<typename T>
 struct Image {
     Image() {}
     Image(int w, int h) : width(w), height(h) {
-        data.resize(w * h);
-        memset(data.data(), 0, sizeof(T) * data.size());
+        // Our vectors don't initialize their members, so we zero the pixels explicitly.
+        if constexpr (std::is_arithmetic_v<T>) {
+            data.resize(w * h, T(0));
+        } else {
+            data.resize(w * h, T(0, 0, 0));
+        }
     }
 
     T &operator()(int x) {
@@ -41,6 +48,135 @@ struct Image {
 using Image1 = Image<Real>;
 using Image3 = Image<Vector3>;
 
+/// An RGB image where multiple threads can add to any pixel at the same time
+/// (e.g., the light tracing splats of bidirectional path tracing, or the photons of SPPM).
+struct SplatImage {
+    SplatImage(int width, int height)
+        : width(width), height(height), data(3 * width * height) {
+        for (std::atomic<Real> &d : data) {
+            d.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void add(int x, int y, const Vector3 &value) {
+        for (int c = 0; c < 3; c++) {
+            std::atomic<Real> &d = data[3 * (y * width + x) + c];
+            Real old = d.load(std::memory_order_relaxed);
+            while (!d.compare_exchange_weak(old, old + value[c], std::memory_order_relaxed)) {
+            }
+        }
+    }
+
+    /// Not thread-safe.
+    void clear(int x, int y) {
+        for (int c = 0; c < 3; c++) {
+            data[3 * (y * width + x) + c].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    Vector3 operator()(int x, int y) const {
+        int i = 3 * (y * width + x);
+        return Vector3{data[i].load(std::memory_order_relaxed),
+                        data[i + 1].load(std::memory_order_relaxed),
+                        data[i + 2].load(std::memory_order_relaxed)};
+    }
+
+    int width, height;
+    std::vector<std::atomic<Real>> data;
+};
+
+/// The pixel type of the channels of the EXR files we write: 16-bit (half) or 32-bit floats.
+/// Half floats are plenty for colors, but they only have 11 bits of precision,
+/// so, e.g., the depths, positions, and IDs need floats.
+enum class EXRPixelType {
+    Half,
+    Float
+};
+
+/// PIZ (wavelet + Huffman coding) usually compresses noisy renderings better than ZIP,
+/// but it is lossless only for the bits we store (i.e., it doesn't make half floats more precise).
+enum class EXRCompression {
+    None,
+    ZIP,
+    PIZ
+};
+
+/// How we write the EXR files (the "componentFormat" and "compression" of the film).
+struct EXROptions {
+    // The pixel type of the image itself. The layers have their own (see ImageLayer).
+    EXRPixelType pixel_type = EXRPixelType::Half;
+    EXRCompression compression = EXRCompression::ZIP;
+    // The width and height of the tiles of the file.
+    int tile_size = 64;
+};
+
+/// A named RGB image that we store along with the rendering, e.g., the radiance of a light group.
+/// In an EXR file, it becomes the channels "<name>.R", "<name>.G", "<name>.B".
+struct ImageLayer {
+    std::string name;
+    Image3 image;
+    EXRPixelType pixel_type = EXRPixelType::Half;
+};
+
+struct Film;
+
+/// Writes an image and its layers to a tiled EXR file one tile at a time, so that a renderer can
+/// write the tiles as it finishes them (see path_render()) instead of writing everything at the end.
+/// Whichever thread finishes the last pixel of a tile converts the tile to half/float,
+/// compresses it, and appends it to the file. So the compression runs in parallel,
+/// and we never need more than a tile of extra memory per thread (instead of a float copy
+/// of the whole image). The tiles go to the file in the order they finish,
+/// and we fill in the table of their offsets at the end.
+/// The writer reads the pixels from the images, so they have to outlive the writer
+/// and keep their sizes.
+struct TiledEXRWriter {
+    TiledEXRWriter(const fs::path &filename,
+                   const Image3 &image,
+                   const std::vector<ImageLayer> &layers,
+                   const EXROptions &options = EXROptions{});
+    /// Same as above, but the image is the means of the pixels of a film (see film.h).
+    TiledEXRWriter(const fs::path &filename,
+                   const Film &film,
+                   const std::vector<ImageLayer> &layers,
+                   const EXROptions &options = EXROptions{});
+
+    /// Tells the writer that the pixels in [x0, x1) x [y0, y1) are final. Thread-safe.
+    void add_pixels(int x0, int y0, int x1, int y1);
+
+    /// Writes the tiles we haven't written yet (in parallel, see parallel.h)
+    /// and the tile offsets, then closes the file.
+    void finish();
+
+    struct Channel {
+        std::string name;
+        // Either image or film is set.
+        const Image3 *image;
+        const Film *film;
+        int c;
+        EXRPixelType pixel_type;
+    };
+
+    /// Adds the channels of the layers and writes the header.
+    void open(const std::vector<ImageLayer> &layers);
+    void write_tile(int tile_id);
+
+    fs::path filename;
+    int width, height;
+    EXROptions options;
+    // Sorted by name, as OpenEXR wants.
+    std::vector<Channel> channels;
+    int num_tiles_x, num_tiles_y;
+    // The number of pixels of each tile that are not final yet.
+    std::vector<std::atomic<int>> pixels_left;
+    // Where each tile starts in the file (0 if we haven't written it yet).
+    std::vector<uint64_t> tile_offsets;
+    uint64_t offset_table_position;
+    // The file, its size, and tile_offsets are protected by file_mutex.
+    std::ofstream file;
+    uint64_t file_size;
+    std::mutex file_mutex;
+};
+
 /// Read from an 1 channel image. If the image is not actually
 /// single channel, the first channel is used.
 /// Supported formats: JPG, PNG, TGA, BMP, PSD, GIF, HDR, PIC
@@ -50,11 +186,18 @@ Image1 imread1(const fs::path &filename);
 /// If the image has more than 3 channels, we truncate it to 3.
 /// Undefined behavior if the image has 2 channels (does that even happen?)
 /// Supported formats: JPG, PNG, TGA, BMP, PSD, GIF, HDR, PIC
-Image3 imread3(const fs::path &filename);
+/// For EXR, we can also read one of the extra layers written by imwrite() (see ImageLayer).
+Image3 imread3(const fs::path &filename, const std::string &layer = "");
 
 /// Save an image to a file.
 /// Supported formats: PFM & exr
-void imwrite(const fs::path &filename, const Image3 &image);
+/// The extra layers go into the same file for EXR. PFM only stores one image,
+/// so we write each layer to "<filename without extension>_<layer name>.pfm".
+/// We write the EXR files with TiledEXRWriter, so the tiles are compressed in parallel.
+void imwrite(const fs::path &filename,
+             const Image3 &image,
+             const std::vector<ImageLayer> &layers = {},
+             const EXROptions &exr_options = EXROptions{});
 
 inline Image3 to_image3(const Image1 &img) {
     Image3 out(img.width, img.height);
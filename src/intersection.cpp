@@ -1,12 +1,25 @@
 #include "intersection.h"
 #include "material.h"
+#include "profiler.h"
 #include "ray.h"
 #include "scene.h"
+#include "stats.h"
 #include <embree4/rtcore.h>
 
+uint64_t num_traced_rays() {
+    return get_stat(Stat::IntersectionQueries) + get_stat(Stat::ShadowQueries);
+}
+
+uint64_t num_traced_rays_of_thread() {
+    const ThreadStats &stats = thread_stats();
+    return stats.counts[int(Stat::IntersectionQueries)].load(std::memory_order_relaxed) +
+           stats.counts[int(Stat::ShadowQueries)].load(std::memory_order_relaxed);
+}
+
 std::optional<PathVertex> intersect(const Scene &scene,
                                     const Ray &ray,
                                     const RayDifferential &ray_diff) {
+    ProfileScope profile(ProfilePhase::Intersect);
     RTCIntersectArguments rtc_args;
     rtcInitIntersectArguments(&rtc_args);
     RTCRayHit rtc_rayhit;
@@ -30,6 +43,7 @@ std::optional<PathVertex> intersect(const Scene &scene,
         {RTC_INVALID_GEOMETRY_ID} // instance IDs
     };
     rtcIntersect1(scene.embree_scene, &rtc_rayhit, &rtc_args);
+    count_stat_always(Stat::IntersectionQueries);
     if (rtc_hit.geomID == RTC_INVALID_GEOMETRY_ID) {
         return {};
     };
@@ -47,6 +61,7 @@ std::optional<PathVertex> intersect(const Scene &scene,
     vertex.exterior_medium_id = get_exterior_medium_id(shape);
     vertex.st = Vector2{rtc_hit.u, rtc_hit.v};
 
+    ProfileScope profile_shading(ProfilePhase::ShadingInfo);
     ShadingInfo shading_info = compute_shading_info(scene.shapes[vertex.shape_id], vertex);
     vertex.shading_frame = shading_info.shading_frame;
     vertex.uv = shading_info.uv;
@@ -65,6 +80,7 @@ std::optional<PathVertex> intersect(const Scene &scene,
 }
 
 bool occluded(const Scene &scene, const Ray &ray) {
+    ProfileScope profile(ProfilePhase::ShadowRay);
     RTCOccludedArguments rtc_args;
     rtcInitOccludedArguments(&rtc_args);
     RTCRay rtc_ray;
@@ -79,11 +95,50 @@ bool occluded(const Scene &scene, const Ray &ray) {
     rtc_ray.mask = (unsigned int)(-1);
     rtc_ray.time = 0.f;
     rtc_ray.flags = 0;
-    // TODO: switch to rtcOccluded16
     rtcOccluded1(scene.embree_scene, &rtc_ray, &rtc_args);
+    count_stat_always(Stat::ShadowQueries);
     return rtc_ray.tfar < 0;
 }
 
+void occluded(const Scene &scene, const Ray *rays, int num_rays, bool *results) {
+    if (num_rays == 1) {
+        // Don't bother with the packet.
+        results[0] = occluded(scene, rays[0]);
+        return;
+    }
+    ProfileScope profile(ProfilePhase::ShadowRay);
+    RTCOccludedArguments rtc_args;
+    rtcInitOccludedArguments(&rtc_args);
+    for (int start = 0; start < num_rays; start += 16) {
+        int count = min(num_rays - start, 16);
+        // Embree requires the packet and the valid mask to be aligned to 64 bytes.
+        alignas(64) int valid[16];
+        RTCRay16 rtc_rays;
+        for (int i = 0; i < 16; i++) {
+            // Fill the unused lanes with the first ray -- they are masked out anyway.
+            const Ray &ray = rays[start + (i < count ? i : 0)];
+            valid[i] = i < count ? -1 : 0;
+            rtc_rays.org_x[i] = (float)ray.org[0];
+            rtc_rays.org_y[i] = (float)ray.org[1];
+            rtc_rays.org_z[i] = (float)ray.org[2];
+            rtc_rays.dir_x[i] = (float)ray.dir[0];
+            rtc_rays.dir_y[i] = (float)ray.dir[1];
+            rtc_rays.dir_z[i] = (float)ray.dir[2];
+            rtc_rays.tnear[i] = (float)ray.tnear;
+            rtc_rays.tfar[i] = (float)ray.tfar;
+            rtc_rays.mask[i] = (unsigned int)(-1);
+            rtc_rays.time[i] = 0.f;
+            rtc_rays.flags[i] = 0;
+            rtc_rays.id[i] = i;
+        }
+        rtcOccluded16(valid, scene.embree_scene, &rtc_rays, &rtc_args);
+        count_stat_always(Stat::ShadowQueries, count);
+        for (int i = 0; i < count; i++) {
+            results[start + i] = rtc_rays.tfar[i] < 0;
+        }
+    }
+}
+
 Spectrum emission(const PathVertex &v,
                   const Vector3 &view_dir,
                   const Scene &scene) {
@@ -93,6 +148,6 @@ Spectrum emission(const PathVertex &v,
     return emission(light,
                     view_dir,
                     v.uv_screen_size,
-                    PointAndNormal{v.position, v.geometric_normal},
+                    PointAndNormal{v.position, v.geometric_normal, v.primitive_id},
                     scene);
 }
@@ -43,6 +43,22 @@ std::optional<PathVertex> intersect(const Scene &scene,
 /// Test is a ray segment intersect with anything in a scene.
 bool occluded(const Scene &scene, const Ray &ray);
 
+/// Test a batch of ray segments for occlusion. results[i] is set to
+/// true if rays[i] is occluded. The rays are traced in packets of 16,
+/// which is faster than tracing them one by one when they are coherent
+/// (e.g., multiple shadow rays from the same point).
+void occluded(const Scene &scene, const Ray *rays, int num_rays, bool *results);
+
+/// The number of rays all the threads have traced so far with intersect() and occluded(),
+/// i.e., the intersection and shadow queries of stats.h.
+/// Only for reporting the throughput (see ProgressReporter): a thread's count can lag
+/// a bit behind.
+uint64_t num_traced_rays();
+
+/// The number of rays the calling thread has traced so far, exactly
+/// (e.g., for the ray count AOV, see aov.h).
+uint64_t num_traced_rays_of_thread();
+
 /// Computes the emission at a path vertex v, with the viewing direction
 /// pointing outwards of the intersection.
 Spectrum emission(const PathVertex &v,
@@ -20,7 +20,12 @@
 // numerical accuracy as much when we render.
 // Switching to floating point computation is easy --
 // just set Real = float.
+// (Or configure with the lajolla_f32 targets in CMake, which define LAJOLLA_USE_FLOAT.)
+#ifdef LAJOLLA_USE_FLOAT
+using Real = float;
+#else
 using Real = double;
+#endif
 
 // Lots of PIs!
 const Real c_PI = Real(3.14159265358979323846);
@@ -1,4 +1,8 @@
 #include "light.h"
+#include "equal_area.h"
+#include "frame.h"
+#include "parallel.h"
+#include "profiler.h"
 #include "scene.h"
 #include "spectrum.h"
 #include "transform.h"
@@ -6,15 +10,35 @@
 struct light_power_op {
     Real operator()(const DiffuseAreaLight &light) const;
     Real operator()(const Envmap &light) const;
+    Real operator()(const PointLight &light) const;
+    Real operator()(const SpotLight &light) const;
+    Real operator()(const DirectionalLight &light) const;
 
     const Scene &scene;
 };
 
+/// For the infinitely far lights (envmaps and directional lights), the rays leaving
+/// the light are parallel. We pick the origins uniformly on a disk perpendicular
+/// to the direction (pointing towards the scene) that covers the bounding sphere of the scene,
+/// placed just outside of the sphere.
+inline Vector3 sample_disk_behind_scene(const Vector3 &dir,
+                                        const Vector2 &rnd_param_uv,
+                                        const Scene &scene) {
+    auto [e1, e2] = coordinate_system(dir);
+    Real r = scene.bounds.radius * sqrt(rnd_param_uv[0]);
+    Real phi = 2 * c_PI * rnd_param_uv[1];
+    return scene.bounds.center + r * cos(phi) * e1 + r * sin(phi) * e2 - scene.bounds.radius * dir;
+}
+
 struct sample_point_on_light_op {
     PointAndNormal operator()(const DiffuseAreaLight &light) const;
     PointAndNormal operator()(const Envmap &light) const;
+    PointAndNormal operator()(const PointLight &light) const;
+    PointAndNormal operator()(const SpotLight &light) const;
+    PointAndNormal operator()(const DirectionalLight &light) const;
 
     const Vector3 &ref_point;
+    const Vector3 &ref_normal;
     const Vector2 &rnd_param_uv;
     const Real &rnd_param_w;
     const Scene &scene;
@@ -23,15 +47,22 @@ struct sample_point_on_light_op {
 struct pdf_point_on_light_op {
     Real operator()(const DiffuseAreaLight &light) const;
     Real operator()(const Envmap &light) const;
+    Real operator()(const PointLight &light) const;
+    Real operator()(const SpotLight &light) const;
+    Real operator()(const DirectionalLight &light) const;
 
     const PointAndNormal &point_on_light;
     const Vector3 &ref_point;
+    const Vector3 &ref_normal;
     const Scene &scene;
 };
 
 struct emission_op {
     Spectrum operator()(const DiffuseAreaLight &light) const;
     Spectrum operator()(const Envmap &light) const;
+    Spectrum operator()(const PointLight &light) const;
+    Spectrum operator()(const SpotLight &light) const;
+    Spectrum operator()(const DirectionalLight &light) const;
 
     const Vector3 &view_dir;
     const PointAndNormal &point_on_light;
@@ -39,15 +70,46 @@ struct emission_op {
     const Scene &scene;
 };
 
+struct sample_emission_op {
+    std::optional<LightEmissionRecord> operator()(const DiffuseAreaLight &light) const;
+    std::optional<LightEmissionRecord> operator()(const Envmap &light) const;
+    std::optional<LightEmissionRecord> operator()(const PointLight &light) const;
+    std::optional<LightEmissionRecord> operator()(const SpotLight &light) const;
+    std::optional<LightEmissionRecord> operator()(const DirectionalLight &light) const;
+
+    const Vector2 &rnd_param_pos_uv;
+    const Real &rnd_param_pos_w;
+    const Vector2 &rnd_param_dir_uv;
+    const Scene &scene;
+};
+
+struct pdf_emission_op {
+    LightEmissionPdf operator()(const DiffuseAreaLight &light) const;
+    LightEmissionPdf operator()(const Envmap &light) const;
+    LightEmissionPdf operator()(const PointLight &light) const;
+    LightEmissionPdf operator()(const SpotLight &light) const;
+    LightEmissionPdf operator()(const DirectionalLight &light) const;
+
+    const PointAndNormal &point_on_light;
+    const Vector3 &dir;
+    const Scene &scene;
+};
+
 struct init_sampling_dist_op {
     void operator()(DiffuseAreaLight &light) const;
     void operator()(Envmap &light) const;
+    void operator()(PointLight &light) const;
+    void operator()(SpotLight &light) const;
+    void operator()(DirectionalLight &light) const;
 
     const Scene &scene;
 };
 
 #include "lights/diffuse_area_light.inl"
 #include "lights/envmap.inl"
+#include "lights/point_light.inl"
+#include "lights/spot_light.inl"
+#include "lights/directional_light.inl"
 
 Real light_power(const Light &light, const Scene &scene) {
     return std::visit(light_power_op{scene}, light);
@@ -55,17 +117,22 @@ Real light_power(const Light &light, const Scene &scene) {
 
 PointAndNormal sample_point_on_light(const Light &light,
                                      const Vector3 &ref_point,
+                                     const Vector3 &ref_normal,
                                      const Vector2 &rnd_param_uv,
                                      Real rnd_param_w,
                                      const Scene &scene) {
-    return std::visit(sample_point_on_light_op{ref_point, rnd_param_uv, rnd_param_w, scene}, light);
+    ProfileScope profile(ProfilePhase::LightSampling);
+    return std::visit(sample_point_on_light_op{
+        ref_point, ref_normal, rnd_param_uv, rnd_param_w, scene}, light);
 }
 
 Real pdf_point_on_light(const Light &light,
                         const PointAndNormal &point_on_light,
                         const Vector3 &ref_point,
+                        const Vector3 &ref_normal,
                         const Scene &scene) {
-    return std::visit(pdf_point_on_light_op{point_on_light, ref_point, scene}, light);
+    ProfileScope profile(ProfilePhase::LightSampling);
+    return std::visit(pdf_point_on_light_op{point_on_light, ref_point, ref_normal, scene}, light);
 }
 
 Spectrum emission(const Light &light,
@@ -76,6 +143,22 @@ Spectrum emission(const Light &light,
     return std::visit(emission_op{view_dir, point_on_light, view_footprint, scene}, light);
 }
 
+std::optional<LightEmissionRecord> sample_emission(const Light &light,
+                                                   const Vector2 &rnd_param_pos_uv,
+                                                   Real rnd_param_pos_w,
+                                                   const Vector2 &rnd_param_dir_uv,
+                                                   const Scene &scene) {
+    return std::visit(sample_emission_op{
+        rnd_param_pos_uv, rnd_param_pos_w, rnd_param_dir_uv, scene}, light);
+}
+
+LightEmissionPdf pdf_emission(const Light &light,
+                              const PointAndNormal &point_on_light,
+                              const Vector3 &dir,
+                              const Scene &scene) {
+    return std::visit(pdf_emission_op{point_on_light, dir, scene}, light);
+}
+
 void init_sampling_dist(Light &light, const Scene &scene) {
     return std::visit(init_sampling_dist_op{scene}, light);
 }
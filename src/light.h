@@ -7,6 +7,7 @@
 #include "spectrum.h"
 #include "texture.h"
 #include "vector.h"
+#include <optional>
 #include <variant>
 
 struct Scene;
@@ -24,14 +25,44 @@ struct Envmap {
     Texture<Spectrum> values;
     Matrix4x4 to_world, to_local;
     Real scale;
+    // If true, values is an image in the equal-area octahedral
+    // parameterization (see equal_area.h) instead of the lat-long one.
+    bool equal_area = false;
 
     // For sampling a point on the envmap
     TableDist2D sampling_dist;
 };
 
+/// An idealized light source that emits from a single point
+/// equally to all directions. It has zero area, so we can't hit it with
+/// BSDF sampling, and we can only reach it through light sampling.
+struct PointLight {
+    Vector3 position;
+    Spectrum intensity; // radiant intensity (power per unit solid angle)
+};
+
+/// A point light that only emits inside a cone around its local +z axis.
+/// The intensity smoothly falls off from the full intensity at cos_falloff_start
+/// to zero at cos_total_width.
+struct SpotLight {
+    Vector3 position;
+    Matrix4x4 to_world, to_local;
+    Spectrum intensity;
+    Real cos_total_width;
+    Real cos_falloff_start;
+};
+
+/// An infinitely far light source that emits parallel light along a single direction
+/// (e.g., the sun). Like the envmap, it is located at infinity, so we use
+/// the solid angle measure for it.
+struct DirectionalLight {
+    Vector3 direction; // the direction the light travels (from the light to the scene)
+    Spectrum irradiance;
+};
+
 // To add more lights, first create a struct for the light, add it to the variant type below,
 // then implement all the relevant function below with the Light type.
-using Light = std::variant<DiffuseAreaLight, Envmap>;
+using Light = std::variant<DiffuseAreaLight, Envmap, PointLight, SpotLight, DirectionalLight>;
 
 /// Computes the total power the light emit to all positions and directions.
 /// Useful for sampling.
@@ -39,12 +70,15 @@ Real light_power(const Light &light, const Scene &scene);
 
 /// Given some random numbers and a reference point, sample a point on the light source.
 /// If the point is on a surface, returns both the point & normal on it.
-/// If the point is infinitely far away (e.g., on an environment map),
+/// If the point is infinitely far away (e.g., on an environment map or a directional light),
 /// we store the direction that points towards the origin in PointAndNormal.normal.
 /// rnd_param_w is usually used for choosing a discrete element e.g., choosing a triangle in a mesh light.
 /// rnd_param_uv is usually used for picking a point on that element.
+/// ref_normal is the shading normal at the reference point, for lights that can importance sample
+/// the cosine there (a zero vector if there is none, e.g., in a medium).
 PointAndNormal sample_point_on_light(const Light &light,
                                      const Vector3 &ref_point,
+                                     const Vector3 &ref_normal,
                                      const Vector2 &rnd_param_uv,
                                      Real rnd_param_w,
                                      const Scene &scene);
@@ -54,6 +88,7 @@ PointAndNormal sample_point_on_light(const Light &light,
 Real pdf_point_on_light(const Light &light,
                         const PointAndNormal &point_on_light,
                         const Vector3 &ref_point,
+                        const Vector3 &ref_normal,
                         const Scene &scene);
 
 /// Given a viewing direction pointing outwards from the light, and a point on the light,
@@ -66,9 +101,56 @@ Spectrum emission(const Light &light,
                   const PointAndNormal &point_on_light,
                   const Scene &scene);
 
+/// The densities of a ray leaving a light source, for methods that start paths from the lights
+/// (e.g., bidirectional path tracing). The position density is in the area measure
+/// (1 for point & spot lights, which we treat as a discrete probability like pdf_point_on_light),
+/// and the direction density is in the solid angle measure.
+struct LightEmissionPdf {
+    Real pos;
+    Real dir;
+};
+
+struct LightEmissionRecord {
+    PointAndNormal point_on_light;
+    Vector3 dir; // pointing outwards from the light
+    LightEmissionPdf pdf;
+};
+
+/// Sample a point on the light without a reference point, then a direction the light emits towards.
+/// The points on the area lights are sampled uniformly, and the directions are
+/// cosine-weighted. Point lights sample the sphere uniformly, and spot lights the cone of the spot.
+/// For the infinitely far lights (envmaps and directional lights), we sample the direction first,
+/// then a ray origin on a disk that covers the scene's bounding sphere (the position density
+/// is then 1 / (pi * radius^2) in the area measure of that disk).
+std::optional<LightEmissionRecord> sample_emission(const Light &light,
+                                                   const Vector2 &rnd_param_pos_uv,
+                                                   Real rnd_param_pos_w,
+                                                   const Vector2 &rnd_param_dir_uv,
+                                                   const Scene &scene);
+
+/// The densities of sample_emission() producing the point and the direction.
+LightEmissionPdf pdf_emission(const Light &light,
+                              const PointAndNormal &point_on_light,
+                              const Vector3 &dir,
+                              const Scene &scene);
+
 /// Some lights require storing sampling data structures inside. This function initialize them.
 void init_sampling_dist(Light &light, const Scene &scene);
 
 inline bool is_envmap(const Light &light) {
     return std::get_if<Envmap>(&light) != nullptr;
 }
+
+/// Delta lights (point, spot, directional) can only be reached by light sampling:
+/// their "pdf" is a Dirac delta, and we always return 1 from pdf_point_on_light.
+inline bool is_delta_light(const Light &light) {
+    return std::get_if<PointLight>(&light) != nullptr ||
+           std::get_if<SpotLight>(&light) != nullptr ||
+           std::get_if<DirectionalLight>(&light) != nullptr;
+}
+
+/// Lights that are infinitely far away. For these we store the direction
+/// in PointAndNormal.normal and integrate in the solid angle measure.
+inline bool is_infinite_light(const Light &light) {
+    return is_envmap(light) || std::get_if<DirectionalLight>(&light) != nullptr;
+}
@@ -4,12 +4,12 @@ Real light_power_op::operator()(const DiffuseAreaLight &light) const {
 
 PointAndNormal sample_point_on_light_op::operator()(const DiffuseAreaLight &light) const {
     const Shape &shape = scene.shapes[light.shape_id];
-    return sample_point_on_shape(shape, ref_point, rnd_param_uv, rnd_param_w);
+    return sample_point_on_shape(shape, ref_point, ref_normal, rnd_param_uv, rnd_param_w);
 }
 
 Real pdf_point_on_light_op::operator()(const DiffuseAreaLight &light) const {
     return pdf_point_on_shape(
-        scene.shapes[light.shape_id], point_on_light, ref_point);
+        scene.shapes[light.shape_id], point_on_light, ref_point, ref_normal);
 }
 
 Spectrum emission_op::operator()(const DiffuseAreaLight &light) const {
@@ -19,5 +19,25 @@ Spectrum emission_op::operator()(const DiffuseAreaLight &light) const {
     return light.intensity;
 }
 
+std::optional<LightEmissionRecord> sample_emission_op::operator()(const DiffuseAreaLight &light) const {
+    const Shape &shape = scene.shapes[light.shape_id];
+    PointAndNormal point_on_light =
+        sample_point_on_shape_uniform(shape, rnd_param_pos_uv, rnd_param_pos_w);
+    // The light only emits to the side of the normal, and the emitted radiance is constant,
+    // so we importance sample the cosine term.
+    Real phi = c_TWOPI * rnd_param_dir_uv[0];
+    Real tmp = sqrt(std::clamp(1 - rnd_param_dir_uv[1], Real(0), Real(1)));
+    Real cos_theta = sqrt(std::clamp(rnd_param_dir_uv[1], Real(0), Real(1)));
+    Vector3 dir = to_world(Frame(point_on_light.normal),
+                           Vector3{cos(phi) * tmp, sin(phi) * tmp, cos_theta});
+    return LightEmissionRecord{point_on_light, dir,
+        LightEmissionPdf{1 / surface_area(shape), cos_theta / c_PI}};
+}
+
+LightEmissionPdf pdf_emission_op::operator()(const DiffuseAreaLight &light) const {
+    return LightEmissionPdf{1 / surface_area(scene.shapes[light.shape_id]),
+                            max(dot(point_on_light.normal, dir), Real(0)) / c_PI};
+}
+
 void init_sampling_dist_op::operator()(DiffuseAreaLight &light) const {
 }
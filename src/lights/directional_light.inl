@@ -0,0 +1,37 @@
+Real light_power_op::operator()(const DirectionalLight &light) const {
+    // The light covers a disk of the scene's bounding sphere.
+    return luminance(light.irradiance) * c_PI *
+        scene.bounds.radius * scene.bounds.radius;
+}
+
+PointAndNormal sample_point_on_light_op::operator()(const DirectionalLight &light) const {
+    // Like the envmap, we store the direction pointing from the light
+    // towards the scene in PointAndNormal.normal.
+    return PointAndNormal{Vector3{0, 0, 0}, light.direction};
+}
+
+Real pdf_point_on_light_op::operator()(const DirectionalLight &light) const {
+    // Dirac delta in the solid angle measure, see PointLight.
+    return 1;
+}
+
+Spectrum emission_op::operator()(const DirectionalLight &light) const {
+    return light.irradiance;
+}
+
+std::optional<LightEmissionRecord> sample_emission_op::operator()(const DirectionalLight &light) const {
+    // Same as the envmap: the ray starts from a disk that covers the scene,
+    // but the direction is fixed.
+    Real r = scene.bounds.radius;
+    Vector3 origin = sample_disk_behind_scene(light.direction, rnd_param_pos_uv, scene);
+    return LightEmissionRecord{PointAndNormal{origin, light.direction}, light.direction,
+        LightEmissionPdf{1 / (c_PI * r * r), 1 /* Dirac delta */}};
+}
+
+LightEmissionPdf pdf_emission_op::operator()(const DirectionalLight &light) const {
+    Real r = scene.bounds.radius;
+    return LightEmissionPdf{1 / (c_PI * r * r), 1};
+}
+
+void init_sampling_dist_op::operator()(DirectionalLight &light) const {
+}
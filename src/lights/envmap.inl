@@ -1,11 +1,26 @@
+/// Maximum width of the table we use for importance sampling the envmap.
+constexpr int c_max_envmap_sampling_width = 1024;
+
 Real light_power_op::operator()(const Envmap &light) const {
-    return c_PI * scene.bounds.radius * scene.bounds.radius *
+    Real power = c_PI * scene.bounds.radius * scene.bounds.radius *
            light.sampling_dist.total_values /
            (light.sampling_dist.width * light.sampling_dist.height);
+    if (light.equal_area) {
+        // The lat-long table averages L * sin(elevation) over a grid of 2pi^2 steradians,
+        // while the equal-area table averages L over 4pi steradians.
+        // Rescale so that both parameterizations lead to the same light selection probabilities.
+        power *= (4 * c_PI) / (2 * c_PI * c_PI);
+    }
+    return power;
 }
 
 PointAndNormal sample_point_on_light_op::operator()(const Envmap &light) const {
     Vector2 uv = sample(light.sampling_dist, rnd_param_uv);
+    if (light.equal_area) {
+        Vector3 world_dir = normalize(xform_vector(light.to_world,
+            equal_area_square_to_sphere(uv)));
+        return PointAndNormal{Vector3{0, 0, 0}, -world_dir};
+    }
     // Convert uv to spherical coordinates
     Real azimuth = uv[0] * (2 * c_PI);
     Real elevation = uv[1] * c_PI;
@@ -24,6 +39,12 @@ Real pdf_point_on_light_op::operator()(const Envmap &light) const {
     Vector3 world_dir = -point_on_light.normal;
     // Convert the direction to local Catesian coordinates.
     Vector3 local_dir = xform_vector(light.to_local, world_dir);
+    if (light.equal_area) {
+        // All texels have the same solid angle, so the Jacobian
+        // from the unit square to the sphere is just 4pi.
+        Vector2 uv = equal_area_sphere_to_square(normalize(local_dir));
+        return pdf(light.sampling_dist, uv) / (4 * c_PI);
+    }
     // Convert the Cartesian coordinates to the spherical coordinates.
     // We use the convention that y is the up-axis.
     Vector2 uv{atan2(local_dir[0], -local_dir[2]) * c_INVTWOPI,
@@ -47,6 +68,15 @@ Spectrum emission_op::operator()(const Envmap &light) const {
     // so we need to flip view dir.
     // We then transform the direction to the local Cartesian coordinates.
     Vector3 local_dir = xform_vector(light.to_local, -view_dir);
+    if (light.equal_area) {
+        Vector2 uv = equal_area_sphere_to_square(normalize(local_dir));
+        // Like pbrt-v4's image infinite light, we don't prefilter here: the ray spread
+        // grows quickly after a few bounces and blurring the envmap with it
+        // visibly changes the lighting.
+        const Mipmap3 &mipmap = get_img(std::get<ImageTexture<Spectrum>>(light.values),
+                                        scene.texture_pool);
+        return lookup_equal_area(mipmap, uv[0], uv[1], 0) * light.scale;
+    }
     // Convert the Cartesian coordinates to the spherical coordinates.
     Vector2 uv{atan2(local_dir[0], -local_dir[2]) * c_INVTWOPI,
                acos(std::clamp(local_dir[1], Real(-1), Real(1))) * c_INVPI};
@@ -72,15 +102,59 @@ Spectrum emission_op::operator()(const Envmap &light) const {
     return eval(light.values, uv, footprint, scene.texture_pool) * light.scale;
 }
 
+std::optional<LightEmissionRecord> sample_emission_op::operator()(const Envmap &light) const {
+    // We first pick a direction using the same distribution as sample_point_on_light,
+    // then pick a ray origin on a disk perpendicular to the direction
+    // that covers the bounding sphere of the scene.
+    Vector3 ref_point{0, 0, 0};
+    Vector3 ref_normal{0, 0, 0};
+    Real rnd_param_w = 0;
+    PointAndNormal p = sample_point_on_light_op{
+        ref_point, ref_normal, rnd_param_dir_uv, rnd_param_w, scene}(light);
+    Vector3 dir = p.normal; // pointing from the envmap towards the scene
+    Real r = scene.bounds.radius;
+    Vector3 origin = sample_disk_behind_scene(dir, rnd_param_pos_uv, scene);
+    Real pdf_dir = pdf_point_on_light_op{p, ref_point, ref_normal, scene}(light);
+    return LightEmissionRecord{PointAndNormal{origin, dir}, dir,
+        LightEmissionPdf{1 / (c_PI * r * r), pdf_dir}};
+}
+
+LightEmissionPdf pdf_emission_op::operator()(const Envmap &light) const {
+    Real r = scene.bounds.radius;
+    Vector3 ref_point{0, 0, 0};
+    Vector3 ref_normal{0, 0, 0};
+    Real pdf_dir = pdf_point_on_light_op{PointAndNormal{ref_point, dir}, ref_point, ref_normal, scene}(light);
+    return LightEmissionPdf{1 / (c_PI * r * r), pdf_dir};
+}
+
 void init_sampling_dist_op::operator()(Envmap &light) const {
     if (auto *t = std::get_if<ImageTexture<Spectrum>>(&light.values)) {
         // Only need to initialize sampling distribution
         // if the envmap is an image.
         const Mipmap3 &mipmap = get_img(*t, scene.texture_pool);
-        int w = get_width(mipmap), h = get_height(mipmap);
+        // Building the table at full resolution is slow and memory hungry for
+        // large HDRIs, so we pick the finest mipmap level that is not wider
+        // than c_max_envmap_sampling_width. Each texel there is the box-filtered average of
+        // the texels it covers, so the distribution is still non-zero wherever the
+        // envmap is. The sampling is only less sharp -- the pdf below is still exact,
+        // since pdf_point_on_light evaluates the same table.
+        int level = 0;
+        while (level + 1 < (int)mipmap.images.size() &&
+                mipmap.images[level].width > c_max_envmap_sampling_width) {
+            level++;
+        }
+        const Image3 &img = mipmap.images[level];
+        int w = img.width, h = img.height;
         std::vector<Real> f(w * h);
-        int i = 0;
-        for (int y = 0; y < h; y++) {
+        parallel_for([&](int64_t y) {
+            if (light.equal_area) {
+                // Texels of the equal-area map all have the same solid angle,
+                // so there is no sin(elevation) term.
+                for (int x = 0; x < w; x++) {
+                    f[y * w + x] = luminance(img(x, y));
+                }
+                return;
+            }
             // We shift the grids by 0.5 pixels because we are approximating
             // a piecewise bilinear distribution with a piecewise constant
             // distribution. This shifting is necessary to make the sampling
@@ -89,10 +163,9 @@ void init_sampling_dist_op::operator()(Envmap &light) const {
             Real v = (y + Real(0.5)) / Real(h);
             Real sin_elevation = sin(c_PI * v);
             for (int x = 0; x < w; x++) {
-                Real u = (x + Real(0.5)) / Real(w);
-                f[i++] = luminance(lookup(mipmap, u, v, 0)) * sin_elevation;
+                f[y * w + x] = luminance(img(x, y)) * sin_elevation;
             }
-        }
+        }, h, 16);
         light.sampling_dist = make_table_dist_2d(f, w, h);
     }
 }
@@ -0,0 +1,38 @@
+Real light_power_op::operator()(const PointLight &light) const {
+    // A point light emits the same intensity to all directions.
+    return luminance(light.intensity) * c_FOURPI;
+}
+
+PointAndNormal sample_point_on_light_op::operator()(const PointLight &light) const {
+    // There is only one point to sample. We set the normal to face
+    // the reference point, since the light emits equally to all directions.
+    return PointAndNormal{light.position, normalize(ref_point - light.position)};
+}
+
+Real pdf_point_on_light_op::operator()(const PointLight &light) const {
+    // The pdf is a Dirac delta -- we return 1 and let the integrator
+    // treat it as a discrete probability.
+    return 1;
+}
+
+Spectrum emission_op::operator()(const PointLight &light) const {
+    return light.intensity;
+}
+
+std::optional<LightEmissionRecord> sample_emission_op::operator()(const PointLight &light) const {
+    // Uniform sphere sampling
+    Real z = 1 - 2 * rnd_param_dir_uv.x;
+    Real r = sqrt(fmax(Real(0), 1 - z * z));
+    Real phi = 2 * c_PI * rnd_param_dir_uv.y;
+    Vector3 dir{r * cos(phi), r * sin(phi), z};
+    // Like sample_point_on_light, the normal faces the direction we emit to.
+    return LightEmissionRecord{PointAndNormal{light.position, dir}, dir,
+                               LightEmissionPdf{1, c_INVFOURPI}};
+}
+
+LightEmissionPdf pdf_emission_op::operator()(const PointLight &light) const {
+    return LightEmissionPdf{1, c_INVFOURPI};
+}
+
+void init_sampling_dist_op::operator()(PointLight &light) const {
+}
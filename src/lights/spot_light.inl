@@ -0,0 +1,57 @@
+/// Smoothly fall off from 1 at cos_falloff_start to 0 at cos_total_width (see pbrt-v4).
+inline Real spot_light_falloff(const SpotLight &light, Real cos_theta) {
+    if (cos_theta <= light.cos_total_width) {
+        return 0;
+    }
+    if (cos_theta >= light.cos_falloff_start) {
+        return 1;
+    }
+    Real t = (cos_theta - light.cos_total_width) /
+             (light.cos_falloff_start - light.cos_total_width);
+    return t * t * (3 - 2 * t);
+}
+
+Real light_power_op::operator()(const SpotLight &light) const {
+    // Integrate the falloff over the sphere: full intensity inside the inner cone,
+    // and exactly half of the solid angle of the falloff band, since the smoothstep
+    // in cos theta averages to 1/2 over the band.
+    return luminance(light.intensity) * 2 * c_PI *
+        (1 - Real(0.5) * (light.cos_falloff_start + light.cos_total_width));
+}
+
+PointAndNormal sample_point_on_light_op::operator()(const SpotLight &light) const {
+    return PointAndNormal{light.position, normalize(ref_point - light.position)};
+}
+
+Real pdf_point_on_light_op::operator()(const SpotLight &light) const {
+    // Dirac delta, see PointLight.
+    return 1;
+}
+
+Spectrum emission_op::operator()(const SpotLight &light) const {
+    // The spot light points towards +z in its local space.
+    Vector3 local_dir = normalize(xform_vector(light.to_local, view_dir));
+    return light.intensity * spot_light_falloff(light, local_dir.z);
+}
+
+std::optional<LightEmissionRecord> sample_emission_op::operator()(const SpotLight &light) const {
+    // Uniformly sample the cone of the spot (the falloff region included).
+    Real cos_theta = (1 - rnd_param_dir_uv.x) + rnd_param_dir_uv.x * light.cos_total_width;
+    Real sin_theta = sqrt(max(Real(0), 1 - cos_theta * cos_theta));
+    Real phi = 2 * c_PI * rnd_param_dir_uv.y;
+    Vector3 local_dir{sin_theta * cos(phi), sin_theta * sin(phi), cos_theta};
+    Vector3 dir = normalize(xform_vector(light.to_world, local_dir));
+    return LightEmissionRecord{PointAndNormal{light.position, dir}, dir,
+        LightEmissionPdf{1, 1 / (2 * c_PI * (1 - light.cos_total_width))}};
+}
+
+LightEmissionPdf pdf_emission_op::operator()(const SpotLight &light) const {
+    Vector3 local_dir = normalize(xform_vector(light.to_local, dir));
+    if (local_dir.z < light.cos_total_width) {
+        return LightEmissionPdf{1, 0};
+    }
+    return LightEmissionPdf{1, 1 / (2 * c_PI * (1 - light.cos_total_width))};
+}
+
+void init_sampling_dist_op::operator()(SpotLight &light) const {
+}
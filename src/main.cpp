@@ -1,7 +1,10 @@
 #include "parsers/parse_scene.h"
 #include "parallel.h"
+#include "profiler.h"
+#include "progress_reporter.h"
 #include "image.h"
 #include "render.h"
+#include "stats.h"
 #include "timer.h"
 #include <embree4/rtcore.h>
 #include <memory>
@@ -10,18 +13,34 @@
 
 int main(int argc, char *argv[]) {
     if (argc <= 1) {
-        std::cout << "[Usage] ./lajolla [-t num_threads] [-o output_file_name] filename.xml" << std::endl;
+        std::cout << "[Usage] ./lajolla [-t num_threads] [-o output_file_name] [-progress text|json] [-stats stats.json] [-profile] filename.xml" << std::endl;
         return 0;
     }
 
     int num_threads = std::thread::hardware_concurrency();
     std::string outputfile = "";
+    std::string statsfile = "";
+    bool profile = false;
     std::vector<std::string> filenames;
     for (int i = 1; i < argc; ++i) {
         if (std::string(argv[i]) == "-t") {
             num_threads = std::stoi(std::string(argv[++i]));
         } else if (std::string(argv[i]) == "-o") {
             outputfile = std::string(argv[++i]);
+        } else if (std::string(argv[i]) == "-stats") {
+            statsfile = std::string(argv[++i]);
+        } else if (std::string(argv[i]) == "-profile") {
+            profile = true;
+        } else if (std::string(argv[i]) == "-progress") {
+            std::string format = std::string(argv[++i]);
+            if (format == "json") {
+                set_progress_format(ProgressFormat::JSON);
+            } else if (format == "text") {
+                set_progress_format(ProgressFormat::Text);
+            } else {
+                std::cerr << "Unknown progress format: " << format << std::endl;
+                return 1;
+            }
         } else {
             filenames.push_back(std::string(argv[i]));
         }
@@ -37,10 +56,32 @@ int main(int argc, char *argv[]) {
         std::unique_ptr<Scene> scene = parse_scene(filename, embree_device);
         std::cout << "Done. Took " << tick(timer) << " seconds." << std::endl;
         std::cout << "Rendering..." << std::endl;
-        Image3 img = render(*scene);
+        reset_stats();
         if (outputfile.compare("") == 0) {outputfile = scene->output_filename;}
+        std::vector<ImageLayer> layers;
+        // For EXR, the path tracer writes the tiles as it finishes them.
+        EXRStream stream{outputfile, scene->output_exr_options};
+        bool is_exr = fs::path(outputfile).extension() == ".exr";
+        if (profile) {
+            reset_profile();
+            profiler_start();
+        }
+        Image3 img = render(*scene, &layers, is_exr ? &stream : nullptr);
+        if (profile) {
+            profiler_stop();
+        }
         std::cout << "Done. Took " << tick(timer) << " seconds." << std::endl;
-        imwrite(outputfile, img);
+        print_stats(std::cout);
+        if (profile) {
+            print_profile(std::cout);
+        }
+        if (!statsfile.empty()) {
+            std::ofstream ofs(statsfile);
+            write_stats_json(ofs);
+        }
+        if (!stream.written) {
+            imwrite(outputfile, img, layers, scene->output_exr_options);
+        }
         std::cout << "Image written to " << outputfile << std::endl;
     }
 
@@ -1,5 +1,6 @@
 #include "material.h"
 #include "intersection.h"
+#include "profiler.h"
 
 inline Vector3 sample_cos_hemisphere(const Vector2 &rnd_param) {
     Real phi = c_TWOPI * rnd_param[0];
@@ -11,60 +12,93 @@ inline Vector3 sample_cos_hemisphere(const Vector2 &rnd_param) {
 }
 
 struct eval_op {
-    Spectrum operator()(const Lambertian &bsdf) const;
-    Spectrum operator()(const RoughPlastic &bsdf) const;
-    Spectrum operator()(const RoughDielectric &bsdf) const;
-    Spectrum operator()(const DisneyDiffuse &bsdf) const;
-    Spectrum operator()(const DisneyMetal &bsdf) const;
-    Spectrum operator()(const DisneyGlass &bsdf) const;
-    Spectrum operator()(const DisneyClearcoat &bsdf) const;
-    Spectrum operator()(const DisneySheen &bsdf) const;
-    Spectrum operator()(const DisneyBSDF &bsdf) const;
+    Spectrum operator()(const LambertianClosure &bsdf) const;
+    Spectrum operator()(const RoughPlasticClosure &bsdf) const;
+    Spectrum operator()(const RoughDielectricClosure &bsdf) const;
+    Spectrum operator()(const DisneyDiffuseClosure &bsdf) const;
+    Spectrum operator()(const DisneyMetalClosure &bsdf) const;
+    Spectrum operator()(const DisneyGlassClosure &bsdf) const;
+    Spectrum operator()(const DisneyClearcoatClosure &bsdf) const;
+    Spectrum operator()(const DisneySheenClosure &bsdf) const;
+    Spectrum operator()(const DisneyBSDFClosure &bsdf) const;
 
     const Vector3 &dir_in;
     const Vector3 &dir_out;
     const PathVertex &vertex;
-    const TexturePool &texture_pool;
     const TransportDirection &dir;
 };
 
 struct pdf_sample_bsdf_op {
-    Real operator()(const Lambertian &bsdf) const;
-    Real operator()(const RoughPlastic &bsdf) const;
-    Real operator()(const RoughDielectric &bsdf) const;
-    Real operator()(const DisneyDiffuse &bsdf) const;
-    Real operator()(const DisneyMetal &bsdf) const;
-    Real operator()(const DisneyGlass &bsdf) const;
-    Real operator()(const DisneyClearcoat &bsdf) const;
-    Real operator()(const DisneySheen &bsdf) const;
-    Real operator()(const DisneyBSDF &bsdf) const;
+    Real operator()(const LambertianClosure &bsdf) const;
+    Real operator()(const RoughPlasticClosure &bsdf) const;
+    Real operator()(const RoughDielectricClosure &bsdf) const;
+    Real operator()(const DisneyDiffuseClosure &bsdf) const;
+    Real operator()(const DisneyMetalClosure &bsdf) const;
+    Real operator()(const DisneyGlassClosure &bsdf) const;
+    Real operator()(const DisneyClearcoatClosure &bsdf) const;
+    Real operator()(const DisneySheenClosure &bsdf) const;
+    Real operator()(const DisneyBSDFClosure &bsdf) const;
+
+    const Vector3 &dir_in;
+    const Vector3 &dir_out;
+    const PathVertex &vertex;
+    const TransportDirection &dir;
+};
+
+struct eval_with_pdf_op {
+    BSDFEvalRecord operator()(const LambertianClosure &bsdf) const;
+    BSDFEvalRecord operator()(const RoughPlasticClosure &bsdf) const;
+    BSDFEvalRecord operator()(const RoughDielectricClosure &bsdf) const;
+    // The other materials compute the value and pdfs separately.
+    template <typename T>
+    BSDFEvalRecord operator()(const T &bsdf) const {
+        TransportDirection rev_dir = dir == TransportDirection::TO_LIGHT ?
+            TransportDirection::TO_VIEW : TransportDirection::TO_LIGHT;
+        return BSDFEvalRecord{
+            eval_op{dir_in, dir_out, vertex, dir}(bsdf),
+            pdf_sample_bsdf_op{dir_in, dir_out, vertex, dir}(bsdf),
+            pdf_sample_bsdf_op{dir_out, dir_in, vertex, rev_dir}(bsdf)};
+    }
 
     const Vector3 &dir_in;
     const Vector3 &dir_out;
     const PathVertex &vertex;
-    const TexturePool &texture_pool;
     const TransportDirection &dir;
 };
 
 struct sample_bsdf_op {
-    std::optional<BSDFSampleRecord> operator()(const Lambertian &bsdf) const;
-    std::optional<BSDFSampleRecord> operator()(const RoughPlastic &bsdf) const;
-    std::optional<BSDFSampleRecord> operator()(const RoughDielectric &bsdf) const;
-    std::optional<BSDFSampleRecord> operator()(const DisneyDiffuse &bsdf) const;
-    std::optional<BSDFSampleRecord> operator()(const DisneyMetal &bsdf) const;
-    std::optional<BSDFSampleRecord> operator()(const DisneyGlass &bsdf) const;
-    std::optional<BSDFSampleRecord> operator()(const DisneyClearcoat &bsdf) const;
-    std::optional<BSDFSampleRecord> operator()(const DisneySheen &bsdf) const;
-    std::optional<BSDFSampleRecord> operator()(const DisneyBSDF &bsdf) const;
+    std::optional<BSDFSampleRecord> operator()(const LambertianClosure &bsdf) const;
+    std::optional<BSDFSampleRecord> operator()(const RoughPlasticClosure &bsdf) const;
+    std::optional<BSDFSampleRecord> operator()(const RoughDielectricClosure &bsdf) const;
+    std::optional<BSDFSampleRecord> operator()(const DisneyDiffuseClosure &bsdf) const;
+    std::optional<BSDFSampleRecord> operator()(const DisneyMetalClosure &bsdf) const;
+    std::optional<BSDFSampleRecord> operator()(const DisneyGlassClosure &bsdf) const;
+    std::optional<BSDFSampleRecord> operator()(const DisneyClearcoatClosure &bsdf) const;
+    std::optional<BSDFSampleRecord> operator()(const DisneySheenClosure &bsdf) const;
+    std::optional<BSDFSampleRecord> operator()(const DisneyBSDFClosure &bsdf) const;
 
     const Vector3 &dir_in;
     const PathVertex &vertex;
-    const TexturePool &texture_pool;
     const Vector2 &rnd_param_uv;
     const Real &rnd_param_w;
     const TransportDirection &dir;
 };
 
+struct make_closure_op {
+    MaterialClosure operator()(const Lambertian &bsdf) const;
+    MaterialClosure operator()(const RoughPlastic &bsdf) const;
+    MaterialClosure operator()(const RoughDielectric &bsdf) const;
+    MaterialClosure operator()(const DisneyDiffuse &bsdf) const;
+    MaterialClosure operator()(const DisneyMetal &bsdf) const;
+    MaterialClosure operator()(const DisneyGlass &bsdf) const;
+    MaterialClosure operator()(const DisneyClearcoat &bsdf) const;
+    MaterialClosure operator()(const DisneySheen &bsdf) const;
+    MaterialClosure operator()(const DisneyBSDF &bsdf) const;
+
+    const PathVertex &vertex;
+    const TexturePool &texture_pool;
+};
+
 struct get_texture_op {
     TextureSpectrum operator()(const Lambertian &bsdf) const;
     TextureSpectrum operator()(const RoughPlastic &bsdf) const;
@@ -87,13 +121,59 @@ struct get_texture_op {
 #include "materials/disney_sheen.inl"
 #include "materials/disney_bsdf.inl"
 
+MaterialClosure make_closure(const Material &material,
+                             const PathVertex &vertex,
+                             const TexturePool &texture_pool) {
+    // Mostly texture lookups, which are tagged on their own.
+    ProfileScope profile(ProfilePhase::BSDFEval);
+    return std::visit(make_closure_op{vertex, texture_pool}, material);
+}
+
+Spectrum eval(const MaterialClosure &closure,
+              const Vector3 &dir_in,
+              const Vector3 &dir_out,
+              const PathVertex &vertex,
+              TransportDirection dir) {
+    ProfileScope profile(ProfilePhase::BSDFEval);
+    return std::visit(eval_op{dir_in, dir_out, vertex, dir}, closure);
+}
+
 Spectrum eval(const Material &material,
               const Vector3 &dir_in,
               const Vector3 &dir_out,
               const PathVertex &vertex,
               const TexturePool &texture_pool,
               TransportDirection dir) {
-    return std::visit(eval_op{dir_in, dir_out, vertex, texture_pool, dir}, material);
+    return eval(make_closure(material, vertex, texture_pool), dir_in, dir_out, vertex, dir);
+}
+
+BSDFEvalRecord eval_with_pdf(const MaterialClosure &closure,
+                             const Vector3 &dir_in,
+                             const Vector3 &dir_out,
+                             const PathVertex &vertex,
+                             TransportDirection dir) {
+    ProfileScope profile(ProfilePhase::BSDFEval);
+    return std::visit(eval_with_pdf_op{dir_in, dir_out, vertex, dir}, closure);
+}
+
+std::optional<BSDFSampleRecord>
+sample_bsdf(const MaterialClosure &closure,
+            const Vector3 &dir_in,
+            const PathVertex &vertex,
+            const Vector2 &rnd_param_uv,
+            const Real &rnd_param_w,
+            TransportDirection dir) {
+    ProfileScope profile(ProfilePhase::BSDFSample);
+    std::optional<BSDFSampleRecord> record = std::visit(sample_bsdf_op{
+        dir_in, vertex, rnd_param_uv, rnd_param_w, dir}, closure);
+    if (record && record->pdf_fwd <= 0) {
+        // The material did not evaluate the sample (or the pdf is really zero).
+        BSDFEvalRecord e = eval_with_pdf(closure, dir_in, record->dir_out, vertex, dir);
+        record->f = e.f;
+        record->pdf_fwd = e.pdf_fwd;
+        record->pdf_rev = e.pdf_rev;
+    }
+    return record;
 }
 
 std::optional<BSDFSampleRecord>
@@ -104,8 +184,17 @@ sample_bsdf(const Material &material,
             const Vector2 &rnd_param_uv,
             const Real &rnd_param_w,
             TransportDirection dir) {
-    return std::visit(sample_bsdf_op{
-        dir_in, vertex, texture_pool, rnd_param_uv, rnd_param_w, dir}, material);
+    return sample_bsdf(make_closure(material, vertex, texture_pool),
+                       dir_in, vertex, rnd_param_uv, rnd_param_w, dir);
+}
+
+Real pdf_sample_bsdf(const MaterialClosure &closure,
+                     const Vector3 &dir_in,
+                     const Vector3 &dir_out,
+                     const PathVertex &vertex,
+                     TransportDirection dir) {
+    ProfileScope profile(ProfilePhase::BSDFEval);
+    return std::visit(pdf_sample_bsdf_op{dir_in, dir_out, vertex, dir}, closure);
 }
 
 Real pdf_sample_bsdf(const Material &material,
@@ -114,8 +203,8 @@ Real pdf_sample_bsdf(const Material &material,
                      const PathVertex &vertex,
                      const TexturePool &texture_pool,
                      TransportDirection dir) {
-    return std::visit(pdf_sample_bsdf_op{
-        dir_in, dir_out, vertex, texture_pool, dir}, material);
+    return pdf_sample_bsdf(make_closure(material, vertex, texture_pool),
+                           dir_in, dir_out, vertex, dir);
 }
 
 TextureSpectrum get_texture(const Material &material) {
@@ -109,6 +109,97 @@ using Material = std::variant<Lambertian,
                               DisneySheen,
                               DisneyBSDF>;
 
+/// A "closure" is a material with all of its texture parameters evaluated
+/// at a surface point (the name comes from the Open Shading Language).
+/// At each path vertex we evaluate, sample, and compute the pdf of the BSDF multiple times,
+/// so instead of fetching the same textures over and over again,
+/// we fetch them once with make_closure() and let the BSDF routines work on the plain values.
+struct LambertianClosure {
+    Spectrum reflectance;
+};
+
+struct RoughPlasticClosure {
+    Spectrum diffuse_reflectance;
+    Spectrum specular_reflectance;
+    Real roughness;
+    Real eta;
+};
+
+struct RoughDielectricClosure {
+    Spectrum specular_reflectance;
+    Spectrum specular_transmittance;
+    Real roughness;
+    Real eta;
+};
+
+struct DisneyDiffuseClosure {
+    Spectrum base_color;
+    Real roughness;
+    Real subsurface;
+};
+
+struct DisneyMetalClosure {
+    Spectrum base_color;
+    Real roughness;
+    Real anisotropic;
+};
+
+struct DisneyGlassClosure {
+    Spectrum base_color;
+    Real roughness;
+    Real anisotropic;
+    Real eta;
+};
+
+struct DisneyClearcoatClosure {
+    Real clearcoat_gloss;
+};
+
+struct DisneySheenClosure {
+    Spectrum base_color;
+    Real sheen_tint;
+};
+
+struct DisneyBSDFClosure {
+    Spectrum base_color;
+    Real specular_transmission;
+    Real metallic;
+    Real subsurface;
+    Real specular;
+    Real roughness;
+    Real specular_tint;
+    Real anisotropic;
+    Real sheen;
+    Real sheen_tint;
+    Real clearcoat;
+    Real clearcoat_gloss;
+    Real eta;
+};
+
+using MaterialClosure = std::variant<LambertianClosure,
+                                     RoughPlasticClosure,
+                                     RoughDielectricClosure,
+                                     DisneyDiffuseClosure,
+                                     DisneyMetalClosure,
+                                     DisneyGlassClosure,
+                                     DisneyClearcoatClosure,
+                                     DisneySheenClosure,
+                                     DisneyBSDFClosure>;
+
+/// Is the closure a reflection or refraction with a roughness below the threshold?
+/// These BSDFs are so sharp that only the BSDF sampling can find the light they reflect,
+/// so the light sampling & density estimation techniques skip them.
+inline bool is_near_specular(const MaterialClosure &closure, Real roughness_threshold) {
+    if (auto *c = std::get_if<RoughDielectricClosure>(&closure)) {
+        return c->roughness < roughness_threshold;
+    } else if (auto *c = std::get_if<DisneyGlassClosure>(&closure)) {
+        return c->roughness < roughness_threshold;
+    } else if (auto *c = std::get_if<DisneyMetalClosure>(&closure)) {
+        return c->roughness < roughness_threshold;
+    }
+    return false;
+}
+
 /// We allow non-reciprocal BRDFs, so it's important
 /// to distinguish which direction we are tracing the rays.
 enum class TransportDirection {
@@ -116,6 +207,11 @@ enum class TransportDirection {
     TO_VIEW
 };
 
+/// Evaluate all the texture parameters of the material at the vertex.
+MaterialClosure make_closure(const Material &material,
+                             const PathVertex &vertex,
+                             const TexturePool &texture_pool);
+
 /// Given incoming direction and outgoing direction of lights,
 /// both pointing outwards of the surface point,
 /// outputs the BSDF times the cosine between outgoing direction
@@ -129,17 +225,51 @@ Spectrum eval(const Material &material,
               const PathVertex &vertex,
               const TexturePool &texture_pool,
               TransportDirection dir = TransportDirection::TO_LIGHT);
+/// Same as above, but with the textures already evaluated.
+Spectrum eval(const MaterialClosure &closure,
+              const Vector3 &dir_in,
+              const Vector3 &dir_out,
+              const PathVertex &vertex,
+              TransportDirection dir = TransportDirection::TO_LIGHT);
+
+/// The BSDF value (times the cosine) together with the sampling pdfs
+/// of a pair of directions. Computing them together is cheaper since
+/// they share most of the terms (half vector, Fresnel, D, G, lobe selection).
+struct BSDFEvalRecord {
+    Spectrum f;
+    // The pdf of sampling dir_out given dir_in.
+    Real pdf_fwd;
+    // The pdf of sampling dir_in given dir_out (for bidirectional methods).
+    Real pdf_rev;
+};
+
+/// Same as eval() and pdf_sample_bsdf(), but returns both at once
+/// (plus the reverse pdf).
+BSDFEvalRecord eval_with_pdf(const MaterialClosure &closure,
+                             const Vector3 &dir_in,
+                             const Vector3 &dir_out,
+                             const PathVertex &vertex,
+                             TransportDirection dir = TransportDirection::TO_LIGHT);
 
 struct BSDFSampleRecord {
     Vector3 dir_out;
     // The index of refraction ratio. Set to 0 if it's not a transmission event.
     Real eta;
     Real roughness; // Roughness of the selected BRDF layer ([0, 1]).
+    // The BSDF value and the pdfs of the sampled direction,
+    // so that we don't need to call eval() & pdf_sample_bsdf() again.
+    // The materials fill these in during sampling, since they have
+    // most of the terms at hand. If a material doesn't (pdf_fwd == 0),
+    // sample_bsdf() evaluates them.
+    Spectrum f = make_zero_spectrum();
+    Real pdf_fwd = 0;
+    Real pdf_rev = 0;
 };
 
 /// Given incoming direction pointing outwards of the surface point,
 /// samples an outgoing direction. Also returns the index of refraction
-/// and the roughness of the selected BSDF layer for path tracer's use.
+/// and the roughness of the selected BSDF layer for path tracer's use,
+/// as well as the BSDF value and the pdfs of the sampled direction.
 /// Return an invalid value if the sampling
 /// failed (e.g., if the incoming direction is invalid).
 /// If dir == TO_LIGHT, incoming direction is the view direction and 
@@ -152,6 +282,13 @@ std::optional<BSDFSampleRecord> sample_bsdf(
     const Vector2 &rnd_param_uv,
     const Real &rnd_param_w,
     TransportDirection dir = TransportDirection::TO_LIGHT);
+std::optional<BSDFSampleRecord> sample_bsdf(
+    const MaterialClosure &closure,
+    const Vector3 &dir_in,
+    const PathVertex &vertex,
+    const Vector2 &rnd_param_uv,
+    const Real &rnd_param_w,
+    TransportDirection dir = TransportDirection::TO_LIGHT);
 
 /// Given incoming direction and outgoing direction of lights,
 /// both pointing outwards of the surface point,
@@ -164,6 +301,11 @@ Real pdf_sample_bsdf(const Material &material,
                      const PathVertex &vertex,
                      const TexturePool &texture_pool,
                      TransportDirection dir = TransportDirection::TO_LIGHT);
+Real pdf_sample_bsdf(const MaterialClosure &closure,
+                     const Vector3 &dir_in,
+                     const Vector3 &dir_out,
+                     const PathVertex &vertex,
+                     TransportDirection dir = TransportDirection::TO_LIGHT);
 
 /// Return a texture from the material for debugging.
 /// If the material contains multiple textures, return an arbitrary one.
@@ -1,4 +1,4 @@
-Spectrum eval_op::operator()(const DisneyDiffuse &bsdf) const {
+Spectrum eval_op::operator()(const DisneyDiffuseClosure &bsdf) const {
     if (dot(vertex.geometric_normal, dir_in) < 0 ||
             dot(vertex.geometric_normal, dir_out) < 0) {
         // No light below the surface
@@ -14,7 +14,7 @@ Spectrum eval_op::operator()(const DisneyDiffuse &bsdf) const {
     return make_zero_spectrum();
 }
 
-Real pdf_sample_bsdf_op::operator()(const DisneyDiffuse &bsdf) const {
+Real pdf_sample_bsdf_op::operator()(const DisneyDiffuseClosure &bsdf) const {
     if (dot(vertex.geometric_normal, dir_in) < 0 ||
             dot(vertex.geometric_normal, dir_out) < 0) {
         // No light below the surface
@@ -30,7 +30,7 @@ Real pdf_sample_bsdf_op::operator()(const DisneyDiffuse &bsdf) const {
     return Real(0);
 }
 
-std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyDiffuse &bsdf) const {
+std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyDiffuseClosure &bsdf) const {
     if (dot(vertex.geometric_normal, dir_in) < 0) {
         // No light below the surface
         return {};
@@ -45,6 +45,14 @@ std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const DisneyDiffuse &
     return {};
 }
 
+MaterialClosure make_closure_op::operator()(const DisneyDiffuse &bsdf) const {
+    return DisneyDiffuseClosure{
+        eval(bsdf.base_color, vertex.uv, vertex.uv_screen_size, texture_pool),
+        eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool),
+        eval(bsdf.subsurface, vertex.uv, vertex.uv_screen_size, texture_pool)
+    };
+}
+
 TextureSpectrum get_texture_op::operator()(const DisneyDiffuse &bsdf) const {
     return bsdf.base_color;
 }
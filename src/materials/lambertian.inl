@@ -1,4 +1,4 @@
-Spectrum eval_op::operator()(const Lambertian &bsdf) const {
+Spectrum eval_op::operator()(const LambertianClosure &bsdf) const {
     if (dot(vertex.geometric_normal, dir_in) < 0 ||
             dot(vertex.geometric_normal, dir_out) < 0) {
         // No light below the surface
@@ -12,11 +12,10 @@ Spectrum eval_op::operator()(const Lambertian &bsdf) const {
         frame = -frame;
     }
 
-    return fmax(dot(frame.n, dir_out), Real(0)) *
-           eval(bsdf.reflectance, vertex.uv, vertex.uv_screen_size, texture_pool) / c_PI;
+    return fmax(dot(frame.n, dir_out), Real(0)) * bsdf.reflectance / c_PI;
 }
 
-Real pdf_sample_bsdf_op::operator()(const Lambertian &bsdf) const {
+Real pdf_sample_bsdf_op::operator()(const LambertianClosure &bsdf) const {
     if (dot(vertex.geometric_normal, dir_in) < 0 ||
             dot(vertex.geometric_normal, dir_out) < 0) {
         // No light below the surface
@@ -32,7 +31,32 @@ Real pdf_sample_bsdf_op::operator()(const Lambertian &bsdf) const {
     return fmax(dot(frame.n, dir_out), Real(0)) / c_PI;
 }
 
-std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const Lambertian &bsdf) const {
+/// The value and the pdfs of the Lambertian BRDF in a (flipped) shading frame.
+inline BSDFEvalRecord eval_lambertian(const LambertianClosure &bsdf,
+                                      const Frame &frame,
+                                      const Vector3 &dir_in,
+                                      const Vector3 &dir_out) {
+    Real n_dot_out = fmax(dot(frame.n, dir_out), Real(0));
+    return BSDFEvalRecord{n_dot_out * bsdf.reflectance / c_PI,
+                          n_dot_out / c_PI,
+                          fmax(dot(frame.n, dir_in), Real(0)) / c_PI};
+}
+
+BSDFEvalRecord eval_with_pdf_op::operator()(const LambertianClosure &bsdf) const {
+    if (dot(vertex.geometric_normal, dir_in) < 0 ||
+            dot(vertex.geometric_normal, dir_out) < 0) {
+        // No light below the surface
+        return BSDFEvalRecord{make_zero_spectrum(), Real(0), Real(0)};
+    }
+    // Flip the shading frame if it is inconsistent with the geometry normal
+    Frame frame = vertex.shading_frame;
+    if (dot(frame.n, dir_in) < 0) {
+        frame = -frame;
+    }
+    return eval_lambertian(bsdf, frame, dir_in, dir_out);
+}
+
+std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const LambertianClosure &bsdf) const {
     // For Lambertian, we importance sample the cosine hemisphere domain.
     if (dot(vertex.geometric_normal, dir_in) < 0) {
         // Incoming direction is below the surface.
@@ -44,9 +68,23 @@ std::optional<BSDFSampleRecord> sample_bsdf_op::operator()(const Lambertian &bsd
         frame = -frame;
     }
 
-    return BSDFSampleRecord{
+    BSDFSampleRecord record{
         to_world(frame, sample_cos_hemisphere(rnd_param_uv)),
         Real(0) /* eta */, Real(1) /* roughness */};
+    if (dot(vertex.geometric_normal, record.dir_out) >= 0) {
+        // Otherwise the sample is below the surface, and f & pdfs stay zero.
+        BSDFEvalRecord e = eval_lambertian(bsdf, frame, dir_in, record.dir_out);
+        record.f = e.f;
+        record.pdf_fwd = e.pdf_fwd;
+        record.pdf_rev = e.pdf_rev;
+    }
+    return record;
+}
+
+MaterialClosure make_closure_op::operator()(const Lambertian &bsdf) const {
+    return LambertianClosure{
+        eval(bsdf.reflectance, vertex.uv, vertex.uv_screen_size, texture_pool)
+    };
 }
 
 TextureSpectrum get_texture_op::operator()(const Lambertian &bsdf) const {
@@ -1,24 +1,17 @@
 #include "../microfacet.h"
 
-Spectrum eval_op::operator()(const RoughDielectric &bsdf) const {
-    bool reflect = dot(vertex.geometric_normal, dir_in) *
-                   dot(vertex.geometric_normal, dir_out) > 0;
-    // Flip the shading frame if it is inconsistent with the geometry normal
-    Frame frame = vertex.shading_frame;
-    if (dot(frame.n, dir_in) * dot(vertex.geometric_normal, dir_in) < 0) {
-        frame = -frame;
-    }
-    // If we are going into the surface, then we use normal eta
-    // (internal/external), otherwise we use external/internal.
-    Real eta = dot(vertex.geometric_normal, dir_in) > 0 ? bsdf.eta : 1 / bsdf.eta;
-
-    Spectrum Ks = eval(
-        bsdf.specular_reflectance, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Spectrum Kt = eval(
-        bsdf.specular_transmittance, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real roughness = eval(
-        bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool);
-
+/// Evaluates the RoughDielectric BSDF together with the forward and reverse
+/// sampling pdfs. eval, pdf_sample_bsdf, and sample_bsdf all share this, so the
+/// Fresnel, D, and G terms are computed only once when we need both the value and the pdf.
+/// frame is the shading frame flipped to the side of dir_in, and eta is the relative IOR
+/// seen from dir_in.
+inline BSDFEvalRecord eval_rough_dielectric(const RoughDielectricClosure &bsdf,
+                                            const Frame &frame,
+                                            Real eta,
+                                            bool reflect,
+                                            const Vector3 &dir_in,
+                                            const Vector3 &dir_out,
+                                            TransportDirection dir) {
     Vector3 half_vector;
     if (reflect) {
         half_vector = normalize(dir_in + dir_out);
@@ -34,7 +27,7 @@ Spectrum eval_op::operator()(const RoughDielectric &bsdf) const {
     }
 
     // Clamp roughness to avoid numerical issues.
-    roughness = std::clamp(roughness, Real(0.01), Real(1));
+    Real roughness = std::clamp(bsdf.roughness, Real(0.01), Real(1));
 
     // Compute F / D / G
     // Note that we use the incoming direction
@@ -46,12 +39,22 @@ Spectrum eval_op::operator()(const RoughDielectric &bsdf) const {
     Real h_dot_in = dot(half_vector, dir_in);
     Real F = fresnel_dielectric(h_dot_in, eta);
     Real D = GTR2(dot(frame.n, half_vector), roughness);
-    Real G = smith_masking_gtr2(to_local(frame, dir_in), roughness) *
-             smith_masking_gtr2(to_local(frame, dir_out), roughness);
+    Real G_in = smith_masking_gtr2(to_local(frame, dir_in), roughness);
+    Real G_out = smith_masking_gtr2(to_local(frame, dir_out), roughness);
+    Real n_dot_in = fabs(dot(frame.n, dir_in));
+    Real n_dot_out = fabs(dot(frame.n, dir_out));
+    // We sample the visible normals, also we use F to determine
+    // whether to sample reflection or refraction
+    // so PDF ~ F * D * G_in for reflection, PDF ~ (1 - F) * D * G_in for refraction.
+    // The reverse pdf swaps dir_in and dir_out. The Fresnel term is reciprocal,
+    // so F stays the same.
     if (reflect) {
-        return Ks * (F * D * G) / (4 * fabs(dot(frame.n, dir_in)));
+        return BSDFEvalRecord{
+            bsdf.specular_reflectance * (F * D * G_in * G_out) / (4 * n_dot_in),
+            (F * D * G_in) / (4 * n_dot_in),
+            (F * D * G_out) / (4 * n_dot_out)};
     } else {
-        // Snell-Descartes law predicts that the light will contract/expand 
+        // Snell-Descartes law predicts that the light will contract/expand
         // due to the different index of refraction. So the normal BSDF needs
         // to scale with 1/eta^2. However, the "adjoint" of the BSDF does not have
         // the eta term. This is due to the non-reciprocal nature of the index of refraction:
@@ -66,12 +69,17 @@ Spectrum eval_op::operator()(const RoughDielectric &bsdf) const {
         Real sqrt_denom = h_dot_in + eta * h_dot_out;
         // Very complicated BSDF. See Walter et al.'s paper for more details.
         // "Microfacet Models for Refraction through Rough Surfaces"
-        return Kt * (eta_factor * (1 - F) * D * G * eta * eta * fabs(h_dot_out * h_dot_in)) / 
-            (fabs(dot(frame.n, dir_in)) * sqrt_denom * sqrt_denom);
+        // (eta^2 * h_dot_out / sqrt_denom^2 is the Jacobian between the half vector and dir_out.)
+        Real h_term = fabs(h_dot_out * h_dot_in) / (sqrt_denom * sqrt_denom);
+        return BSDFEvalRecord{
+            bsdf.specular_transmittance *
+                (eta_factor * (1 - F) * D * G_in * G_out * eta * eta * h_term / n_dot_in),
+            (1 - F) * D * G_in * eta * eta * h_term / n_dot_in,
+            (1 - F) * D * G_out * h_term / n_dot_out};
     }
 }
 
-Real pdf_sample_bsdf_op::operator()(const RoughDielectric &bsdf) const {
+Spectrum eval_op::operator()(const RoughDielectricClosure &bsdf) const {
     bool reflect = dot(vertex.geometric_normal, dir_in) *
                    dot(vertex.geometric_normal, dir_out) > 0;
     // Flip the shading frame if it is inconsistent with the geometry normal
@@ -82,46 +90,40 @@ Real pdf_sample_bsdf_op::operator()(const RoughDielectric &bsdf) const {
     // If we are going into the surface, then we use normal eta
     // (internal/external), otherwise we use external/internal.
     Real eta = dot(vertex.geometric_normal, dir_in) > 0 ? bsdf.eta : 1 / bsdf.eta;
-    assert(eta > 0);
-
-    Vector3 half_vector;
-    if (reflect) {
-        half_vector = normalize(dir_in + dir_out);
-    } else {
-        // "Generalized half-vector" from Walter et al.
-        // See "Microfacet Models for Refraction through Rough Surfaces"
-        half_vector = normalize(dir_in + dir_out * eta);
-    }
+    return eval_rough_dielectric(bsdf, frame, eta, reflect, dir_in, dir_out, dir).f;
+}
 
-    // Flip half-vector if it's below surface
-    if (dot(half_vector, frame.n) < 0) {
-        half_vector = -half_vector;
+Real pdf_sample_bsdf_op::operator()(const RoughDielectricClosure &bsdf) const {
+    bool reflect = dot(vertex.geometric_normal, dir_in) *
+                   dot(vertex.geometric_normal, dir_out) > 0;
+    // Flip the shading frame if it is inconsistent with the geometry normal
+    Frame frame = vertex.shading_frame;
+    if (dot(frame.n, dir_in) * dot(vertex.geometric_normal, dir_in) < 0) {
+        frame = -frame;
     }
+    // If we are going into the surface, then we use normal eta
+    // (internal/external), otherwise we use external/internal.
+    Real eta = dot(vertex.geometric_normal, dir_in) > 0 ? bsdf.eta : 1 / bsdf.eta;
+    assert(eta > 0);
+    return eval_rough_dielectric(bsdf, frame, eta, reflect, dir_in, dir_out, dir).pdf_fwd;
+}
 
-    Real roughness = eval(
-        bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool);
-    // Clamp roughness to avoid numerical issues.
-    roughness = std::clamp(roughness, Real(0.01), Real(1));
-
-    // We sample the visible normals, also we use F to determine
-    // whether to sample reflection or refraction
-    // so PDF ~ F * D * G_in for reflection, PDF ~ (1 - F) * D * G_in for refraction.
-    Real h_dot_in = dot(half_vector, dir_in);
-    Real F = fresnel_dielectric(h_dot_in, eta);
-    Real D = GTR2(dot(half_vector, frame.n), roughness);
-    Real G_in = smith_masking_gtr2(to_local(frame, dir_in), roughness);
-    if (reflect) {
-        return (F * D * G_in) / (4 * fabs(dot(frame.n, dir_in)));
-    } else {
-        Real h_dot_out = dot(half_vector, dir_out);
-        Real sqrt_denom = h_dot_in + eta * h_dot_out;
-        Real dh_dout = eta * eta * h_dot_out / (sqrt_denom * sqrt_denom);
-        return (1 - F) * D * G_in * fabs(dh_dout * h_dot_in / dot(frame.n, dir_in));
+BSDFEvalRecord eval_with_pdf_op::operator()(const RoughDielectricClosure &bsdf) const {
+    bool reflect = dot(vertex.geometric_normal, dir_in) *
+                   dot(vertex.geometric_normal, dir_out) > 0;
+    // Flip the shading frame if it is inconsistent with the geometry normal
+    Frame frame = vertex.shading_frame;
+    if (dot(frame.n, dir_in) * dot(vertex.geometric_normal, dir_in) < 0) {
+        frame = -frame;
     }
+    // If we are going into the surface, then we use normal eta
+    // (internal/external), otherwise we use external/internal.
+    Real eta = dot(vertex.geometric_normal, dir_in) > 0 ? bsdf.eta : 1 / bsdf.eta;
+    return eval_rough_dielectric(bsdf, frame, eta, reflect, dir_in, dir_out, dir);
 }
 
 std::optional<BSDFSampleRecord>
-        sample_bsdf_op::operator()(const RoughDielectric &bsdf) const {
+        sample_bsdf_op::operator()(const RoughDielectricClosure &bsdf) const {
     // If we are going into the surface, then we use normal eta
     // (internal/external), otherwise we use external/internal.
     Real eta = dot(vertex.geometric_normal, dir_in) > 0 ? bsdf.eta : 1 / bsdf.eta;
@@ -130,8 +132,7 @@ std::optional<BSDFSampleRecord>
     if (dot(frame.n, dir_in) * dot(vertex.geometric_normal, dir_in) < 0) {
         frame = -frame;
     }
-    Real roughness = eval(
-        bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool);
+    Real roughness = bsdf.roughness;
     // Clamp roughness to avoid numerical issues.
     roughness = std::clamp(roughness, Real(0.01), Real(1));
     // Sample a micro normal and transform it to world space -- this is our half-vector.
@@ -151,11 +152,26 @@ std::optional<BSDFSampleRecord>
     Real h_dot_in = dot(half_vector, dir_in);
     Real F = fresnel_dielectric(h_dot_in, eta);
 
+    // Evaluate the BSDF & pdfs of the sampled direction. We reclassify reflection
+    // and refraction with the geometric normal like eval() does, so that the values are
+    // consistent with eval() & pdf_sample_bsdf() even when the shading normal disagrees.
+    auto fill_eval = [&](BSDFSampleRecord &record) {
+        bool reflect = dot(vertex.geometric_normal, dir_in) *
+                       dot(vertex.geometric_normal, record.dir_out) > 0;
+        BSDFEvalRecord e = eval_rough_dielectric(
+            bsdf, frame, eta, reflect, dir_in, record.dir_out, dir);
+        record.f = e.f;
+        record.pdf_fwd = e.pdf_fwd;
+        record.pdf_rev = e.pdf_rev;
+    };
+
     if (rnd_param_w <= F) {
         // Reflection
         Vector3 reflected = normalize(-dir_in + 2 * dot(dir_in, half_vector) * half_vector);
         // set eta to 0 since we are not transmitting
-        return BSDFSampleRecord{reflected, Real(0) /* eta */, roughness};
+        BSDFSampleRecord record{reflected, Real(0) /* eta */, roughness};
+        fill_eval(record);
+        return record;
     } else {
         // Refraction
         // https://en.wikipedia.org/wiki/Snell%27s_law#Vector_form
@@ -172,10 +188,21 @@ std::optional<BSDFSampleRecord>
         }
         Real h_dot_out= sqrt(h_dot_out_sq);
         Vector3 refracted = -dir_in / eta + (fabs(h_dot_in) / eta - h_dot_out) * half_vector;
-        return BSDFSampleRecord{refracted, eta, roughness};
+        BSDFSampleRecord record{refracted, eta, roughness};
+        fill_eval(record);
+        return record;
     }
 }
 
+MaterialClosure make_closure_op::operator()(const RoughDielectric &bsdf) const {
+    return RoughDielectricClosure{
+        eval(bsdf.specular_reflectance, vertex.uv, vertex.uv_screen_size, texture_pool),
+        eval(bsdf.specular_transmittance, vertex.uv, vertex.uv_screen_size, texture_pool),
+        eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool),
+        bsdf.eta
+    };
+}
+
 TextureSpectrum get_texture_op::operator()(const RoughDielectric &bsdf) const {
     return bsdf.specular_reflectance;
 }
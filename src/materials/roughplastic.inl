@@ -1,17 +1,13 @@
 #include "../microfacet.h"
 
-Spectrum eval_op::operator()(const RoughPlastic &bsdf) const {
-    if (dot(vertex.geometric_normal, dir_in) < 0 ||
-            dot(vertex.geometric_normal, dir_out) < 0) {
-        // No light below the surface
-        return make_zero_spectrum();
-    }
-    // Flip the shading frame if it is inconsistent with the geometry normal
-    Frame frame = vertex.shading_frame;
-    if (dot(frame.n, dir_in) < 0) {
-        frame = -frame;
-    }
-
+/// Evaluates the RoughPlastic BRDF together with the forward and reverse
+/// sampling pdfs in the (flipped) shading frame. eval, pdf_sample_bsdf, and
+/// sample_bsdf all share this, so the Fresnel, D, and G terms are computed only once
+/// when we need both the value and the pdf.
+inline BSDFEvalRecord eval_rough_plastic(const RoughPlasticClosure &bsdf,
+                                         const Frame &frame,
+                                         const Vector3 &dir_in,
+                                         const Vector3 &dir_out) {
     // The half-vector is a crucial component of the microfacet models.
     // Since microfacet assumes that the surface is made of many small mirrors/glasses,
     // The "average" between input and output direction determines the orientation
@@ -23,17 +19,13 @@ Spectrum eval_op::operator()(const RoughPlastic &bsdf) const {
     Real n_dot_in = dot(frame.n, dir_in);
     Real n_dot_out = dot(frame.n, dir_out);
     if (n_dot_out <= 0 || n_dot_h <= 0) {
-        return make_zero_spectrum();
+        return BSDFEvalRecord{make_zero_spectrum(), Real(0), Real(0)};
     }
 
-    Spectrum Kd = eval(
-        bsdf.diffuse_reflectance, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Spectrum Ks = eval(
-        bsdf.specular_reflectance, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real roughness = eval(
-        bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool);
+    const Spectrum &Kd = bsdf.diffuse_reflectance;
+    const Spectrum &Ks = bsdf.specular_reflectance;
     // Clamp roughness to avoid numerical issues.
-    roughness = std::clamp(roughness, Real(0.01), Real(1));
+    Real roughness = std::clamp(bsdf.roughness, Real(0.01), Real(1));
 
     // We first account for the dielectric layer.
 
@@ -45,10 +37,10 @@ Spectrum eval_op::operator()(const RoughPlastic &bsdf) const {
     // we only need one of them.
     Real F_o = fresnel_dielectric(dot(half_vector, dir_out), bsdf.eta); // F_o is the reflection percentage.
     Real D = GTR2(n_dot_h, roughness); // "Generalized Trowbridge Reitz", GTR2 is equivalent to GGX.
-    Real G = smith_masking_gtr2(to_local(frame, dir_in), roughness) *
-             smith_masking_gtr2(to_local(frame, dir_out), roughness);
+    Real G_in = smith_masking_gtr2(to_local(frame, dir_in), roughness);
+    Real G_out = smith_masking_gtr2(to_local(frame, dir_out), roughness);
 
-    Spectrum spec_contrib = Ks * (G * F_o * D) / (4 * n_dot_in * n_dot_out);
+    Spectrum spec_contrib = Ks * (G_in * G_out * F_o * D) / (4 * n_dot_in * n_dot_out);
 
     // Next we account for the diffuse layer.
     // In order to reflect from the diffuse layer,
@@ -59,58 +51,71 @@ Spectrum eval_op::operator()(const RoughPlastic &bsdf) const {
     // object boundaries. Disney BRDF proposes a fix to this -- we will implement this in problem set 1.
     Spectrum diffuse_contrib = Kd * (Real(1) - F_o) * (Real(1) - F_i) / c_PI;
 
-    return (spec_contrib + diffuse_contrib) * n_dot_out;
+    BSDFEvalRecord record{(spec_contrib + diffuse_contrib) * n_dot_out, Real(0), Real(0)};
+
+    Real lS = luminance(Ks), lR = luminance(Kd);
+    if (lS + lR <= 0) {
+        return record;
+    }
+    // We use the reflectance to determine whether to choose specular sampling lobe or diffuse.
+    Real spec_prob = lS / (lS + lR);
+    Real diff_prob = 1 - spec_prob;
+    // For the specular lobe, we use the ellipsoidal sampling from Heitz 2018
+    // "Sampling the GGX Distribution of Visible Normals"
+    // https://jcgt.org/published/0007/04/01/
+    // this importance samples smith_masking(cos_theta_in) * GTR2(cos_theta_h, roughness) * cos_theta_out
+    // (4 * cos_theta_v) is the Jacobian of the reflection.
+    // For the diffuse lobe, we importance sample cos_theta_out.
+    // The reverse pdf swaps the roles of dir_in and dir_out.
+    record.pdf_fwd = spec_prob * (G_in * D) / (4 * n_dot_in) + diff_prob * n_dot_out / c_PI;
+    record.pdf_rev = spec_prob * (G_out * D) / (4 * n_dot_out) + diff_prob * n_dot_in / c_PI;
+    return record;
 }
 
-Real pdf_sample_bsdf_op::operator()(const RoughPlastic &bsdf) const {
+Spectrum eval_op::operator()(const RoughPlasticClosure &bsdf) const {
     if (dot(vertex.geometric_normal, dir_in) < 0 ||
             dot(vertex.geometric_normal, dir_out) < 0) {
         // No light below the surface
-        return 0;
+        return make_zero_spectrum();
     }
     // Flip the shading frame if it is inconsistent with the geometry normal
     Frame frame = vertex.shading_frame;
     if (dot(frame.n, dir_in) < 0) {
         frame = -frame;
     }
+    return eval_rough_plastic(bsdf, frame, dir_in, dir_out).f;
+}
 
-    Vector3 half_vector = normalize(dir_in + dir_out);
-    Real n_dot_in = dot(frame.n, dir_in);
-    Real n_dot_out = dot(frame.n, dir_out);
-    Real n_dot_h = dot(frame.n, half_vector);
-    if (n_dot_out <= 0 || n_dot_h <= 0) {
+Real pdf_sample_bsdf_op::operator()(const RoughPlasticClosure &bsdf) const {
+    if (dot(vertex.geometric_normal, dir_in) < 0 ||
+            dot(vertex.geometric_normal, dir_out) < 0) {
+        // No light below the surface
         return 0;
     }
+    // Flip the shading frame if it is inconsistent with the geometry normal
+    Frame frame = vertex.shading_frame;
+    if (dot(frame.n, dir_in) < 0) {
+        frame = -frame;
+    }
+    return eval_rough_plastic(bsdf, frame, dir_in, dir_out).pdf_fwd;
+}
 
-    Spectrum S = eval(
-        bsdf.specular_reflectance, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Spectrum R = eval(
-        bsdf.diffuse_reflectance, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Real lS = luminance(S), lR = luminance(R);
-    if (lS + lR <= 0) {
-        return 0;
+BSDFEvalRecord eval_with_pdf_op::operator()(const RoughPlasticClosure &bsdf) const {
+    if (dot(vertex.geometric_normal, dir_in) < 0 ||
+            dot(vertex.geometric_normal, dir_out) < 0) {
+        // No light below the surface
+        return BSDFEvalRecord{make_zero_spectrum(), Real(0), Real(0)};
     }
-    Real roughness = eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool);
-    // Clamp roughness to avoid numerical issues.
-    roughness = std::clamp(roughness, Real(0.01), Real(1));
-    // We use the reflectance to determine whether to choose specular sampling lobe or diffuse.
-    Real spec_prob = lS / (lS + lR);
-    Real diff_prob = 1 - spec_prob;
-    // For the specular lobe, we use the ellipsoidal sampling from Heitz 2018
-    // "Sampling the GGX Distribution of Visible Normals"
-    // https://jcgt.org/published/0007/04/01/
-    // this importance samples smith_masking(cos_theta_in) * GTR2(cos_theta_h, roughness) * cos_theta_out
-    Real G = smith_masking_gtr2(to_local(frame, dir_in), roughness);
-    Real D = GTR2(n_dot_h, roughness);
-    // (4 * cos_theta_v) is the Jacobian of the reflectiokn
-    spec_prob *= (G * D) / (4 * n_dot_in);
-    // For the diffuse lobe, we importance sample cos_theta_out
-    diff_prob *= n_dot_out / c_PI;
-    return spec_prob + diff_prob;
+    // Flip the shading frame if it is inconsistent with the geometry normal
+    Frame frame = vertex.shading_frame;
+    if (dot(frame.n, dir_in) < 0) {
+        frame = -frame;
+    }
+    return eval_rough_plastic(bsdf, frame, dir_in, dir_out);
 }
 
 std::optional<BSDFSampleRecord>
-        sample_bsdf_op::operator()(const RoughPlastic &bsdf) const {
+        sample_bsdf_op::operator()(const RoughPlasticClosure &bsdf) const {
     if (dot(vertex.geometric_normal, dir_in) < 0) {
         // No light below the surface
         return {};
@@ -122,24 +127,21 @@ std::optional<BSDFSampleRecord>
     }
 
     // We use the reflectance to choose between sampling the dielectric or diffuse layer.
-    Spectrum Ks = eval(
-        bsdf.specular_reflectance, vertex.uv, vertex.uv_screen_size, texture_pool);
-    Spectrum Kd = eval(
-        bsdf.diffuse_reflectance, vertex.uv, vertex.uv_screen_size, texture_pool);
+    const Spectrum &Ks = bsdf.specular_reflectance;
+    const Spectrum &Kd = bsdf.diffuse_reflectance;
     Real lS = luminance(Ks), lR = luminance(Kd);
     if (lS + lR <= 0) {
         return {};
     }
     Real spec_prob = lS / (lS + lR);
+    BSDFSampleRecord record;
     if (rnd_param_w < spec_prob) {
         // Sample from the specular lobe.
 
         // Convert the incoming direction to local coordinates
         Vector3 local_dir_in = to_local(frame, dir_in);
-        Real roughness = eval(
-            bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool);
         // Clamp roughness to avoid numerical issues.
-        roughness = std::clamp(roughness, Real(0.01), Real(1));
+        Real roughness = std::clamp(bsdf.roughness, Real(0.01), Real(1));
         Real alpha = roughness * roughness;
         Vector3 local_micro_normal =
             sample_visible_normals(local_dir_in, alpha, rnd_param_uv);
@@ -148,16 +150,33 @@ std::optional<BSDFSampleRecord>
         Vector3 half_vector = to_world(frame, local_micro_normal);
         // Reflect over the world space normal
         Vector3 reflected = normalize(-dir_in + 2 * dot(dir_in, half_vector) * half_vector);
-        return BSDFSampleRecord{
+        record = BSDFSampleRecord{
             reflected,
             Real(0) /* eta */, roughness /* roughness */
         };
     } else {
         // Lambertian sampling
-        return BSDFSampleRecord{
+        record = BSDFSampleRecord{
             to_world(frame, sample_cos_hemisphere(rnd_param_uv)),
             Real(0) /* eta */, Real(1) /* roughness */};
     }
+    if (dot(vertex.geometric_normal, record.dir_out) >= 0) {
+        // Otherwise the sample is below the surface, and f & pdfs stay zero.
+        BSDFEvalRecord e = eval_rough_plastic(bsdf, frame, dir_in, record.dir_out);
+        record.f = e.f;
+        record.pdf_fwd = e.pdf_fwd;
+        record.pdf_rev = e.pdf_rev;
+    }
+    return record;
+}
+
+MaterialClosure make_closure_op::operator()(const RoughPlastic &bsdf) const {
+    return RoughPlasticClosure{
+        eval(bsdf.diffuse_reflectance, vertex.uv, vertex.uv_screen_size, texture_pool),
+        eval(bsdf.specular_reflectance, vertex.uv, vertex.uv_screen_size, texture_pool),
+        eval(bsdf.roughness, vertex.uv, vertex.uv_screen_size, texture_pool),
+        bsdf.eta
+    };
 }
 
 TextureSpectrum get_texture_op::operator()(const RoughPlastic &bsdf) const {
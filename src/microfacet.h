@@ -33,6 +33,11 @@ inline T schlick_fresnel(const T &F0, Real cos_theta) {
 /// eta: eta_transmission / eta_incident
 inline Real fresnel_dielectric(Real n_dot_i, Real n_dot_t, Real eta) {
     assert(n_dot_i >= 0 && n_dot_t >= 0 && eta > 0);
+    if (n_dot_i == 0 && n_dot_t == 0) {
+        // Grazing in and out (only reachable through rounding): everything is reflected.
+        // The formula below would give us 0/0.
+        return 1;
+    }
     Real rs = (n_dot_i - eta * n_dot_t) / (n_dot_i + eta * n_dot_t);
     Real rp = (eta * n_dot_i - n_dot_t) / (eta * n_dot_i + n_dot_t);
     Real F = (rs * rs + rp * rp) / 2;
@@ -46,19 +51,26 @@ inline Real fresnel_dielectric(Real n_dot_i, Real n_dot_t, Real eta) {
 /// eta: eta_transmission / eta_incident
 inline Real fresnel_dielectric(Real n_dot_i, Real eta) {
     assert(eta > 0);
-    Real n_dot_t_sq = 1 - (1 - n_dot_i * n_dot_i) / (eta * eta);
+    // Dot products of unit vectors can be slightly larger than 1 due to rounding
+    // (especially in single precision), which would make sin^2 negative.
+    Real sin_i_sq = max(1 - n_dot_i * n_dot_i, Real(0));
+    Real n_dot_t_sq = 1 - sin_i_sq / (eta * eta);
     if (n_dot_t_sq < 0) {
         // total internal reflection
         return 1;
     }
     Real n_dot_t = sqrt(n_dot_t_sq);
-    return fresnel_dielectric(fabs(n_dot_i), n_dot_t, eta);
+    return fresnel_dielectric(min(fabs(n_dot_i), Real(1)), n_dot_t, eta);
 }
 
 inline Real GTR2(Real n_dot_h, Real roughness) {
     Real alpha = roughness * roughness;
     Real a2 = alpha * alpha;
-    Real t = 1 + (a2 - 1) * n_dot_h * n_dot_h;
+    // 1 + (a2 - 1) * cos^2 written as sin^2 + a2 * cos^2:
+    // for very smooth surfaces (a2 < 1e-8) a2 - 1 rounds to -1 in single precision,
+    // and t would become 0 at n_dot_h = 1.
+    Real n_dot_h2 = n_dot_h * n_dot_h;
+    Real t = (1 - n_dot_h2) + a2 * n_dot_h2;
     return a2 / (c_PI * t*t);
 }
 
@@ -1,4 +1,5 @@
 #include "parallel.h"
+#include "profiler.h"
 #include <list>
 #include <thread>
 #include <condition_variable>
@@ -26,7 +27,7 @@ static ParallelForLoop *workList = nullptr;
 static std::mutex workListMutex;
 
 struct ParallelForLoop {
-    ParallelForLoop(std::function<void(int)> func1D, int64_t maxIndex, int64_t chunkSize)
+    ParallelForLoop(std::function<void(int64_t)> func1D, int64_t maxIndex, int64_t chunkSize)
         : func1D(std::move(func1D)), maxIndex(maxIndex), chunkSize(chunkSize) {
     }
     ParallelForLoop(const std::function<void(Vector2i)> &f, const Vector2i count)
@@ -34,7 +35,7 @@ struct ParallelForLoop {
         nX = count[0];
     }
 
-    std::function<void(int)> func1D;
+    std::function<void(int64_t)> func1D;
     std::function<void(Vector2i)> func2D;
     const int64_t maxIndex;
     const int64_t chunkSize;
@@ -66,9 +67,10 @@ static std::condition_variable workListCondition;
 
 static void worker_thread_func(const int tIndex, std::shared_ptr<Barrier> barrier) {
     ThreadIndex = tIndex;
+    profiler_worker_thread_init();
 
     // The main thread sets up a barrier so that it can be sure that all
-    // workers have called ProfilerWorkerThreadInit() before it continues
+    // workers have called profiler_worker_thread_init() before it continues
     // (and actually starts the profiling system).
     barrier->Wait();
 
@@ -101,7 +103,7 @@ static void worker_thread_func(const int tIndex, std::shared_ptr<Barrier> barrie
             lock.unlock();
             for (int64_t index = indexStart; index < indexEnd; ++index) {
                 if (loop.func1D) {
-                    loop.func1D((int)index);
+                    loop.func1D(index);
                 }
                 // Handle other types of loops
                 else {
@@ -121,12 +123,12 @@ static void worker_thread_func(const int tIndex, std::shared_ptr<Barrier> barrie
     }
 }
 
-void parallel_for(const std::function<void(int)> &func,
+void parallel_for(const std::function<void(int64_t)> &func,
                   int64_t count,
                   int64_t chunkSize) {
     // Run iterations immediately if not using threads or if _count_ is small
     if (threads.empty() || count < chunkSize) {
-        for (int i = 0; i < (int)count; i++) {
+        for (int64_t i = 0; i < count; i++) {
             func(i);
         }
         return;
@@ -162,7 +164,7 @@ void parallel_for(const std::function<void(int)> &func,
         lock.unlock();
         for (int64_t index = indexStart; index < indexEnd; ++index) {
             if (loop.func1D) {
-                loop.func1D((int)index);
+                loop.func1D(index);
             }
             // Handle other types of loops
             else {
@@ -220,7 +222,7 @@ void parallel_for(std::function<void(Vector2i)> func, const Vector2i count) {
         lock.unlock();
         for (int64_t index = indexStart; index < indexEnd; ++index) {
             if (loop.func1D) {
-                loop.func1D((int)index);
+                loop.func1D(index);
             }
             // Handle other types of loops
             else {
@@ -239,9 +241,10 @@ void parallel_for(std::function<void(Vector2i)> func, const Vector2i count) {
 void parallel_init(int num_threads) {
     assert(threads.size() == 0);
     ThreadIndex = 0;
+    profiler_worker_thread_init();
 
     // Create a barrier so that we can be sure all worker threads get past
-    // their call to ProfilerWorkerThreadInit() before we return from this
+    // their call to profiler_worker_thread_init() before we return from this
     // function.  In turn, we can be sure that the profiling system isn't
     // started until after all worker threads have done that.
     std::shared_ptr<Barrier> barrier = std::make_shared<Barrier>(num_threads);
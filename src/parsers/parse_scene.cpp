@@ -1,5 +1,6 @@
 #include "parse_scene.h"
 #include "3rdparty/pugixml.hpp"
+#include "equal_area.h"
 #include "flexception.h"
 #include "load_serialized.h"
 #include "parse_obj.h"
@@ -17,6 +18,8 @@ const Filter c_default_filter = Box{Real(1)};;
 
 struct ParsedSampler {
     int sample_count = 4;
+    SamplerType type = SamplerType::Independent;
+    uint32_t seed = 0;
 };
 
 enum class TextureType {
@@ -536,6 +539,87 @@ void parse_default_map(pugi::xml_node node,
     }
 }
 
+/// Parses the splitting and Russian roulette parameters of the path tracers (see RenderOptions).
+/// Returns false if the child is not one of them.
+/// We follow Mitsuba's direct integrator and also accept "emitterSamples".
+bool parse_splitting_option(pugi::xml_node child,
+                            RenderOptions &options,
+                            const std::map<std::string, std::string> &default_map) {
+    std::string name = child.attribute("name").value();
+    if (name == "neeSamples" || name == "nee_samples" ||
+            name == "emitterSamples" || name == "emitter_samples") {
+        options.nee_samples = parse_integer(
+            child.attribute("value").value(), default_map);
+        if (options.nee_samples < 1 || options.nee_samples > c_max_nee_samples) {
+            Error(std::string("neeSamples should be between 1 and ") +
+                  std::to_string(c_max_nee_samples));
+        }
+    } else if (name == "bsdfSamples" || name == "bsdf_samples") {
+        options.bsdf_samples = parse_integer(
+            child.attribute("value").value(), default_map);
+        if (options.bsdf_samples < 1) {
+            Error("bsdfSamples should be at least 1");
+        }
+    } else if (name == "splitDepth" || name == "split_depth") {
+        options.split_depth = parse_integer(
+            child.attribute("value").value(), default_map);
+    } else if (name == "rrStrategy" || name == "rr_strategy") {
+        std::string strategy = parse_string(
+            child.attribute("value").value(), default_map);
+        if (strategy == "throughput") {
+            options.rr_strategy = RRStrategy::Throughput;
+        } else if (strategy == "adrrs") {
+            options.rr_strategy = RRStrategy::ADRRS;
+        } else {
+            Error(std::string("Unknown Russian roulette strategy: ") + strategy);
+        }
+    } else if (name == "maxSplitPaths" || name == "max_split_paths") {
+        options.max_split_paths = parse_integer(
+            child.attribute("value").value(), default_map);
+        if (options.max_split_paths < 1 || options.max_split_paths > c_max_split_paths) {
+            Error(std::string("maxSplitPaths should be between 1 and ") +
+                  std::to_string(c_max_split_paths));
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/// Parses a comma-separated list of AOVs, e.g., "albedo, normal, depth".
+std::vector<AOVType> parse_aovs(const std::string &value) {
+    std::vector<AOVType> aovs;
+    for (const std::string &token : split_string(value, std::regex("(,| )+"))) {
+        if (token.empty()) {
+            continue;
+        }
+        AOVType type;
+        if (token == "albedo") {
+            type = AOVType::Albedo;
+        } else if (token == "normal" || token == "shadingNormal" || token == "shading_normal") {
+            type = AOVType::ShadingNormal;
+        } else if (token == "depth") {
+            type = AOVType::Depth;
+        } else if (token == "position") {
+            type = AOVType::Position;
+        } else if (token == "objectId" || token == "object_id") {
+            type = AOVType::ObjectID;
+        } else if (token == "materialId" || token == "material_id") {
+            type = AOVType::MaterialID;
+        } else if (token == "time") {
+            type = AOVType::Time;
+        } else if (token == "rays" || token == "rayCount" || token == "ray_count") {
+            type = AOVType::RayCount;
+        } else {
+            Error(std::string("Unknown AOV: ") + token);
+        }
+        if (std::find(aovs.begin(), aovs.end(), type) == aovs.end()) {
+            aovs.push_back(type);
+        }
+    }
+    return aovs;
+}
+
 RenderOptions parse_integrator(pugi::xml_node node,
                                const std::map<std::string, std::string> &default_map) {
     RenderOptions options;
@@ -550,6 +634,110 @@ RenderOptions parse_integrator(pugi::xml_node node,
             } else if (name == "rrDepth") {
                 options.rr_depth = parse_integer(
                     child.attribute("value").value(), default_map);
+            } else if (name == "radianceCacheDepth" || name == "radiance_cache_depth") {
+                options.radiance_cache_depth = parse_integer(
+                    child.attribute("value").value(), default_map);
+            } else if (name == "radianceCacheCellSize" || name == "radiance_cache_cell_size") {
+                options.radiance_cache_cell_size = parse_float(
+                    child.attribute("value").value(), default_map);
+            } else if (name == "restir") {
+                options.restir = parse_boolean(
+                    child.attribute("value").value(), default_map);
+            } else if (name == "restirCandidates" || name == "restir_candidates") {
+                options.restir_candidates = parse_integer(
+                    child.attribute("value").value(), default_map);
+                if (options.restir_candidates < 1) {
+                    Error("restirCandidates should be at least 1");
+                }
+            } else if (name == "restirSpatialSamples" || name == "restir_spatial_samples") {
+                options.restir_spatial_samples = parse_integer(
+                    child.attribute("value").value(), default_map);
+                if (options.restir_spatial_samples < 0 ||
+                        options.restir_spatial_samples > c_restir_max_spatial_samples) {
+                    Error(std::string("restirSpatialSamples should be between 0 and ") +
+                          std::to_string(c_restir_max_spatial_samples));
+                }
+            } else if (name == "restirSpatialRadius" || name == "restir_spatial_radius") {
+                options.restir_spatial_radius = parse_integer(
+                    child.attribute("value").value(), default_map);
+            } else if (name == "restirTemporal" || name == "restir_temporal") {
+                options.restir_temporal = parse_boolean(
+                    child.attribute("value").value(), default_map);
+            } else if (name == "restirBiased" || name == "restir_biased") {
+                options.restir_biased = parse_boolean(
+                    child.attribute("value").value(), default_map);
+            } else if (name == "batchBSDF" || name == "batch_bsdf") {
+                options.batch_bsdf = parse_boolean(
+                    child.attribute("value").value(), default_map);
+            } else if (name == "lightGroups" || name == "light_groups") {
+                options.light_groups = parse_boolean(
+                    child.attribute("value").value(), default_map);
+            } else if (name == "aovs") {
+                options.aovs = parse_aovs(parse_string(
+                    child.attribute("value").value(), default_map));
+            } else if (name == "denoise") {
+                options.denoise = parse_boolean(
+                    child.attribute("value").value(), default_map);
+            } else if (name == "denoiseIterations" || name == "denoise_iterations") {
+                options.denoise_iterations = parse_integer(
+                    child.attribute("value").value(), default_map);
+                if (options.denoise_iterations < 1) {
+                    Error("denoiseIterations should be at least 1");
+                }
+            } else {
+                parse_splitting_option(child, options, default_map);
+            }
+        }
+        if (options.denoise) {
+            // The denoiser is guided by these AOVs.
+            for (AOVType type : {AOVType::Albedo, AOVType::ShadingNormal, AOVType::Depth}) {
+                if (std::find(options.aovs.begin(), options.aovs.end(), type) == options.aovs.end()) {
+                    options.aovs.push_back(type);
+                }
+            }
+        }
+    } else if (type == "guided_path" || type == "guidedPath") {
+        options.integrator = Integrator::GuidedPath;
+        for (auto child : node.children()) {
+            std::string name = child.attribute("name").value();
+            if (name == "maxDepth" || name == "max_depth") {
+                options.max_depth = parse_integer(
+                    child.attribute("value").value(), default_map);
+            } else if (name == "rrDepth" || name == "rr_depth") {
+                options.rr_depth = parse_integer(
+                    child.attribute("value").value(), default_map);
+            } else {
+                parse_splitting_option(child, options, default_map);
+            }
+        }
+    } else if (type == "bdpt") {
+        options.integrator = Integrator::BDPT;
+        for (auto child : node.children()) {
+            std::string name = child.attribute("name").value();
+            if (name == "maxDepth" || name == "max_depth") {
+                options.max_depth = parse_integer(
+                    child.attribute("value").value(), default_map);
+            } else if (name == "rrDepth" || name == "rr_depth") {
+                options.rr_depth = parse_integer(
+                    child.attribute("value").value(), default_map);
+            }
+        }
+    } else if (type == "sppm") {
+        options.integrator = Integrator::SPPM;
+        for (auto child : node.children()) {
+            std::string name = child.attribute("name").value();
+            if (name == "maxDepth" || name == "max_depth") {
+                options.max_depth = parse_integer(
+                    child.attribute("value").value(), default_map);
+            } else if (name == "rrDepth" || name == "rr_depth") {
+                options.rr_depth = parse_integer(
+                    child.attribute("value").value(), default_map);
+            } else if (name == "photonsPerIteration" || name == "photons_per_iteration") {
+                options.sppm_photons_per_iteration = parse_integer(
+                    child.attribute("value").value(), default_map);
+            } else if (name == "initialRadius" || name == "initial_radius") {
+                options.sppm_initial_radius = parse_float(
+                    child.attribute("value").value(), default_map);
             }
         }
     } else if (type == "volpath") {
@@ -568,11 +756,22 @@ RenderOptions parse_integrator(pugi::xml_node node,
             } else if (name == "maxNullCollisions" || name == "max_null_collisions") {
                 options.max_null_collisions = parse_integer(
                     child.attribute("value").value(), default_map);
+            } else if (name == "aovs") {
+                options.aovs = parse_aovs(parse_string(
+                    child.attribute("value").value(), default_map));
+                for (AOVType type : options.aovs) {
+                    if (type != AOVType::Time && type != AOVType::RayCount) {
+                        Error("The volumetric path tracer only supports the time and rays AOVs.");
+                    }
+                }
             }
         }
     } else if (type == "direct") {
         options.integrator = Integrator::Path;
         options.max_depth = 2;
+        for (auto child : node.children()) {
+            parse_splitting_option(child, options, default_map);
+        }
     } else if (type == "depth") {
         options.integrator = Integrator::Depth;
     } else if (type == "shadingNormal" || type == "shading_normal") {
@@ -589,11 +788,12 @@ RenderOptions parse_integrator(pugi::xml_node node,
     return options;
 }
 
-std::tuple<int /* width */, int /* height */, std::string /* filename */, Filter>
+std::tuple<int /* width */, int /* height */, std::string /* filename */, Filter, EXROptions>
         parse_film(pugi::xml_node node, const std::map<std::string, std::string> &default_map) {
     int width = c_default_res, height = c_default_res;
     std::string filename = c_default_filename;
     Filter filter = c_default_filter;
+    EXROptions exr_options;
 
     for (auto child : node.children()) {
         std::string type = child.name();
@@ -604,6 +804,26 @@ std::tuple<int /* width */, int /* height */, std::string /* filename */, Filter
             height = parse_integer(child.attribute("value").value(), default_map);
         } else if (name == "filename") {
             filename = parse_string(child.attribute("value").value(), default_map);
+        } else if (name == "componentFormat" || name == "component_format") {
+            std::string value = parse_string(child.attribute("value").value(), default_map);
+            if (value == "float16") {
+                exr_options.pixel_type = EXRPixelType::Half;
+            } else if (value == "float32") {
+                exr_options.pixel_type = EXRPixelType::Float;
+            } else {
+                Error(std::string("Unsupported componentFormat: ") + value);
+            }
+        } else if (name == "compression") {
+            std::string value = parse_string(child.attribute("value").value(), default_map);
+            if (value == "none") {
+                exr_options.compression = EXRCompression::None;
+            } else if (value == "zip") {
+                exr_options.compression = EXRCompression::ZIP;
+            } else if (value == "piz") {
+                exr_options.compression = EXRCompression::PIZ;
+            } else {
+                Error(std::string("Unsupported compression: ") + value);
+            }
         }
         if (type == "rfilter") {
             std::string filter_type = child.attribute("type").value();
@@ -637,7 +857,7 @@ std::tuple<int /* width */, int /* height */, std::string /* filename */, Filter
             }
         }
     }
-    return std::make_tuple(width, height, filename, filter);
+    return std::make_tuple(width, height, filename, filter, exr_options);
 }
 
 VolumeSpectrum parse_volume_spectrum(pugi::xml_node node,
@@ -745,7 +965,7 @@ std::tuple<std::string /* ID */, Medium> parse_medium(
     }
 }
 
-std::tuple<Camera, std::string /* output filename */, ParsedSampler>
+std::tuple<Camera, std::string /* output filename */, ParsedSampler, EXROptions>
         parse_sensor(pugi::xml_node node,
                      std::vector<Medium> &media,
                      std::map<std::string /* name id */, int /* index id */> &medium_map,
@@ -755,6 +975,7 @@ std::tuple<Camera, std::string /* output filename */, ParsedSampler>
     int width = c_default_res, height = c_default_res;
     std::string filename = c_default_filename;
     Filter filter = c_default_filter;
+    EXROptions exr_options;
     FovAxis fov_axis = FovAxis::X;
     ParsedSampler sampler;
     int medium_id = -1;
@@ -790,17 +1011,30 @@ std::tuple<Camera, std::string /* output filename */, ParsedSampler>
 
     for (auto child : node.children()) {
         if (std::string(child.name()) == "film") {
-            std::tie(width, height, filename, filter) = parse_film(child, default_map);
+            std::tie(width, height, filename, filter, exr_options) = parse_film(child, default_map);
         } else if (std::string(child.name()) == "sampler") {
             std::string name = child.attribute("type").value();
-            if (name != "independent") {
-                std::cerr << "Warning: the renderer currently only supports independent samplers." << std::endl;
+            if (name == "independent") {
+                sampler.type = SamplerType::Independent;
+            } else if (name == "stratified") {
+                sampler.type = SamplerType::Stratified;
+            } else if (name == "sobol" || name == "ldsampler") {
+                // Mitsuba's ldsampler is a (0, 2)-sequence too.
+                sampler.type = SamplerType::Sobol;
+            } else if (name == "zsobol" || name == "bluenoise") {
+                sampler.type = SamplerType::ZSobol;
+            } else {
+                std::cerr << "Warning: unsupported sampler " << name <<
+                    ", falling back to the independent sampler." << std::endl;
             }
             for (auto grand_child : child.children()) {
                 std::string name = grand_child.attribute("name").value();
                 if (name == "sampleCount" || name == "sample_count") {
                     sampler.sample_count = parse_integer(
                         grand_child.attribute("value").value(), default_map);
+                } else if (name == "seed") {
+                    sampler.seed = parse_integer(
+                        grand_child.attribute("value").value(), default_map);
                 }
             }
         } else if (std::string(child.name()) == "ref") {
@@ -843,7 +1077,7 @@ std::tuple<Camera, std::string /* output filename */, ParsedSampler>
     }
 
     return std::make_tuple(Camera(to_world, fov, width, height, filter, medium_id),
-                           filename, sampler);
+                           filename, sampler, exr_options);
 }
 
 Texture<Real> alpha_to_roughness(pugi::xml_node node,
@@ -1173,6 +1407,26 @@ std::tuple<std::string /* ID */, Material> parse_bsdf(
     return std::make_tuple("", Material{});
 }
 
+/// The light group of an emitter (see RenderOptions::light_groups).
+/// Emitters with the same <string name="lightGroup" value="..."/> share a group.
+/// Otherwise, each emitter is its own group, named after its ID (or the ID of its shape),
+/// or "light<index of the light>" if it doesn't have one.
+std::string parse_light_group(pugi::xml_node node,
+                              const std::string &id,
+                              int light_id,
+                              const std::map<std::string, std::string> &default_map) {
+    for (auto child : node.children()) {
+        std::string name = child.attribute("name").value();
+        if (name == "lightGroup" || name == "light_group") {
+            return parse_string(child.attribute("value").value(), default_map);
+        }
+    }
+    if (!id.empty()) {
+        return id;
+    }
+    return "light" + std::to_string(light_id);
+}
+
 Shape parse_shape(pugi::xml_node node,
                   std::vector<Material> &materials,
                   std::map<std::string /* name id */, int /* index id */> &material_map,
@@ -1181,6 +1435,7 @@ Shape parse_shape(pugi::xml_node node,
                   std::vector<Medium> &media,
                   std::map<std::string /* name id */, int /* index id */> &medium_map,
                   std::vector<Light> &lights,
+                  std::vector<std::string> &light_groups,
                   const std::vector<Shape> &shapes,
                   const std::map<std::string, std::string> &default_map) {
     int material_id = -1;
@@ -1301,7 +1556,6 @@ Shape parse_shape(pugi::xml_node node,
         }
     } else if (type == "ply") {
         std::string filename;
-        int shape_index = 0;
         Matrix4x4 to_world = Matrix4x4::identity();
         bool face_normals = false;
         for (auto child : node.children()) {
@@ -1312,8 +1566,6 @@ Shape parse_shape(pugi::xml_node node,
                 if (std::string(child.name()) == "transform") {
                     to_world = parse_transform(child, default_map);
                 }
-            } else if (name == "shapeIndex" || name == "shape_index") {
-                shape_index = parse_integer(child.attribute("value").value(), default_map);
             } else if (name == "faceNormals" || name == "face_normals") {
                 face_normals = parse_boolean(
                     child.attribute("value").value(), default_map);
@@ -1396,8 +1648,16 @@ Shape parse_shape(pugi::xml_node node,
                 std::string name = grand_child.attribute("name").value();
                 if (name == "radiance") {
                     radiance = parse_intensity(grand_child, default_map);
+                } else if (name == "solidAngleSampling" || name == "solid_angle_sampling") {
+                    if (TriangleMesh *mesh = std::get_if<TriangleMesh>(&shape)) {
+                        mesh->solid_angle_sampling = parse_boolean(
+                            grand_child.attribute("value").value(), default_map);
+                    }
                 }
             }
+            std::string id = child.attribute("id").empty() ?
+                node.attribute("id").value() : child.attribute("id").value();
+            light_groups.push_back(parse_light_group(child, id, lights.size(), default_map));
             set_area_light_id(shape, lights.size());
             lights.push_back(DiffuseAreaLight{(int)shapes.size() /* shape ID */, radiance});
         }
@@ -1415,6 +1675,7 @@ std::unique_ptr<Scene> parse_scene(pugi::xml_node node, const RTCDevice &embree_
                   c_default_filter,
                   -1 /*medium_id*/);
     std::string filename = c_default_filename;
+    EXROptions exr_options;
     std::vector<Material> materials;
     std::map<std::string /* name id */, int /* index id */> material_map;
     TexturePool texture_pool;
@@ -1423,6 +1684,8 @@ std::unique_ptr<Scene> parse_scene(pugi::xml_node node, const RTCDevice &embree_
     std::map<std::string /* name id */, int /* index id */> medium_map;
     std::vector<Shape> shapes;
     std::vector<Light> lights;
+    // The light group name of each light.
+    std::vector<std::string> light_groups;
     // For <default> tags
     // e.g., <default name="spp" value="4096"/> will map "spp" to "4096"
     std::map<std::string, std::string> default_map;
@@ -1436,9 +1699,11 @@ std::unique_ptr<Scene> parse_scene(pugi::xml_node node, const RTCDevice &embree_
             options = parse_integrator(child, default_map);
         } else if (name == "sensor") {
             ParsedSampler sampler;
-            std::tie(camera, filename, sampler) =
+            std::tie(camera, filename, sampler, exr_options) =
                 parse_sensor(child, media, medium_map, default_map);
             options.samples_per_pixel = sampler.sample_count;
+            options.sampler_type = sampler.type;
+            options.sampler_seed = sampler.seed;
         } else if (name == "bsdf") {
             std::string material_name;
             Material m;
@@ -1457,6 +1722,7 @@ std::unique_ptr<Scene> parse_scene(pugi::xml_node node, const RTCDevice &embree_
                                   media,
                                   medium_map,
                                   lights,
+                                  light_groups,
                                   shapes,
                                   default_map);
             shapes.push_back(s);
@@ -1468,9 +1734,12 @@ std::unique_ptr<Scene> parse_scene(pugi::xml_node node, const RTCDevice &embree_
             texture_map[id] = parse_texture(child, default_map);
         } else if (name == "emitter") {
             std::string type = child.attribute("type").value();
+            light_groups.push_back(parse_light_group(
+                child, child.attribute("id").value(), lights.size(), default_map));
             if (type == "envmap") {
                 std::string filename;
                 Real scale = 1;
+                bool equal_area = false;
                 Matrix4x4 to_world = Matrix4x4::identity();
                 for (auto grand_child : child.children()) {
                     std::string name = grand_child.attribute("name").value();
@@ -1482,19 +1751,29 @@ std::unique_ptr<Scene> parse_scene(pugi::xml_node node, const RTCDevice &embree_
                     } else if (name == "scale") {
                         scale = parse_float(
                             grand_child.attribute("value").value(), default_map);
+                    } else if (name == "equalArea" || name == "equal_area") {
+                        equal_area = parse_boolean(
+                            grand_child.attribute("value").value(), default_map);
                     }
                 }
                 if (filename.size() > 0) {
-                    Texture<Spectrum> t = make_image_spectrum_texture(
-                        "__envmap_texture__", filename, texture_pool, 1, 1);
+                    Texture<Spectrum> t;
+                    if (equal_area) {
+                        // Resample the lat-long image into the equal-area octahedral map.
+                        t = make_image_spectrum_texture(
+                            "__envmap_texture__", latlong_to_equal_area(imread3(filename)),
+                            texture_pool, 1, 1);
+                    } else {
+                        t = make_image_spectrum_texture(
+                            "__envmap_texture__", filename, texture_pool, 1, 1);
+                    }
                     Matrix4x4 to_local = inverse(to_world);
-                    lights.push_back(Envmap{t, to_world, to_local, scale});
+                    lights.push_back(Envmap{t, to_world, to_local, scale, equal_area});
                     envmap_light_id = (int)lights.size() - 1;
                 } else {
                     Error("Filename unspecified for envmap.");
                 }
             } else if (type == "point") {
-                std::cout << "[Warning] converting a point light into a small spherical light." << std::endl;
                 Vector3 position = Vector3{0, 0, 0};
                 Spectrum intensity = make_const_spectrum(1);
                 for (auto grand_child : child.children()) {
@@ -1509,24 +1788,47 @@ std::unique_ptr<Scene> parse_scene(pugi::xml_node node, const RTCDevice &embree_
                         if (!grand_child.attribute("z").empty()) {
                             position.z = parse_float(grand_child.attribute("z").value(), default_map);
                         }
+                    } else if (name == "toWorld" || name == "to_world") {
+                        Matrix4x4 to_world = parse_transform(grand_child, default_map);
+                        position = xform_point(to_world, position);
                     } else if (name == "intensity") {
                         intensity = parse_intensity(grand_child, default_map);
                     }
                 }
-                Shape s = Sphere{{}, position, Real(1e-4)};
-                intensity *= (c_FOURPI / surface_area(s));
-                Material m = Lambertian{
-                    make_constant_spectrum_texture(make_zero_spectrum())};
-                int material_id = materials.size();
-                materials.push_back(m);
-                set_material_id(s, material_id);
-                set_area_light_id(s, lights.size());
-                lights.push_back(DiffuseAreaLight{(int)shapes.size() /* shape ID */, intensity});
-                shapes.push_back(s);
+                lights.push_back(PointLight{position, intensity});
+            } else if (type == "spot") {
+                Matrix4x4 to_world = Matrix4x4::identity();
+                Spectrum intensity = make_const_spectrum(1);
+                Real cutoff_angle = 20; // in degrees
+                Real beam_width = -1; // defaults to 3/4 of the cutoff angle
+                for (auto grand_child : child.children()) {
+                    std::string name = grand_child.attribute("name").value();
+                    if (name == "toWorld" || name == "to_world") {
+                        to_world = parse_transform(grand_child, default_map);
+                    } else if (name == "intensity") {
+                        intensity = parse_intensity(grand_child, default_map);
+                    } else if (name == "cutoffAngle" || name == "cutoff_angle") {
+                        cutoff_angle = parse_float(
+                            grand_child.attribute("value").value(), default_map);
+                    } else if (name == "beamWidth" || name == "beam_width") {
+                        beam_width = parse_float(
+                            grand_child.attribute("value").value(), default_map);
+                    }
+                }
+                if (beam_width < 0) {
+                    beam_width = cutoff_angle * Real(3) / Real(4);
+                }
+                beam_width = min(beam_width, cutoff_angle);
+                Vector3 position = xform_point(to_world, Vector3{0, 0, 0});
+                lights.push_back(SpotLight{position,
+                                           to_world,
+                                           inverse(to_world),
+                                           intensity,
+                                           cos(radians(cutoff_angle)),
+                                           cos(radians(beam_width))});
             } else if (type == "directional") {
-                std::cout << "[Warning] converting a directional light into a small spherical light." << std::endl;
                 Vector3 direction = Vector3{0, 0, 1};
-                Spectrum intensity = make_const_spectrum(1);
+                Spectrum irradiance = make_const_spectrum(1);
                 for (auto grand_child : child.children()) {
                     std::string name = grand_child.attribute("name").value();
                     if (name == "direction") {
@@ -1543,36 +1845,10 @@ std::unique_ptr<Scene> parse_scene(pugi::xml_node node, const RTCDevice &embree_
                         Matrix4x4 to_world = parse_transform(grand_child, default_map);
                         direction = xform_vector(to_world, direction);
                     } else if (name == "irradiance") {
-                        intensity = parse_intensity(grand_child, default_map);
+                        irradiance = parse_intensity(grand_child, default_map);
                     }
                 }
-                direction = normalize(direction);
-                Vector3 tangent, bitangent;
-                std::tie(tangent, bitangent) = coordinate_system(-direction);
-                TriangleMesh mesh;
-                Real length = Real(1e-3);
-                Real dist = Real(1e3);
-                mesh.positions = {
-                    Real(0.5) * length * (-tangent-bitangent) - dist * direction,
-                    Real(0.5) * length * ( tangent-bitangent) - dist * direction,
-                    Real(0.5) * length * ( tangent+bitangent) - dist * direction,
-                    Real(0.5) * length * (-tangent+bitangent) - dist * direction};
-                mesh.indices = {
-                    Vector3i{0, 1, 2}, Vector3i{0, 2, 3}
-                };
-                mesh.normals = {
-                    direction, direction, direction, direction
-                };
-                intensity *= ((dist * dist) / (length * length));
-                Shape s = mesh;
-                Material m = Lambertian{
-                    make_constant_spectrum_texture(make_zero_spectrum())};
-                int material_id = materials.size();
-                materials.push_back(m);
-                set_material_id(s, material_id);
-                set_area_light_id(s, lights.size());
-                lights.push_back(DiffuseAreaLight{(int)shapes.size() /* shape ID */, intensity});
-                shapes.push_back(s);
+                lights.push_back(DirectionalLight{normalize(direction), irradiance});
             } else {
                 Error(std::string("Unknown emitter type:") + type);
             }
@@ -1586,7 +1862,7 @@ std::unique_ptr<Scene> parse_scene(pugi::xml_node node, const RTCDevice &embree_
             }
         }
     }
-    return std::make_unique<Scene>(
+    std::unique_ptr<Scene> scene = std::make_unique<Scene>(
                 embree_device,
                 camera,
                 materials,
@@ -1596,7 +1872,19 @@ std::unique_ptr<Scene> parse_scene(pugi::xml_node node, const RTCDevice &embree_
                 envmap_light_id,
                 texture_pool,
                 options,
-                filename);
+                filename,
+                exr_options);
+    // Number the light groups in the order they appear.
+    std::map<std::string, int> light_group_map;
+    for (const std::string &group : light_groups) {
+        auto it = light_group_map.find(group);
+        if (it == light_group_map.end()) {
+            it = light_group_map.emplace(group, (int)scene->light_group_names.size()).first;
+            scene->light_group_names.push_back(group);
+        }
+        scene->light_group_ids.push_back(it->second);
+    }
+    return scene;
 }
 
 std::unique_ptr<Scene> parse_scene(const fs::path &filename, const RTCDevice &embree_device) {
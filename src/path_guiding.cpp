@@ -0,0 +1,279 @@
+#include "path_guiding.h"
+
+/// Spatial leaves are split when they receive more than
+/// c_stree_threshold * sqrt(2^iteration) samples in a pass. Müller et al. use 12000,
+/// but we render much smaller images, so we split more eagerly.
+constexpr Real c_stree_threshold = Real(4000);
+/// D-tree nodes holding more than this fraction of the energy are subdivided.
+constexpr Real c_dtree_threshold = Real(0.01);
+constexpr int c_dtree_max_depth = 20;
+
+// C++17 does not have fetch_add for floating point atomics.
+inline void atomic_add(std::atomic<Real> &a, Real v) {
+    Real current = a.load(std::memory_order_relaxed);
+    while (!a.compare_exchange_weak(current, current + v, std::memory_order_relaxed)) {
+    }
+}
+
+/// Map a direction to the cylindrical coordinates in [0, 1]^2.
+inline Vector2 dir_to_canonical(const Vector3 &dir) {
+    Real cos_theta = std::clamp(dir.z, Real(-1), Real(1));
+    Real phi = atan2(dir.y, dir.x);
+    if (phi < 0) {
+        phi += 2 * c_PI;
+    }
+    return Vector2{std::clamp((cos_theta + 1) / 2, Real(0), Real(1)),
+                   std::clamp(phi * c_INVTWOPI, Real(0), Real(1))};
+}
+
+inline Vector3 canonical_to_dir(const Vector2 &p) {
+    Real cos_theta = 2 * p.x - 1;
+    Real sin_theta = sqrt(max(1 - cos_theta * cos_theta, Real(0)));
+    Real phi = 2 * c_PI * p.y;
+    return Vector3{sin_theta * cos(phi), sin_theta * sin(phi), cos_theta};
+}
+
+SDTree make_sd_tree(const Vector3 &center, Real radius) {
+    SDTree sd_tree;
+    // Slightly enlarge the box so that points on the boundary are inside.
+    Real r = radius * Real(1.01);
+    sd_tree.lower = center - Vector3{r, r, r};
+    sd_tree.upper = center + Vector3{r, r, r};
+    STreeNode root;
+    root.dtree_id = 0;
+    sd_tree.nodes.push_back(root);
+    sd_tree.dtrees.push_back(DTreeWrapper{});
+    return sd_tree;
+}
+
+int lookup_dtree_id(const SDTree &sd_tree, const Vector3 &p) {
+    Vector3 q = (p - sd_tree.lower) / (sd_tree.upper - sd_tree.lower);
+    for (int i = 0; i < 3; i++) {
+        q[i] = std::clamp(q[i], Real(0), Real(1));
+    }
+    int node_id = 0;
+    while (!sd_tree.nodes[node_id].is_leaf) {
+        const STreeNode &node = sd_tree.nodes[node_id];
+        int c = q[node.axis] < Real(0.5) ? 0 : 1;
+        q[node.axis] = 2 * q[node.axis] - c;
+        node_id = node.child[c];
+    }
+    return sd_tree.nodes[node_id].dtree_id;
+}
+
+DTreeWrapper &lookup_dtree(SDTree &sd_tree, const Vector3 &p) {
+    return sd_tree.dtrees[lookup_dtree_id(sd_tree, p)];
+}
+
+const DTreeWrapper &lookup_dtree(const SDTree &sd_tree, const Vector3 &p) {
+    return sd_tree.dtrees[lookup_dtree_id(sd_tree, p)];
+}
+
+Vector3 sample(const DTreeWrapper &dtree, const Vector2 &rnd_param) {
+    const DTree &tree = dtree.sampling;
+    Real u = rnd_param.x, v = rnd_param.y;
+    Vector2 origin{0, 0};
+    Real size = 1;
+    int node_id = 0;
+    while (true) {
+        const DTreeNode &node = tree.nodes[node_id];
+        Real s[4];
+        for (int i = 0; i < 4; i++) {
+            s[i] = node.sum[i].load(std::memory_order_relaxed);
+        }
+        Real total = s[0] + s[1] + s[2] + s[3];
+        if (total <= 0) {
+            // No information -- sample the rest uniformly.
+            break;
+        }
+        // Pick the column (x) from the marginal, then the row (y).
+        Real left = (s[0] + s[2]) / total;
+        int x = 0;
+        if (u < left) {
+            u /= left;
+        } else {
+            u = (u - left) / (1 - left);
+            x = 1;
+        }
+        Real column = s[x] + s[x + 2];
+        Real bottom = s[x] / column;
+        int y = 0;
+        if (v < bottom) {
+            v /= bottom;
+        } else {
+            v = (v - bottom) / (1 - bottom);
+            y = 1;
+        }
+        int c = x + 2 * y;
+        size /= 2;
+        origin = origin + Vector2{x * size, y * size};
+        if (node.child[c] == -1) {
+            break;
+        }
+        node_id = node.child[c];
+    }
+    Vector2 p{std::clamp(u, Real(0), Real(1)), std::clamp(v, Real(0), Real(1))};
+    return canonical_to_dir(origin + size * p);
+}
+
+Real pdf(const DTreeWrapper &dtree, const Vector3 &dir) {
+    const DTree &tree = dtree.sampling;
+    Vector2 p = dir_to_canonical(dir);
+    // Density in the unit square
+    Real density = 1;
+    int node_id = 0;
+    while (true) {
+        const DTreeNode &node = tree.nodes[node_id];
+        Real s[4];
+        for (int i = 0; i < 4; i++) {
+            s[i] = node.sum[i].load(std::memory_order_relaxed);
+        }
+        Real total = s[0] + s[1] + s[2] + s[3];
+        if (total <= 0) {
+            break;
+        }
+        int x = p.x < Real(0.5) ? 0 : 1;
+        int y = p.y < Real(0.5) ? 0 : 1;
+        int c = x + 2 * y;
+        density *= 4 * s[c] / total;
+        if (node.child[c] == -1 || density <= 0) {
+            break;
+        }
+        p = Vector2{2 * p.x - x, 2 * p.y - y};
+        node_id = node.child[c];
+    }
+    // The cylindrical mapping preserves area: the unit square maps to 4pi steradians.
+    return density / (4 * c_PI);
+}
+
+void record_radiance(DTreeWrapper &dtree, const Vector3 &dir, Real value) {
+    dtree.num_samples.fetch_add(1, std::memory_order_relaxed);
+    if (!(value > 0) || !std::isfinite(value)) {
+        return;
+    }
+    DTree &tree = dtree.building;
+    Vector2 p = dir_to_canonical(dir);
+    int node_id = 0;
+    while (true) {
+        DTreeNode &node = tree.nodes[node_id];
+        int x = p.x < Real(0.5) ? 0 : 1;
+        int y = p.y < Real(0.5) ? 0 : 1;
+        int c = x + 2 * y;
+        if (node.child[c] == -1) {
+            // We only record at the leaves, and sum up the
+            // interior nodes in refine_sd_tree.
+            atomic_add(node.sum[c], value);
+            return;
+        }
+        p = Vector2{2 * p.x - x, 2 * p.y - y};
+        node_id = node.child[c];
+    }
+}
+
+/// Sum up the energy of the leaves into the interior nodes.
+Real build_sums(DTree &tree, int node_id) {
+    Real total = 0;
+    for (int c = 0; c < 4; c++) {
+        int child = tree.nodes[node_id].child[c];
+        if (child != -1) {
+            tree.nodes[node_id].sum[c].store(build_sums(tree, child), std::memory_order_relaxed);
+        }
+        total += tree.nodes[node_id].sum[c].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+/// Create an empty D-tree whose structure adapts to the energy distribution of prev:
+/// regions with more than c_dtree_threshold of the total energy are subdivided,
+/// and the others are collapsed.
+DTree refine_structure(const DTree &prev) {
+    DTree tree;
+    if (prev.total <= 0) {
+        return tree;
+    }
+    struct Item {
+        int node_id; // in tree
+        int prev_node_id; // in prev, -1 if prev is a leaf here
+        Real leaf_energy; // the energy of the leaf if prev_node_id == -1
+        int depth;
+    };
+    std::vector<Item> stack;
+    stack.push_back(Item{0, 0, 0, 1});
+    while (!stack.empty()) {
+        Item item = stack.back();
+        stack.pop_back();
+        for (int c = 0; c < 4; c++) {
+            Real energy;
+            int prev_child = -1;
+            if (item.prev_node_id >= 0) {
+                const DTreeNode &prev_node = prev.nodes[item.prev_node_id];
+                energy = prev_node.sum[c].load(std::memory_order_relaxed);
+                prev_child = prev_node.child[c];
+            } else {
+                // Assume the energy of a leaf is uniformly distributed.
+                energy = item.leaf_energy / 4;
+            }
+            if (energy / prev.total > c_dtree_threshold && item.depth < c_dtree_max_depth) {
+                int child_id = (int)tree.nodes.size();
+                tree.nodes.push_back(DTreeNode{});
+                tree.nodes[item.node_id].child[c] = child_id;
+                stack.push_back(Item{child_id, prev_child, energy, item.depth + 1});
+            }
+        }
+    }
+    return tree;
+}
+
+void refine_sd_tree(SDTree &sd_tree) {
+    for (DTreeWrapper &dtree : sd_tree.dtrees) {
+        dtree.building.total = build_sums(dtree.building, 0);
+        // Compute this before the spatial split below halves the sample counts.
+        int64_t num_samples = dtree.num_samples.load();
+        dtree.radiance_integral = num_samples > 0 ? dtree.building.total / num_samples : Real(0);
+    }
+
+    // Split the spatial leaves with too many samples. The children inherit
+    // copies of the D-trees and half of the samples each.
+    Real threshold = c_stree_threshold * sqrt(pow(Real(2), Real(sd_tree.iteration)));
+    std::vector<int> stack;
+    for (int i = 0; i < (int)sd_tree.nodes.size(); i++) {
+        if (sd_tree.nodes[i].is_leaf) {
+            stack.push_back(i);
+        }
+    }
+    while (!stack.empty()) {
+        int node_id = stack.back();
+        stack.pop_back();
+        int dtree_id = sd_tree.nodes[node_id].dtree_id;
+        int64_t num_samples = sd_tree.dtrees[dtree_id].num_samples.load();
+        if (Real(num_samples) <= threshold) {
+            continue;
+        }
+        sd_tree.dtrees[dtree_id].num_samples.store(num_samples / 2);
+        int new_dtree_id = (int)sd_tree.dtrees.size();
+        sd_tree.dtrees.push_back(sd_tree.dtrees[dtree_id]);
+
+        int axis = sd_tree.nodes[node_id].axis;
+        int child_axis = (axis + 1) % 3;
+        for (int c = 0; c < 2; c++) {
+            STreeNode child;
+            child.axis = child_axis;
+            child.dtree_id = c == 0 ? dtree_id : new_dtree_id;
+            int child_id = (int)sd_tree.nodes.size();
+            sd_tree.nodes.push_back(child);
+            sd_tree.nodes[node_id].child[c] = child_id;
+            stack.push_back(child_id);
+        }
+        sd_tree.nodes[node_id].is_leaf = false;
+        sd_tree.nodes[node_id].dtree_id = -1;
+    }
+
+    // The D-trees we've just built become the sampling distributions, and we
+    // start recording into fresh, refined trees.
+    for (DTreeWrapper &dtree : sd_tree.dtrees) {
+        dtree.sampling = dtree.building;
+        dtree.building = refine_structure(dtree.sampling);
+        dtree.num_samples.store(0);
+    }
+    sd_tree.iteration++;
+}
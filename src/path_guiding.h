@@ -0,0 +1,127 @@
+#pragma once
+
+#include "lajolla.h"
+#include "material.h"
+#include "vector.h"
+#include <array>
+#include <atomic>
+#include <vector>
+
+/// Path guiding data structures following
+/// "Practical Path Guiding for Efficient Light-Transport Simulation" from Müller et al.
+/// We learn the incident radiance field with an "SD-tree": a binary tree over
+/// the scene's bounding box (the S-tree), where each leaf holds a quadtree over
+/// the sphere of directions (the D-tree). The D-trees are parameterized with the
+/// cylindrical (cos(theta), phi) coordinates, which are area preserving, so
+/// a D-tree node's share of the energy is directly its sampling probability.
+///
+/// Rendering alternates between training passes, which record the radiance
+/// estimates of the paths into the "building" D-trees with atomic additions,
+/// and refinement, which turns the building trees into the "sampling" trees
+/// used by the next pass.
+
+/// A node of the directional quadtree. Each of the four children
+/// is either another node (child >= 0) or a leaf (child == -1).
+/// Children are ordered as x + 2 * y in the unit square.
+struct DTreeNode {
+    DTreeNode() {
+        for (int i = 0; i < 4; i++) {
+            sum[i].store(0, std::memory_order_relaxed);
+            child[i] = -1;
+        }
+    }
+    DTreeNode(const DTreeNode &node) {
+        for (int i = 0; i < 4; i++) {
+            sum[i].store(node.sum[i].load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+            child[i] = node.child[i];
+        }
+    }
+    DTreeNode &operator=(const DTreeNode &node) {
+        for (int i = 0; i < 4; i++) {
+            sum[i].store(node.sum[i].load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+            child[i] = node.child[i];
+        }
+        return *this;
+    }
+
+    std::array<std::atomic<Real>, 4> sum;
+    std::array<int, 4> child;
+};
+
+/// A directional quadtree storing the distribution of incident radiance at
+/// a region of the scene. The root covers the whole unit square.
+struct DTree {
+    DTree() : nodes(1) {}
+
+    std::vector<DTreeNode> nodes;
+    // Total energy of the tree. Only valid after refine_sd_tree.
+    Real total = 0;
+};
+
+/// The pair of D-trees stored in an S-tree leaf.
+struct DTreeWrapper {
+    DTreeWrapper() {}
+    DTreeWrapper(const DTreeWrapper &w) :
+        sampling(w.sampling), building(w.building),
+        num_samples(w.num_samples.load(std::memory_order_relaxed)),
+        radiance_integral(w.radiance_integral) {}
+
+    DTree sampling; // frozen during a pass -- used for sampling & pdf
+    DTree building; // receives the radiance records of the current pass
+    std::atomic<int64_t> num_samples{0};
+    // The average of the radiance records of the last pass: it estimates the integral of the
+    // incident radiance (luminance) over the sphere, i.e., the normalization of the sampling tree.
+    Real radiance_integral = 0;
+};
+
+/// A node of the spatial binary tree. Each interior node splits
+/// its box in half along "axis".
+struct STreeNode {
+    bool is_leaf = true;
+    int axis = 0;
+    std::array<int, 2> child = {-1, -1};
+    int dtree_id = -1;
+};
+
+struct SDTree {
+    std::vector<STreeNode> nodes;
+    std::vector<DTreeWrapper> dtrees;
+    // The S-tree covers a cube around the scene.
+    Vector3 lower, upper;
+    // Number of finished training passes.
+    int iteration = 0;
+};
+
+/// Create an SD-tree with a single spatial leaf covering a cube around the bounding sphere.
+SDTree make_sd_tree(const Vector3 &center, Real radius);
+
+/// Find the D-trees of the spatial leaf that contains p.
+DTreeWrapper &lookup_dtree(SDTree &sd_tree, const Vector3 &p);
+const DTreeWrapper &lookup_dtree(const SDTree &sd_tree, const Vector3 &p);
+
+/// Sample a direction from the sampling D-tree given two random numbers.
+Vector3 sample(const DTreeWrapper &dtree, const Vector2 &rnd_param);
+
+/// The solid angle probability density of the sampling above.
+Real pdf(const DTreeWrapper &dtree, const Vector3 &dir);
+
+/// Atomically add a radiance estimate (divided by the pdf of sampling dir)
+/// to the building D-tree. Safe to call from multiple threads during a pass.
+void record_radiance(DTreeWrapper &dtree, const Vector3 &dir, Real value);
+
+/// Called between passes: split the spatial leaves that received enough samples,
+/// turn the building D-trees into the sampling D-trees, and refine
+/// the structure of the building D-trees for the next pass.
+void refine_sd_tree(SDTree &sd_tree);
+
+/// The probability of sampling the BSDF instead of the D-tree at a guided vertex.
+constexpr Real c_guiding_bsdf_sampling_fraction = Real(0.5);
+
+/// Guiding only pays off for materials with broad lobes. Glossy or specular
+/// transmission is better served by BSDF sampling alone.
+inline bool is_guided_material(const Material &material) {
+    return std::get_if<Lambertian>(&material) != nullptr ||
+           std::get_if<RoughPlastic>(&material) != nullptr;
+}
@@ -1,32 +1,213 @@
 #pragma once
 
 #include "scene.h"
-#include "pcg.h"
+#include "aov.h"
+#include "image.h"
+#include "path_guiding.h"
+#include "radiance_cache.h"
+#include "restir.h"
+#include "sampler.h"
+#include "stats.h"
+#include <array>
 
-/// Unidirectional path tracing
+/// The coarse estimates used by "Adjoint-driven Russian Roulette and Splitting" (ADRRS)
+/// from Vorba and Křivánek. The radiance cache (the SD-tree of path guiding) tells us roughly how much
+/// radiance arrives at a path vertex, and the pixel estimate
+/// (from the training passes) tells us how much radiance the pixel receives in total.
+struct ADRRSEstimates {
+    const SDTree *radiance_cache;
+    const Image1 *pixel_estimate; // luminance
+};
+
+/// ADRRS keeps the weights of the paths within a window [lower, s * lower]
+/// around the ideal weight. Vorba and Křivánek use s = 5.
+constexpr Real c_adrrs_window_size = Real(5);
+
+/// What ADRRS does with a path at a vertex: it continues with probability rr_prob
+/// (Russian roulette if below 1), as num_splits paths. The paths then carry
+/// throughput / (rr_prob * num_splits) each, so the expected total weight doesn't change.
+struct ADRRSFactors {
+    Real rr_prob = 1;
+    int num_splits = 1;
+};
+
+/// The ideal weight pixel / adjoint makes the expected contribution of a path equal to
+/// the pixel value, where adjoint is the radiance we expect the path to collect from the vertex,
+/// and pixel is the pixel estimate (both positive). We terminate the paths with a weight
+/// (the luminance of the throughput) below the window around the ideal weight by Russian roulette,
+/// and split the paths above it, into at most max_splits paths.
+inline ADRRSFactors adrrs_factors(Real weight, Real adjoint, Real pixel, int max_splits) {
+    assert(adjoint > 0 && pixel > 0 && max_splits >= 1);
+    Real ideal_weight = pixel / adjoint;
+    Real lower = 2 * ideal_weight / (1 + c_adrrs_window_size);
+    Real upper = c_adrrs_window_size * lower;
+    ADRRSFactors factors;
+    if (weight < lower) {
+        factors.rr_prob = weight / lower;
+    } else if (weight > upper) {
+        // Splitting is the opposite of Russian roulette: each of the
+        // split paths carries 1/num_splits of the weight.
+        factors.num_splits = int(min(ceil(weight / upper), Real(max_splits)));
+    }
+    return factors;
+}
+
+/// A light sample for the next event estimation at a path vertex.
+struct LightSample {
+    int light_id;
+    PointAndNormal point_on_light;
+    Vector3 dir_light;
+    // The geometry term assuming the point is visible.
+    Real G;
+};
+
+/// Picks a light and a point on it for the next event estimation at vertex (4 dimensions of the sampler),
+/// and sets up the shadow ray towards the point.
+inline LightSample sample_light_point(const Scene &scene,
+                                      const PathVertex &vertex,
+                                      Sampler &sampler,
+                                      Ray &shadow_ray) {
+    Vector2 light_uv = next_2d(sampler);
+    Real light_w = next_1d(sampler);
+    Real shape_w = next_1d(sampler);
+    int light_id = sample_light(scene, light_w);
+    const Light &light = scene.lights[light_id];
+    PointAndNormal point_on_light =
+        sample_point_on_light(light, vertex.position, vertex.shading_frame.n,
+                              light_uv, shape_w, scene);
+
+    // Let's compute G.
+    Real G = 0;
+    Vector3 dir_light;
+    // The geometry term is different between directional light sources and
+    // others. Environment maps and directional lights are infinitely far away.
+    if (!is_infinite_light(light)) {
+        dir_light = normalize(point_on_light.position - vertex.position);
+        // If the point on light is occluded, G is 0. So we need to test for occlusion.
+        // To avoid self intersection, we need to set the tnear of the ray
+        // to a small "epsilon". We set the epsilon to be a small constant times the
+        // scale of the scene, which we can obtain through the get_shadow_epsilon() function.
+        shadow_ray = Ray{vertex.position, dir_light,
+                         get_shadow_epsilon(scene),
+                         (1 - get_shadow_epsilon(scene)) *
+                             distance(point_on_light.position, vertex.position)};
+        // geometry term is cosine at v_{i+1} divided by distance squared
+        // this can be derived by the infinitesimal area of a surface projected on
+        // a unit sphere -- it's the Jacobian between the area measure and the solid angle
+        // measure.
+        // Point & spot lights have no surface, so there is no cosine
+        // at the light, and G is just the inverse squared distance.
+        if (is_delta_light(light)) {
+            G = 1 / distance_squared(point_on_light.position, vertex.position);
+        } else {
+            G = max(-dot(dir_light, point_on_light.normal), Real(0)) /
+                distance_squared(point_on_light.position, vertex.position);
+        }
+    } else {
+        // The direction from the envmap (or the directional light)
+        // towards the point is stored in point_on_light.normal.
+        dir_light = -point_on_light.normal;
+        shadow_ray = Ray{vertex.position, dir_light,
+                         get_shadow_epsilon(scene),
+                         infinity<Real>() /* envmaps are infinitely far away */};
+        // We integrate envmaps using the solid angle measure,
+        // so the geometry term is 1.
+        G = 1;
+    }
+    return LightSample{light_id, point_on_light, dir_light, G};
+}
+
+/// The light sample of the first vertex of a path, traced and shaded ahead of path_tracing()
+/// (see batched_path_render in render.cpp). bsdf_eval is only set if the light is visible and G > 0.
+struct PrimaryLightSample {
+    LightSample sample;
+    bool occluded;
+    BSDFEvalRecord bsdf_eval;
+};
+
+/// The optional inputs & outputs of path_tracing(). The defaults give the plain path tracer.
+struct PathTracingOptions {
+    /// If sd_tree is given, we guide the directional sampling with the learned
+    /// incident radiance (see path_guiding.h), and if train_guiding is true,
+    /// we also record the radiance estimates of the path into the SD-tree.
+    SDTree *sd_tree = nullptr;
+    bool train_guiding = false;
+    /// If adrrs is given, we use ADRRS instead of the throughput-based Russian roulette.
+    const ADRRSEstimates *adrrs = nullptr;
+    /// If radiance_cache is given, we either record the radiance of the path at its
+    /// Lambertian vertices into the cache (train_radiance_cache == true), or we stop
+    /// at the first Lambertian vertex after radiance_cache_depth bounces that the cache covers
+    /// (see radiance_cache.h).
+    RadianceCache *radiance_cache = nullptr;
+    bool train_radiance_cache = false;
+    /// If restir_primary is given, we start from its camera ray and first vertex instead of sampling
+    /// the pixel, and use its direct lighting estimate at the first vertex (if any) instead of
+    /// the light sampling and the emission found by the BSDF sampling there (see restir.h).
+    const ReSTIRPrimary *restir_primary = nullptr;
+    /// If primary_light_sample is given, we use it as the light sample of the first vertex
+    /// instead of sampling & tracing one (with one light sample per vertex only).
+    const PrimaryLightSample *primary_light_sample = nullptr;
+    /// If light_group_radiance is given, we also add the radiance coming from each light group
+    /// to light_group_radiance[group] (see RenderOptions::light_groups). The radiance read from
+    /// the radiance cache doesn't belong to any group.
+    Spectrum *light_group_radiance = nullptr;
+    /// If aov is given, we record the first vertex of the path there (see aov.h).
+    AOVRecord *aov = nullptr;
+};
+
+/// Unidirectional path tracing (see PathTracingOptions for the variants).
 Spectrum path_tracing(const Scene &scene,
                       int x, int y, /* pixel coordinates */
-                      pcg32_state &rng) {
+                      Sampler &sampler,
+                      const PathTracingOptions &options = PathTracingOptions{}) {
+    // The guiding & radiance cache records assume a path never splits.
+    assert(!(options.train_guiding && options.adrrs != nullptr));
+    assert(!(options.train_radiance_cache && options.adrrs != nullptr));
     int w = scene.camera.width, h = scene.camera.height;
-    Vector2 screen_pos((x + next_pcg32_real<Real>(rng)) / w,
-                       (y + next_pcg32_real<Real>(rng)) / h);
-    Ray ray = sample_primary(scene.camera, screen_pos);
+    count_stat(Stat::Paths);
+    Ray ray;
     RayDifferential ray_diff = init_ray_differential(w, h);
-
-    std::optional<PathVertex> vertex_ = intersect(scene, ray, ray_diff);
+    std::optional<PathVertex> vertex_;
+    if (options.restir_primary != nullptr) {
+        ray = options.restir_primary->ray;
+        vertex_ = options.restir_primary->vertex;
+    } else {
+        // The first dimensions of a path are for the pixel filter.
+        Vector2 pixel_uv = next_2d(sampler);
+        Vector2 screen_pos((x + pixel_uv.x) / w,
+                           (y + pixel_uv.y) / h);
+        ray = sample_primary(scene.camera, screen_pos);
+        vertex_ = intersect(scene, ray, ray_diff);
+    }
+    if (options.aov != nullptr) {
+        // The caller reuses the record between pixels: reset everything
+        // that we might not write for this path (e.g., the albedo with maxDepth = 1).
+        options.aov->vertex = vertex_;
+        options.aov->depth = vertex_ ? distance(ray.org, vertex_->position) : Real(0);
+        options.aov->albedo = make_zero_spectrum();
+        options.aov->emission = make_zero_spectrum();
+    }
     if (!vertex_) {
         // Hit background. Account for the environment map if needed.
         if (has_envmap(scene)) {
             const Light &envmap = get_envmap(scene);
-            return emission(envmap,
-                            -ray.dir, // pointing outwards from light
-                            ray_diff.spread,
-                            PointAndNormal{}, // dummy parameter for envmap
-                            scene);
+            Spectrum L = emission(envmap,
+                                  -ray.dir, // pointing outwards from light
+                                  ray_diff.spread,
+                                  PointAndNormal{}, // dummy parameter for envmap
+                                  scene);
+            if (options.light_group_radiance != nullptr) {
+                options.light_group_radiance[scene.light_group_ids[scene.envmap_light_id]] += L;
+            }
+            if (options.aov != nullptr) {
+                options.aov->emission = L;
+            }
+            return L;
         }
         return make_zero_spectrum();
     }
     PathVertex vertex = *vertex_;
+    count_stat(Stat::PathVertices);
 
     Spectrum radiance = make_zero_spectrum();
     // A path's contribution is 
@@ -52,118 +233,238 @@ Spectrum path_tracing(const Scene &scene,
     // path contribution is crucial for many bounces of refraction.
     Real eta_scale = Real(1);
 
+    // For training the path guiding, we store the vertices where we sampled a direction,
+    // together with the path throughput up to and including that sampling,
+    // and the radiance we collected after it. After the path ends, radiance / throughput
+    // is the estimate of the incident radiance along the direction.
+    struct GuidingRecord {
+        DTreeWrapper *dtree;
+        Vector3 dir;
+        Spectrum throughput;
+        Spectrum radiance;
+        Real pdf;
+    };
+    constexpr int c_max_guiding_records = 32;
+    std::array<GuidingRecord, c_max_guiding_records> guiding_records;
+    int num_guiding_records = 0;
+    // Same for the radiance cache, except that we record the outgoing radiance of a vertex:
+    // the throughput doesn't include the BSDF at the vertex.
+    struct RadianceCacheRecord {
+        int entry_id;
+        Spectrum throughput;
+        Spectrum radiance;
+        Spectrum reflectance;
+    };
+    constexpr int c_max_radiance_cache_records = 32;
+    std::array<RadianceCacheRecord, c_max_radiance_cache_records> radiance_cache_records;
+    int num_radiance_cache_records = 0;
+    // light_id is the light the contribution comes from (-1 if we don't know).
+    auto add_radiance = [&](const Spectrum &contrib, int light_id) {
+        radiance += contrib;
+        if (options.light_group_radiance != nullptr && light_id >= 0) {
+            options.light_group_radiance[scene.light_group_ids[light_id]] += contrib;
+        }
+        for (int i = 0; i < num_guiding_records; i++) {
+            guiding_records[i].radiance += contrib;
+        }
+        for (int i = 0; i < num_radiance_cache_records; i++) {
+            radiance_cache_records[i].radiance += contrib;
+        }
+    };
+
     // We hit a light immediately. 
     // This path has only two vertices and has contribution
     // C = W(v0, v1) * G(v0, v1) * L(v0, v1)
     if (is_light(scene.shapes[vertex.shape_id])) {
-        radiance += current_path_throughput *
-            emission(vertex, -ray.dir, scene);
+        Spectrum L = current_path_throughput * emission(vertex, -ray.dir, scene);
+        add_radiance(L, get_area_light_id(scene.shapes[vertex.shape_id]));
+        if (options.aov != nullptr) {
+            options.aov->emission = L;
+        }
     }
 
+    // With ADRRS, a path can split into multiple paths at a vertex. We trace them
+    // one after another, and keep the states of the paths waiting to be traced here.
+    struct PathState {
+        Ray ray;
+        RayDifferential ray_diff;
+        PathVertex vertex;
+        Spectrum throughput;
+        Real eta_scale;
+        int num_vertices;
+    };
+    std::array<PathState, c_max_split_paths> split_paths;
+    int num_split_paths = 0;
+    // The number of paths this camera sample has split into so far.
+    int num_paths = 1;
+
     // We iteratively sum up path contributions from paths with different number of vertices
     // If max_depth == -1, we rely on Russian roulette for path termination.
     int max_depth = scene.options.max_depth;
-    for (int num_vertices = 3; max_depth == -1 || num_vertices <= max_depth + 1; num_vertices++) {
-        // We are at v_i, and all the path contribution on and before has been accounted for.
-        // Now we need to somehow generate v_{i+1} to account for paths with more vertices.
-        // In path tracing, we generate two vertices:
-        // 1) we sample a point on the light source (often called "Next Event Estimation")
-        // 2) we randomly trace a ray from the surface point at v_i and hope we hit something.
-        //
-        // The first importance samples L(v_i, v_{i+1}), and the second
-        // importance samples f(v_{i-1}, v_i, v_{i+1}) * G(v_i, v_{i+1})
-        //
-        // We then combine the two sampling strategies to estimate the contribution using weighted average.
-        // Say the contribution of the first sampling is C1 (with probability density p1), 
-        // and the contribution of the second sampling is C2 (with probability density p2,
-        // then we compute the estimate as w1*C1/p1 + w2*C2/p2.
-        //
-        // Assuming the vertices for C1 is v^1, and v^2 for C2,
-        // Eric Veach showed that it is a good idea setting 
-        // w1 = p_1(v^1)^k / (p_1(v^1)^k + p_2(v^1)^k)
-        // w2 = p_2(v^2)^k / (p_1(v^2)^k + p_2(v^2)^k),
-        // where k is some scalar real number, and p_a(v^b) is the probability density of generating
-        // vertices v^b using sampling method "a".
-        // We will set k=2 as suggested by Eric Veach.
-
-        // Finally, we set our "next vertex" in the loop to the v_{i+1} generated
-        // by the second sampling, and update current_path_throughput using
-        // our hemisphere sampling.
-
-        // Let's implement this!
-        const Material &mat = scene.materials[vertex.material_id];
-
-        // First, we sample a point on the light source.
-        // We do this by first picking a light source, then pick a point on it.
-        Vector2 light_uv{next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng)};
-        Real light_w = next_pcg32_real<Real>(rng);
-        Real shape_w = next_pcg32_real<Real>(rng);
-        int light_id = sample_light(scene, light_w);
-        const Light &light = scene.lights[light_id];
-        PointAndNormal point_on_light =
-            sample_point_on_light(light, vertex.position, light_uv, shape_w, scene);
-
-        // Next, we compute w1*C1/p1. We store C1/p1 in C1.
-        Spectrum C1 = make_zero_spectrum();
-        Real w1 = 0;
-        // Remember "current_path_throughput" already stores all the path contribution on and before v_i.
-        // So we only need to compute G(v_{i}, v_{i+1}) * f(v_{i-1}, v_{i}, v_{i+1}) * L(v_{i}, v_{i+1})
-        {
-            // Let's first deal with C1 = G * f * L.
-            // Let's first compute G.
-            Real G = 0;
-            Vector3 dir_light;
-            // The geometry term is different between directional light sources and
-            // others. Currently we only have environment maps as directional light sources.
-            if (!is_envmap(light)) {
-                dir_light = normalize(point_on_light.position - vertex.position);
-                // If the point on light is occluded, G is 0. So we need to test for occlusion.
-                // To avoid self intersection, we need to set the tnear of the ray
-                // to a small "epsilon". We set the epsilon to be a small constant times the
-                // scale of the scene, which we can obtain through the get_shadow_epsilon() function.
-                Ray shadow_ray{vertex.position, dir_light, 
-                               get_shadow_epsilon(scene),
-                               (1 - get_shadow_epsilon(scene)) *
-                                   distance(point_on_light.position, vertex.position)};
-                if (!occluded(scene, shadow_ray)) {
-                    // geometry term is cosine at v_{i+1} divided by distance squared
-                    // this can be derived by the infinitesimal area of a surface projected on
-                    // a unit sphere -- it's the Jacobian between the area measure and the solid angle
-                    // measure.
-                    G = max(-dot(dir_light, point_on_light.normal), Real(0)) /
-                        distance_squared(point_on_light.position, vertex.position);
+    int first_num_vertices = 3;
+    bool resumed_split_path = false;
+    while (true) {
+        for (int num_vertices = first_num_vertices;
+                max_depth == -1 || num_vertices <= max_depth + 1; num_vertices++) {
+            // We are at v_i, and all the path contribution on and before has been accounted for.
+            // Now we need to somehow generate v_{i+1} to account for paths with more vertices.
+            // In path tracing, we generate two vertices:
+            // 1) we sample a point on the light source (often called "Next Event Estimation")
+            // 2) we randomly trace a ray from the surface point at v_i and hope we hit something.
+            //
+            // The first importance samples L(v_i, v_{i+1}), and the second
+            // importance samples f(v_{i-1}, v_i, v_{i+1}) * G(v_i, v_{i+1})
+            //
+            // We then combine the two sampling strategies to estimate the contribution using weighted average.
+            // Say the contribution of the first sampling is C1 (with probability density p1), 
+            // and the contribution of the second sampling is C2 (with probability density p2,
+            // then we compute the estimate as w1*C1/p1 + w2*C2/p2.
+            //
+            // Assuming the vertices for C1 is v^1, and v^2 for C2,
+            // Eric Veach showed that it is a good idea setting 
+            // w1 = p_1(v^1)^k / (p_1(v^1)^k + p_2(v^1)^k)
+            // w2 = p_2(v^2)^k / (p_1(v^2)^k + p_2(v^2)^k),
+            // where k is some scalar real number, and p_a(v^b) is the probability density of generating
+            // vertices v^b using sampling method "a".
+            // We will set k=2 as suggested by Eric Veach.
+
+            // Finally, we set our "next vertex" in the loop to the v_{i+1} generated
+            // by the second sampling, and update current_path_throughput using
+            // our hemisphere sampling.
+
+            // Let's implement this!
+            const Material &mat = scene.materials[vertex.material_id];
+            // Fetch the textures of the material once -- we evaluate the BSDF
+            // and its pdf multiple times at this vertex.
+            MaterialClosure closure = make_closure(mat, vertex, scene.texture_pool);
+            Vector3 dir_view = -ray.dir;
+
+            // Look up the learned incident radiance distribution if we're guiding.
+            // We need the D-tree for recording even in the first training pass,
+            // but we only sample from it after it has been trained once.
+            // (The training passes of ADRRS guide too: they are unbiased either way,
+            // and the guided paths give a better pixel estimate.)
+            DTreeWrapper *dtree = nullptr;
+            if (options.sd_tree != nullptr && is_guided_material(mat)) {
+                dtree = &lookup_dtree(*options.sd_tree, vertex.position);
+            }
+            bool guided = dtree != nullptr && options.sd_tree->iteration > 0;
+            // With guiding, we pick between BSDF sampling and D-tree sampling
+            // (one-sample MIS), so the directional pdf is the mixture of the two.
+            auto directional_pdf = [&](const Vector3 &dir, Real bsdf_pdf) {
+                if (!guided) {
+                    return bsdf_pdf;
+                }
+                return c_guiding_bsdf_sampling_fraction * bsdf_pdf +
+                    (1 - c_guiding_bsdf_sampling_fraction) * pdf(*dtree, dir);
+            };
+
+            // With splitting, we take multiple light samples and BSDF samples at a vertex.
+            // This amortizes the cost of tracing the path prefix up to the vertex
+            // over more light paths (and batches the shadow rays), which pays off when
+            // the variance is dominated by the last bounce (e.g., many lights or noisy shadows).
+            int depth = num_vertices - 2; // v_1 has depth 1
+            if (options.aov != nullptr && depth == 1) {
+                options.aov->albedo = albedo(closure);
+            }
+
+            // The radiance cache only covers the Lambertian surfaces, whose outgoing radiance
+            // doesn't depend on the viewing direction.
+            const LambertianClosure *lambertian = std::get_if<LambertianClosure>(&closure);
+            if (options.radiance_cache != nullptr && lambertian != nullptr) {
+                Vector3 n = dot(dir_view, vertex.shading_frame.n) < 0 ?
+                    -vertex.shading_frame.n : vertex.shading_frame.n;
+                if (options.train_radiance_cache) {
+                    if (num_radiance_cache_records < c_max_radiance_cache_records) {
+                        int entry_id = find_or_insert_entry(*options.radiance_cache, vertex.position, n);
+                        if (entry_id >= 0) {
+                            radiance_cache_records[num_radiance_cache_records++] = RadianceCacheRecord{
+                                entry_id, current_path_throughput, make_zero_spectrum(), lambertian->reflectance};
+                        }
+                    }
+                } else if (depth >= scene.options.radiance_cache_depth) {
+                    if (std::optional<Spectrum> cached =
+                            lookup_radiance(*options.radiance_cache, vertex.position, n)) {
+                        // The cache already includes the direct lighting, so we stop here.
+                        add_radiance(current_path_throughput * lambertian->reflectance * (*cached),
+                                     -1 /* light_id */);
+                        break;
+                    }
                 }
+            }
+            bool split = scene.options.split_depth == -1 || depth <= scene.options.split_depth;
+            int num_nee_samples = split ? scene.options.nee_samples : 1;
+            int num_bsdf_samples = split ? scene.options.bsdf_samples : 1;
+            assert(num_nee_samples >= 1 && num_nee_samples <= c_max_nee_samples);
+            // With n1 light samples and n2 BSDF samples, Veach's multi-sample MIS
+            // (Chapter 9.2.2 of his thesis) weights the strategies by n * p:
+            // w1 = (n1 p1)^2 / ((n1 p1)^2 + (n2 p2)^2), w2 = (n2 p2)^2 / ((n1 p1)^2 + (n2 p2)^2), and
+            // each sample of a strategy is divided by the number of samples of the strategy.
+            auto power_heuristic = [](Real np, Real np_other) {
+                return (np * np) / (np * np + np_other * np_other);
+            };
+
+            // First, we sample points on the light sources.
+            // We do this by first picking a light source, then pick a point on it.
+            // We generate all the light samples before testing them for occlusion,
+            // so that we can trace all the shadow rays in one packet.
+            std::array<LightSample, c_max_nee_samples> light_samples;
+            std::array<Ray, c_max_nee_samples> shadow_rays;
+            std::array<bool, c_max_nee_samples> shadow_occluded;
+            // ReSTIR has already estimated the direct lighting at the first vertex.
+            bool restir_vertex = options.restir_primary != nullptr &&
+                options.restir_primary->direct && depth == 1;
+            if (restir_vertex) {
+                add_radiance(current_path_throughput * (*options.restir_primary->direct),
+                             options.restir_primary->direct_light_id);
+            }
+            // A resumed split path has already done the light sampling before it split.
+            int num_light_samples = resumed_split_path || restir_vertex ? 0 : num_nee_samples;
+            // The radiance we get from the light sampling at this vertex (for ADRRS).
+            Spectrum nee_radiance = make_zero_spectrum();
+            // The first vertex may come with its light sample already traced and shaded
+            // (see PathTracingOptions::primary_light_sample).
+            bool primary_light = options.primary_light_sample != nullptr && depth == 1;
+            if (primary_light && num_light_samples > 0) {
+                assert(num_light_samples == 1);
+                light_samples[0] = options.primary_light_sample->sample;
+                shadow_occluded[0] = options.primary_light_sample->occluded;
             } else {
-                // The direction from envmap towards the point is stored in
-                // point_on_light.normal.
-                dir_light = -point_on_light.normal;
-                // If the point on light is occluded, G is 0. So we need to test for occlusion.
-                // To avoid self intersection, we need to set the tnear of the ray
-                // to a small "epsilon" which we define as c_shadow_epsilon as a global constant.
-                Ray shadow_ray{vertex.position, dir_light, 
-                               get_shadow_epsilon(scene),
-                               infinity<Real>() /* envmaps are infinitely far away */};
-                if (!occluded(scene, shadow_ray)) {
-                    // We integrate envmaps using the solid angle measure,
-                    // so the geometry term is 1.
-                    G = 1;
+                for (int j = 0; j < num_light_samples; j++) {
+                    light_samples[j] = sample_light_point(scene, vertex, sampler, shadow_rays[j]);
                 }
+                occluded(scene, shadow_rays.data(), num_light_samples, shadow_occluded.data());
             }
 
-            // Before we proceed, we first compute the probability density p1(v1)
-            // The probability density for light sampling to sample our point is
-            // just the probability of sampling a light times the probability of sampling a point
-            Real p1 = light_pmf(scene, light_id) *
-                pdf_point_on_light(light, point_on_light, vertex.position, scene);
+            // Next, we compute w1*C1/p1 for each light sample. We store C1/p1 in C1.
+            // Remember "current_path_throughput" already stores all the path contribution on and before v_i.
+            // So we only need to compute G(v_{i}, v_{i+1}) * f(v_{i-1}, v_{i}, v_{i+1}) * L(v_{i}, v_{i+1})
+            for (int j = 0; j < num_light_samples; j++) {
+                const LightSample &light_sample = light_samples[j];
+                const Light &light = scene.lights[light_sample.light_id];
+                const Vector3 &dir_light = light_sample.dir_light;
+                // If the point on light is occluded, G is 0.
+                Real G = shadow_occluded[j] ? Real(0) : light_sample.G;
+
+                // Before we proceed, we first compute the probability density p1(v1)
+                // The probability density for light sampling to sample our point is
+                // just the probability of sampling a light times the probability of sampling a point
+                Real p1 = light_pmf(scene, light_sample.light_id) *
+                    pdf_point_on_light(light, light_sample.point_on_light,
+                                       vertex.position, vertex.shading_frame.n, scene);
 
-            // We don't need to continue the computation if G is 0.
-            // Also sometimes there can be some numerical issue such that we generate
-            // a light path with probability zero
-            if (G > 0 && p1 > 0) {
+                // We don't need to continue the computation if G is 0.
+                // Also sometimes there can be some numerical issue such that we generate
+                // a light path with probability zero
+                if (G <= 0 || p1 <= 0) {
+                    continue;
+                }
                 // Let's compute f (BSDF) next.
-                Vector3 dir_view = -ray.dir;
                 assert(vertex.material_id >= 0);
-                Spectrum f = eval(mat, dir_view, dir_light, vertex, scene.texture_pool);
+                // We also need the pdf of BSDF sampling for MIS later, so evaluate both at once.
+                BSDFEvalRecord bsdf_eval = primary_light ? options.primary_light_sample->bsdf_eval :
+                    eval_with_pdf(closure, dir_view, dir_light, vertex);
+                const Spectrum &f = bsdf_eval.f;
 
                 // Evaluate the emission
                 // We set the footprint to zero since it is not fully clear how
@@ -171,11 +472,11 @@ Spectrum path_tracing(const Scene &scene,
                 // One way is to use a roughness based heuristics, but we have multi-layered BRDFs.
                 // See "Real-time Shading with Filtered Importance Sampling" from Colbert et al.
                 // for the roughness based heuristics.
-                Spectrum L = emission(light, -dir_light, Real(0), point_on_light, scene);
+                Spectrum L = emission(light, -dir_light, Real(0), light_sample.point_on_light, scene);
 
                 // C1 is just a product of all of them!
-                C1 = G * f * L;
-            
+                Spectrum C1 = G * f * L;
+
                 // Next let's compute w1
 
                 // Remember that we want to set
@@ -184,8 +485,7 @@ Spectrum path_tracing(const Scene &scene,
                 // Therefore we only need to account for the generation of the vertex v_{i+1}.
 
                 // The probability density for our hemispherical sampling to sample 
-                Real p2 = pdf_sample_bsdf(
-                    mat, dir_view, dir_light, vertex, scene.texture_pool);
+                Real p2 = directional_pdf(dir_light, bsdf_eval.pdf_fwd);
                 // !!!! IMPORTANT !!!!
                 // In general, p1 and p2 now live in different spaces!!
                 // our BSDF API outputs a probability density in the solid angle measure
@@ -200,126 +500,291 @@ Spectrum path_tracing(const Scene &scene,
                 // we have dA/dS = G).
                 p2 *= G;
 
-                w1 = (p1*p1) / (p1*p1 + p2*p2);
+                // Delta lights can't be hit by BSDF sampling (p2 is effectively zero),
+                // so light sampling gets all the weight.
+                Real w1 = is_delta_light(light) ? Real(1) :
+                    power_heuristic(num_nee_samples * p1, num_bsdf_samples * p2);
                 C1 /= p1;
+                add_radiance(current_path_throughput * C1 * w1 / Real(num_nee_samples),
+                             light_sample.light_id);
+                nee_radiance += C1 * w1 / Real(num_nee_samples);
             }
-        }
-        radiance += current_path_throughput * C1 * w1;
-
-        // Let's do the hemispherical sampling next.
-        Vector3 dir_view = -ray.dir;
-        Vector2 bsdf_rnd_param_uv{next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng)};
-        Real bsdf_rnd_param_w = next_pcg32_real<Real>(rng);
-        std::optional<BSDFSampleRecord> bsdf_sample_ =
-            sample_bsdf(mat,
-                        dir_view,
-                        vertex,
-                        scene.texture_pool,
-                        bsdf_rnd_param_uv,
-                        bsdf_rnd_param_w);
-        if (!bsdf_sample_) {
-            // BSDF sampling failed. Abort the loop.
-            break;
-        }
-        const BSDFSampleRecord &bsdf_sample = *bsdf_sample_;
-        Vector3 dir_bsdf = bsdf_sample.dir_out;
-        // Update ray differentials & eta_scale
-        if (bsdf_sample.eta == 0) {
-            ray_diff.spread = reflect(ray_diff, vertex.mean_curvature, bsdf_sample.roughness);
-        } else {
-            ray_diff.spread = refract(ray_diff, vertex.mean_curvature, bsdf_sample.eta, bsdf_sample.roughness);
-            eta_scale /= (bsdf_sample.eta * bsdf_sample.eta);
-        }
 
-        // Trace a ray towards bsdf_dir. Note that again we have
-        // to have an "epsilon" tnear to prevent self intersection.
-        Ray bsdf_ray{vertex.position, dir_bsdf, get_intersection_epsilon(scene), infinity<Real>()};
-        std::optional<PathVertex> bsdf_vertex = intersect(scene, bsdf_ray);
-
-        // To update current_path_throughput
-        // we need to multiply G(v_{i}, v_{i+1}) * f(v_{i-1}, v_{i}, v_{i+1}) to it
-        // and divide it with the pdf for getting v_{i+1} using hemisphere sampling.
-        Real G;
-        if (bsdf_vertex) {
-            G = fabs(dot(dir_bsdf, bsdf_vertex->geometric_normal)) /
-                distance_squared(bsdf_vertex->position, vertex.position);
-        } else {
-            // We hit nothing, set G to 1 to account for the environment map contribution.
-            G = 1;
-        }
+            // ADRRS decides whether to terminate or split the path at this vertex by comparing
+            // its expected contribution to the pixel estimate. The expected contribution is the
+            // path throughput times the radiance the BSDF sampling below will collect,
+            // which we approximate with the radiance cache.
+            // Paths expected to contribute much less than the pixel value are terminated
+            // by Russian roulette, and paths expected to contribute much more are split,
+            // so that all paths arriving at the pixel carry similar weights.
+            // Vorba and Křivánek decide before the light sampling, but our radiance cache
+            // only records the radiance found by the BSDF sampling (see the guiding records),
+            // so we decide after it. The split paths resume here.
+            // The cache only covers the guided materials, the others use the usual
+            // Russian roulette at the end of the loop.
+            if (options.adrrs != nullptr && is_guided_material(mat) && !resumed_split_path) {
+                const DTreeWrapper &cache = lookup_dtree(*options.adrrs->radiance_cache, vertex.position);
+                // The cache knows the integral of the incident radiance over the sphere.
+                // If it arrives uniformly from the upper hemisphere, the reflected radiance is
+                // albedo * integral / (2 pi). The BSDF towards the normal gives us albedo / pi.
+                Vector3 n = dot(dir_view, vertex.shading_frame.n) < 0 ?
+                    -vertex.shading_frame.n : vertex.shading_frame.n;
+                Real albedo = c_PI * luminance(eval(closure, dir_view, n, vertex));
+                Real adjoint = luminance(nee_radiance) + albedo * cache.radiance_integral / (2 * c_PI);
+                Real pixel = (*options.adrrs->pixel_estimate)(x, y);
+                Real rr_prob = 1;
+                int num_splits = 1;
+                if (adjoint > 0 && pixel > 0) {
+                    ADRRSFactors factors = adrrs_factors(luminance(current_path_throughput), adjoint, pixel,
+                                                         scene.options.max_split_paths - num_paths + 1);
+                    rr_prob = factors.rr_prob;
+                    num_splits = factors.num_splits;
+                } else if (num_vertices - 2 >= scene.options.rr_depth) {
+                    // No estimate -- same as the usual Russian roulette.
+                    rr_prob = min(max((1 / eta_scale) * current_path_throughput), Real(0.95));
+                }
+                if (rr_prob < 1 && next_1d(sampler) > rr_prob) {
+                    // Terminate the path
+                    count_stat(Stat::RussianRouletteTerminations);
+                    break;
+                }
+                current_path_throughput /= (rr_prob * num_splits);
+                for (int i = 1; i < num_splits; i++) {
+                    split_paths[num_split_paths++] = PathState{
+                        ray, ray_diff, vertex, current_path_throughput, eta_scale, num_vertices};
+                }
+                num_paths += num_splits - 1;
+            }
+            resumed_split_path = false;
 
-        Spectrum f = eval(mat, dir_view, dir_bsdf, vertex, scene.texture_pool);
-        Real p2 = pdf_sample_bsdf(mat, dir_view, dir_bsdf, vertex, scene.texture_pool);
-        if (p2 <= 0) {
-            // Numerical issue -- we generated some invalid rays.
-            break;
-        }
+            // Let's do the hemispherical sampling next.
+            auto sample_direction = [&]() -> std::optional<BSDFSampleRecord> {
+                Vector2 bsdf_rnd_param_uv = next_2d(sampler);
+                Real bsdf_rnd_param_w = next_1d(sampler);
+                if (guided && next_1d(sampler) >= c_guiding_bsdf_sampling_fraction) {
+                    // Sample the learned incident radiance. We treat the direction as
+                    // a rough reflection for the ray differentials.
+                    Vector3 dir_guided = sample(*dtree, bsdf_rnd_param_uv);
+                    BSDFEvalRecord bsdf_eval = eval_with_pdf(closure, dir_view, dir_guided, vertex);
+                    return BSDFSampleRecord{
+                        dir_guided, Real(0) /* eta */, Real(1) /* roughness */,
+                        bsdf_eval.f, bsdf_eval.pdf_fwd, bsdf_eval.pdf_rev};
+                }
+                return sample_bsdf(closure,
+                                   dir_view,
+                                   vertex,
+                                   bsdf_rnd_param_uv,
+                                   bsdf_rnd_param_w);
+            };
+            // The geometry term between v_i and the vertex hit by a BSDF sample.
+            auto bsdf_geometry_term = [&](const Vector3 &dir_bsdf,
+                                          const std::optional<PathVertex> &bsdf_vertex) {
+                if (bsdf_vertex) {
+                    return fabs(dot(dir_bsdf, bsdf_vertex->geometric_normal)) /
+                        distance_squared(bsdf_vertex->position, vertex.position);
+                }
+                // We hit nothing, set G to 1 to account for the environment map contribution.
+                return Real(1);
+            };
+            // Now we want to check whether dir_bsdf hit a light source, and
+            // account for the light contribution (C2 & w2 & p2). This returns w2*C2/p2.
+            // p2 should be in the area measure.
+            // There are two possibilities: either we hit an emissive surface,
+            // or we hit an environment map.
+            // We will handle them separately.
+            auto bsdf_sample_emission = [&](const Vector3 &dir_bsdf,
+                                            const std::optional<PathVertex> &bsdf_vertex,
+                                            const Spectrum &f,
+                                            Real G,
+                                            Real p2,
+                                            Real spread) {
+                if (restir_vertex) {
+                    // Already accounted for by ReSTIR.
+                    return make_zero_spectrum();
+                }
+                if (bsdf_vertex && is_light(scene.shapes[bsdf_vertex->shape_id])) {
+                    // G & f are already computed.
+                    Spectrum L = emission(*bsdf_vertex, -dir_bsdf, scene);
+                    Spectrum C2 = G * f * L;
+                    // Next let's compute p1(v2): the probability of the light source sampling
+                    // directly drawing the point corresponds to bsdf_dir.
+                    int light_id = get_area_light_id(scene.shapes[bsdf_vertex->shape_id]);
+                    assert(light_id >= 0);
+                    const Light &light = scene.lights[light_id];
+                    PointAndNormal light_point{bsdf_vertex->position,
+                                               bsdf_vertex->geometric_normal,
+                                               bsdf_vertex->primitive_id};
+                    Real p1 = light_pmf(scene, light_id) *
+                        pdf_point_on_light(light, light_point, vertex.position, vertex.shading_frame.n, scene);
+                    Real w2 = power_heuristic(num_bsdf_samples * p2, num_nee_samples * p1);
+                    return C2 * w2 / p2;
+                } else if (!bsdf_vertex && has_envmap(scene)) {
+                    // G & f are already computed.
+                    const Light &light = get_envmap(scene);
+                    Spectrum L = emission(light,
+                                          -dir_bsdf, // pointing outwards from light
+                                          spread,
+                                          PointAndNormal{Vector3{0, 0, 0}, Vector3{0, 0, 0}}, // dummy parameter for envmap
+                                          scene);
+                    Spectrum C2 = G * f * L;
+                    // Next let's compute p1(v2): the probability of the light source sampling
+                    // directly drawing the direction bsdf_dir.
+                    PointAndNormal light_point{Vector3{0, 0, 0}, -dir_bsdf}; // pointing outwards from light
+                    Real p1 = light_pmf(scene, scene.envmap_light_id) *
+                              pdf_point_on_light(light, light_point, vertex.position, vertex.shading_frame.n, scene);
+                    Real w2 = power_heuristic(num_bsdf_samples * p2, num_nee_samples * p1);
+                    return C2 * w2 / p2;
+                }
+                return make_zero_spectrum();
+            };
 
-        // Remember to convert p2 to area measure!
-        p2 *= G;
-        // note that G cancels out in the division f/p, but we still need
-        // G later for the calculation of w2.
-
-        // Now we want to check whether dir_bsdf hit a light source, and
-        // account for the light contribution (C2 & w2 & p2).
-        // There are two possibilities: either we hit an emissive surface,
-        // or we hit an environment map.
-        // We will handle them separately.
-        if (bsdf_vertex && is_light(scene.shapes[bsdf_vertex->shape_id])) {
-            // G & f are already computed.
-            Spectrum L = emission(*bsdf_vertex, -dir_bsdf, scene);
-            Spectrum C2 = G * f * L;
-            // Next let's compute p1(v2): the probability of the light source sampling
-            // directly drawing the point corresponds to bsdf_dir.
-            int light_id = get_area_light_id(scene.shapes[bsdf_vertex->shape_id]);
-            assert(light_id >= 0);
-            const Light &light = scene.lights[light_id];
-            PointAndNormal light_point{bsdf_vertex->position, bsdf_vertex->geometric_normal};
-            Real p1 = light_pmf(scene, light_id) *
-                pdf_point_on_light(light, light_point, vertex.position, scene);
-            Real w2 = (p2*p2) / (p1*p1 + p2*p2);
-
-            C2 /= p2;
-            radiance += current_path_throughput * C2 * w2;
-        } else if (!bsdf_vertex && has_envmap(scene)) {
-            // G & f are already computed.
-            const Light &light = get_envmap(scene);
-            Spectrum L = emission(light,
-                                  -dir_bsdf, // pointing outwards from light
-                                  ray_diff.spread,
-                                  PointAndNormal{}, // dummy parameter for envmap
-                                  scene);
-            Spectrum C2 = G * f * L;
-            // Next let's compute p1(v2): the probability of the light source sampling
-            // directly drawing the direction bsdf_dir.
-            PointAndNormal light_point{Vector3{0, 0, 0}, -dir_bsdf}; // pointing outwards from light
-            Real p1 = light_pmf(scene, scene.envmap_light_id) *
-                      pdf_point_on_light(light, light_point, vertex.position, scene);
-            Real w2 = (p2*p2) / (p1*p1 + p2*p2);
-
-            C2 /= p2;
-            radiance += current_path_throughput * C2 * w2;
+            // The light a BSDF sample finds (if any), for the light groups.
+            auto bsdf_sample_light_id = [&](const std::optional<PathVertex> &bsdf_vertex) {
+                if (bsdf_vertex) {
+                    return get_area_light_id(scene.shapes[bsdf_vertex->shape_id]);
+                }
+                return scene.envmap_light_id;
+            };
+
+            // With splitting, the BSDF samples except the first one are only used
+            // for finding emission. We handle them before the first one since the radiance
+            // they collect should not be recorded for the guiding record of the first one.
+            for (int j = 1; j < num_bsdf_samples; j++) {
+                std::optional<BSDFSampleRecord> bsdf_sample = sample_direction();
+                if (!bsdf_sample) {
+                    count_stat(Stat::BSDFSampleFailures);
+                    continue;
+                }
+                Vector3 dir_bsdf = bsdf_sample->dir_out;
+                Real p2 = directional_pdf(dir_bsdf, bsdf_sample->pdf_fwd);
+                if (p2 <= 0) {
+                    count_stat(Stat::BSDFSampleFailures);
+                    continue;
+                }
+                Real spread = bsdf_sample->eta == 0 ?
+                    reflect(ray_diff, vertex.mean_curvature, bsdf_sample->roughness) :
+                    refract(ray_diff, vertex.mean_curvature, bsdf_sample->eta, bsdf_sample->roughness);
+                Ray bsdf_ray{vertex.position, dir_bsdf, get_intersection_epsilon(scene), infinity<Real>()};
+                std::optional<PathVertex> bsdf_vertex = intersect(scene, bsdf_ray);
+                Real G = bsdf_geometry_term(dir_bsdf, bsdf_vertex);
+                add_radiance(current_path_throughput *
+                    bsdf_sample_emission(dir_bsdf, bsdf_vertex, bsdf_sample->f, G, p2 * G, spread) /
+                    Real(num_bsdf_samples), bsdf_sample_light_id(bsdf_vertex));
+            }
+
+            // The first BSDF sample continues the path.
+            std::optional<BSDFSampleRecord> bsdf_sample_ = sample_direction();
+            if (!bsdf_sample_) {
+                // BSDF sampling failed. Abort the loop.
+                count_stat(Stat::BSDFSampleFailures);
+                break;
+            }
+            const BSDFSampleRecord &bsdf_sample = *bsdf_sample_;
+            Vector3 dir_bsdf = bsdf_sample.dir_out;
+            // Update ray differentials & eta_scale
+            if (bsdf_sample.eta == 0) {
+                ray_diff.spread = reflect(ray_diff, vertex.mean_curvature, bsdf_sample.roughness);
+            } else {
+                ray_diff.spread = refract(ray_diff, vertex.mean_curvature, bsdf_sample.eta, bsdf_sample.roughness);
+                eta_scale /= (bsdf_sample.eta * bsdf_sample.eta);
+            }
+
+            // Trace a ray towards bsdf_dir. Note that again we have
+            // to have an "epsilon" tnear to prevent self intersection.
+            Ray bsdf_ray{vertex.position, dir_bsdf, get_intersection_epsilon(scene), infinity<Real>()};
+            std::optional<PathVertex> bsdf_vertex = intersect(scene, bsdf_ray);
+
+            // To update current_path_throughput
+            // we need to multiply G(v_{i}, v_{i+1}) * f(v_{i-1}, v_{i}, v_{i+1}) to it
+            // and divide it with the pdf for getting v_{i+1} using hemisphere sampling.
+            Real G = bsdf_geometry_term(dir_bsdf, bsdf_vertex);
+
+            // The BSDF sampling routine has already evaluated the BSDF and the pdf for us.
+            const Spectrum &f = bsdf_sample.f;
+            Real p2 = directional_pdf(dir_bsdf, bsdf_sample.pdf_fwd);
+            if (p2 <= 0) {
+                // Numerical issue -- we generated some invalid rays.
+                count_stat(Stat::BSDFSampleFailures);
+                break;
+            }
+
+            if (options.train_guiding && dtree != nullptr && num_guiding_records < c_max_guiding_records) {
+                Spectrum throughput = current_path_throughput * f / p2;
+                if (max(throughput) > 0) {
+                    guiding_records[num_guiding_records++] =
+                        GuidingRecord{dtree, dir_bsdf, throughput, make_zero_spectrum(), p2};
+                }
+            }
+
+            // Remember to convert p2 to area measure!
+            p2 *= G;
+            // note that G cancels out in the division f/p, but we still need
+            // G later for the calculation of w2.
+
+            add_radiance(current_path_throughput *
+                bsdf_sample_emission(dir_bsdf, bsdf_vertex, f, G, p2, ray_diff.spread) /
+                Real(num_bsdf_samples), bsdf_sample_light_id(bsdf_vertex));
+
+            if (!bsdf_vertex) {
+                // Hit nothing -- can't continue tracing.
+                break;
+            }
+
+            // Update rays/intersection/current_path_throughput/current_pdf
+            // With ADRRS, the next vertex decides whether to terminate the path instead
+            // (see the beginning of the loop), unless the radiance cache doesn't cover its material.
+            bool adrrs_next = options.adrrs != nullptr &&
+                is_guided_material(scene.materials[bsdf_vertex->material_id]);
+            // Russian roulette heuristics
+            Real rr_prob = 1;
+            if (!adrrs_next && num_vertices - 1 >= scene.options.rr_depth) {
+                rr_prob = min(max((1 / eta_scale) * current_path_throughput), Real(0.95));
+                if (next_1d(sampler) > rr_prob) {
+                    // Terminate the path
+                    count_stat(Stat::RussianRouletteTerminations);
+                    break;
+                }
+            }
+
+            ray = bsdf_ray;
+            vertex = *bsdf_vertex;
+            count_stat(Stat::PathVertices);
+            current_path_throughput = current_path_throughput * (G * f) / (p2 * rr_prob);
         }
 
-        if (!bsdf_vertex) {
-            // Hit nothing -- can't continue tracing.
+        if (num_split_paths == 0) {
             break;
         }
+        // Continue with the next split path.
+        const PathState &state = split_paths[--num_split_paths];
+        ray = state.ray;
+        ray_diff = state.ray_diff;
+        vertex = state.vertex;
+        current_path_throughput = state.throughput;
+        eta_scale = state.eta_scale;
+        first_num_vertices = state.num_vertices;
+        resumed_split_path = true;
+    }
 
-        // Update rays/intersection/current_path_throughput/current_pdf
-        // Russian roulette heuristics
-        Real rr_prob = 1;
-        if (num_vertices - 1 >= scene.options.rr_depth) {
-            rr_prob = min(max((1 / eta_scale) * current_path_throughput), Real(0.95));
-            if (next_pcg32_real<Real>(rng) > rr_prob) {
-                // Terminate the path
-                break;
+    for (int i = 0; i < num_guiding_records; i++) {
+        const GuidingRecord &record = guiding_records[i];
+        Spectrum L = make_zero_spectrum();
+        for (int c = 0; c < 3; c++) {
+            if (record.throughput[c] > 0) {
+                L[c] = record.radiance[c] / record.throughput[c];
             }
         }
-
-        ray = bsdf_ray;
-        vertex = *bsdf_vertex;
-        current_path_throughput = current_path_throughput * (G * f) / (p2 * rr_prob);
+        record_radiance(*record.dtree, record.dir, luminance(L) / record.pdf);
+    }
+    for (int i = 0; i < num_radiance_cache_records; i++) {
+        const RadianceCacheRecord &record = radiance_cache_records[i];
+        Spectrum value = make_zero_spectrum();
+        for (int c = 0; c < 3; c++) {
+            if (record.throughput[c] > 0 && record.reflectance[c] > 0) {
+                value[c] = record.radiance[c] / (record.throughput[c] * record.reflectance[c]);
+            }
+        }
+        record_radiance(*options.radiance_cache, record.entry_id, value);
     }
     return radiance;
 }
@@ -9,4 +9,7 @@
 struct PointAndNormal {
 	Vector3 position;
 	Vector3 normal;
+	/// The triangle the point is on, for points on triangle meshes (-1 otherwise).
+	/// The density of a point can depend on its triangle (see triangle_mesh.inl).
+	int primitive_id = -1;
 };
@@ -0,0 +1,132 @@
+#include "profiler.h"
+#include "flexception.h"
+
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#ifndef _WINDOWS
+#include <csignal>
+#include <sys/time.h>
+#endif
+
+constexpr uint32_t c_num_profile_states = uint32_t(1) << c_num_profile_phases;
+
+/// One counter for each combination of phases. The signal handler can only touch
+/// lock-free atomics, so no mutexes or allocations here.
+static std::atomic<uint64_t> profile_samples[c_num_profile_states];
+
+static const char *profile_phase_names[c_num_profile_phases] = {
+    "Camera ray generation",
+    "Intersect",
+    "Shading info",
+    "Shadow ray",
+    "Light sampling",
+    "BSDF sampling",
+    "BSDF evaluation",
+    "Texture evaluation",
+    "Film write"
+};
+
+/// The CPU time of the process between profiler_start() and profiler_stop(), in seconds.
+static Real profile_cpu_time = 0;
+static std::clock_t profile_start_clock;
+
+#ifndef _WINDOWS
+static void profiler_signal_handler(int) {
+    profile_samples[profiler_state].fetch_add(1, std::memory_order_relaxed);
+}
+#endif
+
+void profiler_worker_thread_init() {
+    // Touch the thread-local variable, in case the system creates it lazily:
+    // we don't want that to happen in the signal handler.
+    profiler_state = 0;
+}
+
+void profiler_start() {
+    profile_start_clock = std::clock();
+#ifndef _WINDOWS
+    struct sigaction sa = {};
+    sa.sa_handler = profiler_signal_handler;
+    // Don't make the system calls of the other threads (e.g., writing the image) fail with EINTR.
+    sa.sa_flags = SA_RESTART;
+    sigfillset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, nullptr) != 0) {
+        Error("Failed to install the SIGPROF handler for the profiler.");
+    }
+    struct itimerval timer = {};
+    timer.it_interval.tv_usec = 1000000 / c_profile_sampling_rate;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+        Error("Failed to start the timer for the profiler.");
+    }
+#endif
+}
+
+void profiler_stop() {
+#ifndef _WINDOWS
+    struct itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    // A signal might still be on its way, so we leave the handler installed
+    // (ignoring SIGPROF would be fine too, but the default action kills us).
+#endif
+    profile_cpu_time += Real(std::clock() - profile_start_clock) / CLOCKS_PER_SEC;
+}
+
+void reset_profile() {
+    profile_cpu_time = 0;
+    for (std::atomic<uint64_t> &count : profile_samples) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t get_profile_samples(uint32_t state) {
+    assert(state < c_num_profile_states);
+    return profile_samples[state].load(std::memory_order_relaxed);
+}
+
+/// e.g., "BSDF evaluation / Texture evaluation"
+static std::string profile_state_name(uint32_t state) {
+    if (state == 0) {
+        return "Integrator (untagged)";
+    }
+    std::string name;
+    for (int i = 0; i < c_num_profile_phases; i++) {
+        if (state & (uint32_t(1) << i)) {
+            if (!name.empty()) {
+                name += " / ";
+            }
+            name += profile_phase_names[i];
+        }
+    }
+    return name;
+}
+
+void print_profile(std::ostream &os) {
+    std::vector<std::pair<uint64_t, uint32_t>> entries;
+    uint64_t total = 0;
+    for (uint32_t state = 0; state < c_num_profile_states; state++) {
+        uint64_t count = get_profile_samples(state);
+        if (count > 0) {
+            entries.push_back({count, state});
+            total += count;
+        }
+    }
+    if (total == 0) {
+        os << "Profile: no samples." << std::endl;
+        return;
+    }
+    std::sort(entries.begin(), entries.end(), std::greater<std::pair<uint64_t, uint32_t>>());
+    std::streamsize precision = os.precision();
+    os << "Profile (" << total << " samples, " << std::fixed << std::setprecision(2) <<
+        profile_cpu_time << "s of CPU time):" << std::endl;
+    for (const auto &[count, state] : entries) {
+        os << "  " << std::left << std::setw(56) << profile_state_name(state) << std::right <<
+            std::setw(6) << Real(100) * count / total << "%  (" <<
+            profile_cpu_time * count / total << "s)" << std::endl;
+    }
+    os << std::defaultfloat << std::setprecision(precision);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "lajolla.h"
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+/// A sampling profiler, similar to the one of pbrt-v3: each thread keeps track of which
+/// phases of the rendering it is in (tracing camera rays, intersecting, evaluating the BSDFs, ...)
+/// in a thread-local bit mask, which costs only a couple of instructions per phase.
+/// While profiling, a timer sends us a SIGPROF signal every millisecond or so of CPU time,
+/// and the signal handler counts a sample for the phases of the thread it interrupts.
+/// In the end, the numbers of samples tell us how much of the time we spent in each phase,
+/// without any external tools, e.g., on the machines that render for us.
+///
+/// The phases nest (e.g., texture lookups during a BSDF evaluation), so we count the samples
+/// for each combination of phases. The time in none of the phases is the integrator itself
+/// (or everything else we didn't tag).
+enum class ProfilePhase {
+    CameraRay,
+    Intersect,
+    ShadingInfo,
+    ShadowRay,
+    LightSampling,
+    BSDFSample,
+    BSDFEval,
+    TextureEval,
+    FilmWrite,
+    NumPhases
+};
+
+constexpr int c_num_profile_phases = int(ProfilePhase::NumPhases);
+
+/// How many samples per second (of CPU time) we ask for. The system might round the interval
+/// up to its scheduler tick (e.g., 4ms), so we measure the CPU time separately for the report.
+constexpr int c_profile_sampling_rate = 1000;
+
+/// The phases the calling thread is in, one bit per phase.
+/// It's an inline variable so that the compiler can see that it doesn't need
+/// a dynamic initialization, and accesses it directly.
+inline thread_local uint32_t profiler_state = 0;
+
+/// Tags the thread with a phase until the scope ends, e.g.,
+///     ProfileScope scope(ProfilePhase::Intersect);
+/// If the thread is already in the phase (e.g., a recursion), we leave it to the outer scope.
+class ProfileScope {
+    public:
+    ProfileScope(ProfilePhase phase) : bit(uint32_t(1) << int(phase)) {
+        reset = (profiler_state & bit) == 0;
+        profiler_state |= bit;
+        // Keep the compiler from moving the work before we set the bit
+        // (the signal handler runs on this thread, so we don't need a real fence).
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+    ~ProfileScope() {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        if (reset) {
+            profiler_state &= ~bit;
+        }
+    }
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+    private:
+    uint32_t bit;
+    bool reset;
+};
+
+/// Each thread that we want to profile should call this before profiler_start():
+/// it makes sure the thread-local state exists before a signal handler reads it.
+/// (parallel_init() does this for the worker threads.)
+void profiler_worker_thread_init();
+
+/// Installs the signal handler and starts the timer. Does nothing on Windows,
+/// which doesn't have SIGPROF.
+void profiler_start();
+/// Stops the timer (but keeps the samples and the CPU time for print_profile()).
+void profiler_stop();
+/// Drops all the samples and the CPU time (e.g., between the renderings of multiple scenes).
+void reset_profile();
+
+/// The number of samples we took in exactly the phases in the mask state.
+uint64_t get_profile_samples(uint32_t state);
+
+/// Prints how many of the samples (and roughly how much of the CPU time) each combination
+/// of phases took, from the most expensive one.
+void print_profile(std::ostream &os);
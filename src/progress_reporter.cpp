@@ -0,0 +1,96 @@
+#include "progress_reporter.h"
+#include "intersection.h"
+#include <cstdio>
+
+static std::atomic<ProgressFormat> progress_format{ProgressFormat::Text};
+
+void set_progress_format(ProgressFormat format) {
+    progress_format.store(format);
+}
+
+ProgressReporter::ProgressReporter(uint64_t total_work) :
+        total_work(total_work), work_done(0), samples_done(0) {
+    tick(start_time);
+    start_rays = num_traced_rays();
+    last_rays = start_rays;
+    thread = std::thread([this]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!cv.wait_for(lock, std::chrono::duration<double>(c_progress_report_interval),
+                            [this]() { return exiting; })) {
+            print(false);
+        }
+    });
+}
+
+ProgressReporter::~ProgressReporter() {
+    // In case we leave early (e.g., an exception).
+    stop();
+}
+
+void ProgressReporter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        exiting = true;
+    }
+    cv.notify_one();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void ProgressReporter::done() {
+    stop();
+    work_done.store(total_work, std::memory_order_relaxed);
+    print(true);
+}
+
+void ProgressReporter::print(bool final) {
+    Timer timer = start_time;
+    Real elapsed = tick(timer);
+    uint64_t work = work_done.load(std::memory_order_relaxed);
+    uint64_t samples = samples_done.load(std::memory_order_relaxed);
+    uint64_t rays = num_traced_rays();
+    Real work_ratio = total_work > 0 ? Real(work) / Real(total_work) : Real(1);
+    // We assume the rest of the work goes as fast as what we have done so far.
+    Real eta = work > 0 ? elapsed * Real(total_work - work) / Real(work) : Real(-1);
+    // The current throughput, or the average one at the end.
+    Real interval = final ? elapsed : elapsed - last_time;
+    Real new_rays = Real(rays - (final ? start_rays : last_rays));
+    Real new_samples = Real(samples - (final ? 0 : last_samples));
+    Real mrays_per_sec = interval > 0 ? new_rays / interval / Real(1e6) : Real(0);
+    Real samples_per_sec = interval > 0 ? new_samples / interval : Real(0);
+    last_time = elapsed;
+    last_rays = rays;
+    last_samples = samples;
+
+    if (progress_format.load() == ProgressFormat::JSON) {
+        fprintf(stdout,
+                "{\"work_done\": %llu, \"total_work\": %llu, \"progress\": %.4f, "
+                "\"elapsed\": %.3f, \"eta\": %.3f, \"mrays_per_sec\": %.3f, "
+                "\"samples_per_sec\": %.1f, \"done\": %s}\n",
+                (unsigned long long)work,
+                (unsigned long long)total_work,
+                double(work_ratio),
+                double(elapsed),
+                double(final ? Real(0) : eta),
+                double(mrays_per_sec),
+                double(samples_per_sec),
+                final ? "true" : "false");
+    } else {
+        // Pad the line so that it overwrites the longer lines before it.
+        fprintf(stdout,
+                "\r %.2f Percent Done (%llu / %llu), %.1fs elapsed, ",
+                double(work_ratio * Real(100.0)),
+                (unsigned long long)work,
+                (unsigned long long)total_work,
+                double(elapsed));
+        if (final) {
+            fprintf(stdout, "average ");
+        } else if (eta >= 0) {
+            fprintf(stdout, "ETA %.1fs, ", double(eta));
+        }
+        fprintf(stdout, "%.2f Mrays/s, %.3g samples/s     %s",
+                double(mrays_per_sec), double(samples_per_sec), final ? "\n" : "");
+    }
+    fflush(stdout);
+}
@@ -1,38 +1,67 @@
 #pragma once
 
 #include "lajolla.h"
+#include "timer.h"
+#include <atomic>
+#include <condition_variable>
 #include <mutex>
+#include <thread>
+
+/// How ProgressReporter prints: a line that keeps overwriting itself for humans,
+/// or one JSON object per line for the scripts that watch the renderings, e.g.,
+/// {"work_done": 29, "total_work": 64, "progress": 0.4531, "elapsed": 1.23, "eta": 1.49,
+///  "mrays_per_sec": 12.3, "samples_per_sec": 105000, "done": false}
+/// (The times are in seconds, and eta is -1 before we know anything.)
+enum class ProgressFormat {
+    Text,
+    JSON
+};
+
+/// Applies to all the reporters (e.g., main() sets it from the command line).
+void set_progress_format(ProgressFormat format);
+
+/// We print at most this often (in seconds).
+constexpr Real c_progress_report_interval = Real(0.5);
 
 /// For printing how much work is done for an operation.
 /// The operations are thread-safe so we can safely use this in multi-thread environment.
+/// update() only adds to atomic counters, so the threads that finish their work don't wait
+/// for each other (or for the terminal). A separate thread wakes up periodically and prints
+/// the progress, the elapsed & remaining time, and the throughput: the rays we traced
+/// per second (see num_traced_rays() in intersection.h) and the samples per second
+/// since the last print.
 class ProgressReporter {
     public:
-    ProgressReporter(uint64_t total_work) : total_work(total_work), work_done(0) {
-    }
-    void update(uint64_t num) {
-        std::lock_guard<std::mutex> lock(mutex);
-        work_done += num;
-        Real work_ratio = (Real)work_done / (Real)total_work;
-        fprintf(stdout,
-                "\r %.2f Percent Done (%llu / %llu)",
-                work_ratio * Real(100.0),
-                (unsigned long long)work_done,
-                (unsigned long long)total_work);
-    }
-    void done() {
-        work_done = total_work;
-        fprintf(stdout,
-                "\r %.2f Percent Done (%llu / %llu)\n",
-                Real(100.0),
-                (unsigned long long)work_done,
-                (unsigned long long)total_work);
+    ProgressReporter(uint64_t total_work);
+    ~ProgressReporter();
+
+    /// num is the amount of work we finished, num_samples the number of pixel samples it took.
+    void update(uint64_t num, uint64_t num_samples = 0) {
+        samples_done.fetch_add(num_samples, std::memory_order_relaxed);
+        work_done.fetch_add(num, std::memory_order_relaxed);
     }
+    /// Stops the printing thread and prints the final numbers (with the average throughput).
+    void done();
     uint64_t get_work_done() const {
-        return work_done;
+        return work_done.load(std::memory_order_relaxed);
     }
 
     private:
+    void print(bool final);
+    void stop();
+
     const uint64_t total_work;
-    uint64_t work_done;
+    std::atomic<uint64_t> work_done;
+    std::atomic<uint64_t> samples_done;
+
+    Timer start_time;
+    uint64_t start_rays;
+    // The numbers at the last print, for the current throughput.
+    Real last_time = 0;
+    uint64_t last_rays = 0, last_samples = 0;
+
+    std::thread thread;
     std::mutex mutex;
+    std::condition_variable cv;
+    bool exiting = false;
 };
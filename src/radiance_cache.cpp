@@ -0,0 +1,96 @@
+#include "radiance_cache.h"
+#include "equal_area.h"
+
+// C++17 does not have fetch_add for floating point atomics.
+inline void atomic_add(std::atomic<Real> &a, Real v) {
+    Real current = a.load(std::memory_order_relaxed);
+    while (!a.compare_exchange_weak(current, current + v, std::memory_order_relaxed)) {
+    }
+}
+
+/// http://zimbry.blogspot.ch/2011/09/better-bit-mixing-improving-on.html
+inline uint64_t mix_bits(uint64_t v) {
+    v ^= (v >> 31);
+    v *= 0x7fb5d329728ea185ULL;
+    v ^= (v >> 27);
+    v *= 0x81dadef4bc2dd44dULL;
+    v ^= (v >> 33);
+    return v;
+}
+
+/// Packs the cell coordinates (19 bits each) and the normal bin into a 64-bit key.
+/// We hash the key again to find its slot in the table.
+inline uint64_t entry_key(const RadianceCache &cache, const Vector3 &p, const Vector3 &n) {
+    uint64_t key = 0;
+    for (int i = 0; i < 3; i++) {
+        int64_t c = int64_t(floor(p[i] / cache.cell_size));
+        key = (key << 19) | (uint64_t(c) & ((1 << 19) - 1));
+    }
+    Vector2 uv = equal_area_sphere_to_square(n);
+    int bx = std::clamp(int(uv.x * c_radiance_cache_normal_bins), 0, c_radiance_cache_normal_bins - 1);
+    int by = std::clamp(int(uv.y * c_radiance_cache_normal_bins), 0, c_radiance_cache_normal_bins - 1);
+    key = (key << 6) | uint64_t(by * c_radiance_cache_normal_bins + bx);
+    // Reserve 0 for the empty entries.
+    return key + 1;
+}
+
+RadianceCache make_radiance_cache(Real cell_size, int num_entries) {
+    return RadianceCache{cell_size, std::vector<RadianceCacheEntry>(num_entries)};
+}
+
+int find_or_insert_entry(RadianceCache &cache, const Vector3 &p, const Vector3 &n) {
+    uint64_t key = entry_key(cache, p, n);
+    size_t slot = mix_bits(key) % cache.entries.size();
+    for (int i = 0; i < c_radiance_cache_max_probes; i++) {
+        RadianceCacheEntry &entry = cache.entries[slot];
+        uint64_t current = entry.key.load(std::memory_order_relaxed);
+        if (current == 0) {
+            // Claim the empty entry. If another thread was faster,
+            // current becomes its key, and we check it below.
+            if (entry.key.compare_exchange_strong(current, key, std::memory_order_relaxed)) {
+                return int(slot);
+            }
+        }
+        if (current == key) {
+            return int(slot);
+        }
+        slot = (slot + 1) % cache.entries.size();
+    }
+    return -1;
+}
+
+void record_radiance(RadianceCache &cache, int entry_id, const Spectrum &value) {
+    if (!std::isfinite(value[0]) || !std::isfinite(value[1]) || !std::isfinite(value[2])) {
+        return;
+    }
+    RadianceCacheEntry &entry = cache.entries[entry_id];
+    for (int i = 0; i < 3; i++) {
+        atomic_add(entry.sum[i], value[i]);
+    }
+    entry.count.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::optional<Spectrum> lookup_radiance(const RadianceCache &cache,
+                                        const Vector3 &p,
+                                        const Vector3 &n) {
+    uint64_t key = entry_key(cache, p, n);
+    size_t slot = mix_bits(key) % cache.entries.size();
+    for (int i = 0; i < c_radiance_cache_max_probes; i++) {
+        const RadianceCacheEntry &entry = cache.entries[slot];
+        uint64_t current = entry.key.load(std::memory_order_relaxed);
+        if (current == 0) {
+            return {};
+        }
+        if (current == key) {
+            int count = entry.count.load(std::memory_order_relaxed);
+            if (count < c_radiance_cache_min_samples) {
+                return {};
+            }
+            return Spectrum{entry.sum[0].load(std::memory_order_relaxed),
+                            entry.sum[1].load(std::memory_order_relaxed),
+                            entry.sum[2].load(std::memory_order_relaxed)} / Real(count);
+        }
+        slot = (slot + 1) % cache.entries.size();
+    }
+    return {};
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "lajolla.h"
+#include "spectrum.h"
+#include "vector.h"
+#include <array>
+#include <atomic>
+#include <optional>
+#include <vector>
+
+/// A world-space radiance cache for the diffuse interreflections, in the spirit of
+/// "A Ray Tracing Solution for Diffuse Interreflection" from Ward et al. (irradiance caching)
+/// and the hashed caches of real-time renderers (e.g., "Real-time Global Illumination by
+/// Precomputed Local Reconstruction from Sparse Radiance Probes").
+/// We quantize the positions into cubic cells, and the normals into a few bins
+/// of the equal-area octahedral map (so that the two sides of a wall,
+/// or the walls meeting at a corner, don't share an entry). Each (cell, normal bin)
+/// pair is an entry of a fixed-size hash table with open addressing.
+///
+/// The path tracer populates the cache with the radiance estimates of its own bounces
+/// at the Lambertian vertices (see path_tracing.h). We store the outgoing radiance
+/// divided by the reflectance of the surface, i.e., the irradiance over pi,
+/// so that the textures don't blur into each other. Later paths that reach a Lambertian
+/// vertex after a few bounces then stop and use reflectance * cache instead of tracing
+/// the rest of the path. This is biased: the lighting is averaged over a cell.
+///
+/// All the updates are atomic, so the cache can be filled by multiple threads at the same time.
+
+/// The number of entries of the hash table.
+constexpr int c_radiance_cache_size = 1 << 20;
+/// Number of bins per side of the equal-area map we quantize the normals with.
+constexpr int c_radiance_cache_normal_bins = 4;
+/// We only use an entry after it has received this many records.
+constexpr int c_radiance_cache_min_samples = 16;
+/// Linear probing gives up after this many entries.
+constexpr int c_radiance_cache_max_probes = 16;
+
+struct RadianceCacheEntry {
+    RadianceCacheEntry() {
+        key.store(0, std::memory_order_relaxed);
+        for (int i = 0; i < 3; i++) {
+            sum[i].store(0, std::memory_order_relaxed);
+        }
+        count.store(0, std::memory_order_relaxed);
+    }
+
+    // 0 means the entry is empty.
+    std::atomic<uint64_t> key;
+    std::array<std::atomic<Real>, 3> sum;
+    std::atomic<int> count;
+};
+
+struct RadianceCache {
+    // The width of the cells: the quality/bias knob.
+    // Smaller cells are less biased, but need more samples to fill.
+    Real cell_size;
+    std::vector<RadianceCacheEntry> entries;
+};
+
+RadianceCache make_radiance_cache(Real cell_size, int num_entries = c_radiance_cache_size);
+
+/// Find the entry of the cell at p with normal n, and create it if it doesn't exist.
+/// Returns -1 if the table is too full. Safe to call from multiple threads.
+int find_or_insert_entry(RadianceCache &cache, const Vector3 &p, const Vector3 &n);
+
+/// Atomically add a record of (outgoing radiance / reflectance) to an entry.
+void record_radiance(RadianceCache &cache, int entry_id, const Spectrum &value);
+
+/// Returns the average of the records around p with normal n,
+/// if the entry has received enough records.
+std::optional<Spectrum> lookup_radiance(const RadianceCache &cache,
+                                        const Vector3 &p,
+                                        const Vector3 &n);
@@ -1,12 +1,32 @@
 #include "render.h"
+#include "aov.h"
+#include "bdpt.h"
+#include "bsdf_batch.h"
+#include "denoiser.h"
+#include "film.h"
+#include "flexception.h"
 #include "intersection.h"
 #include "material.h"
 #include "parallel.h"
 #include "path_tracing.h"
 #include "vol_path_tracing.h"
-#include "pcg.h"
 #include "progress_reporter.h"
+#include "restir.h"
+#include "sampler.h"
 #include "scene.h"
+#include "sppm.h"
+#include "stats.h"
+#include "timer.h"
+
+/// Each tile has its own sampler, since samplers have states.
+/// stream_id decides the random number stream of the independent sampler.
+Sampler make_sampler(const Scene &scene, uint64_t stream_id) {
+    return make_sampler(scene.options.sampler_type,
+                        scene.options.samples_per_pixel,
+                        Vector2i{scene.camera.width, scene.camera.height},
+                        scene.options.sampler_seed,
+                        stream_id);
+}
 
 /// Render auxiliary buffers e.g., depth.
 Image3 aux_render(const Scene &scene) {
@@ -68,18 +88,825 @@ Image3 aux_render(const Scene &scene) {
     return img;
 }
 
-Image3 path_render(const Scene &scene) {
+/// The extra layers of path_render: one per light group (see RenderOptions::light_groups),
+/// followed by the AOVs (see aov.h).
+/// The extra memory grows linearly with the number of layers, so we report it.
+std::vector<ImageLayer> make_path_layers(const Scene &scene) {
+    std::vector<ImageLayer> layers;
+    int w = scene.camera.width, h = scene.camera.height;
+    if (scene.options.light_groups) {
+        if (scene.options.radiance_cache_depth >= 1) {
+            Error("Light groups do not support the radiance cache.");
+        }
+        for (const std::string &name : scene.light_group_names) {
+            layers.push_back(ImageLayer{name, Image3(w, h), scene.output_exr_options.pixel_type});
+        }
+    }
+    for (AOVType type : scene.options.aovs) {
+        layers.push_back(ImageLayer{aov_name(type), Image3(w, h), aov_pixel_type(type)});
+    }
+    if (!layers.empty()) {
+        Real mb_per_layer = Real(sizeof(Vector3)) * w * h / (1024 * 1024);
+        std::cout << "Extra layers: " << layers.size() - scene.options.aovs.size() << " light groups, " <<
+            scene.options.aovs.size() << " AOVs, " << mb_per_layer << " MB per layer (" <<
+            mb_per_layer * layers.size() << " MB in total)." << std::endl;
+    }
+    return layers;
+}
+
+/// The light groups are the first layers of path_render.
+int num_light_groups(const Scene &scene) {
+    return scene.options.light_groups ? (int)scene.light_group_names.size() : 0;
+}
+
+/// Adds the AOVs of a sample of pixel (x, y) to their layers.
+/// The IDs only keep the first sample of the pixel. The cost AOVs are recorded separately
+/// (see record_cost_aovs).
+void record_aovs(const Scene &scene,
+                 std::vector<ImageLayer> &layers,
+                 const AOVRecord &record,
+                 int x, int y,
+                 bool first_sample) {
+    int first_layer = num_light_groups(scene);
+    for (int i = 0; i < (int)scene.options.aovs.size(); i++) {
+        AOVType type = scene.options.aovs[i];
+        Image3 &img = layers[first_layer + i].image;
+        if (is_cost_aov(type)) {
+            continue;
+        }
+        if (!is_id_aov(type)) {
+            img(x, y) += aov_value(type, record);
+        } else if (first_sample) {
+            img(x, y) = aov_value(type, record);
+        }
+    }
+}
+
+/// Averages the AOVs of pixel (x, y) over the samples (except for the IDs and the costs).
+void average_aovs(const Scene &scene,
+                  std::vector<ImageLayer> &layers,
+                  int x, int y,
+                  int num_samples) {
+    int first_layer = num_light_groups(scene);
+    for (int i = 0; i < (int)scene.options.aovs.size(); i++) {
+        AOVType type = scene.options.aovs[i];
+        if (!is_id_aov(type) && !is_cost_aov(type)) {
+            layers[first_layer + i].image(x, y) /= Real(num_samples);
+        }
+    }
+}
+
+/// Adds the time and the rays since cost started to the cost AOVs of pixel (x, y).
+/// We add instead of setting them, so that a pixel rendered in several passes
+/// (e.g., the training pass of the radiance cache) gets the cost of all of them.
+void record_cost_aovs(const Scene &scene,
+                      std::vector<ImageLayer> &layers,
+                      const PixelCost &cost,
+                      int x, int y) {
+    int first_layer = num_light_groups(scene);
+    for (int i = 0; i < (int)scene.options.aovs.size(); i++) {
+        AOVType type = scene.options.aovs[i];
+        if (type == AOVType::Time) {
+            layers[first_layer + i].image(x, y) += make_const_spectrum(cost.elapsed());
+        } else if (type == AOVType::RayCount) {
+            layers[first_layer + i].image(x, y) += make_const_spectrum(Real(cost.num_rays()));
+        }
+    }
+}
+
+/// The layer of an AOV of path_render.
+const Image3 &find_aov_layer(const Scene &scene, const std::vector<ImageLayer> &layers, AOVType type) {
+    auto it = std::find(scene.options.aovs.begin(), scene.options.aovs.end(), type);
+    assert(it != scene.options.aovs.end());
+    return layers[num_light_groups(scene) + (it - scene.options.aovs.begin())].image;
+}
+
+/// What the denoiser needs from the samples of path_render, besides the AOVs
+/// and the variance of the pixels (see Film).
+struct DenoiserBuffers {
+    // The samples of the emission the camera rays see directly (see AOVRecord::emission).
+    // We don't denoise it: it is only noisy at the edges of the lights, where
+    // the denoiser would blur the lights into their surroundings.
+    // We only need the means, so we don't track the variance.
+    DenoiserBuffers(int w, int h) : emission(w, h) {}
+
+    Film emission;
+};
+
+/// Resolves the film of path_render and denoises it (see denoiser.h).
+Image3 denoise_path_render(const Scene &scene,
+                           const Film &film,
+                           const std::vector<ImageLayer> &layers,
+                           const DenoiserBuffers &buffers) {
+    Image3 img = film.resolve();
+    Image1 variance = film.resolve_variance();
+    Image3 emission = buffers.emission.resolve();
+    for (int i = 0; i < img.width * img.height; i++) {
+        img(i) = img(i) - emission(i);
+    }
+    Timer timer;
+    tick(timer);
+    denoise(img, variance,
+            find_aov_layer(scene, layers, AOVType::Albedo),
+            find_aov_layer(scene, layers, AOVType::ShadingNormal),
+            find_aov_layer(scene, layers, AOVType::Depth),
+            scene.options.denoise_iterations);
+    std::cout << "Denoising took " << tick(timer) << " seconds." << std::endl;
+    for (int i = 0; i < img.width * img.height; i++) {
+        img(i) += emission(i);
+    }
+    return img;
+}
+
+/// Path tracing with ReSTIR for the direct lighting at the vertices seen by the camera (see restir.h).
+/// ReSTIR needs all the pixels of a neighborhood at once, so unlike path_render, we render
+/// one sample per pixel per pass. Each pass processes the tiles in parallel, and each tile:
+/// 1. traces the camera rays, resamples the initial light candidates of each pixel, and reuses
+///    the reservoir of the previous pass (temporal reuse),
+/// 2. reuses the reservoirs of random neighbors in the tile (spatial reuse),
+/// 3. shades the resampled light sample, and continues the paths with path_tracing().
+/// Each step tests the visibility of the sample it picked, the last one doubles as the shadow ray
+/// of the shading.
+/// The (near) specular surfaces skip the resampling, and path_tracing() does the usual
+/// light & BSDF sampling there.
+/// The reservoirs and the shading points persist across the passes for the temporal reuse.
+/// Since a tile only reads its own pixels, the tiles don't need to synchronize.
+Image3 restir_path_render(const Scene &scene, std::vector<ImageLayer> &layers) {
+    int w = scene.camera.width, h = scene.camera.height;
+    const RenderOptions &options = scene.options;
+    if (options.radiance_cache_depth >= 1) {
+        Error("ReSTIR does not support the radiance cache.");
+    }
+    if (options.rr_strategy == RRStrategy::ADRRS) {
+        Error("ReSTIR does not support ADRRS.");
+    }
+    // The passes interleave the pixels of a tile, so the cost of a pixel is not well defined.
+    if (has_cost_aovs(options.aovs)) {
+        Error("ReSTIR does not support the time and rays AOVs.");
+    }
+    // The denoiser needs the variance of the pixels.
+    Film film(w, h, options.denoise);
+
+    constexpr int tile_size = c_film_tile_size;
+    int num_tiles_x = (w + tile_size - 1) / tile_size;
+    int num_tiles_y = (h + tile_size - 1) / tile_size;
+    int num_tiles = num_tiles_x * num_tiles_y;
+    int spp = options.samples_per_pixel;
+    bool unbiased = !options.restir_biased;
+    // Each step restarts the pixel sample, so we give them fixed ranges of sampler dimensions:
+    // the pixel filter, the candidates, and the temporal reuse (2 reservoirs) come first,
+    // then the spatial reuse (2 for each neighbor we try, and 1 for each reservoir we combine),
+    // then the rest of the path.
+    int resampling_dimensions =
+        2 + c_restir_candidate_dimensions * options.restir_candidates + 2;
+    int spatial_dimensions = 3 * options.restir_spatial_samples + 1;
+
+    std::optional<DenoiserBuffers> denoiser_buffers;
+    if (options.denoise) {
+        denoiser_buffers.emplace(w, h);
+    }
+
+    std::vector<Reservoir> reservoirs(w * h);
+    std::vector<std::optional<ReSTIRShadingPoint>> points(w * h), prev_points(w * h);
+    ProgressReporter reporter(uint64_t(spp) * num_tiles);
+    for (int s = 0; s < spp; s++) {
+        parallel_for([&](const Vector2i &tile) {
+            int tile_id = tile[1] * num_tiles_x + tile[0];
+            // Use a different sampler (rng stream) for each thread and each pass.
+            Sampler sampler = make_sampler(scene, uint64_t(s) * num_tiles + tile_id);
+            int x0 = tile[0] * tile_size;
+            int x1 = min(x0 + tile_size, w);
+            int y0 = tile[1] * tile_size;
+            int y1 = min(y0 + tile_size, h);
+            int tile_w = x1 - x0;
+            std::array<ReSTIRPrimary, tile_size * tile_size> primaries;
+            // The reservoirs before the spatial reuse.
+            std::array<Reservoir, tile_size * tile_size> tile_reservoirs;
+            std::vector<Spectrum> group_radiance(num_light_groups(scene));
+            Spectrum *light_group_radiance = group_radiance.empty() ? nullptr : group_radiance.data();
+            AOVRecord aov_record;
+            AOVRecord *aov = options.aovs.empty() ? nullptr : &aov_record;
+            PathTracingOptions path_options;
+            path_options.light_group_radiance = light_group_radiance;
+            path_options.aov = aov;
+
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    int local_id = (y - y0) * tile_w + (x - x0);
+                    start_pixel_sample(sampler, Vector2i{x, y}, s);
+                    Vector2 pixel_uv = next_2d(sampler);
+                    Vector2 screen_pos((x + pixel_uv.x) / w,
+                                       (y + pixel_uv.y) / h);
+                    Ray ray = sample_primary(scene.camera, screen_pos);
+                    std::optional<PathVertex> vertex = intersect(scene, ray, init_ray_differential(w, h));
+                    primaries[local_id] = ReSTIRPrimary{ray, vertex, {}};
+                    std::optional<ReSTIRShadingPoint> &point = points[y * w + x];
+                    point.reset();
+                    if (vertex) {
+                        const Material &mat = scene.materials[vertex->material_id];
+                        MaterialClosure closure = make_closure(mat, *vertex, scene.texture_pool);
+                        if (!is_near_specular(closure, c_restir_specular_roughness)) {
+                            point = ReSTIRShadingPoint{*vertex, closure, -ray.dir,
+                                                       distance(ray.org, vertex->position)};
+                        }
+                    }
+                    Reservoir r;
+                    if (point) {
+                        r = sample_light_candidates(scene, *point, options.restir_candidates, sampler);
+                        test_visibility(scene, *point, r);
+                        const std::optional<ReSTIRShadingPoint> &prev_point = prev_points[y * w + x];
+                        if (options.restir_temporal && prev_point && is_similar(*point, *prev_point)) {
+                            std::array<Reservoir, 2> rs = {r, reservoirs[y * w + x]};
+                            rs[1].M = min(rs[1].M, c_restir_temporal_max_M * options.restir_candidates);
+                            std::array<const ReSTIRShadingPoint *, 2> ps = {&*point, &*prev_point};
+                            r = combine_reservoirs(scene, *point, rs.data(), ps.data(), 2, unbiased, sampler);
+                            test_visibility(scene, *point, r);
+                        }
+                    }
+                    tile_reservoirs[local_id] = r;
+                }
+            }
+
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    int local_id = (y - y0) * tile_w + (x - x0);
+                    const std::optional<ReSTIRShadingPoint> &point = points[y * w + x];
+                    if (!point || options.restir_spatial_samples == 0) {
+                        reservoirs[y * w + x] = tile_reservoirs[local_id];
+                        continue;
+                    }
+                    start_pixel_sample(sampler, Vector2i{x, y}, s);
+                    skip_dimensions(sampler, resampling_dimensions);
+                    std::array<Reservoir, c_restir_max_spatial_samples + 1> rs;
+                    std::array<const ReSTIRShadingPoint *, c_restir_max_spatial_samples + 1> ps;
+                    rs[0] = tile_reservoirs[local_id];
+                    ps[0] = &*point;
+                    int n = 1;
+                    int radius = options.restir_spatial_radius;
+                    for (int i = 0; i < options.restir_spatial_samples; i++) {
+                        // Pick a random pixel within the radius. The tile boundary clips the neighborhood.
+                        Vector2 offset = next_2d(sampler);
+                        int nx = x + int(floor((2 * offset.x - 1) * radius + Real(0.5)));
+                        int ny = y + int(floor((2 * offset.y - 1) * radius + Real(0.5)));
+                        if (nx < x0 || nx >= x1 || ny < y0 || ny >= y1 || (nx == x && ny == y)) {
+                            continue;
+                        }
+                        const std::optional<ReSTIRShadingPoint> &neighbor = points[ny * w + nx];
+                        if (!neighbor || !is_similar(*point, *neighbor)) {
+                            continue;
+                        }
+                        rs[n] = tile_reservoirs[(ny - y0) * tile_w + (nx - x0)];
+                        ps[n] = &*neighbor;
+                        n++;
+                    }
+                    Reservoir r = combine_reservoirs(scene, *point, rs.data(), ps.data(), n, unbiased, sampler);
+                    test_visibility(scene, *point, r);
+                    reservoirs[y * w + x] = r;
+                }
+            }
+
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    int local_id = (y - y0) * tile_w + (x - x0);
+                    const std::optional<ReSTIRShadingPoint> &point = points[y * w + x];
+                    ReSTIRPrimary &primary = primaries[local_id];
+                    if (point) {
+                        const Reservoir &r = reservoirs[y * w + x];
+                        primary.direct = shade_reservoir(scene, *point, r);
+                        primary.direct_light_id = r.y.light_id;
+                    }
+                    // Restart the sample of the pixel and skip the dimensions of the resampling,
+                    // so that the rest of the path uses fresh dimensions.
+                    start_pixel_sample(sampler, Vector2i{x, y}, s);
+                    skip_dimensions(sampler, resampling_dimensions + spatial_dimensions);
+                    std::fill(group_radiance.begin(), group_radiance.end(), make_zero_spectrum());
+                    path_options.restir_primary = &primary;
+                    Spectrum L = path_tracing(scene, x, y, sampler, path_options);
+                    film.add_sample(x, y, L);
+                    if (denoiser_buffers) {
+                        denoiser_buffers->emission.add_sample(x, y, aov->emission);
+                    }
+                    for (int i = 0; i < (int)group_radiance.size(); i++) {
+                        layers[i].image(x, y) += group_radiance[i];
+                    }
+                    if (aov != nullptr) {
+                        record_aovs(scene, layers, *aov, x, y, s == 0);
+                    }
+                }
+            }
+            reporter.update(1, (x1 - x0) * (y1 - y0));
+        }, Vector2i(num_tiles_x, num_tiles_y));
+        std::swap(points, prev_points);
+    }
+    reporter.done();
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            for (int i = 0; i < num_light_groups(scene); i++) {
+                layers[i].image(x, y) /= Real(spp);
+            }
+            average_aovs(scene, layers, x, y, spp);
+        }
+    }
+    if (denoiser_buffers) {
+        return denoise_path_render(scene, film, layers, *denoiser_buffers);
+    }
+    return film.resolve();
+}
+
+/// Path tracing that shades the light samples of the vertices seen by the camera a tile at a time
+/// (see RenderOptions::batch_bsdf). Like restir_path_render, we render one sample per pixel per pass,
+/// and each tile:
+/// 1. traces the camera rays and samples a light for each vertex they hit,
+/// 2. traces all the shadow rays of the tile in one packet,
+/// 3. sorts the visible samples by material and evaluates the BSDFs of the rough dielectrics
+///    with the batched kernels (see eval_with_pdf_batch), and the others one at a time,
+/// 4. continues the paths with path_tracing(), which uses the shaded samples at the first vertex.
+/// The steps draw the same sampler dimensions as path_tracing() would, so with the samplers
+/// that have dimensions (i.e., not the independent one), the image is the same as path_render's,
+/// up to the rounding of the batched kernels.
+Image3 batched_path_render(const Scene &scene, std::vector<ImageLayer> &layers) {
+    int w = scene.camera.width, h = scene.camera.height;
+    const RenderOptions &options = scene.options;
+    if (options.radiance_cache_depth >= 1) {
+        Error("The batched BSDF evaluation does not support the radiance cache.");
+    }
+    if (options.rr_strategy == RRStrategy::ADRRS) {
+        Error("The batched BSDF evaluation does not support ADRRS.");
+    }
+    if (options.nee_samples > 1 && (options.split_depth == -1 || options.split_depth >= 1)) {
+        Error("The batched BSDF evaluation only supports one light sample at the first vertex.");
+    }
+    // The passes interleave the pixels of a tile, so the cost of a pixel is not well defined.
+    if (has_cost_aovs(options.aovs)) {
+        Error("The batched BSDF evaluation does not support the time and rays AOVs.");
+    }
+    // The denoiser needs the variance of the pixels.
+    Film film(w, h, options.denoise);
+
+    constexpr int tile_size = c_film_tile_size;
+    int num_tiles_x = (w + tile_size - 1) / tile_size;
+    int num_tiles_y = (h + tile_size - 1) / tile_size;
+    int num_tiles = num_tiles_x * num_tiles_y;
+    int spp = options.samples_per_pixel;
+    // path_tracing() only does the light sampling from the third vertex on.
+    bool sample_lights = options.max_depth == -1 || options.max_depth >= 2;
+    // The pixel filter and the light sample.
+    constexpr int primary_dimensions = 2 + 4;
+
+    std::optional<DenoiserBuffers> denoiser_buffers;
+    if (options.denoise) {
+        denoiser_buffers.emplace(w, h);
+    }
+
+    ProgressReporter reporter(uint64_t(spp) * num_tiles);
+    for (int s = 0; s < spp; s++) {
+        parallel_for([&](const Vector2i &tile) {
+            int tile_id = tile[1] * num_tiles_x + tile[0];
+            // Use a different sampler (rng stream) for each thread and each pass.
+            Sampler sampler = make_sampler(scene, uint64_t(s) * num_tiles + tile_id);
+            int x0 = tile[0] * tile_size;
+            int x1 = min(x0 + tile_size, w);
+            int y0 = tile[1] * tile_size;
+            int y1 = min(y0 + tile_size, h);
+            int tile_w = x1 - x0;
+            std::array<ReSTIRPrimary, tile_size * tile_size> primaries;
+            std::array<MaterialClosure, tile_size * tile_size> closures;
+            std::array<PrimaryLightSample, tile_size * tile_size> light_samples;
+            std::array<Ray, tile_size * tile_size> shadow_rays;
+            std::array<bool, tile_size * tile_size> shadow_occluded;
+            // The pixels (local ids) with a light sample, in the order of shadow_rays.
+            std::array<int, tile_size * tile_size> sampled_pixels;
+            int num_samples = 0;
+            std::vector<Spectrum> group_radiance(num_light_groups(scene));
+            Spectrum *light_group_radiance = group_radiance.empty() ? nullptr : group_radiance.data();
+            AOVRecord aov_record;
+            AOVRecord *aov = options.aovs.empty() ? nullptr : &aov_record;
+            PathTracingOptions path_options;
+            path_options.light_group_radiance = light_group_radiance;
+            path_options.aov = aov;
+
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    int local_id = (y - y0) * tile_w + (x - x0);
+                    start_pixel_sample(sampler, Vector2i{x, y}, s);
+                    Vector2 pixel_uv = next_2d(sampler);
+                    Vector2 screen_pos((x + pixel_uv.x) / w,
+                                       (y + pixel_uv.y) / h);
+                    Ray ray = sample_primary(scene.camera, screen_pos);
+                    std::optional<PathVertex> vertex = intersect(scene, ray, init_ray_differential(w, h));
+                    primaries[local_id] = ReSTIRPrimary{ray, vertex, {}};
+                    if (vertex && sample_lights) {
+                        const Material &mat = scene.materials[vertex->material_id];
+                        closures[local_id] = make_closure(mat, *vertex, scene.texture_pool);
+                        light_samples[local_id].sample =
+                            sample_light_point(scene, *vertex, sampler, shadow_rays[num_samples]);
+                        sampled_pixels[num_samples++] = local_id;
+                    }
+                }
+            }
+            occluded(scene, shadow_rays.data(), num_samples, shadow_occluded.data());
+
+            // Only the rough dielectrics are faster with the batched kernels.
+            // The queries point into primaries & closures, which stay put until we finish the tile.
+            thread_local std::vector<BSDFQuery> queries;
+            thread_local std::vector<BSDFEvalRecord> results;
+            thread_local BSDFBatch workspace;
+            queries.clear();
+            for (int i = 0; i < num_samples; i++) {
+                int local_id = sampled_pixels[i];
+                PrimaryLightSample &light_sample = light_samples[local_id];
+                light_sample.occluded = shadow_occluded[i];
+                if (light_sample.occluded || light_sample.sample.G <= 0) {
+                    continue;
+                }
+                const MaterialClosure &closure = closures[local_id];
+                const ReSTIRPrimary &primary = primaries[local_id];
+                Vector3 dir_view = -primary.ray.dir;
+                if (std::holds_alternative<RoughDielectricClosure>(closure)) {
+                    queries.push_back(BSDFQuery{&closure, &*primary.vertex,
+                                                dir_view, light_sample.sample.dir_light});
+                } else {
+                    light_sample.bsdf_eval = eval_with_pdf(
+                        closure, dir_view, light_sample.sample.dir_light, *primary.vertex);
+                }
+            }
+            if (!queries.empty()) {
+                eval_with_pdf_batch(queries, results, workspace);
+                for (int i = 0; i < (int)queries.size(); i++) {
+                    // The queries keep the order of the pixels.
+                    int local_id = int(queries[i].closure - closures.data());
+                    light_samples[local_id].bsdf_eval = results[i];
+                }
+            }
+
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    int local_id = (y - y0) * tile_w + (x - x0);
+                    // Restart the sample of the pixel and skip the dimensions we have used,
+                    // so that the rest of the path uses the same dimensions as in path_render.
+                    start_pixel_sample(sampler, Vector2i{x, y}, s);
+                    skip_dimensions(sampler, primary_dimensions);
+                    std::fill(group_radiance.begin(), group_radiance.end(), make_zero_spectrum());
+                    path_options.restir_primary = &primaries[local_id];
+                    path_options.primary_light_sample = &light_samples[local_id];
+                    Spectrum L = path_tracing(scene, x, y, sampler, path_options);
+                    film.add_sample(x, y, L);
+                    if (denoiser_buffers) {
+                        denoiser_buffers->emission.add_sample(x, y, aov->emission);
+                    }
+                    for (int i = 0; i < (int)group_radiance.size(); i++) {
+                        layers[i].image(x, y) += group_radiance[i];
+                    }
+                    if (aov != nullptr) {
+                        record_aovs(scene, layers, *aov, x, y, s == 0);
+                    }
+                }
+            }
+            reporter.update(1, (x1 - x0) * (y1 - y0));
+        }, Vector2i(num_tiles_x, num_tiles_y));
+    }
+    reporter.done();
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            for (int i = 0; i < num_light_groups(scene); i++) {
+                layers[i].image(x, y) /= Real(spp);
+            }
+            average_aovs(scene, layers, x, y, spp);
+        }
+    }
+    if (denoiser_buffers) {
+        return denoise_path_render(scene, film, layers, *denoiser_buffers);
+    }
+    return film.resolve();
+}
+
+/// The pixel estimate for ADRRS: the luminance of the training passes,
+/// averaged over spp samples.
+/// With only a few samples, it is very noisy, so we blur it a bit with a 3x3 box filter.
+Image1 adrrs_pixel_estimate(const Image3 &img, int spp) {
+    Image1 estimate(img.width, img.height);
+    for (int y = 0; y < img.height; y++) {
+        for (int x = 0; x < img.width; x++) {
+            Real sum = 0;
+            int count = 0;
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    int xx = x + dx, yy = y + dy;
+                    if (xx >= 0 && xx < img.width && yy >= 0 && yy < img.height) {
+                        sum += luminance(img(xx, yy));
+                        count++;
+                    }
+                }
+            }
+            estimate(x, y) = sum / (count * spp);
+        }
+    }
+    return estimate;
+}
+
+/// With the radiance cache (see radiance_cache.h), we first fill the cache with
+/// a training pass using the first quarter of the samples. The training paths are
+/// unbiased, so we keep them in the image. The rest of the samples only read the cache,
+/// which keeps the result independent of the order the threads render the tiles.
+/// ADRRS (see path_tracing.h) needs a prepass too: training passes with 1, 2, 4, ... spp
+/// as in guided_path_render, which learn the SD-tree that ADRRS uses as its radiance cache,
+/// and whose image is the pixel estimate. We keep them in the image as well.
+/// ReSTIR and the batched BSDF evaluation render the passes differently,
+/// see restir_path_render and batched_path_render above.
+/// We also output the radiance of the light groups and the AOVs as layers (see make_path_layers).
+/// The light groups and the AOVs skip the training passes.
+/// The samples go to a Film (see film.h), whose tiles match the tiles we render.
+/// Finally, we denoise the image if RenderOptions::denoise is on, with the variance from the film.
+/// Otherwise the pixels are final as soon as we finish their tile, so we can write them
+/// to the stream right away.
+Image3 path_render(const Scene &scene, std::vector<ImageLayer> &layers, EXRStream *stream) {
+    if (scene.options.denoise && scene.options.samples_per_pixel < 2) {
+        Error("The denoiser needs at least 2 samples per pixel to estimate the variance.");
+    }
+    layers = make_path_layers(scene);
+    if (scene.options.restir) {
+        if (scene.options.batch_bsdf) {
+            Error("ReSTIR does not support the batched BSDF evaluation.");
+        }
+        return restir_path_render(scene, layers);
+    }
+    if (scene.options.batch_bsdf) {
+        return batched_path_render(scene, layers);
+    }
+    int w = scene.camera.width, h = scene.camera.height;
+    // The denoiser needs the variance of the pixels.
+    Film film(w, h, scene.options.denoise);
+
+    constexpr int tile_size = c_film_tile_size;
+    int num_tiles_x = (w + tile_size - 1) / tile_size;
+    int num_tiles_y = (h + tile_size - 1) / tile_size;
+    int spp = scene.options.samples_per_pixel;
+    std::optional<DenoiserBuffers> denoiser_buffers;
+    if (scene.options.denoise) {
+        denoiser_buffers.emplace(w, h);
+    }
+    // The time and rays AOVs (see PixelCost in aov.h).
+    bool record_cost = has_cost_aovs(scene.options.aovs);
+    std::optional<TiledEXRWriter> writer;
+    if (stream != nullptr && !scene.options.denoise) {
+        writer.emplace(stream->filename, film, layers, stream->options);
+    }
+
+    bool adrrs = scene.options.rr_strategy == RRStrategy::ADRRS;
+    if (adrrs && scene.options.radiance_cache_depth >= 1) {
+        Error("ADRRS does not support the radiance cache.");
+    }
+
+    // The work is a pass over a tile, weighted by its samples per pixel,
+    // so that the training passes count too.
+    ProgressReporter reporter(uint64_t(spp) * num_tiles_x * num_tiles_y);
+
+    // Renders the samples [first_sample, first_sample + num_samples) of all pixels
+    // into the film, for training the caches. pass picks the rng streams.
+    auto training_pass = [&](const PathTracingOptions &training_options,
+                             int first_sample, int num_samples, int pass) {
+        parallel_for([&](const Vector2i &tile) {
+            Sampler sampler = make_sampler(scene, (pass + 1) * num_tiles_x * num_tiles_y +
+                                                  tile[1] * num_tiles_x + tile[0]);
+            int x0 = tile[0] * tile_size;
+            int x1 = min(x0 + tile_size, w);
+            int y0 = tile[1] * tile_size;
+            int y1 = min(y0 + tile_size, h);
+            // The denoiser needs the emission of the training samples too.
+            AOVRecord aov_record;
+            AOVRecord *aov = denoiser_buffers ? &aov_record : nullptr;
+            PathTracingOptions path_options = training_options;
+            path_options.aov = aov;
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    std::optional<PixelCost> cost;
+                    if (record_cost) {
+                        cost.emplace();
+                    }
+                    for (int s = first_sample; s < first_sample + num_samples; s++) {
+                        start_pixel_sample(sampler, Vector2i{x, y}, s);
+                        Spectrum L = path_tracing(scene, x, y, sampler, path_options);
+                        film.add_sample(x, y, L);
+                        if (denoiser_buffers) {
+                            denoiser_buffers->emission.add_sample(x, y, aov->emission);
+                        }
+                    }
+                    if (cost) {
+                        record_cost_aovs(scene, layers, *cost, x, y);
+                    }
+                }
+            }
+            reporter.update(num_samples, uint64_t(x1 - x0) * (y1 - y0) * num_samples);
+        }, Vector2i(num_tiles_x, num_tiles_y));
+    };
+
+    std::optional<RadianceCache> radiance_cache;
+    int train_spp = 0;
+    if (scene.options.radiance_cache_depth >= 1) {
+        // By default, the cells are a bit larger than the footprint of a pixel
+        // when the scene fills the screen.
+        Real cell_size = scene.options.radiance_cache_cell_size > 0 ?
+            scene.options.radiance_cache_cell_size : 4 * scene.bounds.radius / max(w, h);
+        radiance_cache.emplace(make_radiance_cache(cell_size));
+        train_spp = max(spp / 4, 1);
+        PathTracingOptions training_options;
+        training_options.radiance_cache = &*radiance_cache;
+        training_options.train_radiance_cache = true;
+        training_pass(training_options, 0, train_spp, 0);
+    }
+
+    std::optional<SDTree> sd_tree;
+    Image1 pixel_estimate;
+    ADRRSEstimates adrrs_estimates;
+    if (adrrs) {
+        sd_tree.emplace(make_sd_tree(scene.bounds.center, scene.bounds.radius));
+        PathTracingOptions training_options;
+        training_options.sd_tree = &*sd_tree;
+        training_options.train_guiding = true;
+        int pass_spp = 1;
+        int pass = 0;
+        // Keep training as long as the final pass gets at least twice the samples of the last training pass.
+        while (spp - train_spp - pass_spp >= 2 * pass_spp) {
+            training_pass(training_options, train_spp, pass_spp, pass);
+            refine_sd_tree(*sd_tree);
+            train_spp += pass_spp;
+            pass_spp *= 2;
+            pass++;
+        }
+        // With too few samples for a prepass, we fall back to the usual Russian roulette.
+        if (train_spp > 0) {
+            pixel_estimate = adrrs_pixel_estimate(film.resolve(), 1);
+            adrrs_estimates = ADRRSEstimates{&*sd_tree, &pixel_estimate};
+        }
+    }
+
+    parallel_for([&](const Vector2i &tile) {
+        // Use a different sampler (rng stream) for each thread.
+        Sampler sampler = make_sampler(scene, tile[1] * num_tiles_x + tile[0]);
+        int x0 = tile[0] * tile_size;
+        int x1 = min(x0 + tile_size, w);
+        int y0 = tile[1] * tile_size;
+        int y1 = min(y0 + tile_size, h);
+        std::vector<Spectrum> group_radiance(num_light_groups(scene));
+        AOVRecord aov_record;
+        AOVRecord *aov = scene.options.aovs.empty() ? nullptr : &aov_record;
+        PathTracingOptions path_options;
+        path_options.radiance_cache = radiance_cache ? &*radiance_cache : nullptr;
+        path_options.adrrs = adrrs && train_spp > 0 ? &adrrs_estimates : nullptr;
+        path_options.light_group_radiance = group_radiance.empty() ? nullptr : group_radiance.data();
+        path_options.aov = aov;
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                std::optional<PixelCost> cost;
+                if (record_cost) {
+                    cost.emplace();
+                }
+                std::fill(group_radiance.begin(), group_radiance.end(), make_zero_spectrum());
+                for (int s = train_spp; s < spp; s++) {
+                    start_pixel_sample(sampler, Vector2i{x, y}, s);
+                    Spectrum L = path_tracing(scene, x, y, sampler, path_options);
+                    film.add_sample(x, y, L);
+                    if (denoiser_buffers) {
+                        denoiser_buffers->emission.add_sample(x, y, aov->emission);
+                    }
+                    if (aov != nullptr) {
+                        record_aovs(scene, layers, *aov, x, y, s == train_spp);
+                    }
+                }
+                for (int i = 0; i < (int)group_radiance.size(); i++) {
+                    layers[i].image(x, y) = group_radiance[i] / Real(spp - train_spp);
+                }
+                if (aov != nullptr) {
+                    average_aovs(scene, layers, x, y, spp - train_spp);
+                }
+                if (cost) {
+                    record_cost_aovs(scene, layers, *cost, x, y);
+                }
+            }
+        }
+        if (writer) {
+            writer->add_pixels(x0, y0, x1, y1);
+        }
+        reporter.update(spp - train_spp, uint64_t(x1 - x0) * (y1 - y0) * (spp - train_spp));
+    }, Vector2i(num_tiles_x, num_tiles_y));
+    reporter.done();
+    if (denoiser_buffers) {
+        return denoise_path_render(scene, film, layers, *denoiser_buffers);
+    }
+    if (writer) {
+        writer->finish();
+        stream->written = true;
+    }
+    return film.resolve();
+}
+
+/// Path tracing with path guiding (see path_guiding.h).
+/// We spend roughly half of the sample budget on training passes with 1, 2, 4, ... spp.
+/// After each training pass, we refine the SD-tree, and then we render the rest of the samples
+/// with the latest SD-tree. Unlike Müller et al., we don't discard the images of the training
+/// passes: they are unbiased too, so we average all samples together.
+/// With ADRRS (see path_tracing.h), the final pass also uses the SD-tree as the radiance cache
+/// and the training passes as the pixel estimate.
+Image3 guided_path_render(const Scene &scene) {
+    int w = scene.camera.width, h = scene.camera.height;
+    Image3 img(w, h);
+
+    constexpr int tile_size = 16;
+    int num_tiles_x = (w + tile_size - 1) / tile_size;
+    int num_tiles_y = (h + tile_size - 1) / tile_size;
+
+    SDTree sd_tree = make_sd_tree(scene.bounds.center, scene.bounds.radius);
+    int spp_left = scene.options.samples_per_pixel;
+    // The passes use consecutive sample indices, so the samplers see
+    // the same sample sequence as if we rendered everything in one pass.
+    // spp_done + spp_left stays samples_per_pixel, so the indices never leave
+    // [0, samples_per_pixel), which is the range the samplers are made for.
+    int spp_done = 0;
+    int pass_spp = 1;
+    int pass = 0;
+    PathTracingOptions path_options;
+    path_options.sd_tree = &sd_tree;
+    path_options.train_guiding = true;
+    // The work is a pass over a tile, weighted by its samples per pixel,
+    // so that the training passes count too.
+    ProgressReporter reporter(uint64_t(scene.options.samples_per_pixel) * num_tiles_x * num_tiles_y);
+    // Keep training as long as the final pass gets at least twice the samples of the last training pass.
+    while (spp_left - pass_spp >= 2 * pass_spp) {
+        parallel_for([&](const Vector2i &tile) {
+            // Use a different sampler (rng stream) for each thread and each pass.
+            Sampler sampler = make_sampler(scene, (pass + 1) * num_tiles_x * num_tiles_y +
+                                                  tile[1] * num_tiles_x + tile[0]);
+            int x0 = tile[0] * tile_size;
+            int x1 = min(x0 + tile_size, w);
+            int y0 = tile[1] * tile_size;
+            int y1 = min(y0 + tile_size, h);
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    for (int s = 0; s < pass_spp; s++) {
+                        start_pixel_sample(sampler, Vector2i{x, y}, spp_done + s);
+                        img(x, y) += path_tracing(scene, x, y, sampler, path_options);
+                    }
+                }
+            }
+            reporter.update(pass_spp, uint64_t(x1 - x0) * (y1 - y0) * pass_spp);
+        }, Vector2i(num_tiles_x, num_tiles_y));
+        refine_sd_tree(sd_tree);
+        spp_left -= pass_spp;
+        spp_done += pass_spp;
+        pass_spp *= 2;
+        pass++;
+    }
+    assert(spp_done + spp_left == scene.options.samples_per_pixel);
+
+    path_options.train_guiding = false;
+    Image1 pixel_estimate;
+    ADRRSEstimates adrrs_estimates;
+    if (scene.options.rr_strategy == RRStrategy::ADRRS && spp_done > 0) {
+        pixel_estimate = adrrs_pixel_estimate(img, spp_done);
+        adrrs_estimates = ADRRSEstimates{&sd_tree, &pixel_estimate};
+        path_options.adrrs = &adrrs_estimates;
+    }
+
+    parallel_for([&](const Vector2i &tile) {
+        // Use a different sampler (rng stream) for each thread.
+        Sampler sampler = make_sampler(scene, tile[1] * num_tiles_x + tile[0]);
+        int x0 = tile[0] * tile_size;
+        int x1 = min(x0 + tile_size, w);
+        int y0 = tile[1] * tile_size;
+        int y1 = min(y0 + tile_size, h);
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                Spectrum radiance = img(x, y);
+                for (int s = 0; s < spp_left; s++) {
+                    start_pixel_sample(sampler, Vector2i{x, y}, spp_done + s);
+                    radiance += path_tracing(scene, x, y, sampler, path_options);
+                }
+                img(x, y) = radiance / Real(scene.options.samples_per_pixel);
+            }
+        }
+        reporter.update(spp_left, uint64_t(x1 - x0) * (y1 - y0) * spp_left);
+    }, Vector2i(num_tiles_x, num_tiles_y));
+    reporter.done();
+    return img;
+}
+
+/// Bidirectional path tracing (see bdpt.h).
+/// Each camera sample also traces a light subpath, which splats to arbitrary pixels,
+/// so we accumulate the splats in a separate image and add them at the end.
+Image3 bdpt_render(const Scene &scene) {
     int w = scene.camera.width, h = scene.camera.height;
     Image3 img(w, h);
+    SplatImage splats(w, h);
 
     constexpr int tile_size = 16;
     int num_tiles_x = (w + tile_size - 1) / tile_size;
     int num_tiles_y = (h + tile_size - 1) / tile_size;
 
+    int spp = scene.options.samples_per_pixel;
     ProgressReporter reporter(num_tiles_x * num_tiles_y);
     parallel_for([&](const Vector2i &tile) {
-        // Use a different rng stream for each thread.
-        pcg32_state rng = init_pcg32(tile[1] * num_tiles_x + tile[0]);
+        // Use a different sampler (rng stream) for each thread.
+        Sampler sampler = make_sampler(scene, tile[1] * num_tiles_x + tile[0]);
         int x0 = tile[0] * tile_size;
         int x1 = min(x0 + tile_size, w);
         int y0 = tile[1] * tile_size;
@@ -87,22 +914,156 @@ Image3 path_render(const Scene &scene) {
         for (int y = y0; y < y1; y++) {
             for (int x = x0; x < x1; x++) {
                 Spectrum radiance = make_zero_spectrum();
-                int spp = scene.options.samples_per_pixel;
                 for (int s = 0; s < spp; s++) {
-                    radiance += path_tracing(scene, x, y, rng);
+                    start_pixel_sample(sampler, Vector2i{x, y}, s);
+                    radiance += bdpt(scene, x, y, sampler, splats);
                 }
                 img(x, y) = radiance / Real(spp);
             }
         }
-        reporter.update(1);
+        reporter.update(1, uint64_t(x1 - x0) * (y1 - y0) * spp);
     }, Vector2i(num_tiles_x, num_tiles_y));
     reporter.done();
+
+    // Each pixel traced spp light subpaths, and the importance of the camera
+    // is normalized over the whole screen (see camera_importance()), so the splats
+    // are averaged over spp too.
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            img(x, y) += splats(x, y) / Real(spp);
+        }
+    }
+    return img;
+}
+
+/// Stochastic progressive photon mapping (see sppm.h).
+/// Each of the samples_per_pixel iterations runs a camera pass, rebuilds the grid of
+/// visible points, traces the photons, then shrinks the radius of each pixel.
+Image3 sppm_render(const Scene &scene) {
+    int w = scene.camera.width, h = scene.camera.height;
+    int num_pixels = w * h;
+    int num_iterations = scene.options.samples_per_pixel;
+    int64_t photons_per_iteration = scene.options.sppm_photons_per_iteration > 0 ?
+        scene.options.sppm_photons_per_iteration : num_pixels;
+    // By default we start with a radius a few times the footprint of a pixel
+    // when the scene fills the screen.
+    Real initial_radius = scene.options.sppm_initial_radius > 0 ?
+        scene.options.sppm_initial_radius : 4 * scene.bounds.radius / max(w, h);
+
+    std::vector<SPPMPixel> pixels(num_pixels);
+    for (SPPMPixel &pixel : pixels) {
+        pixel.radius = initial_radius;
+        pixel.Ld = make_zero_spectrum();
+        pixel.tau = make_zero_spectrum();
+    }
+    SPPMGrid grid(num_pixels);
+    SplatImage phi(w, h);
+    std::vector<std::atomic<int>> num_photons(num_pixels);
+    for (std::atomic<int> &m : num_photons) {
+        m.store(0, std::memory_order_relaxed);
+    }
+
+    constexpr int tile_size = 16;
+    int num_tiles_x = (w + tile_size - 1) / tile_size;
+    int num_tiles_y = (h + tile_size - 1) / tile_size;
+    constexpr int64_t photon_chunk_size = 4096;
+    int64_t num_photon_chunks = (photons_per_iteration + photon_chunk_size - 1) / photon_chunk_size;
+
+    ProgressReporter reporter(num_iterations);
+    for (int iteration = 0; iteration < num_iterations; iteration++) {
+        // 1. Find the visible points.
+        parallel_for([&](const Vector2i &tile) {
+            Sampler sampler = make_sampler(scene, sppm_camera_stream(
+                iteration, tile[1] * num_tiles_x + tile[0], num_tiles_x * num_tiles_y));
+            int x0 = tile[0] * tile_size;
+            int x1 = min(x0 + tile_size, w);
+            int y0 = tile[1] * tile_size;
+            int y1 = min(y0 + tile_size, h);
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    start_pixel_sample(sampler, Vector2i{x, y}, iteration);
+                    sppm_camera_pass(scene, x, y, sampler, pixels[y * w + x]);
+                }
+            }
+        }, Vector2i(num_tiles_x, num_tiles_y));
+
+        // 2. Build the grid. The cells are as wide as the largest diameter,
+        // so each visible point overlaps at most 2x2x2 cells.
+        Real max_radius = 0;
+        for (const SPPMPixel &pixel : pixels) {
+            if (pixel.has_visible_point) {
+                max_radius = max(max_radius, pixel.radius);
+            }
+        }
+        if (max_radius <= 0) {
+            reporter.update(1, num_pixels);
+            continue;
+        }
+        grid.clear();
+        grid.cell_size = 2 * max_radius;
+        parallel_for([&](int64_t pixel_id) {
+            const SPPMPixel &pixel = pixels[pixel_id];
+            if (pixel.has_visible_point) {
+                grid.insert(pixel.visible_point.vertex.position, pixel.radius, (int)pixel_id);
+            }
+        }, num_pixels, 4096);
+
+        // 3. Trace the photons. Each chunk has its own random number stream,
+        // so the result does not depend on the number of threads.
+        parallel_for([&](int64_t chunk) {
+            pcg32_state rng = init_pcg32(sppm_photon_stream(iteration, chunk, num_photon_chunks,
+                                                            num_iterations, num_tiles_x * num_tiles_y),
+                                         scene.options.sampler_seed);
+            int64_t begin = chunk * photon_chunk_size;
+            int64_t end = min(begin + photon_chunk_size, photons_per_iteration);
+            for (int64_t i = begin; i < end; i++) {
+                sppm_trace_photon(scene, pixels, grid, rng, phi, num_photons);
+            }
+        }, num_photon_chunks, 1);
+
+        // 4. Progressive radius reduction (Equations 16.13 & 16.14 of pbrt-v3):
+        // we keep a fraction alpha of the new photons, and shrink the radius so that
+        // the photon density stays the same.
+        parallel_for([&](int64_t pixel_id) {
+            SPPMPixel &pixel = pixels[pixel_id];
+            int M = num_photons[pixel_id].load(std::memory_order_relaxed);
+            int x = int(pixel_id % w), y = int(pixel_id / w);
+            if (M > 0) {
+                Real N_new = pixel.N + c_sppm_alpha * M;
+                Real radius_new = pixel.radius * sqrt(N_new / (pixel.N + M));
+                pixel.tau = (pixel.tau + pixel.visible_point.beta * phi(x, y)) *
+                    (radius_new * radius_new) / (pixel.radius * pixel.radius);
+                pixel.N = N_new;
+                pixel.radius = radius_new;
+                num_photons[pixel_id].store(0, std::memory_order_relaxed);
+                phi.clear(x, y);
+            }
+        }, num_pixels, 4096);
+        reporter.update(1, num_pixels);
+    }
+    reporter.done();
+
+    // The radiance is the average direct lighting, plus the flux of all the photons
+    // that arrived in the final disk around the visible point, divided by its area.
+    Image3 img(w, h);
+    Real total_photons = Real(num_iterations) * Real(photons_per_iteration);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            const SPPMPixel &pixel = pixels[y * w + x];
+            img(x, y) = pixel.Ld / Real(num_iterations) +
+                pixel.tau / (total_photons * c_PI * pixel.radius * pixel.radius);
+        }
+    }
     return img;
 }
 
-Image3 vol_path_render(const Scene &scene) {
+/// The only AOVs of the volumetric path tracer are the costs of the pixels (see PixelCost in aov.h),
+/// since the dense media are often the most expensive pixels.
+Image3 vol_path_render(const Scene &scene, std::vector<ImageLayer> &layers) {
     int w = scene.camera.width, h = scene.camera.height;
     Image3 img(w, h);
+    layers = make_path_layers(scene);
+    bool record_cost = has_cost_aovs(scene.options.aovs);
 
     constexpr int tile_size = 16;
     int num_tiles_x = (w + tile_size - 1) / tile_size;
@@ -125,34 +1086,49 @@ Image3 vol_path_render(const Scene &scene) {
 
     ProgressReporter reporter(num_tiles_x * num_tiles_y);
     parallel_for([&](const Vector2i &tile) {
-        // Use a different rng stream for each thread.
-        pcg32_state rng = init_pcg32(tile[1] * num_tiles_x + tile[0]);
+        // Use a different sampler (rng stream) for each thread.
+        Sampler sampler = make_sampler(scene, tile[1] * num_tiles_x + tile[0]);
         int x0 = tile[0] * tile_size;
         int x1 = min(x0 + tile_size, w);
         int y0 = tile[1] * tile_size;
         int y1 = min(y0 + tile_size, h);
         for (int y = y0; y < y1; y++) {
             for (int x = x0; x < x1; x++) {
+                std::optional<PixelCost> cost;
+                if (record_cost) {
+                    cost.emplace();
+                }
                 Spectrum radiance = make_zero_spectrum();
                 int spp = scene.options.samples_per_pixel;
                 for (int s = 0; s < spp; s++) {
-                    Spectrum L = f(scene, x, y, rng);
+                    start_pixel_sample(sampler, Vector2i{x, y}, s);
+                    Spectrum L = f(scene, x, y, sampler);
                     if (isfinite(L)) {
                         // Hacky: exclude NaNs in the rendering.
                         radiance += L;
+                    } else {
+                        count_stat(Stat::NonFiniteSamples);
                     }
                 }
                 img(x, y) = radiance / Real(spp);
+                if (cost) {
+                    record_cost_aovs(scene, layers, *cost, x, y);
+                }
             }
         }
-        reporter.update(1);
+        reporter.update(1, uint64_t(x1 - x0) * (y1 - y0) * scene.options.samples_per_pixel);
     }, Vector2i(num_tiles_x, num_tiles_y));
     reporter.done();
     return img;
 }
 
 
-Image3 render(const Scene &scene) {
+Image3 render(const Scene &scene, std::vector<ImageLayer> *layers, EXRStream *stream) {
+    // Some integrators output extra layers. We throw them away if the caller doesn't want them.
+    std::vector<ImageLayer> dummy_layers;
+    if (layers == nullptr) {
+        layers = &dummy_layers;
+    }
     if (scene.options.integrator == Integrator::Depth ||
             scene.options.integrator == Integrator::ShadingNormal ||
             scene.options.integrator == Integrator::MeanCurvature ||
@@ -160,9 +1136,15 @@ Image3 render(const Scene &scene) {
             scene.options.integrator == Integrator::MipmapLevel) {
         return aux_render(scene);
     } else if (scene.options.integrator == Integrator::Path) {
-        return path_render(scene);
+        return path_render(scene, *layers, stream);
+    } else if (scene.options.integrator == Integrator::GuidedPath) {
+        return guided_path_render(scene);
+    } else if (scene.options.integrator == Integrator::BDPT) {
+        return bdpt_render(scene);
+    } else if (scene.options.integrator == Integrator::SPPM) {
+        return sppm_render(scene);
     } else if (scene.options.integrator == Integrator::VolPath) {
-        return vol_path_render(scene);
+        return vol_path_render(scene, *layers);
     } else {
         assert(false);
         return Image3();
@@ -6,4 +6,19 @@
 
 struct Scene;
 
-Image3 render(const Scene &scene);
+/// An EXR file that render() can write the image to while it renders (see TiledEXRWriter).
+struct EXRStream {
+    fs::path filename;
+    EXROptions options;
+    // render() sets this if it wrote the image and the layers to the file.
+    bool written = false;
+};
+
+/// Renders the scene. If layers is given, we also return the extra layers
+/// some integrators produce (e.g., the light groups of the path tracer).
+/// If stream is given, the integrators that finish the pixels tile by tile
+/// (currently the plain path tracer) write them to the file as they go.
+/// Otherwise (stream->written is false), the caller writes the image.
+Image3 render(const Scene &scene,
+              std::vector<ImageLayer> *layers = nullptr,
+              EXRStream *stream = nullptr);
@@ -0,0 +1,275 @@
+#pragma once
+
+#include "scene.h"
+#include "intersection.h"
+#include "light.h"
+#include "material.h"
+#include "sampler.h"
+#include <optional>
+
+/// Reservoir-based spatiotemporal importance resampling (ReSTIR) for the direct lighting, from
+/// "Spatiotemporal reservoir resampling for real-time ray tracing with dynamic direct lighting"
+/// from Bitterli et al. With many lights, picking one light sample per vertex from the
+/// power-based light distribution is noisy: most of the samples land on lights that are far away,
+/// facing away, or behind the BSDF lobe.
+///
+/// Resampled importance sampling (RIS, "Importance Resampling for Global Illumination" from
+/// Talbot et al.) draws M cheap candidates from the light distribution p, and picks one of them
+/// with probability proportional to w = p_hat / p, where p_hat is a target function
+/// close to the integrand. We use the unshadowed contribution luminance(f * L * G),
+/// so that the only ray we trace is the shadow ray of the chosen sample. The estimate
+/// f * L * G * V * W is unbiased if we use the "unbiased contribution weight"
+/// W = (sum of w) / (M * p_hat(y)) for the chosen sample y.
+///
+/// A reservoir keeps the chosen sample and the running sum of the weights, so we can
+/// stream the candidates through it without storing them (weighted reservoir sampling).
+/// More importantly, we can feed the chosen samples of other reservoirs into a reservoir,
+/// as if they were candidates with weight p_hat(y) * W * M. This is what makes ReSTIR cheap:
+/// a pixel reuses the candidates of its neighbors (spatial reuse) and of its
+/// previous samples (temporal reuse, here across the progressive passes), so it effectively
+/// sees hundreds of candidates for the price of a few.
+///
+/// The neighbors have different p_hat, so plainly dividing by the total M is biased
+/// (e.g., it darkens the shadow boundaries). The unbiased version (Section 4.3 of the paper)
+/// weights the chosen sample with a balance-heuristic-like MIS weight instead: the (visible) target
+/// function of the neighbor it came from, over the sum of the (visible) target functions of all
+/// neighbors weighted by their M. This costs one shadow ray per neighbor. The paper's simpler
+/// 1/Z weight (divide by the total M of the neighbors that could have produced the sample)
+/// is also unbiased, but it inflates the weights near the shadow boundaries, and in our tests
+/// it made the spatial reuse useless.
+
+/// The temporal reuse clamps the number of candidates carried over from the previous pass
+/// to this many times the number of initial candidates, so that the old samples don't dominate.
+/// Bitterli et al. use 20.
+constexpr Real c_restir_temporal_max_M = Real(20);
+/// We only reuse a neighbor if its normal is within 25 degrees,
+/// and its distance to the camera is within 10% of ours (Section 6 of the paper).
+constexpr Real c_restir_normal_threshold = Real(0.9063); // cos(25 degrees)
+constexpr Real c_restir_depth_threshold = Real(0.1);
+/// We don't use ReSTIR on the (near) specular surfaces: the light sampling can't find the light they
+/// reflect, so we leave them to the MIS between the light and BSDF sampling of the path tracer.
+constexpr Real c_restir_specular_roughness = Real(0.25);
+
+/// A point on a light, stored in a reservoir.
+struct ReSTIRLightSample {
+    int light_id = -1;
+    PointAndNormal point_on_light;
+};
+
+struct Reservoir {
+    ReSTIRLightSample y;
+    // The sum of the weights of all candidates streamed through the reservoir.
+    Real w_sum = 0;
+    // The number of candidates streamed through the reservoir.
+    Real M = 0;
+    // The unbiased contribution weight of y (0 if the reservoir has no valid sample).
+    Real W = 0;
+};
+
+/// A vertex seen by the camera, where we resample the light samples.
+struct ReSTIRShadingPoint {
+    PathVertex vertex;
+    MaterialClosure closure;
+    Vector3 dir_view;
+    // The distance to the camera, for picking the neighbors to reuse.
+    Real depth;
+};
+
+/// The camera ray and the first vertex of a path, with the direct lighting at the vertex
+/// estimated by ReSTIR (if we used ReSTIR there). path_tracing() continues the path from there.
+struct ReSTIRPrimary {
+    Ray ray;
+    std::optional<PathVertex> vertex;
+    std::optional<Spectrum> direct;
+    // The light of the resampled light sample (-1 if none), for the light groups.
+    int direct_light_id = -1;
+};
+
+/// The unshadowed contribution f * L * G of a light sample at a shading point,
+/// and the shadow ray for testing its visibility.
+struct ReSTIRLightContribution {
+    Spectrum contrib;
+    Ray shadow_ray;
+};
+
+/// Streams a candidate y with weight w, which stands for M candidates, through the reservoir.
+/// u is a uniform random number. Returns true if y replaced the sample of the reservoir.
+inline bool update_reservoir(Reservoir &r, const ReSTIRLightSample &y, Real w, Real M, Real u) {
+    r.w_sum += w;
+    r.M += M;
+    if (w > 0 && u * r.w_sum < w) {
+        r.y = y;
+        return true;
+    }
+    return false;
+}
+
+inline ReSTIRLightContribution eval_light_sample(const Scene &scene,
+                                                 const ReSTIRShadingPoint &point,
+                                                 const ReSTIRLightSample &y) {
+    const Light &light = scene.lights[y.light_id];
+    const PathVertex &vertex = point.vertex;
+    // Same as the light sampling of path_tracing().
+    Real G = 0;
+    Vector3 dir_light;
+    Ray shadow_ray;
+    if (!is_infinite_light(light)) {
+        dir_light = normalize(y.point_on_light.position - vertex.position);
+        shadow_ray = Ray{vertex.position, dir_light,
+                         get_shadow_epsilon(scene),
+                         (1 - get_shadow_epsilon(scene)) *
+                             distance(y.point_on_light.position, vertex.position)};
+        if (is_delta_light(light)) {
+            G = 1 / distance_squared(y.point_on_light.position, vertex.position);
+        } else {
+            G = max(-dot(dir_light, y.point_on_light.normal), Real(0)) /
+                distance_squared(y.point_on_light.position, vertex.position);
+        }
+    } else {
+        dir_light = -y.point_on_light.normal;
+        shadow_ray = Ray{vertex.position, dir_light,
+                         get_shadow_epsilon(scene), infinity<Real>()};
+        G = 1;
+    }
+    if (G <= 0) {
+        return ReSTIRLightContribution{make_zero_spectrum(), shadow_ray};
+    }
+    Spectrum f = eval(point.closure, point.dir_view, dir_light, vertex);
+    Spectrum L = emission(light, -dir_light, Real(0), y.point_on_light, scene);
+    return ReSTIRLightContribution{G * f * L, shadow_ray};
+}
+
+/// The target function p_hat: the luminance of the unshadowed contribution.
+/// Note that p_hat is in the same measure as the light sampling pdf:
+/// area for the area lights, solid angle for the envmap, and discrete for the point lights.
+/// This is fine since a light sample always stays on its light.
+inline Real target_pdf(const Scene &scene,
+                       const ReSTIRShadingPoint &point,
+                       const ReSTIRLightSample &y) {
+    if (y.light_id < 0) {
+        return 0;
+    }
+    return max(luminance(eval_light_sample(scene, point, y).contrib), Real(0));
+}
+
+/// Is the neighbor on a similar surface, so that its samples are likely useful to us?
+inline bool is_similar(const ReSTIRShadingPoint &point, const ReSTIRShadingPoint &neighbor) {
+    return dot(point.vertex.shading_frame.n, neighbor.vertex.shading_frame.n) >= c_restir_normal_threshold &&
+        fabs(point.depth - neighbor.depth) <= c_restir_depth_threshold * point.depth;
+}
+
+/// How many sampler dimensions sample_light_candidates() draws for each candidate:
+/// the point on the light (2), picking the light & the shape, and the reservoir update.
+constexpr int c_restir_candidate_dimensions = 5;
+
+/// RIS with num_candidates candidates from the light sampling distribution.
+/// Draws c_restir_candidate_dimensions * num_candidates dimensions from the sampler.
+inline Reservoir sample_light_candidates(const Scene &scene,
+                                         const ReSTIRShadingPoint &point,
+                                         int num_candidates,
+                                         Sampler &sampler) {
+    Reservoir r;
+    Real p_hat_y = 0;
+    for (int i = 0; i < num_candidates; i++) {
+        Vector2 light_uv = next_2d(sampler);
+        Real light_w = next_1d(sampler);
+        Real shape_w = next_1d(sampler);
+        int light_id = sample_light(scene, light_w);
+        const Light &light = scene.lights[light_id];
+        ReSTIRLightSample y{light_id,
+            sample_point_on_light(light, point.vertex.position, point.vertex.shading_frame.n,
+                                  light_uv, shape_w, scene)};
+        Real p = light_pmf(scene, light_id) *
+            pdf_point_on_light(light, y.point_on_light,
+                               point.vertex.position, point.vertex.shading_frame.n, scene);
+        Real p_hat = p > 0 ? target_pdf(scene, point, y) : Real(0);
+        Real w = p > 0 ? p_hat / p : Real(0);
+        if (update_reservoir(r, y, w, 1, next_1d(sampler))) {
+            p_hat_y = p_hat;
+        }
+    }
+    r.W = p_hat_y > 0 ? r.w_sum / (r.M * p_hat_y) : Real(0);
+    return r;
+}
+
+/// Combines the reservoirs of other shading points (and possibly our own) into a new reservoir
+/// for point (Algorithm 4 of Bitterli et al., or the MIS version of Algorithm 6 if unbiased).
+/// reservoir_points[i] is the shading point that reservoirs[i] was resampled for.
+/// Draws num_reservoirs dimensions from the sampler.
+inline Reservoir combine_reservoirs(const Scene &scene,
+                                    const ReSTIRShadingPoint &point,
+                                    const Reservoir *reservoirs,
+                                    const ReSTIRShadingPoint *const *reservoir_points,
+                                    int num_reservoirs,
+                                    bool unbiased,
+                                    Sampler &sampler) {
+    Reservoir s;
+    Real p_hat_y = 0;
+    int selected = -1;
+    for (int i = 0; i < num_reservoirs; i++) {
+        const Reservoir &r = reservoirs[i];
+        // The neighbor's sample is resampled with our target function.
+        Real p_hat = r.W > 0 ? target_pdf(scene, point, r.y) : Real(0);
+        if (update_reservoir(s, r.y, p_hat * r.W * r.M, r.M, next_1d(sampler))) {
+            p_hat_y = p_hat;
+            selected = i;
+        }
+    }
+    if (p_hat_y <= 0) {
+        s.W = 0;
+        return s;
+    }
+    if (!unbiased) {
+        s.W = s.w_sum / (s.M * p_hat_y);
+        return s;
+    }
+    // The MIS weight of the chosen sample: p_hat of the reservoir it came from, over
+    // the sum of M * p_hat of all reservoirs. The target functions include the visibility,
+    // since test_visibility() makes sure that the reservoirs only keep visible samples.
+    // The chosen sample is visible from the reservoir it came from. If it is invisible from our point,
+    // test_visibility() zeroes it afterwards anyway, so we don't need to test our own reservoirs.
+    Real p_hat_selected = 0;
+    Real p_hat_sum = 0;
+    for (int i = 0; i < num_reservoirs; i++) {
+        Real p_hat = 0;
+        if (reservoir_points[i] == &point) {
+            p_hat = p_hat_y;
+        } else {
+            // The shadow rays start from different points, so tracing them
+            // in a packet was slower than tracing them one by one.
+            ReSTIRLightContribution c = eval_light_sample(scene, *reservoir_points[i], s.y);
+            p_hat = max(luminance(c.contrib), Real(0));
+            if (p_hat > 0 && i != selected && occluded(scene, c.shadow_ray)) {
+                p_hat = 0;
+            }
+        }
+        if (i == selected) {
+            p_hat_selected = p_hat;
+        }
+        p_hat_sum += reservoirs[i].M * p_hat;
+    }
+    s.W = p_hat_sum > 0 ? s.w_sum * p_hat_selected / (p_hat_sum * p_hat_y) : Real(0);
+    return s;
+}
+
+/// Zeroes the weight of the reservoir if its sample is occluded from the point.
+/// We do this after every resampling step (including the "visibility reuse" of
+/// the initial candidates, Section 6 of Bitterli et al.), so that the neighbors never reuse
+/// occluded samples, and so that the support of every reservoir is the set of visible samples,
+/// which the unbiased reuse assumes for its MIS weights.
+inline void test_visibility(const Scene &scene, const ReSTIRShadingPoint &point, Reservoir &r) {
+    if (r.W > 0 && occluded(scene, eval_light_sample(scene, point, r.y).shadow_ray)) {
+        r.W = 0;
+    }
+}
+
+/// The direct lighting estimate of the sample of a reservoir: f * L * G * V * W.
+/// The visibility V has already been tested by test_visibility().
+inline Spectrum shade_reservoir(const Scene &scene,
+                                const ReSTIRShadingPoint &point,
+                                const Reservoir &r) {
+    if (r.W <= 0) {
+        return make_zero_spectrum();
+    }
+    return eval_light_sample(scene, point, r.y).contrib * r.W;
+}
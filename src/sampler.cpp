@@ -0,0 +1,185 @@
+#include "sampler.h"
+
+/// The largest Real that is smaller than 1.
+/// We clamp the samples with it since a float can round 0.99999999 up to 1.
+const Real c_one_minus_epsilon = std::nextafter(Real(1), Real(0));
+
+/// Scrambles the bits of a 64-bit integer so that nearby inputs give unrelated outputs.
+/// http://zimbry.blogspot.ch/2011/09/better-bit-mixing-improving-on.html
+inline uint64_t mix_bits(uint64_t v) {
+    v ^= (v >> 31);
+    v *= 0x7fb5d329728ea185ULL;
+    v ^= (v >> 27);
+    v *= 0x81dadef4bc2dd44dULL;
+    v ^= (v >> 33);
+    return v;
+}
+
+/// Hashes a few integers (e.g., pixel coordinates, dimension, and seed) into 64 bits.
+inline uint64_t hash(uint64_t a, uint64_t b, uint64_t c, uint64_t d = 0) {
+    uint64_t h = mix_bits(a + 0x9e3779b97f4a7c15ULL);
+    h = mix_bits(h ^ (b + 0x9e3779b97f4a7c15ULL));
+    h = mix_bits(h ^ (c + 0x9e3779b97f4a7c15ULL));
+    return mix_bits(h ^ (d + 0x9e3779b97f4a7c15ULL));
+}
+
+inline uint32_t reverse_bits(uint32_t v) {
+    v = (v << 16) | (v >> 16);
+    v = ((v & 0x00ff00ff) << 8) | ((v & 0xff00ff00) >> 8);
+    v = ((v & 0x0f0f0f0f) << 4) | ((v & 0xf0f0f0f0) >> 4);
+    v = ((v & 0x33333333) << 2) | ((v & 0xcccccccc) >> 2);
+    v = ((v & 0x55555555) << 1) | ((v & 0xaaaaaaaa) >> 1);
+    return v;
+}
+
+/// Maps 32 bits to [0, 1).
+inline Real to_unit_real(uint32_t v) {
+    return min(Real(v) * Real(0x1p-32), c_one_minus_epsilon);
+}
+
+/// Returns the i-th element of a random permutation of {0, ..., l - 1}
+/// decided by the seed p, without storing the permutation.
+/// From "Correlated Multi-Jittered Sampling" by Andrew Kensler.
+inline int permutation_element(uint32_t i, uint32_t l, uint32_t p) {
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    // Cycle walking: the hash below is a permutation of {0, ..., w},
+    // we repeat it until we land in {0, ..., l - 1}.
+    do {
+        i ^= p;
+        i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+/// The first two dimensions of the Sobol sequence, as 32-bit fixed-point numbers.
+/// The first dimension is the van der Corput sequence (the reversed bits of the index),
+/// and the generator matrix of the second one is the Pascal triangle modulo 2.
+/// See "Efficient Multidimensional Sampling" from Kollig and Keller.
+inline uint32_t sobol_sample(uint32_t index, int dimension) {
+    assert(dimension == 0 || dimension == 1);
+    if (dimension == 0) {
+        return reverse_bits(index);
+    }
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+        if (index & 1) {
+            result ^= v;
+        }
+    }
+    return result;
+}
+
+/// Owen scrambling randomly flips the digits of a number, where the flip of each digit
+/// depends on all the digits before it. This keeps the stratification of the Sobol points
+/// while giving an unbiased (and faster converging) estimator.
+/// The hash-based approximation is from Laine and Karras, the constants are from
+/// "Practical Hash-based Owen Scrambling" from Brent Burley and PBRT-v4.
+inline uint32_t owen_scramble(uint32_t v, uint32_t seed) {
+    // The hash only propagates from lower to higher bits,
+    // so we reverse the bits to propagate from the leading digits instead.
+    v = reverse_bits(v);
+    v ^= v * 0x3d20adea;
+    v += seed;
+    v *= (seed >> 16) | 1;
+    v ^= v * 0x05526c56;
+    v ^= v * 0x53a22864;
+    return reverse_bits(v);
+}
+
+struct start_pixel_sample_op {
+    void operator()(IndependentSampler &sampler) const;
+    void operator()(StratifiedSampler &sampler) const;
+    void operator()(SobolSampler &sampler) const;
+    void operator()(ZSobolSampler &sampler) const;
+
+    const Vector2i &pixel;
+    int sample_index;
+};
+
+struct next_1d_op {
+    Real operator()(IndependentSampler &sampler) const;
+    Real operator()(StratifiedSampler &sampler) const;
+    Real operator()(SobolSampler &sampler) const;
+    Real operator()(ZSobolSampler &sampler) const;
+};
+
+struct next_2d_op {
+    Vector2 operator()(IndependentSampler &sampler) const;
+    Vector2 operator()(StratifiedSampler &sampler) const;
+    Vector2 operator()(SobolSampler &sampler) const;
+    Vector2 operator()(ZSobolSampler &sampler) const;
+};
+
+struct skip_dimensions_op {
+    void operator()(IndependentSampler &sampler) const;
+    void operator()(StratifiedSampler &sampler) const;
+    void operator()(SobolSampler &sampler) const;
+    void operator()(ZSobolSampler &sampler) const;
+
+    int num_dimensions;
+};
+
+// Implementations of the individual samplers.
+#include "samplers/independent.inl"
+#include "samplers/stratified.inl"
+#include "samplers/sobol.inl"
+#include "samplers/zsobol.inl"
+
+Sampler make_sampler(SamplerType type,
+                     int samples_per_pixel,
+                     const Vector2i &resolution,
+                     uint32_t seed,
+                     uint64_t stream_id) {
+    assert(samples_per_pixel > 0);
+    switch (type) {
+        case SamplerType::Independent:
+            return IndependentSampler{init_pcg32(stream_id, seed)};
+        case SamplerType::Stratified:
+            return StratifiedSampler{samples_per_pixel, seed, Vector2i{0, 0}, 0, 0};
+        case SamplerType::Sobol:
+            return SobolSampler{samples_per_pixel, seed, Vector2i{0, 0}, 0, 0};
+        case SamplerType::ZSobol:
+            return make_zsobol_sampler(samples_per_pixel, resolution, seed);
+        default:
+            assert(false);
+            return IndependentSampler{init_pcg32(stream_id, seed)};
+    }
+}
+
+void start_pixel_sample(Sampler &sampler, const Vector2i &pixel, int sample_index) {
+    std::visit(start_pixel_sample_op{pixel, sample_index}, sampler);
+}
+
+Real next_1d(Sampler &sampler) {
+    return std::visit(next_1d_op{}, sampler);
+}
+
+Vector2 next_2d(Sampler &sampler) {
+    return std::visit(next_2d_op{}, sampler);
+}
+
+void skip_dimensions(Sampler &sampler, int num_dimensions) {
+    assert(num_dimensions >= 0);
+    std::visit(skip_dimensions_op{num_dimensions}, sampler);
+}
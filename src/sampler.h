@@ -0,0 +1,99 @@
+#pragma once
+
+#include "lajolla.h"
+#include "pcg.h"
+#include "vector.h"
+#include <variant>
+
+/// A sampler generates the random numbers for the integrators.
+/// Instead of drawing from an RNG whenever we need a number, the integrators
+/// ask for the samples "dimension by dimension": the pixel filter is the first 2D
+/// sample of a path, then each bounce consumes the light selection/light uv/BSDF uv...
+/// samples in the same order. This bookkeeping allows the samplers to distribute
+/// the samples of each dimension well over the samples of a pixel
+/// (i.e., stratification), which converges much faster than pure random sampling
+/// for the low dimensions that matter most (the camera and the first few bounces).
+///
+/// Usage: call start_pixel_sample() before tracing each sample of a pixel, then call
+/// next_1d() / next_2d() in the same order for every sample.
+/// A sampler has states, so each thread should have its own copy.
+
+enum class SamplerType {
+    Independent,
+    Stratified,
+    Sobol,
+    ZSobol
+};
+
+/// Pure random numbers from PCG. It does not care about dimensions or pixels:
+/// it just keeps drawing from the same stream.
+struct IndependentSampler {
+    pcg32_state rng;
+};
+
+/// Jittered stratified sampling: for each dimension (pair), we divide [0, 1) (or [0, 1)^2)
+/// into samples_per_pixel strata, and each sample of a pixel gets a different stratum.
+/// We randomly permute the strata of each dimension independently to decorrelate the
+/// dimensions (i.e., "padding", see Chapter 7.3 of the third edition of PBRT).
+struct StratifiedSampler {
+    int samples_per_pixel;
+    uint32_t seed;
+
+    // Current state
+    Vector2i pixel;
+    int sample_index;
+    int dimension;
+};
+
+/// Owen-scrambled Sobol sequence using the first two Sobol dimensions,
+/// padded to higher dimensions by shuffling the sample order per dimension.
+/// See "Practical Hash-based Owen Scrambling" from Brent Burley.
+/// https://jcgt.org/published/0009/04/01/
+/// This is the best choice for a moderate number of samples, especially if it is a power of two.
+struct SobolSampler {
+    int samples_per_pixel;
+    uint32_t seed;
+
+    // Current state
+    Vector2i pixel;
+    int sample_index;
+    int dimension;
+};
+
+/// Same Owen-scrambled Sobol points as SobolSampler, but the sample indices are
+/// assigned to the pixels along a randomized Morton (Z) curve, so the error of
+/// neighboring pixels is negatively correlated and looks like blue noise.
+/// See "Screen-Space Blue-Noise Diffusion of Monte Carlo Sampling Error via
+/// Hierarchical Ordering of Pixels" from Ahmed and Wonka.
+struct ZSobolSampler {
+    int log2_samples_per_pixel;
+    int num_base4_digits;
+    uint32_t seed;
+
+    // Current state
+    uint64_t morton_index;
+    int dimension;
+};
+
+using Sampler = std::variant<IndependentSampler, StratifiedSampler, SobolSampler, ZSobolSampler>;
+
+/// stream_id is only used by IndependentSampler to choose the PCG stream
+/// (the seed then picks the starting point in the stream).
+/// The other samplers are deterministic given the pixel, the sample index, and the seed.
+Sampler make_sampler(SamplerType type,
+                     int samples_per_pixel,
+                     const Vector2i &resolution,
+                     uint32_t seed,
+                     uint64_t stream_id);
+
+/// sample_index should be in [0, samples_per_pixel).
+void start_pixel_sample(Sampler &sampler, const Vector2i &pixel, int sample_index);
+
+Real next_1d(Sampler &sampler);
+Vector2 next_2d(Sampler &sampler);
+
+/// Moves the current pixel sample num_dimensions dimensions ahead, as if we drew them.
+/// For passes that revisit a pixel sample (with start_pixel_sample()) and want to continue
+/// after the dimensions an earlier pass used. The independent sampler has no dimensions:
+/// it just keeps drawing fresh numbers, so there is nothing to skip.
+void skip_dimensions(Sampler &sampler, int num_dimensions);
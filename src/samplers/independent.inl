@@ -0,0 +1,19 @@
+void start_pixel_sample_op::operator()(IndependentSampler &sampler) const {
+    // Nothing to do: we keep drawing from the same stream.
+}
+
+void skip_dimensions_op::operator()(IndependentSampler &sampler) const {
+    // Nothing to do: the next numbers of the stream are fresh anyway.
+}
+
+Real next_1d_op::operator()(IndependentSampler &sampler) const {
+    return next_pcg32_real<Real>(sampler.rng);
+}
+
+Vector2 next_2d_op::operator()(IndependentSampler &sampler) const {
+    // Make sure the evaluation order is well defined
+    // (the order of the arguments of a constructor is unspecified).
+    Real u = next_pcg32_real<Real>(sampler.rng);
+    Real v = next_pcg32_real<Real>(sampler.rng);
+    return Vector2{u, v};
+}
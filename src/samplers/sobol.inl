@@ -0,0 +1,40 @@
+void start_pixel_sample_op::operator()(SobolSampler &sampler) const {
+    // The indices are permuted within [0, samples_per_pixel):
+    // beyond that the permutation would repeat or skip points.
+    assert(sample_index >= 0 && sample_index < sampler.samples_per_pixel);
+    sampler.pixel = pixel;
+    sampler.sample_index = sample_index;
+    sampler.dimension = 0;
+}
+
+void skip_dimensions_op::operator()(SobolSampler &sampler) const {
+    sampler.dimension += num_dimensions;
+}
+
+Real next_1d_op::operator()(SobolSampler &sampler) const {
+    uint64_t h = hash(uint32_t(sampler.pixel.x) | (uint64_t(uint32_t(sampler.pixel.y)) << 32),
+                      sampler.dimension, sampler.seed);
+    // "Padding": we only use the first Sobol dimension, but each dimension
+    // visits the points in a different (random) order. The points of a pixel
+    // are still well stratified in every dimension, and the dimensions are decorrelated.
+    // (The permutation is over all samples of the pixel, so a power-of-two
+    //  sample count gives the best stratification.)
+    uint32_t index = permutation_element(
+        uint32_t(sampler.sample_index), uint32_t(sampler.samples_per_pixel), uint32_t(h));
+    sampler.dimension++;
+    return to_unit_real(owen_scramble(sobol_sample(index, 0), uint32_t(h >> 32)));
+}
+
+Vector2 next_2d_op::operator()(SobolSampler &sampler) const {
+    uint64_t h = hash(uint32_t(sampler.pixel.x) | (uint64_t(uint32_t(sampler.pixel.y)) << 32),
+                      sampler.dimension, sampler.seed);
+    uint32_t index = permutation_element(
+        uint32_t(sampler.sample_index), uint32_t(sampler.samples_per_pixel), uint32_t(h));
+    // The first two Sobol dimensions form a (0, 2)-sequence: every power-of-two prefix
+    // is stratified over all elementary intervals (e.g., 16 samples cover
+    // the 1x16, 2x8, 4x4, 8x2, and 16x1 grids).
+    uint64_t scramble = hash(h, 1, 0);
+    sampler.dimension += 2;
+    return Vector2{to_unit_real(owen_scramble(sobol_sample(index, 0), uint32_t(scramble))),
+                   to_unit_real(owen_scramble(sobol_sample(index, 1), uint32_t(scramble >> 32)))};
+}
@@ -0,0 +1,41 @@
+void start_pixel_sample_op::operator()(StratifiedSampler &sampler) const {
+    sampler.pixel = pixel;
+    sampler.sample_index = sample_index;
+    sampler.dimension = 0;
+}
+
+void skip_dimensions_op::operator()(StratifiedSampler &sampler) const {
+    sampler.dimension += num_dimensions;
+}
+
+Real next_1d_op::operator()(StratifiedSampler &sampler) const {
+    int n = sampler.samples_per_pixel;
+    uint64_t h = hash(uint32_t(sampler.pixel.x) | (uint64_t(uint32_t(sampler.pixel.y)) << 32),
+                      sampler.dimension, sampler.seed);
+    // Each dimension gets its own permutation of the strata
+    int stratum = permutation_element(sampler.sample_index % n, n, uint32_t(h));
+    // ...and the jittering inside the stratum is different for each sample.
+    uint64_t jitter = hash(h, sampler.sample_index, 0);
+    sampler.dimension++;
+    return min((stratum + to_unit_real(uint32_t(jitter))) / n, c_one_minus_epsilon);
+}
+
+Vector2 next_2d_op::operator()(StratifiedSampler &sampler) const {
+    // Split the samples into a grid of nx x ny strata.
+    // We want the grid to be as square as possible, so we find the
+    // largest divisor of n that is not larger than sqrt(n).
+    int n = sampler.samples_per_pixel;
+    int nx = int(sqrt(Real(n)));
+    while (n % nx != 0) {
+        nx--;
+    }
+    int ny = n / nx;
+    uint64_t h = hash(uint32_t(sampler.pixel.x) | (uint64_t(uint32_t(sampler.pixel.y)) << 32),
+                      sampler.dimension, sampler.seed);
+    int stratum = permutation_element(sampler.sample_index % n, n, uint32_t(h));
+    uint64_t jitter = hash(h, sampler.sample_index, 0);
+    sampler.dimension += 2;
+    return Vector2{
+        min((stratum % nx + to_unit_real(uint32_t(jitter))) / nx, c_one_minus_epsilon),
+        min((stratum / nx + to_unit_real(uint32_t(jitter >> 32))) / ny, c_one_minus_epsilon)};
+}
@@ -0,0 +1,88 @@
+/// Interleaves the bits of x and y.
+inline uint64_t encode_morton_2(uint32_t x, uint32_t y) {
+    auto spread_bits = [](uint64_t v) {
+        v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+        v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+        v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+        v = (v | (v << 2)) & 0x3333333333333333ULL;
+        v = (v | (v << 1)) & 0x5555555555555555ULL;
+        return v;
+    };
+    return (spread_bits(y) << 1) | spread_bits(x);
+}
+
+ZSobolSampler make_zsobol_sampler(int samples_per_pixel, const Vector2i &resolution, uint32_t seed) {
+    // We need power-of-two sample counts and resolutions:
+    // round them up (it's fine to not use all of the indices).
+    int log2_spp = 0;
+    while ((1 << log2_spp) < samples_per_pixel) {
+        log2_spp++;
+    }
+    int log2_res = 0;
+    while ((1 << log2_res) < max(resolution.x, resolution.y)) {
+        log2_res++;
+    }
+    return ZSobolSampler{log2_spp, log2_res + (log2_spp + 1) / 2, seed, 0, 0};
+}
+
+/// Computes the index of the Sobol point for the current pixel sample & dimension.
+/// The (Morton-ordered pixel, sample) index is permuted digit by digit in base 4,
+/// where the permutation of each digit depends on the higher digits.
+/// Neighboring pixels then get the neighboring points of the Sobol sequence,
+/// which are well stratified when viewed together. That's what makes the error blue.
+inline uint64_t zsobol_sample_index(const ZSobolSampler &sampler) {
+    static const uint8_t permutations[24][4] = {
+        {0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 1, 3}, {0, 2, 3, 1},
+        {0, 3, 2, 1}, {0, 3, 1, 2}, {1, 0, 2, 3}, {1, 0, 3, 2},
+        {1, 2, 0, 3}, {1, 2, 3, 0}, {1, 3, 2, 0}, {1, 3, 0, 2},
+        {2, 1, 0, 3}, {2, 1, 3, 0}, {2, 0, 1, 3}, {2, 0, 3, 1},
+        {2, 3, 0, 1}, {2, 3, 1, 0}, {3, 1, 2, 0}, {3, 1, 0, 2},
+        {3, 2, 1, 0}, {3, 2, 0, 1}, {3, 0, 2, 1}, {3, 0, 1, 2}};
+
+    uint64_t sample_index = 0;
+    // With an odd power of two samples per pixel, the last digit is in base 2.
+    bool pow2_samples = sampler.log2_samples_per_pixel & 1;
+    int last_digit = pow2_samples ? 1 : 0;
+    for (int i = sampler.num_base4_digits - 1; i >= last_digit; i--) {
+        int digit_shift = 2 * i - (pow2_samples ? 1 : 0);
+        int digit = (sampler.morton_index >> digit_shift) & 3;
+        uint64_t higher_digits = sampler.morton_index >> (digit_shift + 2);
+        int p = (mix_bits(higher_digits ^ (0x55555555u * uint64_t(sampler.dimension)) ^ sampler.seed) >> 24) % 24;
+        digit = permutations[p][digit];
+        sample_index |= uint64_t(digit) << digit_shift;
+    }
+    if (pow2_samples) {
+        int digit = sampler.morton_index & 1;
+        sample_index |= digit ^
+            (mix_bits((sampler.morton_index >> 1) ^ (0x55555555u * uint64_t(sampler.dimension)) ^ sampler.seed) & 1);
+    }
+    return sample_index;
+}
+
+void start_pixel_sample_op::operator()(ZSobolSampler &sampler) const {
+    assert(sample_index >= 0 && sample_index < (1 << sampler.log2_samples_per_pixel));
+    sampler.morton_index =
+        (encode_morton_2(pixel.x, pixel.y) << sampler.log2_samples_per_pixel) | uint64_t(sample_index);
+    sampler.dimension = 0;
+}
+
+void skip_dimensions_op::operator()(ZSobolSampler &sampler) const {
+    sampler.dimension += num_dimensions;
+}
+
+Real next_1d_op::operator()(ZSobolSampler &sampler) const {
+    uint64_t index = zsobol_sample_index(sampler);
+    // We only have 32 bits of Sobol points. For (very) large images with many samples,
+    // the index can be longer: we fold the higher bits into the scrambling instead.
+    uint64_t h = hash(sampler.dimension, sampler.seed, index >> 32);
+    sampler.dimension++;
+    return to_unit_real(owen_scramble(sobol_sample(uint32_t(index), 0), uint32_t(h)));
+}
+
+Vector2 next_2d_op::operator()(ZSobolSampler &sampler) const {
+    uint64_t index = zsobol_sample_index(sampler);
+    uint64_t h = hash(sampler.dimension, sampler.seed, index >> 32);
+    sampler.dimension += 2;
+    return Vector2{to_unit_real(owen_scramble(sobol_sample(uint32_t(index), 0), uint32_t(h))),
+                   to_unit_real(owen_scramble(sobol_sample(uint32_t(index), 1), uint32_t(h >> 32)))};
+}
@@ -10,12 +10,14 @@ Scene::Scene(const RTCDevice &embree_device,
              int envmap_light_id,
              const TexturePool &texture_pool,
              const RenderOptions &options,
-             const std::string &output_filename) : 
+             const std::string &output_filename,
+             const EXROptions &output_exr_options) : 
         embree_device(embree_device), camera(camera), materials(materials),
         shapes(shapes), lights(lights), media(media),
         envmap_light_id(envmap_light_id),
         texture_pool(texture_pool), options(options),
-        output_filename(output_filename) {
+        output_filename(output_filename),
+        output_exr_options(output_exr_options) {
     // Register the geometry to Embree
     embree_scene = rtcNewScene(embree_device);
     // We don't care about build time.
@@ -5,6 +5,7 @@
 #include "light.h"
 #include "material.h"
 #include "medium.h"
+#include "sampler.h"
 #include "shape.h"
 #include "volume.h"
 
@@ -18,15 +19,111 @@ enum class Integrator {
     RayDifferential, // visualize radius & spread
     MipmapLevel,
     Path,
+    GuidedPath,
+    BDPT, // bidirectional path tracing
+    SPPM, // stochastic progressive photon mapping
     VolPath
 };
 
+/// How the path tracers decide to terminate (Russian roulette) or split paths.
+/// Throughput: terminate with a probability based on the path throughput (Mitsuba/pbrt-v3).
+/// ADRRS: "Adjoint-driven Russian Roulette and Splitting" from Vorba and Křivánek,
+///        which compares the expected contribution of a path to the pixel estimate
+///        using a coarse radiance cache (see path_tracing.h).
+enum class RRStrategy {
+    Throughput,
+    ADRRS
+};
+
+/// The arbitrary output variables (AOVs) the path tracer can output
+/// along with the rendering (see aov.h).
+enum class AOVType {
+    Albedo,
+    ShadingNormal,
+    Depth,
+    Position,
+    ObjectID, // the shape ID
+    MaterialID,
+    // The cost of the pixels: the wall-clock time we spent on each pixel,
+    // and the number of rays we traced for it.
+    Time,
+    RayCount
+};
+
+/// The maximum number of light samples per path vertex.
+/// The shadow rays of a vertex are traced together in one packet of 16.
+const int c_max_nee_samples = 16;
+
+/// The maximum number of paths a camera sample can split into with ADRRS.
+/// The pending paths are kept in a fixed-size array.
+const int c_max_split_paths = 64;
+
+/// The maximum number of neighbors a pixel reuses with ReSTIR (see restir.h).
+const int c_restir_max_spatial_samples = 16;
+
 struct RenderOptions {
     Integrator integrator = Integrator::Path;
     int samples_per_pixel = 4;
+    SamplerType sampler_type = SamplerType::Independent;
+    uint32_t sampler_seed = 0;
     int max_depth = -1;
     int rr_depth = 5;
+    RRStrategy rr_strategy = RRStrategy::Throughput;
+    // ADRRS only: the maximum number of paths a camera sample can split into.
+    int max_split_paths = 16;
+    // Number of light samples (next event estimation) and BSDF samples
+    // we take at each path vertex. Only the first BSDF sample continues the path,
+    // the rest only look for emission (see path_tracing.h).
+    // We only split at the first split_depth vertices (-1 means all vertices).
+    // Splitting lowers the variance per sample, but in our tests (Cornell box & Veach's MIS scene)
+    // it never lowered the variance per second of rendering, so we don't split by default.
+    int nee_samples = 1;
+    int bsdf_samples = 1;
+    int split_depth = -1;
+    // Plain path tracer only: the radiance cache for the diffuse interreflections (see radiance_cache.h).
+    // Paths stop at the first Lambertian vertex covered by the cache with depth >= radiance_cache_depth
+    // (1 is the vertex seen by the camera, -1 disables the cache). 2 keeps the direct lighting
+    // of the visible surfaces exact and only caches the indirect lighting.
+    // radiance_cache_cell_size is the width of the cache cells (-1 means we pick one from the scene size).
+    int radiance_cache_depth = -1;
+    Real radiance_cache_cell_size = -1;
+    // Plain path tracer only: ReSTIR for the direct lighting at the vertices seen by the camera
+    // (see restir.h). Each pixel resamples restir_candidates light samples, then reuses
+    // the reservoirs of up to restir_spatial_samples neighbors within restir_spatial_radius pixels
+    // (in the same tile) and, if restir_temporal, of its previous sample.
+    // restir_biased skips the extra shadow rays of the unbiased reuse.
+    // The temporal reuse is off by default: the reused samples stick around for many passes,
+    // and in our tests the averaged passes converged much slower than without it.
+    bool restir = false;
+    int restir_candidates = 32;
+    int restir_spatial_samples = 4;
+    int restir_spatial_radius = 8;
+    bool restir_temporal = false;
+    bool restir_biased = false;
+    // Plain path tracer only: shade the light samples of the vertices seen by the camera
+    // a tile at a time, with the batched BSDF kernels (see bsdf_batch.h). Only the rough dielectrics
+    // go through the kernels: the other materials were faster with the scalar evaluation in our tests.
+    bool batch_bsdf = false;
+    // Plain path tracer only: also output the radiance of each light group as a layer
+    // of the image (see Scene::light_group_ids). Radiance is linear in the emission,
+    // so we can rescale the layers and sum them up to change the light intensities
+    // without rendering again.
+    bool light_groups = false;
+    // Plain path tracer only: the AOVs we output as layers of the image (see aov.h).
+    // The volumetric path tracer supports the cost AOVs (time and ray count) too.
+    std::vector<AOVType> aovs;
+    // Plain path tracer only: denoise the rendering after we finish it (see denoiser.h).
+    // The denoiser needs the albedo, normal, and depth AOVs, so we add them to aovs
+    // (and output them) if they are not there.
+    bool denoise = false;
+    int denoise_iterations = 5;
     int vol_path_version = 0;
+    // SPPM only: the number of photons we trace in each iteration
+    // (-1 means the number of pixels), and the initial radius of the density estimation
+    // (-1 means we pick one from the size of the scene and the resolution).
+    // The number of iterations is samples_per_pixel.
+    int sppm_photons_per_iteration = -1;
+    Real sppm_initial_radius = -1;
     int max_null_collisions = 1000;
 };
 
@@ -50,7 +147,8 @@ struct Scene {
           int envmap_light_id, /* -1 if the scene has no envmap */
           const TexturePool &texture_pool,
           const RenderOptions &options,
-          const std::string &output_filename);
+          const std::string &output_filename,
+          const EXROptions &output_exr_options = EXROptions{});
     ~Scene();
     Scene(const Scene& t) = delete;
     Scene& operator=(const Scene& t) = delete;
@@ -76,9 +174,14 @@ struct Scene {
     
     RenderOptions options;
     std::string output_filename;
+    EXROptions output_exr_options;
 
     // For sampling lights
     TableDist1D light_dist;
+
+    // The light group of each light, and the name of each group (see parse_light_group()).
+    std::vector<int> light_group_ids;
+    std::vector<std::string> light_group_names;
 };
 
 /// Sample a light source from the scene given a random number u \in [0, 1]
@@ -96,10 +199,19 @@ inline const Light &get_envmap(const Scene &scene) {
     return scene.lights[scene.envmap_light_id];
 }
 
+/// The ray epsilons are relative to the scene scale. A float only has ~7 digits,
+/// so 1e-5 of the scene radius is only a few ulps of a hit point far from the origin.
+/// We need a larger one in single precision.
+#ifdef LAJOLLA_USE_FLOAT
+const Real c_relative_ray_epsilon = Real(1e-4);
+#else
+const Real c_relative_ray_epsilon = Real(1e-5);
+#endif
+
 inline Real get_shadow_epsilon(const Scene &scene) {
-    return min(scene.bounds.radius * Real(1e-5), Real(0.01));
+    return min(scene.bounds.radius * c_relative_ray_epsilon, Real(0.01));
 }
 
 inline Real get_intersection_epsilon(const Scene &scene) {
-    return min(scene.bounds.radius * Real(1e-5), Real(0.01));
+    return min(scene.bounds.radius * c_relative_ray_epsilon, Real(0.01));
 }
@@ -3,6 +3,8 @@
 #include "point_and_normal.h"
 #include "ray.h"
 #include <embree4/rtcore.h>
+#include <algorithm>
+#include <array>
 
 struct register_embree_op {
     uint32_t operator()(const Sphere &sphere) const;
@@ -17,10 +19,19 @@ struct sample_point_on_shape_op {
     PointAndNormal operator()(const TriangleMesh &mesh) const;
 
     const Vector3 &ref_point;
+    const Vector3 &ref_normal;
     const Vector2 &uv; // for selecting a point on a 2D surface
     const Real &w; // for selecting triangles
 };
 
+struct sample_point_on_shape_uniform_op {
+    PointAndNormal operator()(const Sphere &sphere) const;
+    PointAndNormal operator()(const TriangleMesh &mesh) const;
+
+    const Vector2 &uv;
+    const Real &w;
+};
+
 struct surface_area_op {
     Real operator()(const Sphere &sphere) const;
     Real operator()(const TriangleMesh &mesh) const;
@@ -32,6 +43,7 @@ struct pdf_point_on_shape_op {
 
     const PointAndNormal &point_on_shape;
     const Vector3 &ref_point;
+    const Vector3 &ref_normal;
 };
 
 struct init_sampling_dist_op {
@@ -55,15 +67,23 @@ uint32_t register_embree(const Shape &shape, const RTCDevice &device, const RTCS
 
 PointAndNormal sample_point_on_shape(const Shape &shape,
                                      const Vector3 &ref_point,
+                                     const Vector3 &ref_normal,
                                      const Vector2 &uv,
                                      Real w) {
-    return std::visit(sample_point_on_shape_op{ref_point, uv, w}, shape);
+    return std::visit(sample_point_on_shape_op{ref_point, ref_normal, uv, w}, shape);
 }
 
 Real pdf_point_on_shape(const Shape &shape,
                         const PointAndNormal &point_on_shape,
-                        const Vector3 &ref_point) {
-    return std::visit(pdf_point_on_shape_op{point_on_shape, ref_point}, shape);
+                        const Vector3 &ref_point,
+                        const Vector3 &ref_normal) {
+    return std::visit(pdf_point_on_shape_op{point_on_shape, ref_point, ref_normal}, shape);
+}
+
+PointAndNormal sample_point_on_shape_uniform(const Shape &shape,
+                                             const Vector2 &uv,
+                                             Real w) {
+    return std::visit(sample_point_on_shape_uniform_op{uv, w}, shape);
 }
 
 Real surface_area(const Shape &shape) {
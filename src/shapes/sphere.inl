@@ -9,31 +9,37 @@ void sphere_bounds_func(const struct RTCBoundsFunctionArguments* args) {
     bounds_o->upper_z = sphere->position.z + sphere->radius;
 }
 
-/// Numerically stable quadratic equation solver at^2 + bt + c = 0
-/// See https://people.csail.mit.edu/bkph/articles/Quadratics.pdf
-/// returns false when it can't find solutions.
-bool solve_quadratic(Real a, Real b, Real c, Real *t0, Real *t1) {
-    // Degenerated case
-    if (a == 0) {
-        if (b == 0) {
-            return false;
-        }
-        *t0 = *t1 = -c / b;
-        return true;
+/// Solves for the ray parameters t where the ray hits the sphere.
+/// Plugging B^2 - 4AC directly into the textbook quadratic formula loses most of the digits
+/// when the ray origin is far away compared to the radius (B^2 and 4AC are both huge
+/// and nearly cancel), which is catastrophic in single precision.
+/// Instead, we compute the discriminant from the distance between the sphere center and
+/// the closest point on the ray, which doesn't have the cancellation.
+/// See Chapter 7 of Ray Tracing Gems, "Precision Improvements for Ray/Sphere Intersection".
+bool solve_sphere_quadratic(const Ray &ray, const Sphere &sphere, Real *t0, Real *t1) {
+    Vector3 v = ray.org - sphere.position;
+    Real A = dot(ray.dir, ray.dir);
+    Real C = dot(v, v) - sphere.radius * sphere.radius;
+    if (A == 0) {
+        return false;
     }
-
-    Real discriminant = b * b - 4 * a * c;
+    // -B/2
+    Real b = -dot(ray.dir, v);
+    // The distance between the sphere center and the closest point on the (infinite) ray.
+    Real l = length(v + (b / A) * ray.dir);
+    // (B^2 - 4AC) / 4
+    Real discriminant = A * (sphere.radius - l) * (sphere.radius + l);
     if (discriminant < 0) {
         return false;
     }
-    Real root_discriminant = sqrt(discriminant);
-    if (b >= 0) {
-        *t0 = (- b - root_discriminant) / (2 * a);
-        *t1 = 2 * c / (- b - root_discriminant);
-    } else {
-        *t0 = 2 * c / (- b + root_discriminant);
-        *t1 = (- b + root_discriminant) / (2 * a);
+    Real q = b + (b >= 0 ? sqrt(discriminant) : -sqrt(discriminant));
+    if (q == 0) {
+        // b = 0 and the ray is tangent to the sphere: the double root is at t = 0.
+        *t0 = *t1 = 0;
+        return true;
     }
+    *t0 = C / q;
+    *t1 = q / A;
     return true;
 }
 
@@ -59,12 +65,9 @@ void sphere_intersect_func(const RTCIntersectFunctionNArguments* args) {
     // (d.x^2 + d.y^2 + d.z^2) t^2 + 2 * (d.x * (o.x - p.x) + d.y * (o.y - p.y) + d.z * (o.z - p.z)) t + 
     // ((p.x-o.x)^2 + (p.y-o.y)^2 + (p.z-o.z)^2  - r^2) = 0
     // A t^2 + B t + C
-    Vector3 v = ray.org - sphere->position;
-    Real A = dot(ray.dir, ray.dir);
-    Real B = 2 * dot(ray.dir, v);
-    Real C = dot(v, v) - sphere->radius * sphere->radius;
+    // (solve_sphere_quadratic computes the discriminant in a numerically robust way)
     Real t0, t1;
-    if (!solve_quadratic(A, B, C, &t0, &t1)) {
+    if (!solve_sphere_quadratic(ray, *sphere, &t0, &t1)) {
         // No intersection
         return;
     }
@@ -106,45 +109,42 @@ void sphere_intersect_func(const RTCIntersectFunctionNArguments* args) {
 }
 
 void sphere_occluded_func(const RTCOccludedFunctionNArguments* args) {
-    assert(args->N == 1);
-    int *valid = args->valid;
-    if (!valid[0]) {
-        return;
-    }
-
+    // Unlike sphere_intersect_func, this can be called with a ray packet
+    // (N > 1) when we trace shadow rays in batches (see occluded() in intersection.h).
     void *ptr = args->geometryUserPtr;
     const Sphere *sphere = (const Sphere*)ptr;
-    RTCRay *rtc_ray = (RTCRay *)args->ray;
-    
-    Ray ray{Vector3{rtc_ray->org_x, rtc_ray->org_y, rtc_ray->org_z},
-            Vector3{rtc_ray->dir_x, rtc_ray->dir_y, rtc_ray->dir_z},
-            rtc_ray->tnear, rtc_ray->tfar};
+    RTCRayN *rtc_ray = args->ray;
+    unsigned int N = args->N;
+    for (unsigned int i = 0; i < N; i++) {
+        if (!args->valid[i]) {
+            continue;
+        }
+        Ray ray{Vector3{RTCRayN_org_x(rtc_ray, N, i), RTCRayN_org_y(rtc_ray, N, i), RTCRayN_org_z(rtc_ray, N, i)},
+                Vector3{RTCRayN_dir_x(rtc_ray, N, i), RTCRayN_dir_y(rtc_ray, N, i), RTCRayN_dir_z(rtc_ray, N, i)},
+                RTCRayN_tnear(rtc_ray, N, i), RTCRayN_tfar(rtc_ray, N, i)};
 
-    // See sphere_intersect_func for explanation.
-    Vector3 v = ray.org - sphere->position;
-    Real A = dot(ray.dir, ray.dir);
-    Real B = 2 * dot(ray.dir, v);
-    Real C = dot(v, v) - sphere->radius * sphere->radius;
-    Real t0, t1;
-    if (!solve_quadratic(A, B, C, &t0, &t1)) {
-        // No intersection
-        return;
-    }
+        // See sphere_intersect_func for explanation.
+        Real t0, t1;
+        if (!solve_sphere_quadratic(ray, *sphere, &t0, &t1)) {
+            // No intersection
+            continue;
+        }
 
-    // This can happen due to numerical inaccuracies
-    if (t0 > t1) {
-        std::swap(t0, t1);
-    }
-    Real t = -1;
-    if (t0 >= ray.tnear && t0 < ray.tfar) {
-        t = t0;
-    }
-    if (t1 >= ray.tnear && t1 < ray.tfar && t < 0) {
-        t = t1;
-    }
+        // This can happen due to numerical inaccuracies
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        Real t = -1;
+        if (t0 >= ray.tnear && t0 < ray.tfar) {
+            t = t0;
+        }
+        if (t1 >= ray.tnear && t1 < ray.tfar && t < 0) {
+            t = t1;
+        }
 
-    if (t >= ray.tnear && t < ray.tfar) {
-        rtc_ray->tfar = -infinity<float>();
+        if (t >= ray.tnear && t < ray.tfar) {
+            RTCRayN_tfar(rtc_ray, N, i) = -infinity<float>();
+        }
     }
 }
 
@@ -168,13 +168,7 @@ PointAndNormal sample_point_on_shape_op::operator()(const Sphere &sphere) const
 
     if (distance_squared(ref_point, center) < r * r) {
         // If the reference point is inside the sphere, just sample the whole sphere uniformly
-        Real z = 1 - 2 * uv.x;
-        Real r_ = sqrt(fmax(Real(0), 1 - z * z));
-        Real phi = 2 * c_PI * uv.y;
-        Vector3 offset(r_ * cos(phi), r_ * sin(phi), z);
-        Vector3 position = center + r * offset;
-        Vector3 normal = offset;
-        return PointAndNormal{position, normal};
+        return sample_point_on_shape_uniform_op{uv, w}(sphere);
     }
 
     // Otherwise sample a ray inside a cone towards the sphere center.
@@ -215,6 +209,16 @@ Real surface_area_op::operator()(const Sphere &sphere) const {
     return 4 * c_PI * sphere.radius * sphere.radius;
 }
 
+PointAndNormal sample_point_on_shape_uniform_op::operator()(const Sphere &sphere) const {
+    Real z = 1 - 2 * uv.x;
+    Real r_ = sqrt(fmax(Real(0), 1 - z * z));
+    Real phi = 2 * c_PI * uv.y;
+    Vector3 offset(r_ * cos(phi), r_ * sin(phi), z);
+    Vector3 position = sphere.position + sphere.radius * offset;
+    Vector3 normal = offset;
+    return PointAndNormal{position, normal};
+}
+
 Real pdf_point_on_shape_op::operator()(const Sphere &sphere) const {
     // https://www.pbr-book.org/3ed-2018/Light_Transport_I_Surface_Reflection/Sampling_Light_Sources#x2-SamplingSpheres
     const Vector3 &center = sphere.position;
@@ -232,9 +236,14 @@ Real pdf_point_on_shape_op::operator()(const Sphere &sphere) const {
     // Convert it back to area measure
     Vector3 p_on_sphere = point_on_shape.position;
     Vector3 n_on_sphere = point_on_shape.normal;
-    Vector3 dir = normalize(p_on_sphere - ref_point);
-    return pdf_solid_angle * fabs(dot(n_on_sphere, dir)) /
-        distance_squared(ref_point, p_on_sphere);
+    Real dist_sq = distance_squared(ref_point, p_on_sphere);
+    if (dist_sq <= 0) {
+        // A reference point on the sphere itself (e.g., on the light we sample)
+        // can't be lit by that point.
+        return 0;
+    }
+    Vector3 dir = (p_on_sphere - ref_point) / sqrt(dist_sq);
+    return pdf_solid_angle * fabs(dot(n_on_sphere, dir)) / dist_sq;
 }
 
 void init_sampling_dist_op::operator()(Sphere &sphere) const {
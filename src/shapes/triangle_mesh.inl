@@ -21,19 +21,243 @@ uint32_t register_embree_op::operator()(const TriangleMesh &mesh) const {
     return geomID;
 }
 
-PointAndNormal sample_point_on_shape_op::operator()(const TriangleMesh &mesh) const {
-    int tri_id = sample(mesh.triangle_sampler, w);
-    assert(tri_id >= 0 && tri_id < (int)mesh.indices.size());
+/// Meshes that ask for it ("solidAngleSampling") are sampled according to the solid angle
+/// the triangles subtend from the reference point, instead of their areas.
+/// This visits all the triangles of the mesh for each sample, so we only do it when the
+/// reference point is within a few bounding radii of the mesh (far away, area sampling is
+/// about as good and much cheaper).
+constexpr Real c_solid_angle_sampling_distance = Real(4);
+/// Arvo's spherical triangle sampling becomes numerically unstable when
+/// the triangle is tiny or covers almost a whole hemisphere.
+/// We fall back to area sampling outside this range (the same thresholds as pbrt-v4).
+constexpr Real c_min_spherical_triangle_solid_angle = Real(3e-4);
+constexpr Real c_max_spherical_triangle_solid_angle = Real(6.22);
+/// The projected solid angle warp never lets the density of a direction drop below
+/// this fraction of the cosine, so that the grazing directions can still be sampled
+/// (e.g., for BSDFs that aren't proportional to the cosine). Same as pbrt-v4.
+constexpr Real c_min_projected_solid_angle_weight = Real(0.01);
+
+/// Numerically robust angle between two unit vectors.
+inline Real angle_between(const Vector3 &u, const Vector3 &v) {
+    if (dot(u, v) < 0) {
+        return c_PI - 2 * asin(std::clamp(length(v + u) / 2, Real(0), Real(1)));
+    } else {
+        return 2 * asin(std::clamp(length(v - u) / 2, Real(0), Real(1)));
+    }
+}
+
+/// The solid angle subtended by the triangle (v0, v1, v2) viewed from ref_point.
+/// See "The Solid Angle of a Plane Triangle" from Van Oosterom and Strackee.
+inline Real triangle_solid_angle(const Vector3 &v0,
+                                 const Vector3 &v1,
+                                 const Vector3 &v2,
+                                 const Vector3 &ref_point) {
+    Vector3 a = normalize(v0 - ref_point);
+    Vector3 b = normalize(v1 - ref_point);
+    Vector3 c = normalize(v2 - ref_point);
+    Real numerator = fabs(dot(a, cross(b, c)));
+    Real denominator = 1 + dot(a, b) + dot(b, c) + dot(c, a);
+    Real solid_angle = 2 * atan2(numerator, denominator);
+    // atan2 returns negative values when the denominator is tiny & negative.
+    return solid_angle >= 0 && isfinite(solid_angle) ? solid_angle : Real(0);
+}
+
+/// Whether we sample the triangle (v0, v1, v2) with Arvo's method from ref_point:
+/// the triangle subtends a solid angle in the stable range, and none of its edges
+/// collapses on the sphere of directions. This only depends on the triangle and ref_point,
+/// so sample_point_on_shape and pdf_point_on_shape always make the same decision.
+inline bool use_spherical_triangle_sampling(const Vector3 &v0,
+                                            const Vector3 &v1,
+                                            const Vector3 &v2,
+                                            const Vector3 &ref_point,
+                                            Real solid_angle) {
+    if (solid_angle < c_min_spherical_triangle_solid_angle ||
+            solid_angle > c_max_spherical_triangle_solid_angle) {
+        return false;
+    }
+    Vector3 a = normalize(v0 - ref_point);
+    Vector3 b = normalize(v1 - ref_point);
+    Vector3 c = normalize(v2 - ref_point);
+    return length_squared(cross(a, b)) > 0 &&
+           length_squared(cross(b, c)) > 0 &&
+           length_squared(cross(c, a)) > 0;
+}
+
+/// Uniformly sample a direction in the spherical triangle subtended by
+/// (v0, v1, v2) from ref_point, and return the barycentric coordinates (b1, b2)
+/// of the corresponding point on the planar triangle.
+/// See "Stratified Sampling of Spherical Triangles" from James Arvo.
+/// The implementation follows pbrt-v4's SampleSphericalTriangle.
+/// Assumes use_spherical_triangle_sampling() said yes. The degenerate cases left
+/// (e.g., a direction parallel to the triangle) have zero probability,
+/// so we just return a point on the triangle for them instead of failing.
+inline Vector2 sample_spherical_triangle(const Vector3 &v0,
+                                                        const Vector3 &v1,
+                                                        const Vector3 &v2,
+                                                        const Vector3 &ref_point,
+                                                        const Vector2 &rnd_param) {
+    // Vertices of the spherical triangle
+    Vector3 a = normalize(v0 - ref_point);
+    Vector3 b = normalize(v1 - ref_point);
+    Vector3 c = normalize(v2 - ref_point);
+    // Normals of the great circles passing through the edges
+    Vector3 n_ab = normalize(cross(a, b));
+    Vector3 n_bc = normalize(cross(b, c));
+    Vector3 n_ca = normalize(cross(c, a));
+    // Interior angles at the three vertices
+    Real alpha = angle_between(n_ab, -n_ca);
+    Real beta = angle_between(n_bc, -n_ab);
+    Real gamma = angle_between(n_ca, -n_bc);
+
+    // Uniformly pick a sub-triangle area A' in [0, A] (A = alpha + beta + gamma - pi).
+    Real area_pi = max(alpha + beta + gamma, c_PI);
+    Real sub_area_pi = c_PI + rnd_param[0] * (area_pi - c_PI);
+    // Find the point c' on the arc between a and c such that
+    // the spherical triangle (a, b, c') has area A'.
+    Real cos_alpha = cos(alpha), sin_alpha = sin(alpha);
+    Real sin_phi = sin(sub_area_pi) * cos_alpha - cos(sub_area_pi) * sin_alpha;
+    Real cos_phi = cos(sub_area_pi) * cos_alpha + sin(sub_area_pi) * sin_alpha;
+    Real k1 = cos_phi + cos_alpha;
+    Real k2 = sin_phi - sin_alpha * dot(a, b);
+    Real cos_b_prime = (k2 + (k2 * cos_phi - k1 * sin_phi) * cos_alpha) /
+                       ((k2 * sin_phi + k1 * cos_phi) * sin_alpha);
+    cos_b_prime = std::clamp(cos_b_prime, Real(-1), Real(1));
+    Real sin_b_prime = sqrt(max(Real(0), 1 - cos_b_prime * cos_b_prime));
+    // c is not parallel to a (see use_spherical_triangle_sampling).
+    Vector3 c_prime = cos_b_prime * a + sin_b_prime * normalize(c - dot(c, a) * a);
+
+    // Uniformly sample the arc between b and c' (weighted by the sine of the angle)
+    Real cos_theta = 1 - rnd_param[1] * (1 - dot(c_prime, b));
+    Real sin_theta = sqrt(max(Real(0), 1 - cos_theta * cos_theta));
+    Vector3 cp_perp = c_prime - dot(c_prime, b) * b;
+    Vector3 w = length_squared(cp_perp) > 0 ?
+        cos_theta * b + sin_theta * normalize(cp_perp) : b;
+
+    // Intersect the direction w with the planar triangle to get the barycentric coordinates.
+    Vector3 e1 = v1 - v0;
+    Vector3 e2 = v2 - v0;
+    Vector3 s1 = cross(w, e2);
+    Real divisor = dot(s1, e1);
+    if (divisor == 0) {
+        // w is parallel to the triangle: return the vertex v1 (where w = b points to).
+        return Vector2{1, 0};
+    }
+    Vector3 s = ref_point - v0;
+    Real b1 = std::clamp(dot(s, s1) / divisor, Real(0), Real(1));
+    Real b2 = std::clamp(dot(w, cross(s, e1)) / divisor, Real(0), Real(1));
+    if (b1 + b2 > 1) {
+        Real sum = b1 + b2;
+        b1 /= sum;
+        b2 /= sum;
+    }
+    return Vector2{b1, b2};
+}
+
+/// The inverse of sample_spherical_triangle: given a direction w (from ref_point) inside the
+/// spherical triangle, return the random numbers that sample it.
+/// The implementation follows pbrt-v4's InvertSphericalTriangleSample.
+/// Assumes use_spherical_triangle_sampling() said yes.
+inline Vector2 invert_spherical_triangle_sample(const Vector3 &v0,
+                                                const Vector3 &v1,
+                                                const Vector3 &v2,
+                                                const Vector3 &ref_point,
+                                                const Vector3 &w) {
+    Vector3 a = normalize(v0 - ref_point);
+    Vector3 b = normalize(v1 - ref_point);
+    Vector3 c = normalize(v2 - ref_point);
+    Vector3 n_ab = normalize(cross(a, b));
+    Vector3 n_bc = normalize(cross(b, c));
+    Vector3 n_ca = normalize(cross(c, a));
+    Real alpha = angle_between(n_ab, -n_ca);
+    Real beta = angle_between(n_bc, -n_ab);
+    Real gamma = angle_between(n_ca, -n_bc);
+
+    // The arc from b through w meets the arc between a and c at c'.
+    Vector3 n_bw = cross(b, w);
+    if (length_squared(n_bw) <= 0) {
+        // w = b, where every sub-triangle starts.
+        return Vector2{Real(0.5), Real(0)};
+    }
+    Vector3 c_prime = cross(n_bw, cross(c, a));
+    if (length_squared(c_prime) <= 0) {
+        return Vector2{Real(0.5), Real(0.5)};
+    }
+    c_prime = normalize(c_prime);
+    if (dot(c_prime, a + c) < 0) {
+        c_prime = -c_prime;
+    }
+    // The area of the sub-triangle (a, b, c') gives u0...
+    Real u0 = 0;
+    if (dot(a, c_prime) < Real(0.99999847691) /* 0.1 degrees */) {
+        Vector3 n_cpb = cross(c_prime, b);
+        Vector3 n_acp = cross(a, c_prime);
+        if (length_squared(n_cpb) <= 0 || length_squared(n_acp) <= 0) {
+            return Vector2{Real(0.5), Real(0.5)};
+        }
+        n_cpb = normalize(n_cpb);
+        n_acp = normalize(n_acp);
+        Real sub_area = alpha + angle_between(n_ab, n_cpb) + angle_between(n_acp, -n_cpb) - c_PI;
+        Real area = alpha + beta + gamma - c_PI;
+        u0 = area > 0 ? sub_area / area : Real(0);
+    }
+    // ...and the position of w on the arc between b and c' gives u1.
+    Real denominator = 1 - dot(c_prime, b);
+    Real u1 = denominator > 0 ? (1 - dot(w, b)) / denominator : Real(0);
+    return Vector2{std::clamp(u0, Real(0), Real(1)), std::clamp(u1, Real(0), Real(1))};
+}
+
+/// Sample x in [0, 1] proportional to (1 - x) * a + x * b.
+inline Real sample_linear(Real u, Real a, Real b) {
+    if (u == 0 && a == 0) {
+        return 0;
+    }
+    Real x = u * (a + b) / (a + sqrt((1 - u) * a * a + u * b * b));
+    return std::clamp(x, Real(0), Real(1));
+}
+
+/// Sample a point in [0, 1]^2 proportional to the bilinear interpolation of the corner
+/// weights w (in the order (0, 0), (1, 0), (0, 1), (1, 1)).
+inline Vector2 sample_bilinear(const Vector2 &u, const std::array<Real, 4> &w) {
+    Real y = sample_linear(u[1], w[0] + w[1], w[2] + w[3]);
+    Real x = sample_linear(u[0], (1 - y) * w[0] + y * w[2], (1 - y) * w[1] + y * w[3]);
+    return Vector2{x, y};
+}
+
+/// Probability density of sample_bilinear.
+inline Real pdf_bilinear(const Vector2 &p, const std::array<Real, 4> &w) {
+    return 4 * ((1 - p[0]) * (1 - p[1]) * w[0] + p[0] * (1 - p[1]) * w[1] +
+                (1 - p[0]) * p[1] * w[2] + p[0] * p[1] * w[3]) /
+        (w[0] + w[1] + w[2] + w[3]);
+}
+
+/// The projected solid angle warp (see "Practical Product Sampling by Fitting and Composing Warps"
+/// from Hart et al., and pbrt-v4's Triangle::Sample):
+/// the cosine at the reference point is smooth over the triangle, so we approximate it with
+/// the bilinear interpolation of the cosines at the corners of the square that
+/// sample_spherical_triangle maps to the triangle (u1 = 0 maps to v1, (0, 1) to v0, and (1, 1) to v2),
+/// and warp the random numbers by it before sampling the spherical triangle.
+/// Without a normal at the reference point (e.g., in a medium), all weights are equal
+/// and the warp does nothing.
+inline std::array<Real, 4> projected_solid_angle_weights(const Vector3 &v0,
+                                                         const Vector3 &v1,
+                                                         const Vector3 &v2,
+                                                         const Vector3 &ref_point,
+                                                         const Vector3 &ref_normal) {
+    Real cos0 = max(fabs(dot(ref_normal, normalize(v0 - ref_point))), c_min_projected_solid_angle_weight);
+    Real cos1 = max(fabs(dot(ref_normal, normalize(v1 - ref_point))), c_min_projected_solid_angle_weight);
+    Real cos2 = max(fabs(dot(ref_normal, normalize(v2 - ref_point))), c_min_projected_solid_angle_weight);
+    return {cos1, cos1, cos0, cos2};
+}
+
+/// Given a triangle and barycentric coordinates (b1, b2), return the point and the geometric normal.
+/// The geometric normal is flipped to the same side as the shading normal when there is one.
+inline PointAndNormal point_on_triangle(const TriangleMesh &mesh, int tri_id, Real b1, Real b2) {
     Vector3i index = mesh.indices[tri_id];
     Vector3 v0 = mesh.positions[index[0]];
     Vector3 v1 = mesh.positions[index[1]];
     Vector3 v2 = mesh.positions[index[2]];
     Vector3 e1 = v1 - v0;
     Vector3 e2 = v2 - v0;
-    // https://pbr-book.org/3ed-2018/Monte_Carlo_Integration/2D_Sampling_with_Multidimensional_Transformations#SamplingaTriangle
-    Real a = sqrt(std::clamp(uv[0], Real(0), Real(1)));
-    Real b1 = 1 - a;
-    Real b2 = a * uv[1];
     Vector3 geometric_normal = normalize(cross(e1, e2));
     // Flip the geometric normal to the same side as the shading normal
     if (mesh.normals.size() > 0) {
@@ -46,7 +270,74 @@ PointAndNormal sample_point_on_shape_op::operator()(const TriangleMesh &mesh) co
             geometric_normal = -geometric_normal;
         }
     }
-    return PointAndNormal{v0 + (e1 * b1) + (e2 * b2), geometric_normal};
+    return PointAndNormal{v0 + (e1 * b1) + (e2 * b2), geometric_normal, tri_id};
+}
+
+/// Whether we sample the mesh by the solid angles of its triangles from ref_point.
+inline bool use_solid_angle_sampling(const TriangleMesh &mesh, const Vector3 &ref_point) {
+    if (!mesh.solid_angle_sampling) {
+        return false;
+    }
+    Real max_dist = c_solid_angle_sampling_distance * mesh.bounding_radius;
+    return distance_squared(ref_point, mesh.bounding_center) <= max_dist * max_dist;
+}
+
+/// The solid angle of the triangle tri_id of the mesh seen from ref_point.
+inline Real triangle_solid_angle(const TriangleMesh &mesh, int tri_id, const Vector3 &ref_point) {
+    Vector3i index = mesh.indices[tri_id];
+    return triangle_solid_angle(mesh.positions[index[0]],
+                                mesh.positions[index[1]],
+                                mesh.positions[index[2]],
+                                ref_point);
+}
+
+/// The running sums of the solid angles of the triangles for sample_point_on_shape.
+/// Each thread keeps its own, so we only allocate when we see a larger mesh.
+static thread_local std::vector<Real> solid_angle_cdf;
+
+PointAndNormal sample_point_on_shape_op::operator()(const TriangleMesh &mesh) const {
+    if (use_solid_angle_sampling(mesh, ref_point)) {
+        // Select a triangle proportional to the solid angle it subtends.
+        int num_triangles = (int)mesh.indices.size();
+        solid_angle_cdf.resize(num_triangles + 1);
+        solid_angle_cdf[0] = 0;
+        for (int i = 0; i < num_triangles; i++) {
+            solid_angle_cdf[i + 1] = solid_angle_cdf[i] + triangle_solid_angle(mesh, i, ref_point);
+        }
+        Real total_solid_angle = solid_angle_cdf[num_triangles];
+        // Zero when the reference point is on the plane of all triangles.
+        if (total_solid_angle > 0) {
+            int tri_id = int(std::upper_bound(solid_angle_cdf.begin() + 1, solid_angle_cdf.end(),
+                                              w * total_solid_angle) - (solid_angle_cdf.begin() + 1));
+            tri_id = std::clamp(tri_id, 0, num_triangles - 1);
+            Real solid_angle = solid_angle_cdf[tri_id + 1] - solid_angle_cdf[tri_id];
+            Vector3i index = mesh.indices[tri_id];
+            const Vector3 &v0 = mesh.positions[index[0]];
+            const Vector3 &v1 = mesh.positions[index[1]];
+            const Vector3 &v2 = mesh.positions[index[2]];
+            if (use_spherical_triangle_sampling(v0, v1, v2, ref_point, solid_angle)) {
+                Vector2 u = sample_bilinear(
+                    uv, projected_solid_angle_weights(v0, v1, v2, ref_point, ref_normal));
+                Vector2 b = sample_spherical_triangle(v0, v1, v2, ref_point, u);
+                return point_on_triangle(mesh, tri_id, b.x, b.y);
+            }
+            // Tiny (or huge, or degenerate) triangle: uniformly sample the area.
+            Real a = sqrt(std::clamp(uv[0], Real(0), Real(1)));
+            return point_on_triangle(mesh, tri_id, 1 - a, a * uv[1]);
+        }
+    }
+
+    return sample_point_on_shape_uniform_op{uv, w}(mesh);
+}
+
+PointAndNormal sample_point_on_shape_uniform_op::operator()(const TriangleMesh &mesh) const {
+    int tri_id = sample(mesh.triangle_sampler, w);
+    assert(tri_id >= 0 && tri_id < (int)mesh.indices.size());
+    // https://pbr-book.org/3ed-2018/Monte_Carlo_Integration/2D_Sampling_with_Multidimensional_Transformations#SamplingaTriangle
+    Real a = sqrt(std::clamp(uv[0], Real(0), Real(1)));
+    Real b1 = 1 - a;
+    Real b2 = a * uv[1];
+    return point_on_triangle(mesh, tri_id, b1, b2);
 }
 
 Real surface_area_op::operator()(const TriangleMesh &mesh) const {
@@ -54,7 +345,48 @@ Real surface_area_op::operator()(const TriangleMesh &mesh) const {
 }
 
 Real pdf_point_on_shape_op::operator()(const TriangleMesh &mesh) const {
-    return 1 / surface_area_op{}(mesh);
+    if (!use_solid_angle_sampling(mesh, ref_point)) {
+        return 1 / surface_area_op{}(mesh);
+    }
+    Real total_solid_angle = 0;
+    for (int i = 0; i < (int)mesh.indices.size(); i++) {
+        total_solid_angle += triangle_solid_angle(mesh, i, ref_point);
+    }
+    if (total_solid_angle <= 0) {
+        return 1 / surface_area_op{}(mesh);
+    }
+    // The density depends on the triangle the point is on.
+    int tri_id = point_on_shape.primitive_id;
+    assert(tri_id >= 0 && tri_id < (int)mesh.indices.size());
+    if (tri_id < 0 || tri_id >= (int)mesh.indices.size()) {
+        return 0;
+    }
+    Real solid_angle = triangle_solid_angle(mesh, tri_id, ref_point);
+    if (solid_angle <= 0) {
+        return 0;
+    }
+    Real tri_pmf = solid_angle / total_solid_angle;
+    Vector3i index = mesh.indices[tri_id];
+    const Vector3 &v0 = mesh.positions[index[0]];
+    const Vector3 &v1 = mesh.positions[index[1]];
+    const Vector3 &v2 = mesh.positions[index[2]];
+    const Vector3 &p = point_on_shape.position;
+    if (use_spherical_triangle_sampling(v0, v1, v2, ref_point, solid_angle)) {
+        Real dist_sq = distance_squared(ref_point, p);
+        if (dist_sq <= 0) {
+            return 0;
+        }
+        Vector3 dir = (p - ref_point) / sqrt(dist_sq);
+        // Uniform in solid angle, warped by the cosine at the reference point.
+        Vector2 u = invert_spherical_triangle_sample(v0, v1, v2, ref_point, dir);
+        Real pdf_solid_angle = pdf_bilinear(
+            u, projected_solid_angle_weights(v0, v1, v2, ref_point, ref_normal)) / solid_angle;
+        // Convert to area measure.
+        return tri_pmf * pdf_solid_angle * fabs(dot(point_on_shape.normal, dir)) / dist_sq;
+    } else {
+        Real area = length(cross(v1 - v0, v2 - v0)) / 2;
+        return area > 0 ? tri_pmf / area : Real(0);
+    }
 }
 
 void init_sampling_dist_op::operator()(TriangleMesh &mesh) const {
@@ -72,6 +404,21 @@ void init_sampling_dist_op::operator()(TriangleMesh &mesh) const {
     }
     mesh.triangle_sampler = make_table_dist_1d(tri_areas);
     mesh.total_area = total_area;
+
+    // Bounding sphere of the mesh (not the tightest one, but good enough)
+    Vector3 lb{infinity<Real>(), infinity<Real>(), infinity<Real>()};
+    Vector3 ub = -lb;
+    for (const Vector3 &p : mesh.positions) {
+        for (int i = 0; i < 3; i++) {
+            lb[i] = min(lb[i], p[i]);
+            ub[i] = max(ub[i], p[i]);
+        }
+    }
+    mesh.bounding_center = (lb + ub) / Real(2);
+    mesh.bounding_radius = 0;
+    for (const Vector3 &p : mesh.positions) {
+        mesh.bounding_radius = max(mesh.bounding_radius, distance(p, mesh.bounding_center));
+    }
 }
 
 ShadingInfo compute_shading_info_op::operator()(const TriangleMesh &mesh) const {
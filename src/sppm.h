@@ -0,0 +1,406 @@
+#pragma once
+
+#include "scene.h"
+#include "image.h"
+#include "intersection.h"
+#include "material.h"
+#include "pcg.h"
+#include "sampler.h"
+#include <atomic>
+#include <vector>
+
+/// Stochastic progressive photon mapping (SPPM), from "Stochastic Progressive Photon Mapping"
+/// from Hachisuka and Jensen, following the implementation of pbrt-v3 (Chapter 16.2 of the book).
+/// Photon mapping traces paths from the lights ("photons"), and estimates the radiance
+/// at a point seen by the camera by averaging the photons that land within a radius around it
+/// (density estimation). This is biased (it blurs the lighting over the radius), but it can render
+/// the paths that the (bidirectional) path tracers can't sample well, e.g., caustics seen
+/// through a glass object: these need a light subpath and a camera subpath that meet
+/// exactly at a diffuse surface.
+///
+/// Each iteration has two passes:
+/// 1. The camera pass traces a path from each pixel through the (near) specular surfaces,
+///    until it finds a "visible point" on a non-specular surface. We compute the direct lighting
+///    there with next event estimation, and store the point for the photon pass.
+/// 2. The photon pass traces photons from the lights, and adds the flux of every photon
+///    to the visible points within the radius of their pixel.
+/// After each iteration, we shrink the radius of each pixel depending on how many photons
+/// it has seen, so that the bias goes to zero as we render more iterations (the "progressive" part).
+/// Since we only store the visible points (one per pixel) and never the photons,
+/// the memory usage only depends on the number of pixels.
+///
+/// The visible points are stored in a spatial hash grid, which we rebuild from scratch each iteration
+/// in parallel. The photons then look up the grid in parallel and accumulate their flux atomically.
+///
+/// Limitations:
+/// - We use a one-pixel box filter, and one camera path per pixel per iteration.
+/// - No participating media.
+
+/// The camera paths go through the closures with a roughness below this:
+/// their BSDFs are so sharp that the density estimation would blur them too much.
+constexpr Real c_sppm_specular_roughness = Real(0.25);
+
+/// The radius shrinks slower with a larger alpha (the fraction of the new photons we keep).
+/// Hachisuka and Jensen recommend 2/3.
+constexpr Real c_sppm_alpha = Real(2) / Real(3);
+
+/// Each visible point covers at most 2x2x2 cells of the grid (the cells are as wide
+/// as the largest diameter), so the grid needs at most this many entries per pixel.
+constexpr int c_sppm_max_cells_per_point = 8;
+
+/// A point found by the camera pass, where we do the density estimation of the photons.
+struct SPPMVisiblePoint {
+    PathVertex vertex;
+    MaterialClosure closure;
+    Vector3 dir_view;
+    // The throughput of the camera path up to this point.
+    Spectrum beta;
+    // The number of segments of the camera path up to this point.
+    int num_segments;
+};
+
+/// The progressive statistics of a pixel, see Chapter 16.2.2 of pbrt-v3.
+struct SPPMPixel {
+    Real radius;
+    // The sum of the direct lighting (and the emission seen through specular surfaces) of all iterations.
+    Spectrum Ld;
+    // The visible point of the current iteration, if any.
+    bool has_visible_point = false;
+    SPPMVisiblePoint visible_point;
+    // N: the (reduced) number of photons the pixel has seen.
+    // tau: the (reduced) flux of those photons, multiplied by the throughput of the visible points.
+    Real N = 0;
+    Spectrum tau;
+};
+
+/// A hash grid over the visible points. Each cell of the hash table is a linked list of the
+/// visible points overlapping the cell. The lists are built lock-free: to add an entry, we
+/// allocate a node with an atomic counter, then atomically swap it with the head of the list.
+/// The nodes are preallocated, and we never free them individually: we clear the whole grid
+/// each iteration.
+struct SPPMGrid {
+    SPPMGrid(int num_pixels)
+        : heads(num_pixels), nodes(c_sppm_max_cells_per_point * size_t(num_pixels)) {
+        clear();
+    }
+
+    struct Node {
+        int pixel_id;
+        int next;
+    };
+
+    void clear() {
+        for (std::atomic<int> &h : heads) {
+            h.store(-1, std::memory_order_relaxed);
+        }
+        num_nodes.store(0, std::memory_order_relaxed);
+    }
+
+    Vector3i cell(const Vector3 &p) const {
+        return Vector3i{int(floor(p.x / cell_size)),
+                        int(floor(p.y / cell_size)),
+                        int(floor(p.z / cell_size))};
+    }
+
+    /// Spatial hash from "Optimized Spatial Hashing for Collision Detection of Deformable Objects"
+    /// from Teschner et al.
+    size_t hash(const Vector3i &c) const {
+        uint32_t h = (uint32_t(c.x) * 73856093u) ^ (uint32_t(c.y) * 19349663u) ^ (uint32_t(c.z) * 83492791u);
+        return h % heads.size();
+    }
+
+    /// Can be called by multiple threads at the same time.
+    void insert(const Vector3 &p, Real radius, int pixel_id) {
+        Vector3i c0 = cell(p - Vector3{radius, radius, radius});
+        Vector3i c1 = cell(p + Vector3{radius, radius, radius});
+        for (int z = c0.z; z <= c1.z; z++) {
+            for (int y = c0.y; y <= c1.y; y++) {
+                for (int x = c0.x; x <= c1.x; x++) {
+                    int node_id = num_nodes.fetch_add(1, std::memory_order_relaxed);
+                    // The cells are at least as large as the diameter, so this never happens
+                    // unless floating point rounding puts a point over one more cell.
+                    if (node_id >= (int)nodes.size()) {
+                        return;
+                    }
+                    nodes[node_id].pixel_id = pixel_id;
+                    nodes[node_id].next =
+                        heads[hash(Vector3i{x, y, z})].exchange(node_id, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    Real cell_size = 1;
+    std::vector<std::atomic<int>> heads;
+    std::vector<Node> nodes;
+    std::atomic<int> num_nodes;
+};
+
+/// Next event estimation at a visible point, with MIS between one light sample and
+/// one BSDF sample (see path_tracing.h for the details).
+inline Spectrum sppm_direct_lighting(const Scene &scene,
+                                     const SPPMVisiblePoint &vp,
+                                     Sampler &sampler) {
+    const PathVertex &vertex = vp.vertex;
+    Spectrum L = make_zero_spectrum();
+
+    // Light sampling
+    Vector2 light_uv = next_2d(sampler);
+    Real light_w = next_1d(sampler);
+    Real shape_w = next_1d(sampler);
+    int light_id = sample_light(scene, light_w);
+    const Light &light = scene.lights[light_id];
+    PointAndNormal point_on_light =
+        sample_point_on_light(light, vertex.position, vertex.shading_frame.n, light_uv, shape_w, scene);
+    Real p_light = light_pmf(scene, light_id) *
+        pdf_point_on_light(light, point_on_light, vertex.position, vertex.shading_frame.n, scene);
+    if (p_light > 0) {
+        Vector3 dir_light;
+        Ray shadow_ray;
+        // We compare the densities in the solid angle measure.
+        Real p_light_dir = p_light;
+        if (is_infinite_light(light)) {
+            dir_light = -point_on_light.normal;
+            shadow_ray = Ray{vertex.position, dir_light, get_shadow_epsilon(scene), infinity<Real>()};
+        } else {
+            dir_light = point_on_light.position - vertex.position;
+            Real dist = length(dir_light);
+            dir_light = dir_light / dist;
+            shadow_ray = Ray{vertex.position, dir_light,
+                             get_shadow_epsilon(scene), (1 - get_shadow_epsilon(scene)) * dist};
+            if (!is_delta_light(light)) {
+                Real cos_light = fabs(dot(dir_light, point_on_light.normal));
+                p_light_dir = cos_light > 0 ? p_light * dist * dist / cos_light : Real(0);
+            } else {
+                p_light_dir = p_light * dist * dist;
+            }
+        }
+        BSDFEvalRecord bsdf_eval = eval_with_pdf(vp.closure, vp.dir_view, dir_light, vertex);
+        Spectrum contrib = bsdf_eval.f *
+            emission(light, -dir_light, Real(0), point_on_light, scene) / p_light_dir;
+        if (p_light_dir > 0 && max(contrib) > 0 && !occluded(scene, shadow_ray)) {
+            Real w = is_delta_light(light) ? Real(1) :
+                (p_light_dir * p_light_dir) /
+                (p_light_dir * p_light_dir + bsdf_eval.pdf_fwd * bsdf_eval.pdf_fwd);
+            L += contrib * w;
+        }
+    }
+
+    // BSDF sampling
+    Vector2 bsdf_rnd_param_uv = next_2d(sampler);
+    Real bsdf_rnd_param_w = next_1d(sampler);
+    std::optional<BSDFSampleRecord> bsdf_sample =
+        sample_bsdf(vp.closure, vp.dir_view, vertex, bsdf_rnd_param_uv, bsdf_rnd_param_w);
+    if (!bsdf_sample || bsdf_sample->pdf_fwd <= 0) {
+        return L;
+    }
+    Spectrum f_over_pdf = bsdf_sample->f / bsdf_sample->pdf_fwd;
+    Ray bsdf_ray{vertex.position, bsdf_sample->dir_out, get_intersection_epsilon(scene), infinity<Real>()};
+    std::optional<PathVertex> hit = intersect(scene, bsdf_ray);
+    Real p_bsdf = bsdf_sample->pdf_fwd;
+    if (hit) {
+        if (is_light(scene.shapes[hit->shape_id])) {
+            int hit_light_id = get_area_light_id(scene.shapes[hit->shape_id]);
+            const Light &hit_light = scene.lights[hit_light_id];
+            Real dist_sq = distance_squared(hit->position, vertex.position);
+            Real cos_light = fabs(dot(bsdf_sample->dir_out, hit->geometric_normal));
+            Real p = light_pmf(scene, hit_light_id) *
+                pdf_point_on_light(hit_light,
+                                   PointAndNormal{hit->position, hit->geometric_normal, hit->primitive_id},
+                                   vertex.position, vertex.shading_frame.n, scene);
+            Real p_light_dir = cos_light > 0 ? p * dist_sq / cos_light : Real(0);
+            Real w = (p_bsdf * p_bsdf) / (p_bsdf * p_bsdf + p_light_dir * p_light_dir);
+            L += f_over_pdf * emission(*hit, -bsdf_sample->dir_out, scene) * w;
+        }
+    } else if (has_envmap(scene)) {
+        const Light &envmap = get_envmap(scene);
+        Real p_light_dir = light_pmf(scene, scene.envmap_light_id) *
+            pdf_point_on_light(envmap, PointAndNormal{Vector3{0, 0, 0}, -bsdf_sample->dir_out},
+                               vertex.position, vertex.shading_frame.n, scene);
+        Real w = (p_bsdf * p_bsdf) / (p_bsdf * p_bsdf + p_light_dir * p_light_dir);
+        L += f_over_pdf * emission(envmap, -bsdf_sample->dir_out, Real(0), PointAndNormal{}, scene) * w;
+    }
+    return L;
+}
+
+/// The camera pass of pixel (x, y): accumulates the direct lighting to pixel.Ld,
+/// and stores the visible point of the pixel, if there is one.
+inline void sppm_camera_pass(const Scene &scene,
+                             int x, int y, /* pixel coordinates */
+                             Sampler &sampler,
+                             SPPMPixel &pixel) {
+    int w = scene.camera.width, h = scene.camera.height;
+    int max_depth = scene.options.max_depth;
+    pixel.has_visible_point = false;
+
+    Vector2 pixel_uv = next_2d(sampler);
+    Vector2 screen_pos((x + pixel_uv.x) / w,
+                       (y + pixel_uv.y) / h);
+    Ray ray = screen_to_ray(scene.camera, screen_pos);
+    RayDifferential ray_diff = init_ray_differential(w, h);
+    Spectrum beta = make_const_spectrum(1);
+    // We only account for the emission we hit directly or through specular surfaces:
+    // the rest comes from the next event estimation.
+    // Like the path tracer, max_depth is the maximum number of segments of the full path
+    // (camera + photon), so the direct lighting needs one segment after the visible point.
+    for (int depth = 0; max_depth == -1 || depth < max_depth; depth++) {
+        std::optional<PathVertex> vertex_ = intersect(scene, ray, ray_diff);
+        if (!vertex_) {
+            if (has_envmap(scene)) {
+                pixel.Ld += beta * emission(get_envmap(scene), -ray.dir, ray_diff.spread,
+                                            PointAndNormal{}, scene);
+            }
+            return;
+        }
+        const PathVertex &vertex = *vertex_;
+        if (is_light(scene.shapes[vertex.shape_id])) {
+            pixel.Ld += beta * emission(vertex, -ray.dir, scene);
+        }
+        if (max_depth != -1 && depth + 1 >= max_depth) {
+            return;
+        }
+        MaterialClosure closure =
+            make_closure(scene.materials[vertex.material_id], vertex, scene.texture_pool);
+        Vector3 dir_view = -ray.dir;
+        // Stop at the first non-specular surface, where the photons will do the rest.
+        if (!is_near_specular(closure, c_sppm_specular_roughness)) {
+            SPPMVisiblePoint vp{vertex, closure, dir_view, beta, depth + 1};
+            pixel.Ld += beta * sppm_direct_lighting(scene, vp, sampler);
+            pixel.has_visible_point = true;
+            pixel.visible_point = vp;
+            return;
+        }
+
+        Vector2 bsdf_rnd_param_uv = next_2d(sampler);
+        Real bsdf_rnd_param_w = next_1d(sampler);
+        std::optional<BSDFSampleRecord> bsdf_sample =
+            sample_bsdf(closure, dir_view, vertex, bsdf_rnd_param_uv, bsdf_rnd_param_w);
+        if (!bsdf_sample || bsdf_sample->pdf_fwd <= 0) {
+            return;
+        }
+        beta *= bsdf_sample->f / bsdf_sample->pdf_fwd;
+        if (bsdf_sample->eta == 0) {
+            ray_diff.spread = reflect(ray_diff, vertex.mean_curvature, bsdf_sample->roughness);
+        } else {
+            ray_diff.spread = refract(ray_diff, vertex.mean_curvature, bsdf_sample->eta, bsdf_sample->roughness);
+        }
+        ray = Ray{vertex.position, bsdf_sample->dir_out, get_intersection_epsilon(scene), infinity<Real>()};
+    }
+}
+
+/// The random number streams of an SPPM rendering with num_iterations iterations:
+/// the camera pass of each iteration uses num_tiles streams (one per tile of the image),
+/// and the photon pass num_photon_chunks streams (one per chunk of photons).
+/// Each iteration needs new streams: the independent sampler doesn't look at the sample index,
+/// so reusing the streams would trace the same camera paths and photons every iteration.
+inline uint64_t sppm_camera_stream(int iteration, int tile_id, int num_tiles) {
+    return uint64_t(iteration) * num_tiles + tile_id;
+}
+
+/// The photon streams come after all the camera streams, so that no photon
+/// shares its random numbers with a camera path.
+inline uint64_t sppm_photon_stream(int iteration, int64_t chunk, int64_t num_photon_chunks,
+                                   int num_iterations, int num_tiles) {
+    return uint64_t(num_iterations) * num_tiles + uint64_t(iteration) * num_photon_chunks + chunk;
+}
+
+/// Traces one photon from the lights, and adds its flux to the visible points it lands near:
+/// phi (per pixel) accumulates the flux times the BSDF, and num_photons counts the photons.
+inline void sppm_trace_photon(const Scene &scene,
+                              const std::vector<SPPMPixel> &pixels,
+                              const SPPMGrid &grid,
+                              pcg32_state &rng,
+                              SplatImage &phi,
+                              std::vector<std::atomic<int>> &num_photons) {
+    int w = scene.camera.width;
+    int max_depth = scene.options.max_depth;
+    Real light_w = next_pcg32_real<Real>(rng);
+    Vector2 pos_uv{next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng)};
+    Real pos_w = next_pcg32_real<Real>(rng);
+    Vector2 dir_uv{next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng)};
+    int light_id = sample_light(scene, light_w);
+    const Light &light = scene.lights[light_id];
+    std::optional<LightEmissionRecord> rec = sample_emission(light, pos_uv, pos_w, dir_uv, scene);
+    if (!rec) {
+        return;
+    }
+    Real pdf = light_pmf(scene, light_id) * rec->pdf.pos * rec->pdf.dir;
+    if (pdf <= 0) {
+        return;
+    }
+    // The point, spot, and infinite lights store the emission direction in the normal,
+    // so the cosine is 1 for them.
+    Real cos_light = fabs(dot(rec->point_on_light.normal, rec->dir));
+    Spectrum beta = emission(light, rec->dir, Real(0), rec->point_on_light, scene) * cos_light / pdf;
+    if (max(beta) <= 0) {
+        return;
+    }
+
+    // For Russian roulette, see bdpt.h.
+    Spectrum throughput = make_const_spectrum(1);
+    Real eta_scale = 1;
+    Ray ray{rec->point_on_light.position, rec->dir, get_intersection_epsilon(scene), infinity<Real>()};
+    for (int depth = 0; max_depth == -1 || depth < max_depth; depth++) {
+        std::optional<PathVertex> vertex_ = intersect(scene, ray);
+        if (!vertex_) {
+            return;
+        }
+        const PathVertex &vertex = *vertex_;
+        MaterialClosure closure =
+            make_closure(scene.materials[vertex.material_id], vertex, scene.texture_pool);
+        // The direct lighting is done by the camera pass.
+        // The visible points are never on the specular surfaces, so we don't deposit the photons
+        // there either: a photon on a glass shell would otherwise add its flux to the visible
+        // points on the surfaces right behind the shell.
+        // This vertex is depth + 1 segments away from the light.
+        if (depth > 0 && !is_near_specular(closure, c_sppm_specular_roughness)) {
+            Vector3i c = grid.cell(vertex.position);
+            for (int node_id = grid.heads[grid.hash(c)].load(std::memory_order_relaxed);
+                    node_id != -1; node_id = grid.nodes[node_id].next) {
+                int pixel_id = grid.nodes[node_id].pixel_id;
+                const SPPMPixel &pixel = pixels[pixel_id];
+                const SPPMVisiblePoint &vp = pixel.visible_point;
+                if (distance_squared(vp.vertex.position, vertex.position) > pixel.radius * pixel.radius) {
+                    continue;
+                }
+                if (max_depth != -1 && vp.num_segments + depth + 1 > max_depth) {
+                    continue;
+                }
+                // Our BSDFs include the cosine term, which the density estimation doesn't want.
+                Vector3 dir_photon = -ray.dir;
+                Real cos_photon = fabs(dot(dir_photon, vp.vertex.shading_frame.n));
+                if (cos_photon <= 0) {
+                    continue;
+                }
+                Spectrum f = eval(vp.closure, vp.dir_view, dir_photon, vp.vertex) / cos_photon;
+                if (max(f) <= 0) {
+                    continue;
+                }
+                phi.add(pixel_id % w, pixel_id / w, beta * f);
+                num_photons[pixel_id].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        Vector2 bsdf_rnd_param_uv{next_pcg32_real<Real>(rng), next_pcg32_real<Real>(rng)};
+        Real bsdf_rnd_param_w = next_pcg32_real<Real>(rng);
+        std::optional<BSDFSampleRecord> bsdf_sample = sample_bsdf(
+            closure, -ray.dir, vertex, bsdf_rnd_param_uv, bsdf_rnd_param_w, TransportDirection::TO_VIEW);
+        if (!bsdf_sample || bsdf_sample->pdf_fwd <= 0) {
+            return;
+        }
+        beta *= bsdf_sample->f / bsdf_sample->pdf_fwd;
+        throughput *= bsdf_sample->f / bsdf_sample->pdf_fwd;
+        if (bsdf_sample->eta != 0) {
+            eta_scale /= (bsdf_sample->eta * bsdf_sample->eta);
+        }
+        if (depth >= scene.options.rr_depth) {
+            Real rr_prob = min(max((1 / eta_scale) * throughput), Real(0.95));
+            if (next_pcg32_real<Real>(rng) > rr_prob) {
+                return;
+            }
+            beta /= rr_prob;
+            throughput /= rr_prob;
+        }
+        ray = Ray{vertex.position, bsdf_sample->dir_out, get_intersection_epsilon(scene), infinity<Real>()};
+    }
+}
@@ -0,0 +1,91 @@
+#include "stats.h"
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+static std::mutex thread_stats_mutex;
+// The counters outlive their threads, so that we don't lose their counts.
+static std::vector<std::unique_ptr<ThreadStats>> all_thread_stats;
+ThreadStats &make_thread_stats() {
+    assert(current_thread_stats == nullptr);
+    std::lock_guard<std::mutex> lock(thread_stats_mutex);
+    all_thread_stats.push_back(std::make_unique<ThreadStats>());
+    current_thread_stats = all_thread_stats.back().get();
+    for (std::atomic<uint64_t> &count : current_thread_stats->counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    return *current_thread_stats;
+}
+
+uint64_t get_stat(Stat stat) {
+    std::lock_guard<std::mutex> lock(thread_stats_mutex);
+    uint64_t sum = 0;
+    for (const std::unique_ptr<ThreadStats> &stats : all_thread_stats) {
+        sum += stats->counts[int(stat)].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+void reset_stats() {
+    std::lock_guard<std::mutex> lock(thread_stats_mutex);
+    for (const std::unique_ptr<ThreadStats> &stats : all_thread_stats) {
+        for (std::atomic<uint64_t> &count : stats->counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+/// The names of the counters in the report, and in the JSON file.
+struct StatName {
+    Stat stat;
+    const char *name;
+    const char *json_name;
+};
+
+static const StatName stat_names[] = {
+    {Stat::CameraRays, "Camera rays", "camera_rays"},
+    {Stat::IntersectionQueries, "Intersection queries", "intersection_queries"},
+    {Stat::ShadowQueries, "Shadow ray queries", "shadow_queries"},
+    {Stat::Paths, "Paths", "paths"},
+    {Stat::PathVertices, "Path vertices", "path_vertices"},
+    {Stat::RussianRouletteTerminations, "Russian roulette terminations", "rr_terminations"},
+    {Stat::BSDFSampleFailures, "BSDF sampling failures", "bsdf_sample_failures"},
+    {Stat::NonFiniteSamples, "NaN/Inf samples dropped", "nonfinite_samples"},
+    {Stat::NullCollisions, "Null collisions", "null_collisions"}
+};
+
+/// The number of vertices the paths hit, on average.
+static Real average_path_length() {
+    uint64_t num_paths = get_stat(Stat::Paths);
+    return num_paths > 0 ? Real(get_stat(Stat::PathVertices)) / Real(num_paths) : Real(0);
+}
+
+void print_stats(std::ostream &os) {
+#ifdef LAJOLLA_STATS
+    os << "Statistics:" << std::endl;
+    for (const StatName &s : stat_names) {
+        os << "  " << std::left << std::setw(32) << s.name << std::right << get_stat(s.stat) << std::endl;
+    }
+    os << "  " << std::left << std::setw(32) << "Average path length" << std::right <<
+        average_path_length() << std::endl;
+    os << "  Texture lookups per mipmap level:";
+    for (int level = 0; level < c_max_mipmap_levels; level++) {
+        os << " " << get_stat(Stat(int(Stat::TextureLookups) + level));
+    }
+    os << std::endl;
+#endif
+}
+
+void write_stats_json(std::ostream &os) {
+    os << "{";
+    for (const StatName &s : stat_names) {
+        os << "\"" << s.json_name << "\": " << get_stat(s.stat) << ", ";
+    }
+    os << "\"average_path_length\": " << average_path_length() << ", ";
+    os << "\"texture_lookups\": [";
+    for (int level = 0; level < c_max_mipmap_levels; level++) {
+        os << (level > 0 ? ", " : "") << get_stat(Stat(int(Stat::TextureLookups) + level));
+    }
+    os << "]}" << std::endl;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "lajolla.h"
+#include "image.h"
+#include "mipmap.h"
+
+#include <atomic>
+#include <ostream>
+
+/// Render statistics, similar to the STAT_COUNTERs of pbrt: counters of what a rendering did
+/// (how many rays it traced, how long its paths were, ...), which we print after the rendering.
+/// Each thread adds to its own counters, each set on its own cache lines, so that the threads
+/// don't invalidate each other's caches; we only sum them up for the report.
+/// Configure with -DLAJOLLA_STATS=OFF to compile the counting away
+/// (except for the ray queries, see count_stat_always()).
+enum class Stat {
+    CameraRays,
+    IntersectionQueries,
+    ShadowQueries,
+    // The paths of path_tracing() and the number of surface vertices they hit,
+    // for the average path length.
+    Paths,
+    PathVertices,
+    RussianRouletteTerminations,
+    // BSDF sampling that failed or returned a zero pdf.
+    BSDFSampleFailures,
+    // The samples of vol_path_render that were NaN or infinite, which we drop.
+    NonFiniteSamples,
+    // For the delta/ratio tracking of the heterogeneous volumes (see vol_path_tracing.h).
+    NullCollisions,
+    // Followed by one counter per mipmap level.
+    TextureLookups,
+    NumStats = TextureLookups + c_max_mipmap_levels
+};
+
+constexpr int c_num_stats = int(Stat::NumStats);
+
+/// The counters of one thread. Only the thread itself writes to them, so we don't need
+/// atomic adds -- the atomics are only there so that reading them from another thread is safe.
+struct alignas(64) ThreadStats {
+    std::atomic<uint64_t> counts[c_num_stats];
+};
+
+/// The counters of the calling thread, or nullptr if it hasn't asked for them yet.
+/// It lives in the header so that counting stays inline: one thread-local load and a store.
+inline thread_local ThreadStats *current_thread_stats = nullptr;
+
+/// Creates the counters of the calling thread (see thread_stats()).
+ThreadStats &make_thread_stats();
+
+/// The counters of the calling thread, created the first time the thread asks for them.
+inline ThreadStats &thread_stats() {
+    ThreadStats *stats = current_thread_stats;
+    return stats != nullptr ? *stats : make_thread_stats();
+}
+
+/// Adds to a counter even if we compiled the statistics away. Only for the ray queries:
+/// the renderer itself needs them for the throughput and the ray count AOV
+/// (see num_traced_rays() in intersection.h).
+inline void count_stat_always(Stat stat, uint64_t num = 1) {
+    std::atomic<uint64_t> &count = thread_stats().counts[int(stat)];
+    count.store(count.load(std::memory_order_relaxed) + num, std::memory_order_relaxed);
+}
+
+inline void count_stat(Stat stat, uint64_t num = 1) {
+#ifdef LAJOLLA_STATS
+    count_stat_always(stat, num);
+#endif
+}
+
+inline void count_texture_lookup(int level) {
+    count_stat(Stat(int(Stat::TextureLookups) + level));
+}
+
+/// The sum of a counter over all the threads.
+uint64_t get_stat(Stat stat);
+
+/// Sets all the counters to zero (e.g., between the renderings of multiple scenes).
+/// Don't call it while rendering.
+void reset_stats();
+
+/// Prints the counters as a table. Does nothing if we compiled the statistics away.
+void print_stats(std::ostream &os);
+
+/// Writes the counters as a JSON object (as numbers, except for the per-level texture lookups,
+/// which are an array), e.g., for comparing renderings with a script.
+void write_stats_json(std::ostream &os);
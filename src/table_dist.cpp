@@ -3,17 +3,23 @@
 TableDist1D make_table_dist_1d(const std::vector<Real> &f) {
     std::vector<Real> pmf = f;
     std::vector<Real> cdf(f.size() + 1);
-    cdf[0] = 0;
+    // We always accumulate the prefix sum in double: with large tables (e.g., envmaps)
+    // a float running sum stops growing once the sum is much larger than the entries,
+    // and the cdf would be badly off.
+    std::vector<double> sum(f.size() + 1);
+    sum[0] = 0;
     for (int i = 0; i < (int)f.size(); i++) {
         assert(pmf[i] >= 0);
-        cdf[i + 1] = cdf[i] + pmf[i];
+        sum[i + 1] = sum[i] + double(pmf[i]);
     }
-    Real total = cdf.back();
+    double total = sum.back();
     if (total > 0) {
         for (int i = 0; i < (int)pmf.size(); i++) {
-            pmf[i] /= total;
-            cdf[i] /= total;
+            pmf[i] = Real(double(pmf[i]) / total);
+            cdf[i] = Real(sum[i] / total);
         }
+        // Make sure the cdf ends at exactly 1 regardless of rounding.
+        cdf.back() = 1;
     } else {
         for (int i = 0; i < (int)pmf.size(); i++) {
             pmf[i] = Real(1) / Real(pmf.size());
@@ -41,17 +47,21 @@ TableDist2D make_table_dist_2d(const std::vector<Real> &f, int width, int height
     // Construct a 1D distribution for each row
     std::vector<Real> cdf_rows(height * (width + 1));
     std::vector<Real> pdf_rows(height * width);
+    // Same as the 1D case, we accumulate the prefix sums in double.
+    std::vector<double> row_sum(width + 1);
+    std::vector<double> row_integrals(height);
     for (int y = 0; y < height; y++) {
-        cdf_rows[y * (width + 1)] = 0;
+        row_sum[0] = 0;
         for (int x = 0; x < width; x++) {
-            cdf_rows[y * (width + 1) + (x + 1)] =
-                cdf_rows[y * (width + 1) + x] + f[y * width + x];
+            row_sum[x + 1] = row_sum[x] + double(f[y * width + x]);
         }
-        Real integral = cdf_rows[y * (width + 1) + width];
+        double integral = row_sum[width];
+        row_integrals[y] = integral;
+        cdf_rows[y * (width + 1) + width] = Real(integral);
         if (integral > 0) {
             // Normalize
             for (int x = 0; x < width; x++) {
-                cdf_rows[y * (width + 1) + x] /= integral;
+                cdf_rows[y * (width + 1) + x] = Real(row_sum[x] / integral);
             }
             // Note that after normalization, the last entry of each row for
             // cdf_rows is still the "integral".
@@ -59,7 +69,7 @@ TableDist2D make_table_dist_2d(const std::vector<Real> &f, int width, int height
 
             // Setup the pmf/pdf
             for (int x = 0; x < width; x++) {
-                pdf_rows[y * width + x] = f[y * width + x] / integral;
+                pdf_rows[y * width + x] = Real(double(f[y * width + x]) / integral);
             }
         } else {
             // We shouldn't sample this row, but just in case we
@@ -74,22 +84,21 @@ TableDist2D make_table_dist_2d(const std::vector<Real> &f, int width, int height
     // Now construct the marginal CDF for each column.
     std::vector<Real> cdf_marginals(height + 1);
     std::vector<Real> pdf_marginals(height);
-    cdf_marginals[0] = 0;
+    std::vector<double> marginal_sum(height + 1);
+    marginal_sum[0] = 0;
     for (int y = 0; y < height; y++) {
-        Real weight = cdf_rows[y * (width + 1) + width];
-        cdf_marginals[y + 1] = cdf_marginals[y] + weight;
+        marginal_sum[y + 1] = marginal_sum[y] + row_integrals[y];
     }
-    Real total_values = cdf_marginals.back();
+    Real total_values = Real(marginal_sum.back());
     if (total_values > 0) {
         // Normalize
         for (int y = 0; y < height; y++) {
-            cdf_marginals[y] /= total_values;
+            cdf_marginals[y] = Real(marginal_sum[y] / marginal_sum.back());
         }
         cdf_marginals[height] = 1;
         // Setup pdf cols
         for (int y = 0; y < height; y++) {
-            Real weight = cdf_rows[y * (width + 1) + width];
-            pdf_marginals[y] = weight / total_values;
+            pdf_marginals[y] = Real(row_integrals[y] / marginal_sum.back());
         }
     } else {
         // The whole thing is black...why are we even here?
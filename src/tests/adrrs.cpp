@@ -0,0 +1,67 @@
+#include "../path_tracing.h"
+#include <cstdio>
+
+int main(int argc, char *argv[]) {
+    // With adjoint = 2 and pixel = 6, the ideal weight is 3, and the window [1, 5].
+    Real adjoint = 2, pixel = 6;
+    Real lower = 2 * (pixel / adjoint) / (1 + c_adrrs_window_size);
+    Real upper = c_adrrs_window_size * lower;
+    if (fabs(lower - 1) > Real(1e-4) || fabs(upper - 5) > Real(1e-4)) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    // Inside the window, the path continues as it is.
+    for (Real weight : {Real(1), Real(3), Real(5)}) {
+        ADRRSFactors factors = adrrs_factors(weight, adjoint, pixel, 16);
+        if (factors.rr_prob != 1 || factors.num_splits != 1) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
+    // Below the window, Russian roulette brings the surviving paths up to the lower end.
+    ADRRSFactors rr = adrrs_factors(lower / 4, adjoint, pixel, 16);
+    if (fabs(rr.rr_prob - Real(0.25)) > Real(1e-4) || rr.num_splits != 1) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    // Above the window, splitting brings the split paths down into it.
+    ADRRSFactors split = adrrs_factors(3 * upper, adjoint, pixel, 16);
+    if (split.rr_prob != 1 || split.num_splits != 3) {
+        printf("FAIL\n");
+        return 1;
+    }
+    split = adrrs_factors(Real(3.5) * upper, adjoint, pixel, 16);
+    if (split.num_splits != 4 || 3.5 * upper / split.num_splits > upper) {
+        printf("FAIL\n");
+        return 1;
+    }
+    // ...but never into more paths than we have left.
+    split = adrrs_factors(100 * upper, adjoint, pixel, 7);
+    if (split.num_splits != 7) {
+        printf("FAIL\n");
+        return 1;
+    }
+    split = adrrs_factors(Real(1e30), adjoint, pixel, 1);
+    if (split.num_splits != 1) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    // Unless we run out of paths to split into, the surviving paths always end up in the window,
+    // and the expected total weight rr_prob * num_splits * (weight / (rr_prob * num_splits)) stays the same.
+    for (Real weight = Real(1e-3); weight < c_max_split_paths * upper; weight *= Real(1.1)) {
+        ADRRSFactors factors = adrrs_factors(weight, adjoint, pixel, c_max_split_paths);
+        Real path_weight = weight / (factors.rr_prob * factors.num_splits);
+        if (factors.rr_prob <= 0 || factors.rr_prob > 1 || factors.num_splits < 1 ||
+                path_weight < lower * (1 - Real(1e-4)) || path_weight > upper * (1 + Real(1e-4))) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
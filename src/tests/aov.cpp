@@ -0,0 +1,65 @@
+#include "../aov.h"
+#include <cstdio>
+
+bool differs(const Vector3 &a, const Vector3 &b) {
+    return length(a - b) > Real(1e-6);
+}
+
+int main(int argc, char *argv[]) {
+    // A path that hits nothing has zero AOVs and -1 IDs.
+    AOVRecord miss;
+    if (differs(aov_value(AOVType::Depth, miss), make_zero_spectrum()) ||
+            differs(aov_value(AOVType::Albedo, miss), make_zero_spectrum()) ||
+            differs(aov_value(AOVType::ObjectID, miss), make_const_spectrum(-1)) ||
+            differs(aov_value(AOVType::MaterialID, miss), make_const_spectrum(-1))) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    PathVertex vertex;
+    vertex.position = Vector3{1, 2, 3};
+    vertex.shading_frame = Frame(Vector3{0, 0, 1});
+    vertex.shape_id = 5;
+    vertex.material_id = 2;
+    AOVRecord hit{vertex, Real(4), albedo(LambertianClosure{Spectrum{Real(0.1), Real(0.2), Real(0.3)}})};
+    if (differs(aov_value(AOVType::Position, hit), vertex.position) ||
+            differs(aov_value(AOVType::ShadingNormal, hit), Vector3{0, 0, 1}) ||
+            differs(aov_value(AOVType::Depth, hit), make_const_spectrum(4)) ||
+            differs(aov_value(AOVType::Albedo, hit), Spectrum{Real(0.1), Real(0.2), Real(0.3)}) ||
+            differs(aov_value(AOVType::ObjectID, hit), make_const_spectrum(5)) ||
+            differs(aov_value(AOVType::MaterialID, hit), make_const_spectrum(2))) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    // The cost AOVs come from the renderer, not the paths, and they need full floats.
+    if (!is_cost_aov(AOVType::Time) || !is_cost_aov(AOVType::RayCount) || is_cost_aov(AOVType::Depth) ||
+            differs(aov_value(AOVType::Time, hit), make_zero_spectrum()) ||
+            aov_pixel_type(AOVType::RayCount) != EXRPixelType::Float ||
+            !has_cost_aovs({AOVType::Albedo, AOVType::Time}) || has_cost_aovs({AOVType::Albedo})) {
+        printf("FAIL\n");
+        return 1;
+    }
+    // The time and the rays since the start of the pixel.
+    PixelCost cost;
+    if (cost.elapsed() < 0 || cost.num_rays() != 0) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    // The layers of the AOVs need distinct names.
+    AOVType types[] = {AOVType::Albedo, AOVType::ShadingNormal, AOVType::Depth,
+                       AOVType::Position, AOVType::ObjectID, AOVType::MaterialID,
+                       AOVType::Time, AOVType::RayCount};
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < i; j++) {
+            if (aov_name(types[i]) == aov_name(types[j])) {
+                printf("FAIL\n");
+                return 1;
+            }
+        }
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,197 @@
+#include "../bdpt.h"
+#include "../path_tracing.h"
+#include <cstdio>
+#include <vector>
+
+/// The vertex of the full path where a ray from "from" towards "to" hits the scene.
+std::optional<BDPTVertex> trace_vertex(const Scene &scene, const Vector3 &from, const Vector3 &to) {
+    Ray ray{from, normalize(to - from), get_intersection_epsilon(scene), infinity<Real>()};
+    std::optional<PathVertex> vertex = intersect(scene, ray);
+    if (!vertex) {
+        return {};
+    }
+    BDPTVertex v;
+    v.type = BDPTVertexType::Surface;
+    v.position = vertex->position;
+    v.normal = vertex->geometric_normal;
+    v.vertex = *vertex;
+    v.closure = make_closure(scene.materials[vertex->material_id], *vertex, scene.texture_pool);
+    v.light_id = get_area_light_id(scene.shapes[vertex->shape_id]);
+    return v;
+}
+
+/// A rectangle spanning center +- u +- v, facing cross(u, v).
+TriangleMesh make_rectangle(const Vector3 &center, const Vector3 &u, const Vector3 &v) {
+    TriangleMesh mesh;
+    mesh.positions = {center - u - v, center + u - v, center + u + v, center - u + v};
+    mesh.indices = {Vector3i{0, 1, 2}, Vector3i{0, 2, 3}};
+    Vector3 n = normalize(cross(u, v));
+    mesh.normals = {n, n, n, n};
+    return mesh;
+}
+
+/// Splits the full path x_0 (camera), ..., x_{k-1} (light) into the camera subpath x_0, x_1, ...
+/// and the light subpath x_{k-1}, x_{k-2}, ..., with the pdfs that random_walk() would store.
+/// Every strategy (s, t) uses the prefixes of the two.
+void make_subpaths(const Scene &scene,
+                   const std::vector<BDPTVertex> &path,
+                   BDPTSubpath &camera_path,
+                   BDPTSubpath &light_path) {
+    int k = (int)path.size();
+    camera_path.num_vertices = k;
+    for (int i = 0; i < k; i++) {
+        BDPTVertex &v = camera_path.vertices[i];
+        v = path[i];
+        if (v.type == BDPTVertexType::Light) {
+            // The camera subpath finds the area lights as surfaces.
+            v.type = BDPTVertexType::Surface;
+        }
+        v.pdf_fwd = i == 0 ? Real(1) : pdf_next(scene, path[i - 1], i >= 2 ? &path[i - 2] : nullptr, v);
+        v.pdf_rev = i + 2 < k ? pdf_next(scene, path[i + 1], &path[i + 2], v) : Real(0);
+    }
+    // The light subpaths never reach the camera.
+    light_path.num_vertices = k - 1;
+    for (int j = 0; j < k - 1; j++) {
+        BDPTVertex &v = light_path.vertices[j];
+        v = path[k - 1 - j];
+        if (j == 0) {
+            v.type = BDPTVertexType::Light;
+            v.pdf_fwd = pdf_light_origin(scene, v);
+        } else {
+            const BDPTVertex &prev = light_path.vertices[j - 1];
+            v.pdf_fwd = pdf_next(scene, prev, j >= 2 ? &light_path.vertices[j - 2] : nullptr, v);
+        }
+        v.pdf_rev = j + 2 < k - 1 ? pdf_next(scene, path[k - 2 - j], &path[k - 3 - j], v) : Real(0);
+    }
+}
+
+/// The sum of the MIS weights of all the strategies BDPT uses for a path.
+Real sum_mis_weights(const Scene &scene, const std::vector<BDPTVertex> &path) {
+    BDPTSubpath camera_path, light_path;
+    make_subpaths(scene, path, camera_path, light_path);
+    int k = (int)path.size();
+    bool delta_light = is_delta_light(scene.lights[path.back().light_id]);
+    Real sum = 0;
+    for (int s = delta_light ? 1 : 0; s < k; s++) {
+        int t = k - s;
+        // The same strategies as bdpt().
+        if (t == 1 && s <= 1) {
+            continue;
+        }
+        // The strategies with s = 1 or t = 1 sample a new light or camera vertex for the connection.
+        const BDPTVertex &sampled = s == 1 ? light_path.vertices[0] : camera_path.vertices[0];
+        sum += bdpt_mis_weight(scene, light_path, camera_path, sampled, s, t);
+    }
+    return sum;
+}
+
+int main(int argc, char *argv[]) {
+    RTCDevice embree_device = rtcNewDevice(nullptr);
+
+    // A plastic floor and a diffuse back wall, lit by a spherical lamp and a point light.
+    int w = 16, h = 16;
+    Camera camera(Matrix4x4::identity(), Real(60), w, h, Box{Real(1)}, -1);
+    Shape floor = make_rectangle(Vector3{0, -3, 3}, Vector3{0, 0, 5}, Vector3{6, 0, 0});
+    Shape wall = make_rectangle(Vector3{0, 2, 8}, Vector3{0, 5, 0}, Vector3{6, 0, 0});
+    Shape lamp = Sphere{{}, Vector3{3, 4, 2}, Real(0.5)};
+    set_material_id(floor, 1);
+    set_material_id(wall, 0);
+    set_material_id(lamp, 0);
+    set_area_light_id(lamp, 0);
+    RenderOptions options;
+    options.sampler_type = SamplerType::Independent;
+    options.samples_per_pixel = 64;
+    options.max_depth = 4;
+    Scene scene(embree_device,
+                camera,
+                {Lambertian{ConstantTexture<Spectrum>{make_const_spectrum(Real(0.5))}},
+                 RoughPlastic{ConstantTexture<Spectrum>{make_const_spectrum(Real(0.4))},
+                              ConstantTexture<Spectrum>{make_const_spectrum(Real(1))},
+                              ConstantTexture<Real>{Real(0.2)},
+                              Real(1.5)}},
+                {floor, wall, lamp},
+                {DiffuseAreaLight{2, make_const_spectrum(10)},
+                 PointLight{Vector3{-3, 2, 1}, make_const_spectrum(20)}},
+                {}, /* media */
+                -1, /* envmap id */
+                TexturePool{},
+                options,
+                "" /* output filename */);
+
+    // The MIS weights of the strategies that can sample a path add up to one.
+    // The path bounces between the wall and the floor, and ends at one of the lights.
+    BDPTVertex x0;
+    x0.type = BDPTVertexType::Camera;
+    x0.position = Vector3{0, 0, 0};
+    x0.normal = Vector3{0, 0, 0};
+    Vector3 bounces[] = {Vector3{-1, 1, 8}, Vector3{Real(0.5), Real(-3), Real(5)},
+                         Vector3{1, 0, 8}, Vector3{Real(-0.5), Real(-3), Real(4)}};
+    for (int k = 3; k <= 6; k++) {
+        std::vector<BDPTVertex> path = {x0};
+        for (int i = 0; i < k - 2; i++) {
+            std::optional<BDPTVertex> v = trace_vertex(scene, path.back().position, bounces[i]);
+            if (!v || distance(v->position, bounces[i]) > Real(1e-3)) {
+                printf("FAIL\n");
+                return 1;
+            }
+            path.push_back(*v);
+        }
+
+        // End at the lamp...
+        std::vector<BDPTVertex> lamp_path = path;
+        std::optional<BDPTVertex> v = trace_vertex(scene, path.back().position, Vector3{3, 4, 2});
+        if (!v || v->light_id != 0) {
+            printf("FAIL\n");
+            return 1;
+        }
+        lamp_path.push_back(*v);
+        Real lamp_sum = sum_mis_weights(scene, lamp_path);
+        // ...or at the point light, which only the strategies with s >= 1 can sample.
+        std::vector<BDPTVertex> point_path = path;
+        BDPTVertex point;
+        point.type = BDPTVertexType::Light;
+        point.position = Vector3{-3, 2, 1};
+        point.normal = Vector3{0, 0, 0};
+        point.light_id = 1;
+        point_path.push_back(point);
+        Real point_sum = sum_mis_weights(scene, point_path);
+        printf("%d vertices: sum of the MIS weights %g (lamp), %g (point light)\n", k, lamp_sum, point_sum);
+        if (fabs(lamp_sum - 1) > Real(1e-4) || fabs(point_sum - 1) > Real(1e-4)) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
+    // BDPT and the path tracer converge to the same image.
+    Real bdpt_sum = 0, path_sum = 0;
+    SplatImage splats(w, h);
+    int spp = options.samples_per_pixel;
+    Sampler bdpt_sampler = make_sampler(options.sampler_type, spp, Vector2i{w, h}, options.sampler_seed, 0);
+    Sampler path_sampler = make_sampler(options.sampler_type, spp, Vector2i{w, h}, options.sampler_seed, 1);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            for (int s = 0; s < spp; s++) {
+                start_pixel_sample(bdpt_sampler, Vector2i{x, y}, s);
+                bdpt_sum += luminance(bdpt(scene, x, y, bdpt_sampler, splats));
+                start_pixel_sample(path_sampler, Vector2i{x, y}, s);
+                path_sum += luminance(path_tracing(scene, x, y, path_sampler));
+            }
+        }
+    }
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            bdpt_sum += luminance(splats(x, y));
+        }
+    }
+    Real bdpt_mean = bdpt_sum / (w * h * spp);
+    Real path_mean = path_sum / (w * h * spp);
+    printf("mean: BDPT %g, path tracer %g\n", bdpt_mean, path_mean);
+    if (!(fabs(bdpt_mean - path_mean) <= Real(0.02) * path_mean)) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    rtcReleaseDevice(embree_device);
+    printf("SUCCESS\n");
+    return 0;
+}
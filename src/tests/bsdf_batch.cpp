@@ -0,0 +1,206 @@
+#include "../bsdf_batch.h"
+#include "../frame.h"
+#include "../intersection.h"
+#include "../parallel.h"
+#include "../parsers/parse_scene.h"
+#include "../render.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <random>
+
+// A rough glass sphere in front of a diffuse wall, lit by a spherical lamp.
+// BATCH is replaced by true or false.
+const char *c_scene_xml = R"(<?xml version="1.0" encoding="utf-8"?>
+<scene version="0.4.0">
+    <integrator type="path">
+        <integer name="maxDepth" value="4"/>
+        <boolean name="batchBSDF" value="BATCH"/>
+    </integrator>
+    <sensor type="perspective">
+        <float name="fov" value="60"/>
+        <sampler type="sobol">
+            <integer name="sampleCount" value="4"/>
+        </sampler>
+        <film type="hdrfilm">
+            <integer name="width" value="24"/>
+            <integer name="height" value="24"/>
+            <rfilter type="box"/>
+        </film>
+    </sensor>
+    <bsdf type="diffuse" id="white">
+        <rgb name="reflectance" value="0.5, 0.5, 0.5"/>
+    </bsdf>
+    <shape type="rectangle">
+        <transform name="toWorld">
+            <scale value="10"/>
+            <translate z="8"/>
+        </transform>
+        <boolean name="flipNormals" value="true"/>
+        <ref id="white"/>
+    </shape>
+    <shape type="sphere">
+        <point name="center" x="0" y="0" z="4"/>
+        <float name="radius" value="1.5"/>
+        <bsdf type="roughdielectric">
+            <float name="intIOR" value="1.5"/>
+            <float name="alpha" value="0.2"/>
+        </bsdf>
+    </shape>
+    <shape type="sphere">
+        <point name="center" x="2" y="3" z="2"/>
+        <float name="radius" value="0.5"/>
+        <ref id="white"/>
+        <emitter type="area">
+            <rgb name="radiance" value="10, 10, 10"/>
+        </emitter>
+    </shape>
+</scene>
+)";
+
+/// Renders c_scene_xml with or without the batched BSDF evaluation.
+Image3 render_scene(RTCDevice embree_device, bool batch) {
+    std::string xml = c_scene_xml;
+    xml.replace(xml.find("BATCH"), 5, batch ? "true" : "false");
+    fs::path filename = fs::temp_directory_path() / "lajolla_test_bsdf_batch.xml";
+    {
+        std::ofstream ofs(filename);
+        ofs << xml;
+    }
+    std::unique_ptr<Scene> scene = parse_scene(filename, embree_device);
+    fs::remove(filename);
+    std::vector<ImageLayer> layers;
+    return render(*scene, &layers);
+}
+
+int main(int argc, char *argv[]) {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<Real> uni(0, 1);
+    auto random_dir = [&]() {
+        Real z = 1 - 2 * uni(rng);
+        Real phi = 2 * c_PI * uni(rng);
+        Real r = sqrt(max(1 - z * z, Real(0)));
+        return Vector3{r * cos(phi), r * sin(phi), z};
+    };
+
+    std::vector<MaterialClosure> closures = {
+        LambertianClosure{Spectrum{Real(0.5), Real(0.6), Real(0.7)}},
+        RoughPlasticClosure{Spectrum{Real(0.5), Real(0.3), Real(0.2)},
+                            Spectrum{Real(0.8), Real(0.8), Real(0.8)},
+                            Real(0.3), Real(1.5)},
+        RoughDielectricClosure{Spectrum{Real(1), Real(1), Real(1)},
+                               Spectrum{Real(0.9), Real(0.8), Real(0.7)},
+                               Real(0.2), Real(1.5)},
+        // No batched kernel -- tests the fallback
+        DisneyDiffuseClosure{Spectrum{Real(0.5), Real(0.5), Real(0.5)}, Real(0.5), Real(0)}
+    };
+
+    // Vertices with shading normals that are slightly off the geometric normals.
+    int num_vertices = 64;
+    std::vector<PathVertex> vertices(num_vertices);
+    for (PathVertex &vertex : vertices) {
+        vertex.geometric_normal = random_dir();
+        vertex.shading_frame = Frame(normalize(vertex.geometric_normal + Real(0.3) * random_dir()));
+    }
+
+    // Mixed queries: the batch evaluation should match eval_with_pdf.
+    int n = 4096;
+    std::vector<BSDFQuery> queries(n);
+    for (BSDFQuery &q : queries) {
+        q.closure = &closures[std::uniform_int_distribution<int>(0, (int)closures.size() - 1)(rng)];
+        q.vertex = &vertices[std::uniform_int_distribution<int>(0, num_vertices - 1)(rng)];
+        q.dir_in = random_dir();
+        q.dir_out = random_dir();
+    }
+    BSDFBatch workspace;
+    for (TransportDirection dir : {TransportDirection::TO_LIGHT, TransportDirection::TO_VIEW}) {
+        std::vector<BSDFEvalRecord> results;
+        eval_with_pdf_batch(queries, results, workspace, dir);
+        auto close = [](Real a, Real b) {
+            // The kernels evaluate the terms in a different order, which matters in single precision
+            // (especially for the tiny values of refraction near grazing angles).
+            Real tol = std::is_same_v<Real, float> ? Real(1e-3) : Real(1e-6);
+            Real abs_tol = std::is_same_v<Real, float> ? Real(1e-6) : Real(1e-10);
+            return fabs(a - b) <= tol * max(fabs(a), fabs(b)) + abs_tol;
+        };
+        for (int i = 0; i < n; i++) {
+            const BSDFQuery &q = queries[i];
+            BSDFEvalRecord ref = eval_with_pdf(*q.closure, q.dir_in, q.dir_out, *q.vertex, dir);
+            if (!close(ref.f.x, results[i].f.x) ||
+                    !close(ref.f.y, results[i].f.y) ||
+                    !close(ref.f.z, results[i].f.z) ||
+                    !close(ref.pdf_fwd, results[i].pdf_fwd) ||
+                    !close(ref.pdf_rev, results[i].pdf_rev)) {
+                printf("FAIL\n");
+                return 1;
+            }
+        }
+    }
+
+    // Throughput of the scalar and the batched evaluation for each material.
+    const char *names[] = {"Lambertian", "RoughPlastic", "RoughDielectric"};
+    for (int m = 0; m < 3; m++) {
+        std::vector<BSDFQuery> single(queries);
+        for (BSDFQuery &q : single) {
+            q.closure = &closures[m];
+        }
+        std::vector<BSDFEvalRecord> results(n);
+        int num_rounds = 16;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int r = 0; r < num_rounds; r++) {
+            for (int i = 0; i < n; i++) {
+                const BSDFQuery &q = single[i];
+                results[i] = eval_with_pdf(*q.closure, q.dir_in, q.dir_out, *q.vertex);
+            }
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        for (int r = 0; r < num_rounds; r++) {
+            eval_with_pdf_batch(single, results, workspace);
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        // The workspace still holds the gathered batch: time the kernel alone.
+        for (int r = 0; r < num_rounds; r++) {
+            if (m == 0) {
+                eval_lambertian_batch(workspace);
+            } else if (m == 1) {
+                eval_rough_plastic_batch(workspace);
+            } else {
+                eval_rough_dielectric_batch(workspace, TransportDirection::TO_LIGHT);
+            }
+        }
+        auto t3 = std::chrono::steady_clock::now();
+        Real total = Real(n) * num_rounds;
+        auto throughput = [&](auto start, auto end) {
+            return total / std::chrono::duration<Real, std::micro>(end - start).count();
+        };
+        printf("%s: scalar %.1f M evals/s, batched %.1f M evals/s (kernel only: %.1f M evals/s)\n",
+               names[m], throughput(t0, t1), throughput(t1, t2), throughput(t2, t3));
+    }
+
+    // The batched path render draws the same samples as the scalar one,
+    // so the images only differ by the rounding of the kernels.
+    parallel_init(2);
+    RTCDevice embree_device = rtcNewDevice(nullptr);
+    Image3 scalar_img = render_scene(embree_device, false);
+    Image3 batched_img = render_scene(embree_device, true);
+    rtcReleaseDevice(embree_device);
+    parallel_cleanup();
+    Real sum = 0;
+    for (int y = 0; y < scalar_img.height; y++) {
+        for (int x = 0; x < scalar_img.width; x++) {
+            sum += luminance(scalar_img(x, y));
+            if (!(length(batched_img(x, y) - scalar_img(x, y)) <= Real(1e-3) * (1 + length(scalar_img(x, y))))) {
+                printf("FAIL\n");
+                return 1;
+            }
+        }
+    }
+    // ...and the glass and the wall actually receive some light.
+    if (sum <= 0) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include "../camera.h"
+#include "../transform.h"
+#include <cstdio>
+
+int main(int argc, char *argv[]) {
+    Matrix4x4 cam_to_world = look_at(Vector3{1, 2, 3}, Vector3{0, 0, 0}, Vector3{0, 1, 0});
+    Camera camera(cam_to_world, Real(45), 64, 48, Box{Real(1)}, -1);
+
+    // world_to_screen should invert screen_to_ray.
+    for (Vector2 screen_pos : {Vector2{0.5, 0.5}, Vector2{0.1, 0.7}, Vector2{0.95, 0.02}}) {
+        Ray ray = screen_to_ray(camera, screen_pos);
+        std::optional<Vector2> p = world_to_screen(camera, ray.org + Real(3) * ray.dir);
+        if (!p || fabs(p->x - screen_pos.x) > Real(1e-4) || fabs(p->y - screen_pos.y) > Real(1e-4)) {
+            printf("FAIL\n");
+            return 1;
+        }
+        // Behind the camera
+        if (world_to_screen(camera, ray.org - ray.dir)) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
+    // The importance of the camera should integrate to one over the sphere of directions.
+    int n = 1024;
+    Real sum = 0;
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            // Uniform sphere sampling
+            Real z = 1 - 2 * (i + Real(0.5)) / n;
+            Real r = sqrt(fmax(Real(0), 1 - z * z));
+            Real phi = 2 * c_PI * (j + Real(0.5)) / n;
+            sum += camera_importance(camera, Vector3{r * cos(phi), r * sin(phi), z}) * c_FOURPI;
+        }
+    }
+    Real integral = sum / (n * n);
+    printf("integral of the importance: %f\n", integral);
+    if (fabs(integral - 1) > Real(0.01)) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    // The importance is the density of screen_to_ray with a uniform screen position:
+    // the area of a small patch of the screen should map to importance * solid angle = patch area.
+    Vector2 screen_pos{0.2, 0.8};
+    Real eps = Real(1e-3);
+    Vector3 d00 = screen_to_ray(camera, screen_pos).dir;
+    Vector3 d10 = screen_to_ray(camera, screen_pos + Vector2{eps, Real(0)}).dir;
+    Vector3 d01 = screen_to_ray(camera, screen_pos + Vector2{Real(0), eps}).dir;
+    Real solid_angle = length(cross(d10 - d00, d01 - d00));
+    Real importance = camera_importance(camera, d00);
+    if (fabs(importance * solid_angle / (eps * eps) - 1) > Real(0.01)) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "../denoiser.h"
+#include "../parallel.h"
+#include "../pcg.h"
+#include "../spectrum.h"
+#include <cstdio>
+
+/// A 64x64 screen: a wall at depth 2 facing the camera on the left half,
+/// and a wall facing right on the right half.
+constexpr int size = 64;
+
+Spectrum clean_radiance(int x, int y) {
+    return x < size / 2 ? make_const_spectrum(Real(0.2)) : make_const_spectrum(Real(0.8));
+}
+
+Real squared_error(const Image3 &img) {
+    Real error = 0;
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            Spectrum d = img(x, y) - clean_radiance(x, y);
+            error += d.x * d.x + d.y * d.y + d.z * d.z;
+        }
+    }
+    return error;
+}
+
+int main(int argc, char *argv[]) {
+    parallel_init(4);
+    Image3 albedo(size, size), normal(size, size), depth(size, size);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            albedo(x, y) = make_const_spectrum(Real(0.5));
+            normal(x, y) = x < size / 2 ? Vector3{0, 0, 1} : Vector3{1, 0, 0};
+            depth(x, y) = make_const_spectrum(2);
+        }
+    }
+
+    // Add noise with standard deviation 0.1 to the clean image.
+    Image3 img(size, size);
+    Image1 variance(size, size);
+    pcg32_state rng = init_pcg32();
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            Real noise = Real(0.1) * sqrt(Real(3)) * (2 * next_pcg32_real<Real>(rng) - 1);
+            img(x, y) = clean_radiance(x, y) + make_const_spectrum(noise);
+            variance(x, y) = Real(0.01);
+        }
+    }
+    Real noisy_error = squared_error(img);
+    denoise(img, variance, albedo, normal, depth);
+    // The denoiser should remove most of the noise...
+    if (squared_error(img) > Real(0.1) * noisy_error) {
+        printf("FAIL\n");
+        return 1;
+    }
+    // ...without blurring across the edge between the walls.
+    for (int y = 0; y < size; y++) {
+        for (int x = size / 2 - 1; x <= size / 2; x++) {
+            if (fabs(img(x, y).x - clean_radiance(x, y).x) > Real(0.1)) {
+                printf("FAIL\n");
+                return 1;
+            }
+        }
+    }
+
+    // Without noise, the denoiser keeps the texture details.
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            albedo(x, y) = make_const_spectrum((x + y) % 2 == 0 ? Real(0.1) : Real(0.9));
+            img(x, y) = albedo(x, y) * Real(0.5);
+            variance(x, y) = 0;
+        }
+    }
+    denoise(img, variance, albedo, normal, depth);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            if (fabs(img(x, y).x - albedo(x, y).x * Real(0.5)) > Real(1e-4)) {
+                printf("FAIL\n");
+                return 1;
+            }
+        }
+    }
+
+    parallel_cleanup();
+    printf("SUCCESS\n");
+    return 0;
+}
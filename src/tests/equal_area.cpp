@@ -0,0 +1,67 @@
+#include "../equal_area.h"
+#include <cstdio>
+
+int main(int argc, char *argv[]) {
+    // Round trip between the unit square and the sphere
+    // on a grid that covers all eight octants.
+    int n = 64;
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            Vector2 p{(x + Real(0.5)) / n, (y + Real(0.5)) / n};
+            Vector3 d = equal_area_square_to_sphere(p);
+            if (fabs(length(d) - 1) > Real(1e-6)) {
+                printf("FAIL\n");
+                return 1;
+            }
+            Vector2 q = equal_area_sphere_to_square(d);
+            // atan is approximated by a polynomial
+            if (max(fabs(p.x - q.x), fabs(p.y - q.y)) > Real(1e-5)) {
+                printf("FAIL\n");
+                return 1;
+            }
+        }
+    }
+
+    // The edges of the square are folded onto themselves: (0, v) and (0, 1 - v) are the same
+    // direction, and so are (u, 1) and (1 - u, 1).
+    for (Real t : {Real(0.1), Real(0.3), Real(0.45)}) {
+        if (length(equal_area_square_to_sphere(Vector2{Real(0), t}) -
+                   equal_area_square_to_sphere(Vector2{Real(0), 1 - t})) > Real(1e-5) ||
+                length(equal_area_square_to_sphere(Vector2{t, Real(1)}) -
+                       equal_area_square_to_sphere(Vector2{1 - t, Real(1)})) > Real(1e-5)) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
+    // So the bilinear lookup at the edges blends with the mirrored texels.
+    // Every texel of the image is different.
+    int w = 4, h = 4;
+    Image3 img(w, h);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            img(x, y) = Vector3{Real(x), Real(y), Real(x + w * y)};
+        }
+    }
+    Mipmap3 mipmap = make_mipmap(img);
+    for (int y = 0; y < h; y++) {
+        // At the left edge, half of the texel (0, y) and half of its neighbor across the edge,
+        // which is the texel (0, h - 1 - y).
+        Vector3 left = lookup_equal_area(mipmap, Real(0), (y + Real(0.5)) / h, 0);
+        if (distance(left, (img(0, y) + img(0, h - 1 - y)) / Real(2)) > Real(1e-5)) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+    for (int x = 0; x < w; x++) {
+        // At the top edge, the neighbor of (x, h - 1) is (w - 1 - x, h - 1).
+        Vector3 top = lookup_equal_area(mipmap, (x + Real(0.5)) / w, Real(1), 0);
+        if (distance(top, (img(x, h - 1) + img(w - 1 - x, h - 1)) / Real(2)) > Real(1e-5)) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
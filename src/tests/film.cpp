@@ -0,0 +1,73 @@
+#include "../film.h"
+#include "../pcg.h"
+#include <cstdio>
+
+int main(int argc, char *argv[]) {
+    // Not a multiple of the tile size.
+    int w = 37, h = 21;
+    Film film(w, h, true /* track_variance */);
+    Film half(w, h, true), other_half(w, h, true);
+    // The reference, in double so that it is accurate in the single precision build too.
+    std::vector<double> sum(w * h, 0), sum_sq(w * h, 0);
+    pcg32_state rng = init_pcg32();
+    int spp = 64;
+    for (int s = 0; s < spp; s++) {
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                // A large mean with a small variance, where the naive formula would lose
+                // most of the precision of float.
+                Real l = 1000 + x + next_pcg32_real<Real>(rng);
+                Spectrum L = make_const_spectrum(l);
+                film.add_sample(x, y, L);
+                (s % 3 == 0 ? half : other_half).add_sample(x, y, L);
+                sum[y * w + x] += l;
+                sum_sq[y * w + x] += double(l) * l;
+            }
+        }
+    }
+    half.merge(other_half);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            double mean = sum[y * w + x] / spp;
+            double variance = (sum_sq[y * w + x] / spp - mean * mean) / (spp - 1);
+            for (const Film *f : {&film, &half}) {
+                if (f->num_samples(x, y) != spp ||
+                        fabs(f->mean(x, y).x - mean) > 1e-3 ||
+                        fabs(f->variance(x, y) - variance) > 1e-2 * variance) {
+                    printf("FAIL\n");
+                    return 1;
+                }
+            }
+        }
+    }
+
+    // The pixels are unique, and the ones of a tile are contiguous.
+    std::vector<int> seen(film.sums.size(), 0);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            seen[film.pixel_index(x, y)]++;
+        }
+    }
+    for (int i = 0; i < (int)seen.size(); i++) {
+        if (seen[i] > 1) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+    if (film.pixel_index(c_film_tile_size - 1, c_film_tile_size - 1) !=
+            c_film_tile_size * c_film_tile_size - 1) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    // The pixels without samples resolve to zero.
+    Film empty(w, h);
+    Image3 img = empty.resolve();
+    if (length(img(w - 1, h - 1)) != 0 || film.resolve()(3, 4).x != film.mean(3, 4).x) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -2,16 +2,37 @@
 #include <cstdio>
 
 Real compute_determinant(const Filter &f, const Vector2 &rnd_param) {
+#ifndef LAJOLLA_USE_FLOAT
     Real eps = Real(1e-6);
     Vector2 s = sample(f, rnd_param);
     Vector2 s_u = sample(f, rnd_param + Vector2{eps, Real(0)});
     Vector2 s_v = sample(f, rnd_param + Vector2{Real(0), eps});
     Vector2 s_du = (s_u - s) / eps;
     Vector2 s_dv = (s_v - s) / eps;
+#else
+    // Forward differences are too inaccurate in single precision:
+    // use central differences with a larger step.
+    Real eps = Real(1e-3);
+    Vector2 s_u0 = sample(f, rnd_param - Vector2{eps, Real(0)});
+    Vector2 s_u1 = sample(f, rnd_param + Vector2{eps, Real(0)});
+    Vector2 s_v0 = sample(f, rnd_param - Vector2{Real(0), eps});
+    Vector2 s_v1 = sample(f, rnd_param + Vector2{Real(0), eps});
+    Vector2 s_du = (s_u1 - s_u0) / (2 * eps);
+    Vector2 s_dv = (s_v1 - s_v0) / (2 * eps);
+#endif
     Real det = fabs(s_du.x * s_dv.y - s_du.y * s_dv.x);
     return det;
 }
 
+bool close(Real det, Real target) {
+#ifndef LAJOLLA_USE_FLOAT
+    return fabs(det - target) <= Real(1e-3);
+#else
+    // A float only has ~7 digits: use a relative error.
+    return fabs(det - target) <= Real(1e-3) * target;
+#endif
+}
+
 int main(int argc, char *argv[]) {
     Real width = 2;
     Vector2 rnd_param = Vector2{0.3, 0.4};
@@ -22,7 +43,7 @@ int main(int argc, char *argv[]) {
         // The determinant of this Jacobian should be
         // a constant width * width (the inverse value of the normalized box filter kernel)
         Real det = compute_determinant(f, rnd_param);
-        if (fabs(det - width * width) > Real(1e-3)) {
+        if (!close(det, width * width)) {
             printf("FAIL\n");
             return 1;
         }
@@ -41,7 +62,7 @@ int main(int argc, char *argv[]) {
         Real kernel = ((1 - fabs(s.x) / half_width) / norm) *
                       ((1 - fabs(s.y) / half_width) / norm);
         Real inv_kernel = 1 / kernel;
-        if (fabs(det - inv_kernel) > Real(1e-3)) {
+        if (!close(det, inv_kernel)) {
             printf("FAIL\n");
             return 1;
         }
@@ -57,7 +78,7 @@ int main(int argc, char *argv[]) {
         Real kernel = exp(-((s.x * s.x + s.y * s.y) / (stddev * stddev)) / 2) /
             (stddev * stddev * 2 * c_PI);
         Real inv_kernel = 1 / kernel;
-        if (fabs(det - inv_kernel) > Real(1e-3)) {
+        if (!close(det, inv_kernel)) {
             printf("FAIL\n");
             return 1;
         }
@@ -31,6 +31,58 @@ int main(int argc, char *argv[]) {
 
     std::remove("test.exr");
 
+    // Multi-layer round trip. "Albedo" sorts before the channels of the image (B, G, R),
+    // and "key" after them.
+    std::vector<ImageLayer> layers = {ImageLayer{"Albedo", Image3(32, 24)}, ImageLayer{"key", Image3(32, 24)}};
+    for (int i = 0; i < (int)img.data.size(); i++) {
+        layers[0].image(i) = Vector3{Real(0.25), Real(0.5), Real(0.75)};
+        layers[1].image(i) = img(i) * Real(2);
+    }
+    imwrite("test_layers.exr", img, layers);
+    Image3 rimg_beauty = imread3("test_layers.exr");
+    Image3 rimg_albedo = imread3("test_layers.exr", "Albedo");
+    Image3 rimg_key = imread3("test_layers.exr", "key");
+    for (int i = 0; i < (int)img.data.size(); i++) {
+        if (length(rimg_beauty(i) - img(i)) > Real(1e-2) ||
+                length(rimg_albedo(i) - layers[0].image(i)) > Real(1e-2) ||
+                length(rimg_key(i) - layers[1].image(i)) > Real(2e-2)) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
+    std::remove("test_layers.exr");
+
+    // Stream the tiles as the pixels come, out of order and with partial tiles.
+    // The image is not a multiple of the tile size, and "key" keeps 32 bits.
+    layers[1].pixel_type = EXRPixelType::Float;
+    layers[1].image(31, 23) = Vector3{Real(1371.25), Real(-2), Real(1e-3)};
+    for (EXRCompression compression : {EXRCompression::None, EXRCompression::ZIP, EXRCompression::PIZ}) {
+        EXROptions options;
+        options.compression = compression;
+        options.tile_size = 16;
+        TiledEXRWriter writer("test_tiles.exr", img, layers, options);
+        writer.add_pixels(16, 16, 32, 24);
+        writer.add_pixels(0, 8, 32, 16);
+        writer.add_pixels(0, 0, 32, 8);
+        // The last tile is only written in finish().
+        writer.add_pixels(0, 16, 8, 24);
+        writer.finish();
+        Image3 rimg_beauty = imread3("test_tiles.exr");
+        Image3 rimg_albedo = imread3("test_tiles.exr", "Albedo");
+        Image3 rimg_key = imread3("test_tiles.exr", "key");
+        for (int i = 0; i < (int)img.data.size(); i++) {
+            if (length(rimg_beauty(i) - img(i)) > Real(1e-2) ||
+                    length(rimg_albedo(i) - layers[0].image(i)) > Real(1e-2) ||
+                    length(rimg_key(i) - layers[1].image(i)) > Real(1e-5)) {
+                printf("FAIL\n");
+                return 1;
+            }
+        }
+    }
+
+    std::remove("test_tiles.exr");
+
     printf("SUCCESS\n");
     return 0;
 }
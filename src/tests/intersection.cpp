@@ -37,6 +37,71 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    {
+        // A small sphere far away from the ray origin. The textbook quadratic formula
+        // loses all the digits of the discriminant here in single precision.
+        std::vector<Shape> sphere_shapes;
+        sphere_shapes.push_back(Sphere{{}, Vector3{0, 0, -10000}, Real(1)});
+        Scene sphere_scene(embree_device,
+                           Camera(),
+                           {}, /* materials */
+                           sphere_shapes,
+                           {}, /* lights */
+                           {}, /* media */
+                           -1, /* envmap id */
+                           TexturePool{},
+                           RenderOptions{},
+                           "" /* output filename */);
+        std::optional<PathVertex> sphere_vertex = intersect(sphere_scene, ray, ray_diff);
+        if (!sphere_vertex) {
+            printf("FAIL\n");
+            return 1;
+        }
+        if (distance(sphere_vertex->position, Vector3{0, 0, -9999}) > Real(1e-2)) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
+    {
+        // Batched occlusion (ray packets) should agree with the single ray version,
+        // for both the triangles and the user-defined spheres.
+        // We use 20 rays to also test a partially filled packet.
+        std::vector<Shape> mixed_shapes = shapes;
+        mixed_shapes.push_back(Sphere{{}, Vector3{2, 0, -1}, Real(0.5)});
+        Scene mixed_scene(embree_device,
+                          Camera(),
+                          {}, /* materials */
+                          mixed_shapes,
+                          {}, /* lights */
+                          {}, /* media */
+                          -1, /* envmap id */
+                          TexturePool{},
+                          RenderOptions{},
+                          "" /* output filename */);
+        std::vector<Ray> rays;
+        for (int i = 0; i < 20; i++) {
+            Vector3 target{Real(-1.5) + Real(0.2) * i, Real(0.1), Real(-1)};
+            // Half of the rays stop before reaching the shapes.
+            Real tfar = i % 2 == 0 ? infinity<Real>() : Real(0.5);
+            rays.push_back(Ray{Vector3{0, 0, 0}, normalize(target), Real(0), tfar});
+        }
+        bool results[20];
+        occluded(mixed_scene, rays.data(), (int)rays.size(), results);
+        int num_occluded = 0;
+        for (int i = 0; i < (int)rays.size(); i++) {
+            if (results[i] != occluded(mixed_scene, rays[i])) {
+                printf("FAIL\n");
+                return 1;
+            }
+            num_occluded += results[i];
+        }
+        if (num_occluded == 0 || num_occluded == (int)rays.size()) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
     printf("SUCCESS\n");
     return 0;
 }
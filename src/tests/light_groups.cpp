@@ -0,0 +1,134 @@
+#include "../parallel.h"
+#include "../parsers/parse_scene.h"
+#include "../render.h"
+#include "../scene.h"
+#include <cstdio>
+#include <fstream>
+
+// The camera looks at a diffuse wall over a diffuse floor, lit by two lamps in the group "key",
+// a lamp with an ID and no group, and a point light with neither.
+const char *c_scene_xml = R"(<?xml version="1.0" encoding="utf-8"?>
+<scene version="0.4.0">
+    <integrator type="path">
+        <integer name="maxDepth" value="4"/>
+        <boolean name="lightGroups" value="true"/>
+    </integrator>
+    <sensor type="perspective">
+        <float name="fov" value="90"/>
+        <sampler type="independent">
+            <integer name="sampleCount" value="8"/>
+        </sampler>
+        <film type="hdrfilm">
+            <integer name="width" value="16"/>
+            <integer name="height" value="16"/>
+            <rfilter type="box"/>
+        </film>
+    </sensor>
+    <bsdf type="diffuse" id="white">
+        <rgb name="reflectance" value="0.5, 0.5, 0.5"/>
+    </bsdf>
+    <shape type="rectangle">
+        <transform name="toWorld">
+            <scale value="10"/>
+            <translate z="8"/>
+        </transform>
+        <boolean name="flipNormals" value="true"/>
+        <ref id="white"/>
+    </shape>
+    <shape type="rectangle">
+        <transform name="toWorld">
+            <scale value="10"/>
+            <rotate x="1" angle="-90"/>
+            <translate y="-6"/>
+        </transform>
+        <ref id="white"/>
+    </shape>
+    <shape type="sphere" id="lamp_a">
+        <point name="center" x="-3" y="2" z="5"/>
+        <float name="radius" value="1"/>
+        <ref id="white"/>
+        <emitter type="area">
+            <rgb name="radiance" value="4, 2, 1"/>
+            <string name="lightGroup" value="key"/>
+        </emitter>
+    </shape>
+    <shape type="sphere" id="fill">
+        <point name="center" x="3" y="-2" z="5"/>
+        <float name="radius" value="1"/>
+        <ref id="white"/>
+        <emitter type="area">
+            <rgb name="radiance" value="1, 2, 4"/>
+        </emitter>
+    </shape>
+    <shape type="sphere" id="lamp_b">
+        <point name="center" x="0" y="4" z="3"/>
+        <float name="radius" value="0.5"/>
+        <ref id="white"/>
+        <emitter type="area">
+            <rgb name="radiance" value="3, 3, 3"/>
+            <string name="lightGroup" value="key"/>
+        </emitter>
+    </shape>
+    <emitter type="point">
+        <point name="position" x="0" y="-5" z="2"/>
+        <rgb name="intensity" value="20, 20, 20"/>
+    </emitter>
+</scene>
+)";
+
+int main(int argc, char *argv[]) {
+    parallel_init(2);
+    RTCDevice embree_device = rtcNewDevice(nullptr);
+
+    fs::path filename = fs::temp_directory_path() / "lajolla_test_light_groups.xml";
+    {
+        std::ofstream ofs(filename);
+        ofs << c_scene_xml;
+    }
+    std::unique_ptr<Scene> scene = parse_scene(filename, embree_device);
+    fs::remove(filename);
+
+    // The groups are named after their lightGroup, the ID of the emitter (or its shape),
+    // or the index of the light, in the order they appear.
+    std::vector<std::string> names = {"key", "fill", "light3"};
+    std::vector<int> ids = {0, 1, 0, 2};
+    if (scene->light_group_names != names || scene->light_group_ids != ids) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    // Radiance is linear in the emission, so the groups add up to the beauty image.
+    std::vector<ImageLayer> layers;
+    Image3 img = render(*scene, &layers);
+    if (layers.size() != names.size()) {
+        printf("FAIL\n");
+        return 1;
+    }
+    std::vector<Real> group_sums(layers.size(), Real(0));
+    for (int y = 0; y < img.height; y++) {
+        for (int x = 0; x < img.width; x++) {
+            Spectrum sum = make_zero_spectrum();
+            for (int i = 0; i < (int)layers.size(); i++) {
+                sum += layers[i].image(x, y);
+                group_sums[i] += luminance(layers[i].image(x, y));
+            }
+            // The film keeps its sums in floats.
+            if (length(sum - img(x, y)) > Real(1e-4) * (1 + length(img(x, y)))) {
+                printf("FAIL\n");
+                return 1;
+            }
+        }
+    }
+    // ...and every group lights some of the wall or the floor.
+    for (Real group_sum : group_sums) {
+        if (group_sum <= 0) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
+    rtcReleaseDevice(embree_device);
+    parallel_cleanup();
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,182 @@
+#include "../scene.h"
+#include "../transform.h"
+#include <cstdio>
+
+bool close(Real a, Real b, Real tolerance) {
+    return fabs(a - b) <= tolerance * max(fabs(b), Real(1e-6));
+}
+
+/// A stratified direction on the unit sphere for the cell (i, j) of an n x n grid.
+Vector3 sphere_direction(int i, int j, int n) {
+    Real z = 1 - 2 * (j + Real(0.5)) / n;
+    Real r = sqrt(max(Real(0), 1 - z * z));
+    Real phi = c_TWOPI * (i + Real(0.5)) / n;
+    return Vector3{r * cos(phi), r * sin(phi), z};
+}
+
+/// The power of a light that doesn't depend on the scene, by integrating
+/// the luminance of its intensity over the sphere of directions.
+Real integrate_intensity(const Light &light, const Vector3 &position, const Scene &scene) {
+    int n = 512;
+    Real sum = 0;
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            Vector3 dir = sphere_direction(i, j, n);
+            sum += luminance(emission(light, dir, Real(0), PointAndNormal{position, dir}, scene));
+        }
+    }
+    return sum * c_FOURPI / (n * n);
+}
+
+/// The same integral, importance sampled with sample_emission.
+/// Also checks that pdf_emission agrees with the sampled densities.
+Real integrate_emission_samples(const Light &light, const Scene &scene, bool *pdf_mismatch) {
+    int n = 256;
+    Real sum = 0;
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            Vector2 dir_uv{(i + Real(0.5)) / n, (j + Real(0.5)) / n};
+            std::optional<LightEmissionRecord> record =
+                sample_emission(light, Vector2{0, 0}, Real(0), dir_uv, scene);
+            if (!record || record->pdf.dir <= 0) {
+                continue;
+            }
+            LightEmissionPdf pdf = pdf_emission(light, record->point_on_light, record->dir, scene);
+            if (!close(pdf.pos, record->pdf.pos, Real(1e-4)) || !close(pdf.dir, record->pdf.dir, Real(1e-4))) {
+                *pdf_mismatch = true;
+            }
+            sum += luminance(emission(light, record->dir, Real(0), record->point_on_light, scene)) /
+                record->pdf.dir;
+        }
+    }
+    return sum / (n * n);
+}
+
+int main(int argc, char *argv[]) {
+    RTCDevice embree_device = rtcNewDevice(nullptr);
+
+    Vector3 position{1, 2, 3};
+    Spectrum intensity = make_const_spectrum(5);
+    // The spot points towards +x.
+    Matrix4x4 spot_to_world = translate(position) * rotate(Real(90), Vector3{0, 1, 0});
+    Real cos_total_width = cos(radians(Real(30))), cos_falloff_start = cos(radians(Real(20)));
+    Vector3 sun_dir = normalize(Vector3{1, -1, 0});
+    // A small spherical area light with the same intensity as the point light:
+    // a diffuse sphere of radius r with radiance L has intensity pi r^2 L towards every direction.
+    Real sphere_radius = Real(0.01);
+    Shape sphere = Sphere{{}, position, sphere_radius};
+    set_area_light_id(sphere, 3);
+    std::vector<Light> lights = {
+        PointLight{position, intensity},
+        SpotLight{position, spot_to_world, inverse(spot_to_world), intensity,
+                  cos_total_width, cos_falloff_start},
+        DirectionalLight{sun_dir, intensity},
+        DiffuseAreaLight{0, intensity / (c_PI * sphere_radius * sphere_radius)}
+    };
+    Scene scene(embree_device,
+                Camera(),
+                {}, /* materials */
+                {sphere},
+                lights,
+                {}, /* media */
+                -1, /* envmap id */
+                TexturePool{},
+                RenderOptions{},
+                "" /* output filename */);
+    const Light &point = scene.lights[0], &spot = scene.lights[1], &sun = scene.lights[2];
+    const Light &sphere_light = scene.lights[3];
+
+    // Delta lights have a single sample with a discrete probability of 1.
+    Vector3 ref_point{2, 2, 3}, ref_normal{0, 0, 1};
+    for (const Light *light : {&point, &spot}) {
+        PointAndNormal p = sample_point_on_light(
+            *light, ref_point, ref_normal, Vector2{Real(0.3), Real(0.7)}, Real(0.5), scene);
+        if (distance(p.position, position) > Real(1e-4) ||
+                length(p.normal - normalize(ref_point - position)) > Real(1e-4) ||
+                pdf_point_on_light(*light, p, ref_point, ref_normal, scene) != 1) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+    PointAndNormal sun_sample = sample_point_on_light(sun, ref_point, ref_normal, Vector2{0, 0}, Real(0), scene);
+    if (length(sun_sample.normal - sun_dir) > Real(1e-4) ||
+            pdf_point_on_light(sun, sun_sample, ref_point, ref_normal, scene) != 1) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    // The power of the point & spot lights is their intensity integrated over the sphere,
+    // both with uniform directions and with sample_emission.
+    bool pdf_mismatch = false;
+    for (const Light *light : {&point, &spot}) {
+        Real power = light_power(*light, scene);
+        if (!close(integrate_intensity(*light, position, scene), power, Real(1e-2)) ||
+                !close(integrate_emission_samples(*light, scene, &pdf_mismatch), power, Real(1e-2))) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+    // The directional light covers the disk of the scene's bounding sphere.
+    Real r = scene.bounds.radius;
+    if (!close(light_power(sun, scene), luminance(intensity) * c_PI * r * r, Real(1e-4))) {
+        printf("FAIL\n");
+        return 1;
+    }
+    integrate_emission_samples(sun, scene, &pdf_mismatch);
+    if (pdf_mismatch) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    // The spot light falloff: full intensity inside the inner cone, none outside the outer cone,
+    // and half of it in the middle of the (smoothstep) falloff in cosine.
+    auto spot_intensity = [&](Real cos_theta) {
+        Real sin_theta = sqrt(1 - cos_theta * cos_theta);
+        Vector3 dir = xform_vector(spot_to_world, Vector3{sin_theta, Real(0), cos_theta});
+        return luminance(emission(spot, dir, Real(0), PointAndNormal{position, dir}, scene));
+    };
+    if (!close(spot_intensity(1), luminance(intensity), Real(1e-4)) ||
+            !close(spot_intensity(cos_falloff_start + Real(1e-4)), luminance(intensity), Real(1e-4)) ||
+            spot_intensity(cos_total_width - Real(1e-4)) != 0 ||
+            spot_intensity(-1) != 0 ||
+            !close(spot_intensity((cos_total_width + cos_falloff_start) / 2),
+                   luminance(intensity) / 2, Real(1e-4))) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    // The point light is as bright as the small spherical light of the same intensity:
+    // the irradiance at a receiver facing the light at distance d is I / d^2.
+    Vector3 receiver{1, 2, 5}, receiver_normal{0, 0, -1};
+    Real d = distance(receiver, position);
+    Real point_irradiance = luminance(emission(point, receiver - position, Real(0),
+        sample_point_on_light(point, receiver, receiver_normal, Vector2{0, 0}, Real(0), scene), scene)) / (d * d);
+    int n = 128;
+    Real sphere_irradiance = 0;
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            Vector2 uv{(i + Real(0.5)) / n, (j + Real(0.5)) / n};
+            PointAndNormal p = sample_point_on_light(sphere_light, receiver, receiver_normal, uv, Real(0), scene);
+            Real pdf = pdf_point_on_light(sphere_light, p, receiver, receiver_normal, scene);
+            Vector3 dir = normalize(receiver - p.position);
+            Real cos_light = dot(p.normal, dir);
+            Real cos_receiver = -dot(receiver_normal, dir);
+            if (pdf <= 0 || cos_light <= 0) {
+                continue;
+            }
+            Spectrum L = emission(sphere_light, dir, Real(0), p, scene);
+            sphere_irradiance += luminance(L) * cos_light * cos_receiver /
+                (distance_squared(receiver, p.position) * pdf);
+        }
+    }
+    sphere_irradiance /= n * n;
+    if (!close(point_irradiance, luminance(intensity) / (d * d), Real(1e-4)) ||
+            !close(sphere_irradiance, point_irradiance, Real(1e-2))) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    rtcReleaseDevice(embree_device);
+    printf("SUCCESS\n");
+    return 0;
+}
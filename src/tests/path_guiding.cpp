@@ -0,0 +1,57 @@
+#include "../path_guiding.h"
+#include <cstdio>
+
+int main(int argc, char *argv[]) {
+    // Stratified directions over the sphere.
+    int n = 256;
+    auto grid_dir = [&](int x, int y) {
+        Real z = 1 - 2 * (x + Real(0.5)) / n;
+        Real phi = 2 * c_PI * (y + Real(0.5)) / n;
+        Real r = sqrt(max(1 - z * z, Real(0)));
+        return Vector3{r * cos(phi), r * sin(phi), z};
+    };
+
+    // Train on a radiance field with a sharp peak.
+    SDTree sd_tree = make_sd_tree(Vector3{0, 0, 0}, Real(1));
+    Vector3 peak = normalize(Vector3{Real(0.3), Real(0.5), Real(0.8)});
+    for (int it = 0; it < 3; it++) {
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                Vector3 d = grid_dir(x, y);
+                Real L = pow(max(dot(d, peak), Real(0)), Real(50)) * 100 + Real(0.1);
+                record_radiance(lookup_dtree(sd_tree, Vector3{0, 0, 0}), d, L * 4 * c_PI);
+            }
+        }
+        refine_sd_tree(sd_tree);
+    }
+    const DTreeWrapper &dtree = lookup_dtree(sd_tree, Vector3{0, 0, 0});
+
+    // The pdf should integrate to one, and the samples should concentrate around the peak.
+    Real pdf_integral = 0;
+    Real near_peak = 0;
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            pdf_integral += pdf(dtree, grid_dir(x, y)) * 4 * c_PI / (n * n);
+            Vector3 d = sample(dtree, Vector2{(x + Real(0.5)) / n, (y + Real(0.5)) / n});
+            if (!(pdf(dtree, d) > 0)) {
+                printf("FAIL\n");
+                return 1;
+            }
+            if (dot(d, peak) > Real(0.95)) {
+                near_peak += Real(1) / (n * n);
+            }
+        }
+    }
+    if (fabs(pdf_integral - 1) > Real(1e-2)) {
+        printf("FAIL\n");
+        return 1;
+    }
+    // The cap around the peak covers 2.5% of the sphere.
+    if (near_peak < Real(0.5)) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
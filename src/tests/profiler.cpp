@@ -0,0 +1,71 @@
+#include "../profiler.h"
+#include "../parallel.h"
+#include "../timer.h"
+#include <cstdio>
+#include <sstream>
+
+int main(int argc, char *argv[]) {
+    parallel_init(2);
+
+    // The scopes nest, and an inner scope of the same phase leaves the bit to the outer one.
+    {
+        ProfileScope intersect(ProfilePhase::Intersect);
+        {
+            ProfileScope shading(ProfilePhase::ShadingInfo);
+            ProfileScope intersect_again(ProfilePhase::Intersect);
+        }
+        if (profiler_state != (uint32_t(1) << int(ProfilePhase::Intersect))) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+    if (profiler_state != 0) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+#ifndef _WINDOWS
+    // Keep the threads busy in a phase until the sampler sees it (or we give up).
+    uint32_t state = (uint32_t(1) << int(ProfilePhase::BSDFEval)) |
+                     (uint32_t(1) << int(ProfilePhase::TextureEval));
+    reset_profile();
+    profiler_start();
+    Timer timer;
+    tick(timer);
+    Real elapsed = 0;
+    volatile double sink = 0;
+    while (get_profile_samples(state) < 10 && elapsed < 10) {
+        parallel_for([&](int64_t i) {
+            ProfileScope bsdf(ProfilePhase::BSDFEval);
+            ProfileScope texture(ProfilePhase::TextureEval);
+            double x = 0;
+            for (int j = 0; j < 100000; j++) {
+                x += sqrt(double(j + i));
+            }
+            sink = sink + x;
+        }, 64);
+        Timer t = timer;
+        elapsed = tick(t);
+    }
+    profiler_stop();
+    if (get_profile_samples(state) < 10) {
+        printf("FAIL\n");
+        return 1;
+    }
+    std::stringstream ss;
+    print_profile(ss);
+    if (ss.str().find("BSDF evaluation / Texture evaluation") == std::string::npos) {
+        printf("FAIL\n");
+        return 1;
+    }
+#endif
+    reset_profile();
+    if (get_profile_samples(0) != 0) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    parallel_cleanup();
+    printf("SUCCESS\n");
+    return 0;
+}
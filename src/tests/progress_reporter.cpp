@@ -0,0 +1,101 @@
+#include "../progress_reporter.h"
+#include "../intersection.h"
+#include "../parallel.h"
+#include "../stats.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef _WINDOWS
+#include <unistd.h>
+#endif
+
+int main(int argc, char *argv[]) {
+    parallel_init(4);
+
+    // The ray counts are the query counters of the statistics, even without LAJOLLA_STATS.
+    parallel_for([&](int64_t i) {
+        count_stat_always(Stat::IntersectionQueries, 2);
+        count_stat_always(Stat::ShadowQueries, 3);
+    }, 1000);
+    if (num_traced_rays() != 5000 ||
+            num_traced_rays() != get_stat(Stat::IntersectionQueries) + get_stat(Stat::ShadowQueries)) {
+        printf("FAIL\n");
+        return 1;
+    }
+    uint64_t thread_rays = num_traced_rays_of_thread();
+    count_stat_always(Stat::ShadowQueries, 7);
+    if (num_traced_rays_of_thread() != thread_rays + 7) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+#ifndef _WINDOWS
+    // Capture what the reporter prints, in JSON.
+    FILE *capture = tmpfile();
+    fflush(stdout);
+    int saved_stdout = dup(fileno(stdout));
+    dup2(fileno(capture), fileno(stdout));
+    set_progress_format(ProgressFormat::JSON);
+    uint64_t work_done = 0;
+    {
+        ProgressReporter reporter(64);
+        parallel_for([&](int64_t i) {
+            // One million rays and 100 samples for each piece of work.
+            count_stat_always(Stat::IntersectionQueries, 1000000);
+            reporter.update(1, 100);
+        }, 48);
+        // Let the printing thread report at least once before we finish.
+        std::this_thread::sleep_for(
+            std::chrono::duration<double>(2 * c_progress_report_interval));
+        work_done = reporter.get_work_done();
+        reporter.done();
+    }
+    fflush(stdout);
+    dup2(saved_stdout, fileno(stdout));
+    close(saved_stdout);
+
+    std::vector<std::string> lines;
+    rewind(capture);
+    char buffer[1024];
+    while (fgets(buffer, sizeof(buffer), capture) != nullptr) {
+        lines.push_back(buffer);
+    }
+    fclose(capture);
+    if (work_done != 48 || lines.size() < 2) {
+        printf("FAIL\n");
+        return 1;
+    }
+    // The periodic reports see 48 of the 64 pieces of work, and an estimate of the time left.
+    unsigned long long work, total_work;
+    double progress, elapsed, eta, mrays_per_sec, samples_per_sec;
+    char done[8];
+    const char *format = "{\"work_done\": %llu, \"total_work\": %llu, \"progress\": %lf, "
+                         "\"elapsed\": %lf, \"eta\": %lf, \"mrays_per_sec\": %lf, "
+                         "\"samples_per_sec\": %lf, \"done\": %7[a-z]}";
+    if (sscanf(lines[0].c_str(), format, &work, &total_work, &progress, &elapsed, &eta,
+               &mrays_per_sec, &samples_per_sec, done) != 8 ||
+            work != 48 || total_work != 64 || fabs(progress - 0.75) > 1e-4 ||
+            eta < 0 || strcmp(done, "false") != 0) {
+        printf("FAIL\n");
+        return 1;
+    }
+    // The final report has all the work, and the average throughput over the whole run:
+    // 48 million rays and 4800 samples.
+    if (sscanf(lines.back().c_str(), format, &work, &total_work, &progress, &elapsed, &eta,
+               &mrays_per_sec, &samples_per_sec, done) != 8 ||
+            work != 64 || fabs(progress - 1) > 1e-4 || eta != 0 || strcmp(done, "true") != 0 ||
+            elapsed <= 0 ||
+            fabs(mrays_per_sec * elapsed - 48) > 0.01 * 48 ||
+            fabs(samples_per_sec * elapsed - 4800) > 0.01 * 4800) {
+        printf("FAIL\n");
+        return 1;
+    }
+    set_progress_format(ProgressFormat::Text);
+#endif
+
+    parallel_cleanup();
+    printf("SUCCESS\n");
+    return 0;
+}
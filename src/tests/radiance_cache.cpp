@@ -0,0 +1,58 @@
+#include "../radiance_cache.h"
+#include "../parallel.h"
+#include <cstdio>
+
+int main(int argc, char *argv[]) {
+    parallel_init(4);
+    RadianceCache cache = make_radiance_cache(Real(1), 1 << 12);
+
+    // Many threads record into the same few cells at the same time.
+    // Each of the 8 cells (4 positions x 2 normals) receives 1000 records of its own value.
+    Vector3 positions[] = {Vector3{0.5, 0.5, 0.5}, Vector3{1.5, 0.5, 0.5},
+                           Vector3{-0.5, 0.5, 0.5}, Vector3{0.5, 3.5, -2.5}};
+    Vector3 normals[] = {Vector3{0, 0, 1}, Vector3{0, 0, -1}};
+    int num_records = 8000;
+    parallel_for([&](int64_t i) {
+        int cell = int(i % 8);
+        // Jitter the positions inside the cell.
+        Real jitter = Real(0.4) * (Real((i / 8) % 10) / 10 - Real(0.5));
+        Vector3 p = positions[cell / 2] + Vector3{jitter, -jitter, jitter};
+        int entry_id = find_or_insert_entry(cache, p, normals[cell % 2]);
+        if (entry_id < 0) {
+            return;
+        }
+        record_radiance(cache, entry_id, Spectrum{Real(cell), Real(1), Real(2 * cell)});
+    }, num_records, 16);
+
+    for (int cell = 0; cell < 8; cell++) {
+        std::optional<Spectrum> value = lookup_radiance(cache, positions[cell / 2], normals[cell % 2]);
+        if (!value || fabs((*value)[0] - cell) > Real(1e-3) ||
+                fabs((*value)[1] - 1) > Real(1e-3) || fabs((*value)[2] - 2 * cell) > Real(1e-3)) {
+            printf("FAIL\n");
+            return 1;
+        }
+        int entry_id = find_or_insert_entry(cache, positions[cell / 2], normals[cell % 2]);
+        if (cache.entries[entry_id].count.load() != num_records / 8) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
+    // Cells that were never recorded, and cells with too few records, are not in the cache.
+    if (lookup_radiance(cache, Vector3{10.5, 0.5, 0.5}, normals[0])) {
+        printf("FAIL\n");
+        return 1;
+    }
+    int entry_id = find_or_insert_entry(cache, Vector3{20.5, 0.5, 0.5}, normals[0]);
+    for (int i = 0; i < c_radiance_cache_min_samples - 1; i++) {
+        record_radiance(cache, entry_id, Spectrum{1, 1, 1});
+    }
+    if (lookup_radiance(cache, Vector3{20.5, 0.5, 0.5}, normals[0])) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    parallel_cleanup();
+    printf("SUCCESS\n");
+    return 0;
+}
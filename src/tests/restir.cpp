@@ -0,0 +1,59 @@
+#include "../restir.h"
+#include <cstdio>
+
+int main(int argc, char *argv[]) {
+    // Stream 4 candidates with different weights through a reservoir many times.
+    // Each candidate should be picked with probability proportional to its weight.
+    Real weights[] = {1, 0, 2, 5};
+    Real w_total = 8;
+    int counts[4] = {0, 0, 0, 0};
+    // Same, but we stream the first two and the last two candidates through two reservoirs,
+    // and then merge the two reservoirs into one.
+    int merged_counts[4] = {0, 0, 0, 0};
+    pcg32_state rng = init_pcg32();
+    int num_trials = 100000;
+    for (int t = 0; t < num_trials; t++) {
+        Reservoir r;
+        for (int i = 0; i < 4; i++) {
+            update_reservoir(r, ReSTIRLightSample{i, PointAndNormal{}}, weights[i], 1, next_pcg32_real<Real>(rng));
+        }
+        if (r.M != 4 || fabs(r.w_sum - w_total) > Real(1e-3)) {
+            printf("FAIL\n");
+            return 1;
+        }
+        counts[r.y.light_id]++;
+
+        Reservoir r0, r1;
+        for (int i = 0; i < 2; i++) {
+            update_reservoir(r0, ReSTIRLightSample{i, PointAndNormal{}}, weights[i], 1, next_pcg32_real<Real>(rng));
+            update_reservoir(r1, ReSTIRLightSample{i + 2, PointAndNormal{}}, weights[i + 2], 1, next_pcg32_real<Real>(rng));
+        }
+        Reservoir merged;
+        update_reservoir(merged, r0.y, r0.w_sum, r0.M, next_pcg32_real<Real>(rng));
+        update_reservoir(merged, r1.y, r1.w_sum, r1.M, next_pcg32_real<Real>(rng));
+        if (merged.M != 4) {
+            printf("FAIL\n");
+            return 1;
+        }
+        merged_counts[merged.y.light_id]++;
+    }
+    for (int i = 0; i < 4; i++) {
+        Real expected = weights[i] / w_total;
+        if (fabs(Real(counts[i]) / num_trials - expected) > Real(0.01) ||
+                fabs(Real(merged_counts[i]) / num_trials - expected) > Real(0.01)) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
+    // A reservoir that only sees zero weights keeps no sample.
+    Reservoir empty;
+    update_reservoir(empty, ReSTIRLightSample{0, PointAndNormal{}}, 0, 1, Real(0.5));
+    if (empty.y.light_id != -1 || empty.M != 1) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include "../sampler.h"
+#include <cstdio>
+#include <vector>
+
+/// Each of the n intervals [i/n, (i+1)/n) should contain exactly one sample.
+bool stratified_1d(const std::vector<Real> &samples) {
+    int n = (int)samples.size();
+    std::vector<int> count(n, 0);
+    for (Real s : samples) {
+        if (s < 0 || s >= 1) {
+            return false;
+        }
+        count[int(s * n)]++;
+    }
+    for (int c : count) {
+        if (c != 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Each cell of a nx x ny grid should contain exactly one sample.
+bool stratified_2d(const std::vector<Vector2> &samples, int nx, int ny) {
+    std::vector<int> count(nx * ny, 0);
+    for (Vector2 s : samples) {
+        if (s.x < 0 || s.x >= 1 || s.y < 0 || s.y >= 1) {
+            return false;
+        }
+        count[int(s.y * ny) * nx + int(s.x * nx)]++;
+    }
+    for (int c : count) {
+        if (c != 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int spp = 16;
+    Vector2i resolution{64, 32};
+    const char *names[] = {"independent", "stratified", "sobol", "zsobol"};
+    SamplerType types[] = {SamplerType::Independent, SamplerType::Stratified,
+                           SamplerType::Sobol, SamplerType::ZSobol};
+
+    // Mimic an integrator: a 2D sample, two 1D samples, and another 2D sample per path.
+    // All samplers except the independent one should stratify every dimension
+    // over the samples of a pixel.
+    for (int t = 1; t < 4; t++) {
+        Sampler sampler = make_sampler(types[t], spp, resolution, 7 /* seed */, 0);
+        for (Vector2i pixel : {Vector2i{0, 0}, Vector2i{5, 3}, Vector2i{63, 31}}) {
+            std::vector<Vector2> dim0(spp), dim3(spp);
+            std::vector<Real> dim1(spp), dim2(spp);
+            for (int s = 0; s < spp; s++) {
+                start_pixel_sample(sampler, pixel, s);
+                dim0[s] = next_2d(sampler);
+                dim1[s] = next_1d(sampler);
+                dim2[s] = next_1d(sampler);
+                dim3[s] = next_2d(sampler);
+            }
+            std::vector<Real> dim0_x(spp), dim3_y(spp);
+            for (int s = 0; s < spp; s++) {
+                dim0_x[s] = dim0[s].x;
+                dim3_y[s] = dim3[s].y;
+            }
+            if (!stratified_1d(dim1) || !stratified_1d(dim2) ||
+                    !stratified_2d(dim0, 4, 4) || !stratified_2d(dim3, 4, 4)) {
+                printf("FAIL\n");
+                return 1;
+            }
+            // The (0, 2)-sequence of Sobol is also stratified over all the elementary intervals,
+            // including the 1D projections (a jittered grid is not).
+            if (types[t] != SamplerType::Stratified) {
+                if (!stratified_2d(dim0, 2, 8) || !stratified_2d(dim0, 8, 2) ||
+                        !stratified_1d(dim0_x) || !stratified_1d(dim3_y)) {
+                    printf("FAIL\n");
+                    return 1;
+                }
+            }
+        }
+    }
+
+    // Samplers should be deterministic.
+    for (int t = 1; t < 4; t++) {
+        Sampler a = make_sampler(types[t], spp, resolution, 7, 0);
+        Sampler b = make_sampler(types[t], spp, resolution, 7, 1);
+        start_pixel_sample(a, Vector2i{3, 4}, 5);
+        start_pixel_sample(b, Vector2i{3, 4}, 5);
+        next_1d(a);
+        next_1d(b);
+        Vector2 sample_a = next_2d(a), sample_b = next_2d(b);
+        if (sample_a.x != sample_b.x || sample_a.y != sample_b.y) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
+    // ...and the seed should change the samples of every sampler, including the independent one.
+    for (int t = 0; t < 4; t++) {
+        Sampler a = make_sampler(types[t], spp, resolution, 7, 0);
+        Sampler b = make_sampler(types[t], spp, resolution, 8, 0);
+        start_pixel_sample(a, Vector2i{3, 4}, 5);
+        start_pixel_sample(b, Vector2i{3, 4}, 5);
+        Vector2 sample_a = next_2d(a), sample_b = next_2d(b);
+        if (sample_a.x == sample_b.x && sample_a.y == sample_b.y) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
+    // Equal-spp error of integrating a smooth 2D function over all pixels.
+    // f(u, v) = u * v^2 integrates to 1/6. The stratified samplers should
+    // have a much lower error than independent sampling.
+    Real mse[4];
+    for (int t = 0; t < 4; t++) {
+        Sampler sampler = make_sampler(types[t], spp, resolution, 0, 0);
+        Real sum_error_sq = 0;
+        for (int y = 0; y < resolution.y; y++) {
+            for (int x = 0; x < resolution.x; x++) {
+                Real estimate = 0;
+                for (int s = 0; s < spp; s++) {
+                    start_pixel_sample(sampler, Vector2i{x, y}, s);
+                    next_2d(sampler); // pixel filter
+                    Vector2 uv = next_2d(sampler);
+                    estimate += uv.x * uv.y * uv.y;
+                }
+                estimate /= spp;
+                sum_error_sq += (estimate - Real(1) / Real(6)) * (estimate - Real(1) / Real(6));
+            }
+        }
+        mse[t] = sum_error_sq / (resolution.x * resolution.y);
+        printf("%s: MSE %g\n", names[t], mse[t]);
+    }
+    if (mse[1] > mse[0] / 4 || mse[2] > mse[0] / 4 || mse[3] > mse[0] / 4) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include "../shape.h"
+#include "../point_and_normal.h"
+#include <cstdio>
+
+// Estimate the surface area of a shape with Monte Carlo integration
+// using the light sampling routines: E[1 / pdf] should be the area
+// if the sampling and the PDF are consistent.
+Real estimate_area(const Shape &shape, const Vector3 &ref_point, const Vector3 &ref_normal) {
+    int n = 256;
+    Real sum = 0;
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            Vector2 uv{(i + Real(0.5)) / n, (j + Real(0.5)) / n};
+            // Golden ratio sequence for selecting the triangles
+            Real w = modulo((j * n + i) * Real(0.618033988749895), Real(1));
+            PointAndNormal p = sample_point_on_shape(shape, ref_point, ref_normal, uv, w);
+            Real pdf = pdf_point_on_shape(shape, p, ref_point, ref_normal);
+            if (pdf <= 0) {
+                return Real(-1);
+            }
+            sum += 1 / pdf;
+        }
+    }
+    return sum / (n * n);
+}
+
+// The variance of the Monte Carlo estimate of the irradiance from a shape
+// emitting 1 towards both sides, at ref_point facing ref_normal.
+// We sample with sampling_normal as the reference normal.
+Real irradiance_variance(const Shape &shape,
+                         const Vector3 &ref_point,
+                         const Vector3 &ref_normal,
+                         const Vector3 &sampling_normal) {
+    int n = 64;
+    Real sum = 0, sum_sq = 0;
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            Vector2 uv{(i + Real(0.5)) / n, (j + Real(0.5)) / n};
+            Real w = modulo((j * n + i) * Real(0.618033988749895), Real(1));
+            PointAndNormal p = sample_point_on_shape(shape, ref_point, sampling_normal, uv, w);
+            Real pdf = pdf_point_on_shape(shape, p, ref_point, sampling_normal);
+            Vector3 dir = p.position - ref_point;
+            Real dist_sq = length_squared(dir);
+            dir = dir / sqrt(dist_sq);
+            Real f = fabs(dot(ref_normal, dir)) * fabs(dot(p.normal, dir)) / dist_sq;
+            Real estimate = pdf > 0 ? f / pdf : Real(0);
+            sum += estimate;
+            sum_sq += estimate * estimate;
+        }
+    }
+    Real mean = sum / (n * n);
+    return sum_sq / (n * n) - mean * mean;
+}
+
+int main(int argc, char *argv[]) {
+    // A unit quad made of two triangles (similar to an area light).
+    TriangleMesh quad;
+    quad.positions = {Vector3{0, 0, 0}, Vector3{1, 0, 0}, Vector3{1, 1, 0}, Vector3{0, 1, 0}};
+    quad.indices = {Vector3i{0, 1, 2}, Vector3i{0, 2, 3}};
+    Shape area_sampled = quad;
+    init_sampling_dist(area_sampled);
+    Real area = surface_area(area_sampled);
+    // Solid angle sampling is opt-in: by default we sample the area uniformly.
+    Vector3 close_point{Real(0.5), Real(0.5), Real(0.1)};
+    Vector3 up{0, 0, 1};
+    PointAndNormal p = sample_point_on_shape(area_sampled, close_point, up, Vector2{Real(0.3), Real(0.6)}, Real(0.2));
+    if (fabs(pdf_point_on_shape(area_sampled, p, close_point, up) - 1 / area) > Real(1e-6)) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    quad.solid_angle_sampling = true;
+    Shape shape = quad;
+    init_sampling_dist(shape);
+
+    // Close, grazing, barely off the plane (where the triangles are too small for
+    // Arvo's method from some points), and far away reference points,
+    // with and without the projected solid angle warp.
+    Vector3 ref_points[] = {close_point,
+                            Vector3{Real(-0.3), Real(0.2), Real(0.05)},
+                            Vector3{Real(1.5), Real(0.5), Real(1e-4)},
+                            Vector3{Real(0.2), Real(0.7), Real(-2)},
+                            Vector3{Real(10), Real(20), Real(100)}};
+    Vector3 ref_normals[] = {Vector3{0, 0, 0}, up, normalize(Vector3{1, 0, 1}), Vector3{1, 0, 0}};
+    for (const Vector3 &ref_point : ref_points) {
+        for (const Vector3 &ref_normal : ref_normals) {
+            Real estimate = estimate_area(shape, ref_point, ref_normal);
+            if (fabs(estimate - area) / area > Real(1e-2)) {
+                printf("FAIL\n");
+                return 1;
+            }
+        }
+    }
+
+    // Larger meshes are sampled by the solid angles of their triangles too:
+    // a 2 x 2 quad made of 8 x 8 cells.
+    TriangleMesh grid;
+    int cells = 8;
+    for (int j = 0; j <= cells; j++) {
+        for (int i = 0; i <= cells; i++) {
+            grid.positions.push_back(Vector3{Real(2 * i) / cells, Real(2 * j) / cells, Real(0)});
+        }
+    }
+    for (int j = 0; j < cells; j++) {
+        for (int i = 0; i < cells; i++) {
+            int v = j * (cells + 1) + i;
+            grid.indices.push_back(Vector3i{v, v + 1, v + cells + 2});
+            grid.indices.push_back(Vector3i{v, v + cells + 2, v + cells + 1});
+        }
+    }
+    grid.solid_angle_sampling = true;
+    Shape grid_shape = grid;
+    init_sampling_dist(grid_shape);
+    Real grid_area = surface_area(grid_shape);
+    Vector3 grid_point{Real(0.5), Real(1.2), Real(0.3)};
+    p = sample_point_on_shape(grid_shape, grid_point, up, Vector2{Real(0.3), Real(0.6)}, Real(0.2));
+    if (p.primitive_id < 0 ||
+            fabs(pdf_point_on_shape(grid_shape, p, grid_point, up) - 1 / grid_area) < Real(1e-2) / grid_area) {
+        printf("FAIL\n");
+        return 1;
+    }
+    for (const Vector3 &ref_normal : ref_normals) {
+        Real estimate = estimate_area(grid_shape, grid_point, ref_normal);
+        if (fabs(estimate - grid_area) / grid_area > Real(1e-2)) {
+            printf("FAIL\n");
+            return 1;
+        }
+    }
+
+    // The projected solid angle warp reduces the variance of the irradiance
+    // at a point beside the light, which sees it at grazing angles.
+    Vector3 side_point{Real(1.5), Real(0.5), Real(0.5)}, down{0, 0, -1};
+    Real uniform_variance = irradiance_variance(shape, side_point, down, Vector3{0, 0, 0});
+    Real warped_variance = irradiance_variance(shape, side_point, down, down);
+    printf("irradiance variance: %g (solid angle), %g (projected solid angle)\n",
+           uniform_variance, warped_variance);
+    if (!(warped_variance < Real(0.6) * uniform_variance)) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "../sppm.h"
+#include "../transform.h"
+#include <cstdio>
+
+int main(int argc, char *argv[]) {
+    RTCDevice embree_device = rtcNewDevice(nullptr);
+
+    // The camera sits inside a large diffuse sphere, with a small light next to it,
+    // so every pixel finds a visible point.
+    int w = 4, h = 4;
+    Camera camera(Matrix4x4::identity(), Real(45), w, h, Box{Real(1)}, -1);
+    Shape room = Sphere{{}, Vector3{0, 0, 0}, Real(10)};
+    Shape lamp = Sphere{{}, Vector3{0, 3, 0}, Real(0.5)};
+    set_material_id(room, 0);
+    set_material_id(lamp, 0);
+    set_area_light_id(lamp, 0);
+    RenderOptions options;
+    options.integrator = Integrator::SPPM;
+    options.sampler_type = SamplerType::Independent;
+    options.samples_per_pixel = 2;
+    Scene scene(embree_device,
+                camera,
+                {Lambertian{ConstantTexture<Spectrum>{make_const_spectrum(Real(0.5))}}},
+                {room, lamp},
+                {DiffuseAreaLight{1, make_const_spectrum(1)}},
+                {}, /* media */
+                -1, /* envmap id */
+                TexturePool{},
+                options,
+                "" /* output filename */);
+
+    // The camera pass of pixel (x, y) in an iteration, with the sampler sppm_render() uses.
+    auto camera_pass = [&](int x, int y, int iteration) {
+        Sampler sampler = make_sampler(options.sampler_type, options.samples_per_pixel,
+                                       Vector2i{w, h}, options.sampler_seed,
+                                       sppm_camera_stream(iteration, 0 /* tile */, 1 /* num tiles */));
+        start_pixel_sample(sampler, Vector2i{x, y}, iteration);
+        SPPMPixel pixel;
+        pixel.Ld = make_zero_spectrum();
+        sppm_camera_pass(scene, x, y, sampler, pixel);
+        return pixel;
+    };
+
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            SPPMPixel p0 = camera_pass(x, y, 0);
+            SPPMPixel p0_again = camera_pass(x, y, 0);
+            SPPMPixel p1 = camera_pass(x, y, 1);
+            if (!p0.has_visible_point || !p0_again.has_visible_point || !p1.has_visible_point) {
+                printf("FAIL\n");
+                return 1;
+            }
+            const Vector3 &v0 = p0.visible_point.vertex.position;
+            // An iteration is deterministic...
+            if (distance(v0, p0_again.visible_point.vertex.position) != 0) {
+                printf("FAIL\n");
+                return 1;
+            }
+            // ...but the next one traces a new camera path,
+            // even though the independent sampler ignores the sample index.
+            if (distance(v0, p1.visible_point.vertex.position) < Real(1e-6)) {
+                printf("FAIL\n");
+                return 1;
+            }
+        }
+    }
+
+    // The photons never share a random number stream with the camera paths.
+    int num_iterations = 3, num_tiles = 6;
+    int64_t num_photon_chunks = 5;
+    uint64_t max_camera_stream = sppm_camera_stream(num_iterations - 1, num_tiles - 1, num_tiles);
+    if (sppm_photon_stream(0, 0, num_photon_chunks, num_iterations, num_tiles) <= max_camera_stream ||
+            sppm_photon_stream(1, 0, num_photon_chunks, num_iterations, num_tiles) <=
+            sppm_photon_stream(0, num_photon_chunks - 1, num_photon_chunks, num_iterations, num_tiles)) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    rtcReleaseDevice(embree_device);
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -0,0 +1,39 @@
+#include "../stats.h"
+#include "../parallel.h"
+#include <cstdio>
+#include <sstream>
+
+int main(int argc, char *argv[]) {
+    parallel_init(4);
+    // Count from all the threads.
+    parallel_for([&](int64_t i) {
+        count_stat(Stat::CameraRays);
+        count_stat(Stat::ShadowQueries, 3);
+        count_texture_lookup(int(i % 2));
+    }, 1000);
+#ifdef LAJOLLA_STATS
+    if (get_stat(Stat::CameraRays) != 1000 ||
+            get_stat(Stat::ShadowQueries) != 3000 ||
+            get_stat(Stat(int(Stat::TextureLookups) + 1)) != 500 ||
+            get_stat(Stat::IntersectionQueries) != 0) {
+        printf("FAIL\n");
+        return 1;
+    }
+    std::stringstream ss;
+    write_stats_json(ss);
+    if (ss.str().find("\"camera_rays\": 1000") == std::string::npos ||
+            ss.str().find("\"texture_lookups\": [500, 500, 0") == std::string::npos) {
+        printf("FAIL\n");
+        return 1;
+    }
+#endif
+    reset_stats();
+    if (get_stat(Stat::CameraRays) != 0) {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    parallel_cleanup();
+    printf("SUCCESS\n");
+    return 0;
+}
@@ -4,6 +4,8 @@
 #include "image.h"
 #include "intersection.h"
 #include "mipmap.h"
+#include "profiler.h"
+#include "stats.h"
 #include <map>
 #include <variant>
 
@@ -135,6 +137,8 @@ T eval_texture_op<T>::operator()(const ImageTexture<T> &t) const {
                      modulo(uv[1] * t.vscale + t.voffset, Real(1))};
     Real scaled_footprint = max(get_width(img), get_height(img)) * max(t.uscale, t.vscale) * footprint;
     Real level = log2(max(scaled_footprint, Real(1e-8f)));
+    // The finer of the (up to) two levels the trilinear lookup reads.
+    count_texture_lookup(level > 0 ? min(int(level), int(img.images.size()) - 1) : 0);
     return lookup(img, local_uv[0], local_uv[1], level);
 }
 template <typename T>
@@ -155,6 +159,7 @@ T eval_texture_op<T>::operator()(const CheckerboardTexture<T> &t) const {
 /// Footprint should be approximatedly min(du/dx, du/dy, dv/dx, dv/dy) for texture filtering.
 template <typename T>
 T eval(const Texture<T> &texture, const Vector2 &uv, Real footprint, const TexturePool &pool) {
+    ProfileScope profile(ProfilePhase::TextureEval);
     return std::visit(eval_texture_op<T>{uv, footprint, pool}, texture);
 }
 
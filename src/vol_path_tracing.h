@@ -5,7 +5,7 @@
 // only handle directly visible light sources
 Spectrum vol_path_tracing_1(const Scene &scene,
                             int x, int y, /* pixel coordinates */
-                            pcg32_state &rng) {
+                            Sampler &sampler) {
     // Homework 2: implememt this!
     return make_zero_spectrum();
 }
@@ -15,7 +15,7 @@ Spectrum vol_path_tracing_1(const Scene &scene,
 // no need to handle surface lighting, only directly visible light source
 Spectrum vol_path_tracing_2(const Scene &scene,
                             int x, int y, /* pixel coordinates */
-                            pcg32_state &rng) {
+                            Sampler &sampler) {
     // Homework 2: implememt this!
     return make_zero_spectrum();
 }
@@ -25,7 +25,7 @@ Spectrum vol_path_tracing_2(const Scene &scene,
 // no need to handle surface lighting, only directly visible light source
 Spectrum vol_path_tracing_3(const Scene &scene,
                             int x, int y, /* pixel coordinates */
-                            pcg32_state &rng) {
+                            Sampler &sampler) {
     // Homework 2: implememt this!
     return make_zero_spectrum();
 }
@@ -36,7 +36,7 @@ Spectrum vol_path_tracing_3(const Scene &scene,
 // still no surface lighting
 Spectrum vol_path_tracing_4(const Scene &scene,
                             int x, int y, /* pixel coordinates */
-                            pcg32_state &rng) {
+                            Sampler &sampler) {
     // Homework 2: implememt this!
     return make_zero_spectrum();
 }
@@ -47,7 +47,7 @@ Spectrum vol_path_tracing_4(const Scene &scene,
 // with surface lighting
 Spectrum vol_path_tracing_5(const Scene &scene,
                             int x, int y, /* pixel coordinates */
-                            pcg32_state &rng) {
+                            Sampler &sampler) {
     // Homework 2: implememt this!
     return make_zero_spectrum();
 }
@@ -58,7 +58,9 @@ Spectrum vol_path_tracing_5(const Scene &scene,
 // with surface lighting
 Spectrum vol_path_tracing(const Scene &scene,
                           int x, int y, /* pixel coordinates */
-                          pcg32_state &rng) {
+                          Sampler &sampler) {
     // Homework 2: implememt this!
+    // (Count the null collisions of the delta/ratio tracking
+    // with count_stat(Stat::NullCollisions), see stats.h.)
     return make_zero_spectrum();
 }